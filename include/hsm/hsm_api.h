@@ -78,6 +78,32 @@ hsm_err_t hsm_open_session(open_session_args_t *args, hsm_hdl_t *session_hdl);
  * \return error_code error code.
  */
 hsm_err_t hsm_close_session(hsm_hdl_t session_hdl);
+
+/**
+ * Register a long-lived buffer on a session.\n
+ * The buffer is mapped once for the HSM. Input and output buffers of the following operations
+ * of the session (e.g. hsm_generate_signature, hsm_cipher_one_go) which lie inside it are then
+ * accessed in place instead of being copied for each operation.\n
+ * The buffer must stay allocated until it is unregistered or the session is closed.
+ *
+ * \param session_hdl handle identifying the session.
+ * \param buf pointer to the buffer.
+ * \param size size in bytes of the buffer.
+ *
+ * \return error_code error code.
+ */
+hsm_err_t hsm_register_buffer(hsm_hdl_t session_hdl, uint8_t *buf, uint32_t size);
+
+/**
+ * Unregister a buffer previously registered on a session.\n
+ * Operations in progress on the session are completed first. Closing the session unregisters all its buffers.
+ *
+ * \param session_hdl handle identifying the session.
+ * \param buf pointer to the buffer, as passed to hsm_register_buffer.
+ *
+ * \return error_code error code.
+ */
+hsm_err_t hsm_unregister_buffer(hsm_hdl_t session_hdl, uint8_t *buf);
 /** @} end of session group */
 
 /**
@@ -0,0 +1,103 @@
+/*
+ * Copyright 2019 NXP
+ *
+ * NXP Confidential.
+ * This software is owned or controlled by NXP and may only be used strictly
+ * in accordance with the applicable license terms.  By expressly accepting
+ * such terms or by downloading, installing, activating and/or otherwise using
+ * the software, you are agreeing that you have read, and that you agree to
+ * comply with and are bound by, such license terms.  If you do not agree to be
+ * bound by the applicable license terms, then you may not retain, install,
+ * activate or otherwise use the software.
+ */
+
+#ifndef HSM_DISPATCH_H
+#define HSM_DISPATCH_H
+
+#include <stdint.h>
+#include "hsm_api.h"
+
+/**
+ *  @defgroup group17 Dispatcher
+ * Distribution of operations over a pool of sessions.\n
+ * Each session of the pool uses its own MU channel and is served by its own worker thread, with
+ * its own key store and service flows. Operations submitted to the dispatcher are queued to the
+ * workers in turn, a worker without pending operation takes the oldest one queued to another worker.
+ * Several operations are then processed in parallel, up to what HSM can sustain.
+ * @{
+ */
+#define HSM_DISPATCH_MAX_SESSIONS   8u      //!< maximum number of sessions in the pool of a dispatcher.
+
+typedef struct hsm_dispatcher_s hsm_dispatcher_t;
+
+typedef struct {
+    uint32_t nb_sessions;                   //!< number of sessions to be opened in the pool (1 to HSM_DISPATCH_MAX_SESSIONS).
+    open_session_args_t session;            //!< arguments used to open each session.
+    open_svc_key_store_args_t *key_store;   //!< key store opened on each session, needed for signature generation and ciphering. NULL if not used. If creation is requested it is done by the first session only.
+} hsm_dispatcher_args_t;
+
+typedef uint8_t hsm_dispatch_op_type_t;
+#define HSM_DISPATCH_OP_VERIFY_SIGN     ((hsm_dispatch_op_type_t)(1u))  //!< hsm_verify_signature, args.verify_sign.
+#define HSM_DISPATCH_OP_GENERATE_SIGN   ((hsm_dispatch_op_type_t)(2u))  //!< hsm_generate_signature, args.generate_sign. Requires a key store.
+#define HSM_DISPATCH_OP_CIPHER          ((hsm_dispatch_op_type_t)(3u))  //!< hsm_cipher_one_go, args.cipher. Requires a key store.
+#define HSM_DISPATCH_OP_HASH            ((hsm_dispatch_op_type_t)(4u))  //!< hsm_hash_one_go, args.hash.
+
+typedef struct hsm_dispatch_op_s hsm_dispatch_op_t;
+struct hsm_dispatch_op_s {
+    hsm_dispatch_op_type_t type;            //!< operation to be performed.
+    union {
+        op_verify_sign_args_t *verify_sign;
+        op_generate_sign_args_t *generate_sign;
+        op_cipher_one_go_args_t *cipher;
+        op_hash_one_go_args_t *hash;
+    } args;                                 //!< arguments of the operation, as for the corresponding API.
+    hsm_verification_status_t verification_status; //!< on completion of a signature verification: its status.
+    hsm_err_t err;                          //!< on completion: error code of the operation.
+    void (*callback)(hsm_dispatch_op_t *op);//!< function called on completion, from a worker thread.
+    void *user_data;                        //!< free for use by the caller.
+    hsm_dispatch_op_t *next;                //!< reserved.
+    void *priv;                             //!< reserved.
+};
+
+/**
+ * Open a pool of sessions and the worker threads serving them.
+ *
+ * \param args pointer to the structure containing the function arguments.
+ * \param dispatcher pointer to where the dispatcher must be written.
+ *
+ * \return error code
+ */
+hsm_err_t hsm_open_dispatcher(hsm_dispatcher_args_t *args, hsm_dispatcher_t **dispatcher);
+
+/**
+ * Queue an operation. Its callback is called once it is completed.\n
+ * The operation and its arguments must not be modified nor released until then.
+ *
+ * \param dispatcher pointer to the dispatcher.
+ * \param op pointer to the operation. Its callback must be set.
+ *
+ * \return error code
+ */
+hsm_err_t hsm_dispatch_submit(hsm_dispatcher_t *dispatcher, hsm_dispatch_op_t *op);
+
+/**
+ * Perform an operation on the pool and wait for its completion.\n
+ * Can be called by several threads at a time. The callback and user_data fields are not used.
+ *
+ * \param dispatcher pointer to the dispatcher.
+ * \param op pointer to the operation.
+ *
+ * \return error code of the operation.
+ */
+hsm_err_t hsm_dispatch_run(hsm_dispatcher_t *dispatcher, hsm_dispatch_op_t *op);
+
+/**
+ * Complete the operations queued, stop the workers and close the sessions of the pool.
+ *
+ * \param dispatcher pointer to the dispatcher.
+ *
+ * \return error code
+ */
+hsm_err_t hsm_close_dispatcher(hsm_dispatcher_t *dispatcher);
+/** @} end of dispatcher group */
+#endif
@@ -23,6 +23,15 @@
 
 #include <stdint.h>
 
+/**
+ * Run the storage manager: give the storage to SECO then serve its export and chunk requests.
+ *
+ * Does not return while the storage channels are served. With NVM_FLAGS_SHE | NVM_FLAGS_HSM
+ * both storages are served by the same call, each one on its own worker thread.
+ *
+ * \param flags storages to be served.
+ * \param status pointer to where the status of the manager is written (NVM_STATUS_*).
+ */
 void seco_nvm_manager(uint8_t flags, uint32_t *status);
 #define NVM_FLAGS_SHE    (0x01u)
 #define NVM_FLAGS_HSM    (0x02u)
@@ -32,4 +41,204 @@ void seco_nvm_manager(uint8_t flags, uint32_t *status);
 #define NVM_STATUS_RUNNING  (0x02u)
 #define NVM_STATUS_STOPPED  (0x03u)
 
+struct seco_nvm_manager_s;
+
+/**
+ * Where the storages are kept.
+ *
+ * - NVM_STORAGE_FILE: files in the directory path (/etc if NULL). Writes are durable when acknowledged to SECO.
+ * - NVM_STORAGE_RAW: raw block device or MTD partition path, formatted on first use if its first block is
+ *   blank. Writes are durable when acknowledged to SECO. The SHE and HSM storages can share the same device.
+ *   A device holding anything else is not opened, unless NVM_STORAGE_FORMAT is added to the type: it is then
+ *   formatted and its content lost.
+ * - NVM_STORAGE_RAM: storages loaded in RAM from the directory path (/etc if NULL) and written back to it
+ *   flush_delay_ms after the last write. Writes acknowledged to SECO during this delay are lost on a power
+ *   failure; they are written when the manager is stopped, and with a master export (the export SECO does
+ *   to commit the storage, e.g. on a STRICT operation) before it is acknowledged.
+ */
+/*
+ * Blobs (master or chunk) exported by SECO can be up to 1MB. Only the buffer SECO writes to and reads
+ * from scales with the blob, the storages are read and written by segments. On NVM_STORAGE_RAW the master
+ * blob is limited to the slot size chosen when the device is formatted (32KB for a new device).
+ */
+#define NVM_STORAGE_FILE    (0x00u)
+#define NVM_STORAGE_RAW     (0x01u)
+#define NVM_STORAGE_RAM     (0x02u)
+#define NVM_STORAGE_FORMAT  (0x80u)
+
+struct seco_nvm_storage_cfg {
+    uint8_t type;               /**< NVM_STORAGE_* */
+    const char *path;           /**< directory or device, depending on type. */
+    uint32_t flush_delay_ms;    /**< NVM_STORAGE_RAM only: delay before writing to the files. */
+    uint32_t prefetch_threads;  /**< HSM: number of threads loading all the chunks in memory at start (up to 8),
+                                     0 to load each chunk on its first use. */
+    uint32_t coalesce_ms;       /**< HSM: delay before writing the chunks exported by SECO, 0 to write them
+                                     before acknowledging the export. See below. */
+    uint32_t metrics_dump_ms;   /**< period of the text dump of the metrics (see seco_nvm_format_metrics()),
+                                     0 for none. */
+    const char *metrics_path;   /**< file replaced by each dump of the metrics, NULL to write them to stderr. */
+};
+
+/*
+ * Write coalescing (coalesce_ms): a chunk exported by SECO is acknowledged once kept in memory.
+ * Only its newest payload is written to the storage, coalesce_ms after the first chunk left pending,
+ * before the next master export or when the manager is stopped. Chunks acknowledged but not written yet are lost on a
+ * power failure, the master exported last is always written after them.
+ */
+
+/**
+ * Start the storage manager on its own thread and wait until it is ready to serve SECO.
+ *
+ * Unlike seco_nvm_manager(), the caller is blocked only while the storage is given to SECO,
+ * then the manager can be stopped at any time with seco_nvm_manager_stop().
+ *
+ * \param flags storages to be served (NVM_FLAGS_SHE and/or NVM_FLAGS_HSM).
+ * \param storage where the storages are kept, only read until this call returns. NULL keeps them in files
+ *        in /etc, as seco_nvm_manager().
+ * \param manager pointer to where the manager handle is written, NULL if it failed to start.
+ *
+ * \return NVM_STATUS_RUNNING once the storage channels are waited for, NVM_STATUS_STOPPED otherwise
+ *         (e.g. serving both storages with a driver not supporting poll).
+ */
+uint32_t seco_nvm_manager_start(uint8_t flags, const struct seco_nvm_storage_cfg *storage, struct seco_nvm_manager_s **manager);
+
+/**
+ * Read the status of a storage manager started by seco_nvm_manager_start().
+ * NVM_STATUS_STOPPED means the manager stopped on an error: it must still be released with
+ * seco_nvm_manager_stop().
+ *
+ * \param manager pointer to the manager.
+ *
+ * \return status of the manager (NVM_STATUS_*).
+ */
+uint32_t seco_nvm_manager_get_status(struct seco_nvm_manager_s *manager);
+
+#define NVM_PREFETCH_NONE       (0x00u)
+#define NVM_PREFETCH_RUNNING    (0x01u)
+#define NVM_PREFETCH_DONE       (0x02u)
+
+/**
+ * Warm-up of the HSM storage, when started with prefetch_threads.
+ *
+ * The chunks of the storage are read and checked by background threads while the manager
+ * already serves SECO, then kept in memory for the life of the manager: their first use
+ * does not read the storage. Chunks requested before the warm-up is done are read from the
+ * storage as usual, and a chunk written by SECO first waits for the warm-up to complete.
+ */
+struct seco_nvm_prefetch_stats {
+    uint32_t state;     /**< NVM_PREFETCH_* */
+    uint32_t chunks;    /**< chunks loaded in memory. */
+    uint32_t errors;    /**< chunks which could not be read or failed the integrity checks. */
+    uint32_t bytes;     /**< memory taken by the chunks loaded, bookkeeping included. */
+    uint64_t time_us;   /**< duration of the warm-up in microseconds, once done. */
+};
+
+/**
+ * Read the state of the warm-up of a storage manager started by seco_nvm_manager_start().
+ * Can be called from any thread.
+ *
+ * \param manager pointer to the manager.
+ * \param stats pointer to where the state of the warm-up must be written.
+ */
+void seco_nvm_manager_get_prefetch_stats(struct seco_nvm_manager_s *manager, struct seco_nvm_prefetch_stats *stats);
+
+/**
+ * Stop a storage manager started by seco_nvm_manager_start() and release it.
+ *
+ * Requests already received from SECO are completed, then the storage channels are closed.
+ * The call does not wait for any further request.
+ *
+ * \param manager pointer to the manager.
+ */
+void seco_nvm_manager_stop(struct seco_nvm_manager_s *manager);
+
+/**
+ * Statistics of the cache of storage chunks kept by the HSM NVM manager.
+ */
+struct seco_nvm_cache_stats {
+    uint64_t hits;      /**< chunk requests served from the cache. */
+    uint64_t misses;    /**< chunk requests read from the storage. */
+    uint32_t entries;   /**< chunks currently cached. */
+    uint32_t bytes;     /**< size of the chunks currently cached. */
+};
+
+/**
+ * Read the statistics of the chunk cache. Can be called from any thread.
+ *
+ * \param stats pointer to where the statistics must be written.
+ */
+void seco_nvm_get_cache_stats(struct seco_nvm_cache_stats *stats);
+
+/**
+ * Metrics of the storage manager, kept for each storage (SHE and HSM) for the life of the process.
+ *
+ * Latencies are in microseconds and counted in log-linear histograms: the buckets 0 to 3 count the
+ * values 0 to 3, then each power of two is split in 4 buckets of equal width. The last bucket also
+ * counts all the larger values.
+ */
+#define NVM_METRICS_BUCKETS     (96u)
+
+struct seco_nvm_latency {
+    uint64_t count;                         /**< values counted. */
+    uint64_t total_us;                      /**< sum of the values. */
+    uint64_t max_us;                        /**< largest value. */
+    uint64_t buckets[NVM_METRICS_BUCKETS];  /**< number of values in each bucket. */
+};
+
+#define NVM_REQ_MASTER_IMPORT   (0u)    /**< storage given to SECO when the manager starts. */
+#define NVM_REQ_MASTER_EXPORT   (1u)    /**< storage exported by SECO. */
+#define NVM_REQ_CHUNK_EXPORT    (2u)    /**< chunk exported by SECO. */
+#define NVM_REQ_CHUNK_GET       (3u)    /**< chunk requested by SECO. */
+#define NVM_REQ_NB              (4u)
+
+struct seco_nvm_req_metrics {
+    uint64_t count;                 /**< requests processed. */
+    uint64_t errors;                /**< requests which failed or were answered with an error. */
+    uint64_t bytes;                 /**< size of the blobs exchanged with SECO. */
+    struct seco_nvm_latency total;  /**< from the request to its last answer, storage accesses included. */
+    struct seco_nvm_latency seco;   /**< time taken by SECO: from the answer giving it the blob address to
+                                         its finish message, or to its answer for the import. */
+};
+
+struct seco_nvm_metrics {
+    struct seco_nvm_req_metrics req[NVM_REQ_NB];    /**< indexed by NVM_REQ_* */
+    struct seco_nvm_latency write;  /**< storage writes, including the flush to the media for the durable
+                                         storages (see NVM_STORAGE_*). */
+    uint64_t write_errors;          /**< storage writes which failed. */
+    uint64_t write_skipped;         /**< chunks exported unchanged, not written again. */
+    uint64_t bytes_written;
+    struct seco_nvm_latency read;   /**< storage reads made to serve SECO. */
+    uint64_t bytes_read;
+};
+
+/**
+ * Read the metrics of a storage. Can be called from any thread.
+ *
+ * \param flags storage: NVM_FLAGS_SHE or NVM_FLAGS_HSM.
+ * \param metrics pointer to where the metrics must be written.
+ */
+void seco_nvm_get_metrics(uint8_t flags, struct seco_nvm_metrics *metrics);
+
+/**
+ * Lowest latency counted in a bucket of the histograms.
+ *
+ * \param bucket index of the bucket, lower than NVM_METRICS_BUCKETS.
+ *
+ * \return latency in microseconds.
+ */
+uint64_t seco_nvm_metrics_bucket_us(uint32_t bucket);
+
+/**
+ * Write the metrics of the storages as text: one line per request type and per storage access, with
+ * the counters and the average, median, 99th percentile and maximum latencies.
+ * Can be called from any thread.
+ *
+ * \param flags storages to be reported (NVM_FLAGS_SHE and/or NVM_FLAGS_HSM).
+ * \param buf pointer to where the text is written, NUL terminated and truncated to size.
+ * \param size size of buf.
+ *
+ * \return length of the whole text, as snprintf().
+ */
+int32_t seco_nvm_format_metrics(uint8_t flags, char *buf, uint32_t size);
+
 #endif
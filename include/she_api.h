@@ -130,6 +130,32 @@ struct she_hdl_s *she_open_session(uint32_t key_storage_identifier, uint32_t aut
  * \param hdl pointer to the session handler to be closed.
  */
 void she_close_session(struct she_hdl_s *hdl);
+
+/**
+ * Allocate memory in the secure RAM buffer shared with SHE by the session.
+ *
+ * Data written there is used in place by the SHE commands, without the copy done otherwise
+ * for each call. For CMD_GENERATE_MAC and CMD_VERIFY_MAC the message and the MAC must be
+ * allocated in one block, with the MAC located SHE_SHARED_BUF_MAC_POS(message_length) bytes
+ * after the start of the message.\n
+ * The memory is reserved until she_shared_buf_reset() is called or the session is closed.
+ * It reduces the space left for the commands working on buffers outside of it.
+ *
+ * \param hdl pointer to the SHE session handler
+ * \param size size in bytes of the memory to be allocated
+ * \param offset pointer to where the offset of the memory in secure RAM should be written. Can be NULL.
+ *
+ * \return pointer to the allocated memory, NULL if the space left or the platform does not allow it.
+ */
+uint8_t *she_shared_buf_alloc(struct she_hdl_s *hdl, uint32_t size, uint16_t *offset);
+#define SHE_SHARED_BUF_MAC_POS(message_length) (((uint32_t)(message_length) + 7u) & ~7u) //!< position of the MAC after the message in secure RAM.
+
+/**
+ * Release all the memory allocated with she_shared_buf_alloc() on the session.
+ *
+ * \param hdl pointer to the SHE session handler
+ */
+void she_shared_buf_reset(struct she_hdl_s *hdl);
 /** @} end of session group */
 
 /**
@@ -0,0 +1,372 @@
+/*
+ * Copyright 2019 NXP
+ *
+ * NXP Confidential.
+ * This software is owned or controlled by NXP and may only be used strictly
+ * in accordance with the applicable license terms.  By expressly accepting
+ * such terms or by downloading, installing, activating and/or otherwise using
+ * the software, you are agreeing that you have read, and that you agree to
+ * comply with and are bound by, such license terms.  If you do not agree to be
+ * bound by the applicable license terms, then you may not retain, install,
+ * activate or otherwise use the software.
+ */
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "hsm_api.h"
+#include "hsm_dispatch.h"
+#include "seco_os_abs.h"
+
+/* Each worker owns one session, opened on its own MU channel, and the service
+ * flows opened on it. Operations are queued to the workers round-robin: a worker
+ * serves its own queue first and, when it is empty, takes the head of the queue
+ * of another worker. So a long operation (e.g. signature verification) does not
+ * hold back the ones queued after it while other sessions are idle.
+ * The queues are protected by the lock of the dispatcher: a worker finding them
+ * all empty sleeps on its condition until an operation is submitted.
+ */
+struct hsm_dispatch_worker {
+	struct hsm_dispatcher_s *dispatcher;
+	hsm_dispatch_op_t *head;
+	hsm_dispatch_op_t *tail;
+	pthread_t thread;
+	bool started;
+	hsm_hdl_t session_hdl;
+	hsm_hdl_t key_store_hdl;
+	hsm_hdl_t sig_gen_hdl;
+	hsm_hdl_t sig_ver_hdl;
+	hsm_hdl_t cipher_hdl;
+	hsm_hdl_t hash_hdl;
+};
+
+struct hsm_dispatcher_s {
+	uint32_t nb_workers;
+	uint32_t next;		/* Queue of the next submitted operation. */
+	pthread_mutex_t lock;	/* Protects the queues, queued and stop, with cond. */
+	pthread_cond_t cond;
+	uint32_t queued;	/* Operations in the queues, not yet taken by a worker. */
+	bool stop;
+	struct hsm_dispatch_worker workers[HSM_DISPATCH_MAX_SESSIONS];
+};
+
+/* Completion of the operations performed by hsm_dispatch_run. */
+struct hsm_dispatch_sync {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool done;
+};
+
+/* Called with the dispatcher lock held. */
+static void dispatch_push(struct hsm_dispatch_worker *w, hsm_dispatch_op_t *op)
+{
+	op->next = NULL;
+	if (w->tail != NULL) {
+		w->tail->next = op;
+	} else {
+		w->head = op;
+	}
+	w->tail = op;
+}
+
+/* Called with the dispatcher lock held. */
+static hsm_dispatch_op_t *dispatch_pop(struct hsm_dispatch_worker *w)
+{
+	hsm_dispatch_op_t *op = NULL;
+
+	if (w->head != NULL) {
+		op = w->head;
+		w->head = op->next;
+		if (w->head == NULL) {
+			w->tail = NULL;
+		}
+	}
+
+	return op;
+}
+
+/* Own queue first, then the other queues starting with the next worker.
+ * Called with the dispatcher lock held.
+ */
+static hsm_dispatch_op_t *dispatch_take(struct hsm_dispatch_worker *w)
+{
+	struct hsm_dispatcher_s *d = w->dispatcher;
+	hsm_dispatch_op_t *op;
+	uint32_t self = (uint32_t)(w - d->workers);
+	uint32_t i;
+
+	op = dispatch_pop(w);
+	for (i = 1u; (op == NULL) && (i < d->nb_workers); i++) {
+		op = dispatch_pop(&d->workers[(self + i) % d->nb_workers]);
+	}
+
+	return op;
+}
+
+static void dispatch_execute(struct hsm_dispatch_worker *w, hsm_dispatch_op_t *op)
+{
+	op->verification_status = 0u;
+
+	switch (op->type) {
+	case HSM_DISPATCH_OP_VERIFY_SIGN:
+		op->err = hsm_verify_signature(w->sig_ver_hdl, op->args.verify_sign, &op->verification_status);
+		break;
+	case HSM_DISPATCH_OP_GENERATE_SIGN:
+		op->err = (w->sig_gen_hdl != 0u) ? hsm_generate_signature(w->sig_gen_hdl, op->args.generate_sign) : HSM_INVALID_PARAM;
+		break;
+	case HSM_DISPATCH_OP_CIPHER:
+		op->err = (w->cipher_hdl != 0u) ? hsm_cipher_one_go(w->cipher_hdl, op->args.cipher) : HSM_INVALID_PARAM;
+		break;
+	case HSM_DISPATCH_OP_HASH:
+		op->err = hsm_hash_one_go(w->hash_hdl, op->args.hash);
+		break;
+	default:
+		op->err = HSM_INVALID_PARAM;
+		break;
+	}
+}
+
+static void *dispatch_worker(void *arg)
+{
+	struct hsm_dispatch_worker *w = (struct hsm_dispatch_worker *)arg;
+	struct hsm_dispatcher_s *d = w->dispatcher;
+	hsm_dispatch_op_t *op;
+
+	(void)pthread_mutex_lock(&d->lock);
+	for (;;) {
+		while ((d->queued == 0u) && !d->stop) {
+			(void)pthread_cond_wait(&d->cond, &d->lock);
+		}
+		op = dispatch_take(w);
+		if (op == NULL) {
+			/* Stop requested and nothing left to do. */
+			break;
+		}
+		d->queued--;
+		(void)pthread_mutex_unlock(&d->lock);
+
+		dispatch_execute(w, op);
+		op->callback(op);
+
+		(void)pthread_mutex_lock(&d->lock);
+	}
+	(void)pthread_mutex_unlock(&d->lock);
+
+	return NULL;
+}
+
+static void dispatch_close_worker(struct hsm_dispatch_worker *w)
+{
+	if (w->hash_hdl != 0u) {
+		(void)hsm_close_hash_service(w->hash_hdl);
+	}
+	if (w->cipher_hdl != 0u) {
+		(void)hsm_close_cipher_service(w->cipher_hdl);
+	}
+	if (w->sig_ver_hdl != 0u) {
+		(void)hsm_close_signature_verification_service(w->sig_ver_hdl);
+	}
+	if (w->sig_gen_hdl != 0u) {
+		(void)hsm_close_signature_generation_service(w->sig_gen_hdl);
+	}
+	if (w->key_store_hdl != 0u) {
+		(void)hsm_close_key_store_service(w->key_store_hdl);
+	}
+	if (w->session_hdl != 0u) {
+		(void)hsm_close_session(w->session_hdl);
+	}
+}
+
+static hsm_err_t dispatch_open_worker(struct hsm_dispatch_worker *w, hsm_dispatcher_args_t *args, bool first)
+{
+	open_svc_key_store_args_t key_store_args;
+	open_svc_sign_gen_args_t sig_gen_args = {0};
+	open_svc_sign_ver_args_t sig_ver_args = {0};
+	open_svc_cipher_args_t cipher_args = {0};
+	open_svc_hash_args_t hash_args = {0};
+	hsm_err_t err;
+
+	do {
+		err = hsm_open_session(&args->session, &w->session_hdl);
+		if (err != HSM_NO_ERROR) {
+			break;
+		}
+		err = hsm_open_signature_verification_service(w->session_hdl, &sig_ver_args, &w->sig_ver_hdl);
+		if (err != HSM_NO_ERROR) {
+			break;
+		}
+		err = hsm_open_hash_service(w->session_hdl, &hash_args, &w->hash_hdl);
+		if (err != HSM_NO_ERROR) {
+			break;
+		}
+		if (args->key_store == NULL) {
+			break;
+		}
+		/* The key store is created once, by the first session. */
+		key_store_args = *args->key_store;
+		if (!first) {
+			key_store_args.flags &= (hsm_svc_key_store_flags_t)~HSM_SVC_KEY_STORE_FLAGS_CREATE;
+		}
+		err = hsm_open_key_store_service(w->session_hdl, &key_store_args, &w->key_store_hdl);
+		if (err != HSM_NO_ERROR) {
+			break;
+		}
+		err = hsm_open_signature_generation_service(w->key_store_hdl, &sig_gen_args, &w->sig_gen_hdl);
+		if (err != HSM_NO_ERROR) {
+			break;
+		}
+		err = hsm_open_cipher_service(w->key_store_hdl, &cipher_args, &w->cipher_hdl);
+	} while (false);
+
+	return err;
+}
+
+static void dispatch_stop(struct hsm_dispatcher_s *d)
+{
+	uint32_t i;
+
+	(void)pthread_mutex_lock(&d->lock);
+	d->stop = true;
+	(void)pthread_cond_broadcast(&d->cond);
+	(void)pthread_mutex_unlock(&d->lock);
+
+	for (i = 0u; i < d->nb_workers; i++) {
+		if (d->workers[i].started) {
+			(void)pthread_join(d->workers[i].thread, NULL);
+		}
+	}
+	for (i = 0u; i < d->nb_workers; i++) {
+		dispatch_close_worker(&d->workers[i]);
+	}
+	(void)pthread_cond_destroy(&d->cond);
+	(void)pthread_mutex_destroy(&d->lock);
+	seco_os_abs_free(d);
+}
+
+hsm_err_t hsm_open_dispatcher(hsm_dispatcher_args_t *args, hsm_dispatcher_t **dispatcher)
+{
+	struct hsm_dispatcher_s *d = NULL;
+	hsm_err_t err = HSM_INVALID_PARAM;
+	uint32_t i;
+
+	do {
+		if ((args == NULL) || (dispatcher == NULL)) {
+			break;
+		}
+		if ((args->nb_sessions == 0u) || (args->nb_sessions > HSM_DISPATCH_MAX_SESSIONS)) {
+			break;
+		}
+		d = (struct hsm_dispatcher_s *)seco_os_abs_malloc((uint32_t)sizeof(struct hsm_dispatcher_s));
+		if (d == NULL) {
+			err = HSM_OUT_OF_MEMORY;
+			break;
+		}
+		seco_os_abs_memset((uint8_t *)d, 0u, (uint32_t)sizeof(struct hsm_dispatcher_s));
+		d->nb_workers = args->nb_sessions;
+		(void)pthread_mutex_init(&d->lock, NULL);
+		(void)pthread_cond_init(&d->cond, NULL);
+
+		for (i = 0u; i < d->nb_workers; i++) {
+			d->workers[i].dispatcher = d;
+		}
+
+		err = HSM_NO_ERROR;
+		for (i = 0u; i < d->nb_workers; i++) {
+			err = dispatch_open_worker(&d->workers[i], args, i == 0u);
+			if (err != HSM_NO_ERROR) {
+				break;
+			}
+		}
+		for (i = 0u; (err == HSM_NO_ERROR) && (i < d->nb_workers); i++) {
+			if (pthread_create(&d->workers[i].thread, NULL, dispatch_worker, &d->workers[i]) != 0) {
+				err = HSM_GENERAL_ERROR;
+				break;
+			}
+			d->workers[i].started = true;
+		}
+		if (err != HSM_NO_ERROR) {
+			/* Handles not opened are left to 0 and not closed. */
+			dispatch_stop(d);
+			break;
+		}
+		*dispatcher = d;
+	} while (false);
+
+	return err;
+}
+
+hsm_err_t hsm_dispatch_submit(hsm_dispatcher_t *dispatcher, hsm_dispatch_op_t *op)
+{
+	struct hsm_dispatcher_s *d = dispatcher;
+	hsm_err_t err = HSM_INVALID_PARAM;
+
+	do {
+		if ((d == NULL) || (op == NULL) || (op->callback == NULL)) {
+			break;
+		}
+		(void)pthread_mutex_lock(&d->lock);
+		dispatch_push(&d->workers[d->next % d->nb_workers], op);
+		d->next++;
+		d->queued++;
+		(void)pthread_cond_signal(&d->cond);
+		(void)pthread_mutex_unlock(&d->lock);
+		err = HSM_NO_ERROR;
+	} while (false);
+
+	return err;
+}
+
+static void dispatch_sync_done(hsm_dispatch_op_t *op)
+{
+	struct hsm_dispatch_sync *s = (struct hsm_dispatch_sync *)op->priv;
+
+	(void)pthread_mutex_lock(&s->lock);
+	s->done = true;
+	(void)pthread_cond_signal(&s->cond);
+	(void)pthread_mutex_unlock(&s->lock);
+}
+
+hsm_err_t hsm_dispatch_run(hsm_dispatcher_t *dispatcher, hsm_dispatch_op_t *op)
+{
+	struct hsm_dispatch_sync s;
+	hsm_err_t err = HSM_INVALID_PARAM;
+
+	do {
+		if (op == NULL) {
+			break;
+		}
+		(void)pthread_mutex_init(&s.lock, NULL);
+		(void)pthread_cond_init(&s.cond, NULL);
+		s.done = false;
+		op->callback = dispatch_sync_done;
+		op->priv = &s;
+
+		err = hsm_dispatch_submit(dispatcher, op);
+		if (err == HSM_NO_ERROR) {
+			(void)pthread_mutex_lock(&s.lock);
+			while (!s.done) {
+				(void)pthread_cond_wait(&s.cond, &s.lock);
+			}
+			(void)pthread_mutex_unlock(&s.lock);
+			err = op->err;
+		}
+		op->callback = NULL;
+		op->priv = NULL;
+		(void)pthread_cond_destroy(&s.cond);
+		(void)pthread_mutex_destroy(&s.lock);
+	} while (false);
+
+	return err;
+}
+
+hsm_err_t hsm_close_dispatcher(hsm_dispatcher_t *dispatcher)
+{
+	hsm_err_t err = HSM_INVALID_PARAM;
+
+	if (dispatcher != NULL) {
+		dispatch_stop(dispatcher);
+		err = HSM_NO_ERROR;
+	}
+
+	return err;
+}
@@ -11,6 +11,7 @@
  * activate or otherwise use the software.
  */
 
+#include <stddef.h>
 #include "hsm_api.h"
 #include "seco_os_abs.h"
 #include "seco_sab_msg_def.h"
@@ -20,99 +21,352 @@
 struct hsm_session_hdl_s {
 	struct seco_os_abs_hdl *phdl;
 	uint32_t session_hdl;
+	uint32_t slot;
 };
 
 struct hsm_service_hdl_s {
 	struct hsm_session_hdl_s *session;
 	uint32_t service_hdl;
+	uint32_t slot;
 };
 
-#define HSM_MAX_SESSIONS	(8u)
-#define HSM_MAX_SERVICES	(32u)
+/* Sessions and services are allocated by slabs, added when all the slots are in use
+ * so that their address never changes. Slab sizes can be tuned to the deployment.
+ * The tables are shared by all threads: lookups take the tables lock for reading,
+ * opening and closing take it for writing. The pointers returned by the lookups
+ * stay valid until the handle is closed.
+ */
+#ifndef HSM_SESSIONS_SLAB
+#define HSM_SESSIONS_SLAB	(8u)
+#endif
+#ifndef HSM_SERVICES_SLAB
+#define HSM_SERVICES_SLAB	(32u)
+#endif
+
+/* Handles are given by SECO: they are mapped to their slot with an open addressing
+ * hash table (linear probing), sized to a power of 2 at least twice the number of slots.
+ */
+#define HSM_HDL_MAP_MIN_SIZE	(16u)
+#define HSM_HDL_NO_SLOT		(0xFFFFFFFFu)
 
-static struct hsm_session_hdl_s hsm_sessions[HSM_MAX_SESSIONS] = {};
-static struct hsm_service_hdl_s hsm_services[HSM_MAX_SERVICES] = {};
+struct hsm_hdl_map_entry {
+	uint32_t hdl;	/* 0 if the entry is empty. */
+	uint32_t slot;
+};
 
-static struct hsm_session_hdl_s *session_hdl_to_ptr(uint32_t hdl)
+struct hsm_slots {
+	uint32_t elt_size;
+	uint32_t slab_size;
+	uint8_t **slabs;
+	uint32_t nb_slabs;
+	uint32_t *free_slots;	/* Stack of the free slots. */
+	uint32_t nb_free;
+	struct hsm_hdl_map_entry *map;
+	uint32_t map_size;
+};
+
+static struct hsm_slots hsm_sessions = {
+	.elt_size = (uint32_t)sizeof(struct hsm_session_hdl_s),
+	.slab_size = HSM_SESSIONS_SLAB,
+};
+static struct hsm_slots hsm_services = {
+	.elt_size = (uint32_t)sizeof(struct hsm_service_hdl_s),
+	.slab_size = HSM_SERVICES_SLAB,
+};
+
+static uint32_t hdl_map_hash(uint32_t hdl, uint32_t size)
 {
-	uint32_t i;
-	struct hsm_session_hdl_s *ret;
+	/* Fibonacci hashing: handles are often close values. */
+	return ((hdl * 0x9E3779B1u) >> 16) & (size - 1u);
+}
 
-	ret = NULL;
-	for (i=0u; i<HSM_MAX_SESSIONS; i++) {
-		if (hdl == hsm_sessions[i].session_hdl) {
-			if (hsm_sessions[i].phdl != NULL) {
-				ret = &hsm_sessions[i];
+static uint32_t hdl_map_find(struct hsm_hdl_map_entry *map, uint32_t size, uint32_t hdl)
+{
+	uint32_t i, n;
+	uint32_t slot = HSM_HDL_NO_SLOT;
+
+	if ((hdl != 0u) && (size != 0u)) {
+		i = hdl_map_hash(hdl, size);
+		for (n = 0u; (n < size) && (map[i].hdl != 0u); n++) {
+			if (map[i].hdl == hdl) {
+				slot = map[i].slot;
+				break;
 			}
-			break;
+			i = (i + 1u) & (size - 1u);
 		}
 	}
-	return ret;
+	return slot;
 }
 
-static struct hsm_service_hdl_s *service_hdl_to_ptr(uint32_t hdl)
+static void hdl_map_insert(struct hsm_hdl_map_entry *map, uint32_t size, uint32_t hdl, uint32_t slot)
+{
+	uint32_t i, n;
+
+	if ((hdl != 0u) && (size != 0u)) {
+		i = hdl_map_hash(hdl, size);
+		/* Never full: more entries than slots. */
+		for (n = 0u; n < size; n++) {
+			if ((map[i].hdl == 0u) || (map[i].hdl == hdl)) {
+				map[i].hdl = hdl;
+				map[i].slot = slot;
+				break;
+			}
+			i = (i + 1u) & (size - 1u);
+		}
+	}
+}
+
+static void hdl_map_remove(struct hsm_hdl_map_entry *map, uint32_t size, uint32_t hdl, uint32_t slot)
+{
+	uint32_t i, j, home, n;
+
+	if ((hdl == 0u) || (size == 0u)) {
+		return;
+	}
+	i = hdl_map_hash(hdl, size);
+	for (n = 0u; (n < size) && (map[i].hdl != 0u); n++) {
+		if ((map[i].hdl == hdl) && (map[i].slot == slot)) {
+			/* Shift back the following entries of the cluster instead of leaving a tombstone. */
+			j = i;
+			for (;;) {
+				map[i].hdl = 0u;
+				do {
+					j = (j + 1u) & (size - 1u);
+					if (map[j].hdl == 0u) {
+						return;
+					}
+					home = hdl_map_hash(map[j].hdl, size);
+				} while (((j > i) && (home > i) && (home <= j))
+					|| ((j < i) && ((home > i) || (home <= j))));
+				map[i] = map[j];
+				i = j;
+			}
+		}
+		i = (i + 1u) & (size - 1u);
+	}
+}
+
+static void *slots_get(struct hsm_slots *slots, uint32_t slot)
 {
+	void *ptr = NULL;
+
+	if ((slot != HSM_HDL_NO_SLOT) && (slot / slots->slab_size < slots->nb_slabs)) {
+		ptr = slots->slabs[slot / slots->slab_size]
+			+ (slot % slots->slab_size) * slots->elt_size;
+	}
+	return ptr;
+}
+
+/* Add a slab of slots, growing the free stack and the handle map along. */
+static int32_t slots_grow(struct hsm_slots *slots)
+{
+	uint32_t capacity = (slots->nb_slabs + 1u) * slots->slab_size;
+	uint32_t map_size = (slots->map_size == 0u) ? HSM_HDL_MAP_MIN_SIZE : slots->map_size;
+	uint8_t **slabs = NULL;
+	uint8_t *slab = NULL;
+	uint32_t *free_slots = NULL;
+	struct hsm_hdl_map_entry *map = NULL;
+	int32_t err = -1;
 	uint32_t i;
-	struct hsm_service_hdl_s *ret;
 
-	ret = NULL;
-	for (i=0u; i<HSM_MAX_SERVICES; i++) {
-		if (hdl == hsm_services[i].service_hdl) {
-			if (hsm_services[i].session != NULL) {
-				ret = &hsm_services[i];
+	while (map_size < 2u * capacity) {
+		map_size *= 2u;
+	}
+
+	do {
+		slab = seco_os_abs_malloc(slots->slab_size * slots->elt_size);
+		slabs = (uint8_t **)seco_os_abs_malloc((slots->nb_slabs + 1u) * (uint32_t)sizeof(uint8_t *));
+		free_slots = (uint32_t *)seco_os_abs_malloc(capacity * (uint32_t)sizeof(uint32_t));
+		if ((slab == NULL) || (slabs == NULL) || (free_slots == NULL)) {
+			break;
+		}
+		if (map_size != slots->map_size) {
+			map = (struct hsm_hdl_map_entry *)seco_os_abs_malloc(map_size * (uint32_t)sizeof(struct hsm_hdl_map_entry));
+			if (map == NULL) {
 				break;
 			}
+			/* Rehash the handles in use. */
+			seco_os_abs_memset((uint8_t *)map, 0u, map_size * (uint32_t)sizeof(struct hsm_hdl_map_entry));
+			for (i = 0u; i < slots->map_size; i++) {
+				hdl_map_insert(map, map_size, slots->map[i].hdl, slots->map[i].slot);
+			}
+			seco_os_abs_free(slots->map);
+			slots->map = map;
+			slots->map_size = map_size;
 		}
+
+		seco_os_abs_memset(slab, 0u, slots->slab_size * slots->elt_size);
+		if (slots->nb_slabs != 0u) {
+			seco_os_abs_memcpy((uint8_t *)slabs, (uint8_t *)slots->slabs, slots->nb_slabs * (uint32_t)sizeof(uint8_t *));
+		}
+		slabs[slots->nb_slabs] = slab;
+		seco_os_abs_free(slots->slabs);
+		slots->slabs = slabs;
+
+		/* All the slots in use before were not free: only the new ones are. Lowest first. */
+		for (i = 0u; i < slots->slab_size; i++) {
+			free_slots[i] = capacity - 1u - i;
+		}
+		seco_os_abs_free(slots->free_slots);
+		slots->free_slots = free_slots;
+		slots->nb_free = slots->slab_size;
+		slots->nb_slabs++;
+		err = 0;
+	} while (false);
+
+	if (err != 0) {
+		seco_os_abs_free(slab);
+		seco_os_abs_free(slabs);
+		seco_os_abs_free(free_slots);
 	}
+	return err;
+}
+
+static void *slots_alloc(struct hsm_slots *slots, uint32_t *slot)
+{
+	void *ptr = NULL;
+
+	if ((slots->nb_free != 0u) || (slots_grow(slots) == 0)) {
+		slots->nb_free--;
+		*slot = slots->free_slots[slots->nb_free];
+		ptr = slots_get(slots, *slot);
+	}
+	return ptr;
+}
+
+static void slots_free(struct hsm_slots *slots, uint32_t slot)
+{
+	/* The stack can hold all the slots. */
+	slots->free_slots[slots->nb_free] = slot;
+	slots->nb_free++;
+}
+
+static bool slots_empty(struct hsm_slots *slots)
+{
+	return slots->nb_free == slots->nb_slabs * slots->slab_size;
+}
+
+static void slots_release(struct hsm_slots *slots)
+{
+	uint32_t i;
+
+	for (i = 0u; i < slots->nb_slabs; i++) {
+		seco_os_abs_free(slots->slabs[i]);
+	}
+	seco_os_abs_free(slots->slabs);
+	seco_os_abs_free(slots->free_slots);
+	seco_os_abs_free(slots->map);
+	slots->slabs = NULL;
+	slots->nb_slabs = 0u;
+	slots->free_slots = NULL;
+	slots->nb_free = 0u;
+	slots->map = NULL;
+	slots->map_size = 0u;
+}
+
+/* Give the memory back once nothing is open anymore. Services refer to their session. */
+static void slots_release_unused(void)
+{
+	if (slots_empty(&hsm_sessions) && slots_empty(&hsm_services)) {
+		slots_release(&hsm_sessions);
+		slots_release(&hsm_services);
+	}
+}
+
+static struct hsm_session_hdl_s *session_hdl_to_ptr(uint32_t hdl)
+{
+	struct hsm_session_hdl_s *ret;
+
+	seco_os_abs_tables_rdlock();
+	ret = slots_get(&hsm_sessions, hdl_map_find(hsm_sessions.map, hsm_sessions.map_size, hdl));
+	if ((ret != NULL) && (ret->phdl == NULL)) {
+		ret = NULL;
+	}
+	seco_os_abs_tables_unlock();
+	return ret;
+}
+
+static struct hsm_service_hdl_s *service_hdl_to_ptr(uint32_t hdl)
+{
+	struct hsm_service_hdl_s *ret;
+
+	seco_os_abs_tables_rdlock();
+	ret = slots_get(&hsm_services, hdl_map_find(hsm_services.map, hsm_services.map_size, hdl));
+	if ((ret != NULL) && (ret->session == NULL)) {
+		ret = NULL;
+	}
+	seco_os_abs_tables_unlock();
 	return ret;
 }
 
 static struct hsm_session_hdl_s *add_session(void)
 {
-	uint32_t i;
-	struct hsm_session_hdl_s *s_ptr = NULL;
+	uint32_t slot;
+	struct hsm_session_hdl_s *s_ptr;
 
-	for (i=0u; i<HSM_MAX_SESSIONS; i++) {
-		if ((hsm_sessions[i].phdl == NULL)
-			&& (hsm_sessions[i].session_hdl == 0u)) {
-			/* Found an empty slot. */
-			s_ptr = &hsm_sessions[i];
-			break;
-		}
+	seco_os_abs_tables_wrlock();
+	s_ptr = slots_alloc(&hsm_sessions, &slot);
+	if (s_ptr != NULL) {
+		s_ptr->slot = slot;
 	}
+	seco_os_abs_tables_unlock();
 	return s_ptr;
 }
 
 static struct hsm_service_hdl_s *add_service(struct hsm_session_hdl_s *session)
 {
-	uint32_t i;
-	struct hsm_service_hdl_s *s_ptr = NULL;
+	uint32_t slot;
+	struct hsm_service_hdl_s *s_ptr;
 
-	for (i=0u; i<HSM_MAX_SERVICES; i++) {
-		if ((hsm_services[i].session == NULL)
-			&& (hsm_services[i].service_hdl == 0u)) {
-			/* Found an empty slot. */
-			s_ptr = &hsm_services[i];
-			s_ptr->session = session;
-			break;
-		}
+	seco_os_abs_tables_wrlock();
+	s_ptr = slots_alloc(&hsm_services, &slot);
+	if (s_ptr != NULL) {
+		s_ptr->slot = slot;
+		s_ptr->session = session;
 	}
+	seco_os_abs_tables_unlock();
 	return s_ptr;
 }
 
+/* Make a session reachable from its handle, once given by SECO. */
+static void index_session(struct hsm_session_hdl_s *s_ptr)
+{
+	seco_os_abs_tables_wrlock();
+	hdl_map_insert(hsm_sessions.map, hsm_sessions.map_size, s_ptr->session_hdl, s_ptr->slot);
+	seco_os_abs_tables_unlock();
+}
+
+/* Make a service reachable from its handle, once given by SECO. */
+static void index_service(struct hsm_service_hdl_s *s_ptr)
+{
+	seco_os_abs_tables_wrlock();
+	hdl_map_insert(hsm_services.map, hsm_services.map_size, s_ptr->service_hdl, s_ptr->slot);
+	seco_os_abs_tables_unlock();
+}
+
 static void delete_session(struct hsm_session_hdl_s *s_ptr)
 {
 	if (s_ptr != NULL) {
+		seco_os_abs_tables_wrlock();
+		hdl_map_remove(hsm_sessions.map, hsm_sessions.map_size, s_ptr->session_hdl, s_ptr->slot);
 		s_ptr->phdl = NULL;
 		s_ptr->session_hdl = 0u;
+		slots_free(&hsm_sessions, s_ptr->slot);
+		slots_release_unused();
+		seco_os_abs_tables_unlock();
 	}
 }
 
 static void delete_service(struct hsm_service_hdl_s *s_ptr)
 {
 	if (s_ptr != NULL) {
+		seco_os_abs_tables_wrlock();
+		hdl_map_remove(hsm_services.map, hsm_services.map_size, s_ptr->service_hdl, s_ptr->slot);
 		s_ptr->session = NULL;
 		s_ptr->service_hdl = 0u;
+		slots_free(&hsm_services, s_ptr->slot);
+		slots_release_unused();
+		seco_os_abs_tables_unlock();
 	}
 }
 
@@ -160,6 +414,54 @@ hsm_err_t hsm_close_session(hsm_hdl_t session_hdl)
 	return err;
 }
 
+hsm_err_t hsm_register_buffer(hsm_hdl_t session_hdl, uint8_t *buf, uint32_t size)
+{
+	struct hsm_session_hdl_s *s_ptr;
+	hsm_err_t err = HSM_GENERAL_ERROR;
+
+	do {
+		s_ptr = session_hdl_to_ptr(session_hdl);
+		if (s_ptr == NULL) {
+			err = HSM_UNKNOWN_HANDLE;
+			break;
+		}
+		if ((buf == NULL) || (size == 0u)) {
+			err = HSM_INVALID_ADDRESS;
+			break;
+		}
+
+		if (seco_os_abs_register_buf(s_ptr->phdl, buf, size, NULL) != 0) {
+			break;
+		}
+
+		err = HSM_NO_ERROR;
+	} while (false);
+
+	return err;
+}
+
+hsm_err_t hsm_unregister_buffer(hsm_hdl_t session_hdl, uint8_t *buf)
+{
+	struct hsm_session_hdl_s *s_ptr;
+	hsm_err_t err = HSM_GENERAL_ERROR;
+
+	do {
+		s_ptr = session_hdl_to_ptr(session_hdl);
+		if (s_ptr == NULL) {
+			err = HSM_UNKNOWN_HANDLE;
+			break;
+		}
+
+		if (seco_os_abs_unregister_buf(s_ptr->phdl, buf) != 0) {
+			break;
+		}
+
+		err = HSM_NO_ERROR;
+	} while (false);
+
+	return err;
+}
+
 hsm_err_t hsm_open_session(open_session_args_t *args, hsm_hdl_t *session_hdl)
 {
 	struct hsm_session_hdl_s *s_ptr = NULL;
@@ -190,6 +492,7 @@ hsm_err_t hsm_open_session(open_session_args_t *args, hsm_hdl_t *session_hdl)
 						mu_params.did,
 						args->session_priority,
 						args->operating_mode);
+		index_session(s_ptr);
 		err = sab_rating_to_hsm_err(sab_err);
 		if (err != HSM_NO_ERROR) {
 			break;
@@ -255,6 +558,7 @@ hsm_err_t hsm_open_key_store_service(hsm_hdl_t session_hdl,
 			break;
 		}
 
+		index_service(serv_ptr);
 		*key_store_hdl = serv_ptr->service_hdl;
 	} while (false);
 
@@ -343,6 +647,7 @@ hsm_err_t hsm_open_key_management_service(hsm_hdl_t key_store_hdl,
 		}
 
 		key_mgt_serv_ptr->service_hdl = rsp.key_management_handle;
+		index_service(key_mgt_serv_ptr);
 		*key_management_hdl = rsp.key_management_handle;
 	} while (false);
 
@@ -354,6 +659,7 @@ hsm_err_t hsm_generate_key(hsm_hdl_t key_management_hdl,
 {
 	struct sab_cmd_generate_key_msg cmd;
 	struct sab_cmd_generate_key_rsp rsp;
+	struct seco_os_abs_buf bufs[1];
 	int32_t error = 1;
 	struct hsm_service_hdl_s *serv_ptr;
 	hsm_err_t err = HSM_GENERAL_ERROR;
@@ -379,20 +685,20 @@ hsm_err_t hsm_generate_key(hsm_hdl_t key_management_hdl,
 		cmd.key_type = args->key_type;
 		cmd.key_group = args->key_group;
  		cmd.key_info = args->key_info;
- 		cmd.out_key_addr = (uint32_t)seco_os_abs_data_buf(serv_ptr->session->phdl,
+		cmd.out_key_addr = 0u;
+		seco_fill_data_buf(&bufs[0],
 				args->out_key,
 				args->out_size,
-				0u);
- 		cmd.crc = 0u;
-		cmd.crc = seco_compute_msg_crc((uint32_t*)&cmd,
-				(uint32_t)(sizeof(cmd) - sizeof(uint32_t)));
+				0u,
+				(uint32_t)offsetof(struct sab_cmd_generate_key_msg, out_key_addr));
 
 		/* Send the message to Seco. */
-		error = seco_send_msg_and_get_resp(serv_ptr->session->phdl,
+		error = seco_send_msg_with_bufs_and_get_resp(serv_ptr->session->phdl,
 			(uint32_t *)&cmd,
 			(uint32_t)sizeof(struct sab_cmd_generate_key_msg),
 			(uint32_t *)&rsp,
-			(uint32_t)sizeof(struct sab_cmd_generate_key_rsp));
+			(uint32_t)sizeof(struct sab_cmd_generate_key_rsp),
+			bufs, 1u, MU_TRANSACTION_CMD_CRC);
 		if (error != 0) {
 			break;
 		}
@@ -412,6 +718,7 @@ hsm_err_t hsm_manage_key(hsm_hdl_t key_management_hdl,
 {
 	struct sab_cmd_manage_key_msg cmd;
 	struct sab_cmd_manage_key_rsp rsp;
+	struct seco_os_abs_buf bufs[1];
 	int32_t error = 1;
 	struct hsm_service_hdl_s *serv_ptr;
 	hsm_err_t err = HSM_GENERAL_ERROR;
@@ -438,20 +745,20 @@ hsm_err_t hsm_manage_key(hsm_hdl_t key_management_hdl,
 		cmd.key_type = args->key_type;
 		cmd.key_group = args->key_group;
  		cmd.key_info = args->key_info;
-		cmd.input_data_addr = (uint32_t)seco_os_abs_data_buf(serv_ptr->session->phdl,
+		cmd.input_data_addr = 0u;
+		seco_fill_data_buf(&bufs[0],
 				args->input_data,
 				args->input_size,
-				DATA_BUF_IS_INPUT);
- 		cmd.crc = 0u;
-		cmd.crc = seco_compute_msg_crc((uint32_t*)&cmd,
-				(uint32_t)(sizeof(cmd) - sizeof(uint32_t)));
+				DATA_BUF_IS_INPUT,
+				(uint32_t)offsetof(struct sab_cmd_manage_key_msg, input_data_addr));
 
 		/* Send the message to Seco. */
-		error = seco_send_msg_and_get_resp(serv_ptr->session->phdl,
+		error = seco_send_msg_with_bufs_and_get_resp(serv_ptr->session->phdl,
 			(uint32_t *)&cmd,
 			(uint32_t)sizeof(struct sab_cmd_manage_key_msg),
 			(uint32_t *)&rsp,
-			(uint32_t)sizeof(struct sab_cmd_manage_key_rsp));
+			(uint32_t)sizeof(struct sab_cmd_manage_key_rsp),
+			bufs, 1u, MU_TRANSACTION_CMD_CRC);
 		if (error != 0) {
 			break;
 		}
@@ -518,6 +825,7 @@ hsm_err_t hsm_butterfly_key_expansion(hsm_hdl_t key_management_hdl,
 {
 	struct sab_cmd_butterfly_key_exp_msg cmd;
 	struct sab_cmd_butterfly_key_exp_rsp rsp;
+	struct seco_os_abs_buf bufs[4];
 	int32_t error = 1;
 	struct hsm_service_hdl_s *serv_ptr;
 	hsm_err_t err = HSM_GENERAL_ERROR;
@@ -538,42 +846,48 @@ hsm_err_t hsm_butterfly_key_expansion(hsm_hdl_t key_management_hdl,
 			(uint32_t)sizeof(struct sab_cmd_butterfly_key_exp_msg));
 		cmd.key_management_handle = key_management_hdl;
 		cmd.key_identifier = args->key_identifier;
-		cmd.expansion_function_value_addr = (uint32_t)seco_os_abs_data_buf(serv_ptr->session->phdl,
+		cmd.expansion_function_value_addr = 0u;
+		seco_fill_data_buf(&bufs[0],
 				args->expansion_function_value,
 				args->expansion_function_value_size,
-				DATA_BUF_IS_INPUT);
-		cmd.hash_value_addr = (uint32_t)seco_os_abs_data_buf(serv_ptr->session->phdl,
+				DATA_BUF_IS_INPUT,
+				(uint32_t)offsetof(struct sab_cmd_butterfly_key_exp_msg, expansion_function_value_addr));
+		cmd.hash_value_addr = 0u;
+		seco_fill_data_buf(&bufs[1],
 				args->hash_value,
 				args->hash_value_size,
-				DATA_BUF_IS_INPUT);
-		cmd.pr_reconstruction_value_addr = (uint32_t)seco_os_abs_data_buf(serv_ptr->session->phdl,
+				DATA_BUF_IS_INPUT,
+				(uint32_t)offsetof(struct sab_cmd_butterfly_key_exp_msg, hash_value_addr));
+		cmd.pr_reconstruction_value_addr = 0u;
+		seco_fill_data_buf(&bufs[2],
 				args->pr_reconstruction_value,
 				args->pr_reconstruction_value_size,
-				DATA_BUF_IS_INPUT);
+				DATA_BUF_IS_INPUT,
+				(uint32_t)offsetof(struct sab_cmd_butterfly_key_exp_msg, pr_reconstruction_value_addr));
 		cmd.expansion_function_value_size = args->expansion_function_value_size;
 		cmd.hash_value_size = args->hash_value_size;
 		cmd.pr_reconstruction_value_size = args->pr_reconstruction_value_size;
 		cmd.flags = args->flags;
 		cmd.dest_key_identifier = *(args->dest_key_identifier);
-		cmd.output_address = (uint32_t)seco_os_abs_data_buf(serv_ptr->session->phdl,
+		cmd.output_address = 0u;
+		seco_fill_data_buf(&bufs[3],
 				args->output,
 				args->output_size,
-				0u);
+				0u,
+				(uint32_t)offsetof(struct sab_cmd_butterfly_key_exp_msg, output_address));
 		cmd.output_size = args->output_size;
 		cmd.key_type = args->key_type;
 		cmd.rsv = 0u;
 		cmd.key_group = args->key_group;
 		cmd.key_info = args->key_info;
-		cmd.crc = 0u;
-		cmd.crc = seco_compute_msg_crc((uint32_t*)&cmd,
-				(uint32_t)(sizeof(cmd) - sizeof(uint32_t)));
 
 		/* Send the message to Seco. */
-		error = seco_send_msg_and_get_resp(serv_ptr->session->phdl,
+		error = seco_send_msg_with_bufs_and_get_resp(serv_ptr->session->phdl,
 			(uint32_t *)&cmd,
 			(uint32_t)sizeof(struct sab_cmd_butterfly_key_exp_msg),
 			(uint32_t *)&rsp,
-			(uint32_t)sizeof(struct sab_cmd_butterfly_key_exp_rsp));
+			(uint32_t)sizeof(struct sab_cmd_butterfly_key_exp_rsp),
+			bufs, 4u, MU_TRANSACTION_CMD_CRC);
 		if (error != 0) {
 			break;
 		}
@@ -655,6 +969,7 @@ hsm_err_t hsm_open_cipher_service(hsm_hdl_t key_store_hdl,
 			delete_service(cipher_serv_ptr);
 			break;
 		}
+		index_service(cipher_serv_ptr);
 		*cipher_hdl = cipher_serv_ptr->service_hdl;
 	} while (false);
 
@@ -722,6 +1037,7 @@ hsm_err_t hsm_ecies_decryption(hsm_hdl_t cipher_hdl, hsm_op_ecies_dec_args_t *ar
 {
 	struct sab_cmd_ecies_decrypt_msg cmd;
 	struct sab_cmd_ecies_decrypt_rsp rsp;
+	struct seco_os_abs_buf bufs[4];
 	int32_t error = 1;
 	struct hsm_service_hdl_s *serv_ptr;
 	hsm_err_t err = HSM_GENERAL_ERROR;
@@ -742,22 +1058,30 @@ hsm_err_t hsm_ecies_decryption(hsm_hdl_t cipher_hdl, hsm_op_ecies_dec_args_t *ar
 			(uint32_t)sizeof(struct sab_cmd_ecies_decrypt_msg));
 		cmd.cipher_handle = cipher_hdl;
 		cmd.key_id = args->key_identifier;
-		cmd.input_address = (uint32_t)seco_os_abs_data_buf(serv_ptr->session->phdl,
+		cmd.input_address = 0u;
+		seco_fill_data_buf(&bufs[0],
 				args->input,
 				args->input_size,
-				DATA_BUF_IS_INPUT);
-		cmd.p1_addr = (uint32_t)seco_os_abs_data_buf(serv_ptr->session->phdl,
+				DATA_BUF_IS_INPUT,
+				(uint32_t)offsetof(struct sab_cmd_ecies_decrypt_msg, input_address));
+		cmd.p1_addr = 0u;
+		seco_fill_data_buf(&bufs[1],
 				args->p1,
 				args->p1_size,
-				DATA_BUF_IS_INPUT);
-		cmd.p2_addr = (uint32_t)seco_os_abs_data_buf(serv_ptr->session->phdl,
+				DATA_BUF_IS_INPUT,
+				(uint32_t)offsetof(struct sab_cmd_ecies_decrypt_msg, p1_addr));
+		cmd.p2_addr = 0u;
+		seco_fill_data_buf(&bufs[2],
 				args->p2,
 				args->p2_size,
-				DATA_BUF_IS_INPUT);
-		cmd.output_address = (uint32_t)seco_os_abs_data_buf(serv_ptr->session->phdl,
+				DATA_BUF_IS_INPUT,
+				(uint32_t)offsetof(struct sab_cmd_ecies_decrypt_msg, p2_addr));
+		cmd.output_address = 0u;
+		seco_fill_data_buf(&bufs[3],
 				args->output,
 				args->output_size,
-				0u);
+				0u,
+				(uint32_t)offsetof(struct sab_cmd_ecies_decrypt_msg, output_address));
 		cmd.input_size = args->input_size;
 		cmd.output_size = args->output_size;
 		cmd.p1_size = args->p1_size;
@@ -765,16 +1089,14 @@ hsm_err_t hsm_ecies_decryption(hsm_hdl_t cipher_hdl, hsm_op_ecies_dec_args_t *ar
 		cmd.mac_size = args->mac_size;
 		cmd.key_type = args->key_type;
 		cmd.flags = args->flags;
-		cmd.crc = 0u;
-		cmd.crc = seco_compute_msg_crc((uint32_t*)&cmd,
-				(uint32_t)(sizeof(cmd) - sizeof(uint32_t)));
 
 		/* Send the message to Seco. */
-		error = seco_send_msg_and_get_resp(serv_ptr->session->phdl,
+		error = seco_send_msg_with_bufs_and_get_resp(serv_ptr->session->phdl,
 			(uint32_t *)&cmd,
 			(uint32_t)sizeof(struct sab_cmd_ecies_decrypt_msg),
 			(uint32_t *)&rsp,
-			(uint32_t)sizeof(struct sab_cmd_ecies_decrypt_rsp));
+			(uint32_t)sizeof(struct sab_cmd_ecies_decrypt_rsp),
+			bufs, 4u, MU_TRANSACTION_CMD_CRC);
 		if (error != 0) {
 			break;
 		}
@@ -842,6 +1164,7 @@ hsm_err_t hsm_open_signature_generation_service(hsm_hdl_t key_store_hdl,
 			break;
 		}
 		sig_gen_serv_ptr->service_hdl = rsp.sig_gen_hdl;
+		index_service(sig_gen_serv_ptr);
 		*signature_gen_hdl = rsp.sig_gen_hdl;
 	} while (false);
 
@@ -888,6 +1211,7 @@ hsm_err_t hsm_generate_signature(hsm_hdl_t signature_gen_hdl,
 {
 	struct sab_signature_generate_msg cmd;
 	struct sab_signature_generate_rsp rsp;
+	struct seco_os_abs_buf bufs[2];
 	int32_t error = 1;
 	struct hsm_service_hdl_s *serv_ptr;
 	hsm_err_t err = HSM_GENERAL_ERROR;
@@ -908,28 +1232,30 @@ hsm_err_t hsm_generate_signature(hsm_hdl_t signature_gen_hdl,
 			(uint32_t)sizeof(struct sab_signature_generate_msg));
 		cmd.sig_gen_hdl = signature_gen_hdl;
 		cmd.key_identifier = args->key_identifier;
-		cmd.message_addr = (uint32_t)seco_os_abs_data_buf(serv_ptr->session->phdl,
+		cmd.message_addr = 0u;
+		seco_fill_data_buf(&bufs[0],
 					args->message,
 					args->message_size,
-					DATA_BUF_IS_INPUT);
-		cmd.signature_addr = (uint32_t)seco_os_abs_data_buf(serv_ptr->session->phdl,
+					DATA_BUF_IS_INPUT,
+					(uint32_t)offsetof(struct sab_signature_generate_msg, message_addr));
+		cmd.signature_addr = 0u;
+		seco_fill_data_buf(&bufs[1],
 					args->signature,
 					args->signature_size,
-					0u);
+					0u,
+					(uint32_t)offsetof(struct sab_signature_generate_msg, signature_addr));
 		cmd.message_size = args->message_size;
 		cmd.signature_size = args->signature_size;
 		cmd.scheme_id = args->scheme_id;
 		cmd.flags = args->flags;
-		cmd.crc = 0u;
-		cmd.crc = seco_compute_msg_crc((uint32_t*)&cmd,
-				(uint32_t)(sizeof(cmd) - sizeof(uint32_t)));
 
 		/* Send the message to Seco. */
-		error = seco_send_msg_and_get_resp(serv_ptr->session->phdl,
+		error = seco_send_msg_with_bufs_and_get_resp(serv_ptr->session->phdl,
 			(uint32_t *)&cmd,
 			(uint32_t)sizeof(struct sab_signature_generate_msg),
 			(uint32_t *)&rsp,
-			(uint32_t)sizeof(struct sab_signature_generate_rsp));
+			(uint32_t)sizeof(struct sab_signature_generate_rsp),
+			bufs, 2u, MU_TRANSACTION_CMD_CRC);
 		if (error != 0) {
 			break;
 		}
@@ -1040,6 +1366,7 @@ hsm_err_t hsm_open_signature_verification_service(hsm_hdl_t session_hdl,
 			break;
 		}
 		serv_ptr->service_hdl = rsp.sig_ver_hdl;
+		index_service(serv_ptr);
 		*signature_ver_hdl = rsp.sig_ver_hdl;
 	} while (false);
 
@@ -1086,6 +1413,7 @@ hsm_err_t hsm_verify_signature(hsm_hdl_t signature_ver_hdl,
 {
 	struct sab_signature_verify_msg cmd;
 	struct sab_signature_verify_rsp rsp;
+	struct seco_os_abs_buf bufs[3];
 	int32_t error = 1;
 	struct hsm_service_hdl_s *serv_ptr;
 	hsm_err_t err = HSM_GENERAL_ERROR;
@@ -1105,34 +1433,38 @@ hsm_err_t hsm_verify_signature(hsm_hdl_t signature_ver_hdl,
 			SAB_SIGNATURE_VERIFY_REQ,
 			(uint32_t)sizeof(struct sab_signature_verify_msg));
 		cmd.sig_ver_hdl = signature_ver_hdl;
-		cmd.key_addr = (uint32_t)seco_os_abs_data_buf(serv_ptr->session->phdl,
+		cmd.key_addr = 0u;
+		seco_fill_data_buf(&bufs[0],
 					args->key,
 					args->key_size,
-					DATA_BUF_IS_INPUT);
-		cmd.msg_addr = (uint32_t)seco_os_abs_data_buf(serv_ptr->session->phdl,
+					DATA_BUF_IS_INPUT,
+					(uint32_t)offsetof(struct sab_signature_verify_msg, key_addr));
+		cmd.msg_addr = 0u;
+		seco_fill_data_buf(&bufs[1],
 					args->message,
 					args->message_size,
-					DATA_BUF_IS_INPUT);
-		cmd.sig_addr = (uint32_t)seco_os_abs_data_buf(serv_ptr->session->phdl,
+					DATA_BUF_IS_INPUT,
+					(uint32_t)offsetof(struct sab_signature_verify_msg, msg_addr));
+		cmd.sig_addr = 0u;
+		seco_fill_data_buf(&bufs[2],
 					args->signature,
 					args->signature_size,
-					DATA_BUF_IS_INPUT);
+					DATA_BUF_IS_INPUT,
+					(uint32_t)offsetof(struct sab_signature_verify_msg, sig_addr));
 		cmd.key_size = args->key_size;
 		cmd.sig_size = args->signature_size;
 		cmd.message_size = args->message_size;
 		cmd.sig_scheme = args->scheme_id;
 		cmd.flags = args->flags;
 		cmd.reserved = 0u;
-		cmd.crc = 0u;
-		cmd.crc = seco_compute_msg_crc((uint32_t*)&cmd,
-				(uint32_t)(sizeof(cmd) - sizeof(uint32_t)));
 
 		/* Send the message to Seco. */
-		error = seco_send_msg_and_get_resp(serv_ptr->session->phdl,
+		error = seco_send_msg_with_bufs_and_get_resp(serv_ptr->session->phdl,
 			(uint32_t *)&cmd,
 			(uint32_t)sizeof(struct sab_signature_verify_msg),
 			(uint32_t *)&rsp,
-			(uint32_t)sizeof(struct sab_signature_verify_rsp));
+			(uint32_t)sizeof(struct sab_signature_verify_rsp),
+			bufs, 3u, MU_TRANSACTION_CMD_CRC);
 		if (error != 0) {
 			break;
 		}
@@ -1150,6 +1482,7 @@ hsm_err_t hsm_import_public_key(hsm_hdl_t signature_ver_hdl,
 {
 	struct sab_import_pub_key_msg cmd;
 	struct sab_import_pub_key_rsp rsp;
+	struct seco_os_abs_buf bufs[1];
 	int32_t error = 1;
 	struct hsm_service_hdl_s *serv_ptr;
 	hsm_err_t err = HSM_GENERAL_ERROR;
@@ -1170,20 +1503,23 @@ hsm_err_t hsm_import_public_key(hsm_hdl_t signature_ver_hdl,
 			SAB_IMPORT_PUB_KEY,
 			(uint32_t)sizeof(struct sab_import_pub_key_msg));
 		cmd.sig_ver_hdl = signature_ver_hdl;
-		cmd.key_addr = (uint32_t)seco_os_abs_data_buf(serv_ptr->session->phdl,
-					args->key,
-					args->key_size,
-					DATA_BUF_IS_INPUT);
+		cmd.key_addr = 0u;
+		seco_fill_data_buf(&bufs[0],
+				args->key,
+				args->key_size,
+				DATA_BUF_IS_INPUT,
+				(uint32_t)offsetof(struct sab_import_pub_key_msg, key_addr));
 		cmd.key_size = args->key_size;
 		cmd.key_type = args->key_type;
 		cmd.flags = args->flags;
 
 		/* Send the message to Seco. */
-		error = seco_send_msg_and_get_resp(serv_ptr->session->phdl,
+		error = seco_send_msg_with_bufs_and_get_resp(serv_ptr->session->phdl,
 			(uint32_t *)&cmd,
 			(uint32_t)sizeof(struct sab_import_pub_key_msg),
 			(uint32_t *)&rsp,
-			(uint32_t)sizeof(struct sab_import_pub_key_rsp));
+			(uint32_t)sizeof(struct sab_import_pub_key_rsp),
+			bufs, 1u, 0u);
 		if (error != 0) {
 			break;
 		}
@@ -1228,6 +1564,7 @@ hsm_err_t hsm_open_rng_service(hsm_hdl_t session_hdl,
 			delete_service(serv_ptr);
 			break;
 		}
+		index_service(serv_ptr);
 		*rng_hdl = serv_ptr->service_hdl;
 	} while (false);
 
@@ -1261,6 +1598,7 @@ hsm_err_t hsm_get_random(hsm_hdl_t rng_hdl, op_get_random_args_t *args)
 {
 	struct sab_cmd_get_rnd_msg cmd;
 	struct sab_cmd_get_rnd_rsp rsp;
+	struct seco_os_abs_buf bufs[1];
 	int32_t error = 1;
 	struct hsm_service_hdl_s *serv_ptr;
 	hsm_err_t err = HSM_GENERAL_ERROR;
@@ -1281,18 +1619,21 @@ hsm_err_t hsm_get_random(hsm_hdl_t rng_hdl, op_get_random_args_t *args)
 			SAB_RNG_GET_RANDOM,
 			(uint32_t)sizeof(struct sab_cmd_get_rnd_msg));
 		cmd.rng_handle = rng_hdl;
-		cmd.rnd_addr = (uint32_t)seco_os_abs_data_buf(serv_ptr->session->phdl,
-					args->output,
-					args->random_size,
-					0u);
+		cmd.rnd_addr = 0u;
+		seco_fill_data_buf(&bufs[0],
+				args->output,
+				args->random_size,
+				0u,
+				(uint32_t)offsetof(struct sab_cmd_get_rnd_msg, rnd_addr));
 		cmd.rnd_size = args->random_size;
 
 		/* Send the message to Seco. */
-		error = seco_send_msg_and_get_resp(serv_ptr->session->phdl,
+		error = seco_send_msg_with_bufs_and_get_resp(serv_ptr->session->phdl,
 			(uint32_t *)&cmd,
 			(uint32_t)sizeof(struct sab_cmd_get_rnd_msg),
 			(uint32_t *)&rsp,
-			(uint32_t)sizeof(struct sab_cmd_get_rnd_rsp));
+			(uint32_t)sizeof(struct sab_cmd_get_rnd_rsp),
+			bufs, 1u, 0u);
 		if (error != 0) {
 			break;
 		}
@@ -1359,6 +1700,7 @@ hsm_err_t hsm_open_hash_service(hsm_hdl_t session_hdl,
 			break;
 		}
 		serv_ptr->service_hdl = rsp.hash_hdl;
+		index_service(serv_ptr);
 		*hash_hdl = rsp.hash_hdl;
 	} while (false);
 
@@ -1404,6 +1746,7 @@ hsm_err_t hsm_hash_one_go(hsm_hdl_t hash_hdl, op_hash_one_go_args_t *args)
 {
 	struct sab_hash_one_go_msg cmd;
 	struct sab_hash_one_go_rsp rsp;
+	struct seco_os_abs_buf bufs[2];
 	int32_t error = 1;
 	struct hsm_service_hdl_s *serv_ptr;
 	hsm_err_t err = HSM_GENERAL_ERROR;
@@ -1425,28 +1768,30 @@ hsm_err_t hsm_hash_one_go(hsm_hdl_t hash_hdl, op_hash_one_go_args_t *args)
 			(uint32_t)sizeof(struct sab_hash_one_go_msg));
 
 		cmd.hash_hdl = hash_hdl;
-		cmd.input_addr = (uint32_t)seco_os_abs_data_buf(serv_ptr->session->phdl,
+		cmd.input_addr = 0u;
+		seco_fill_data_buf(&bufs[0],
 					args->input,
 					args->input_size,
-					DATA_BUF_IS_INPUT);
-		cmd.output_addr = (uint32_t)seco_os_abs_data_buf(serv_ptr->session->phdl,
+					DATA_BUF_IS_INPUT,
+					(uint32_t)offsetof(struct sab_hash_one_go_msg, input_addr));
+		cmd.output_addr = 0u;
+		seco_fill_data_buf(&bufs[1],
 					args->output,
 					args->output_size,
-					0u);
+					0u,
+					(uint32_t)offsetof(struct sab_hash_one_go_msg, output_addr));
 		cmd.input_size = args->input_size;
 		cmd.output_size = args->output_size;
 		cmd.algo = args->algo;
 		cmd.flags = args->flags;
 		cmd.reserved = 0u;
-		cmd.crc = 0u;
-		cmd.crc = seco_compute_msg_crc((uint32_t*)&cmd,
-				(uint32_t)(sizeof(cmd) - sizeof(uint32_t)));
 		/* Send the message to Seco. */
-		error = seco_send_msg_and_get_resp(serv_ptr->session->phdl,
+		error = seco_send_msg_with_bufs_and_get_resp(serv_ptr->session->phdl,
 			(uint32_t *)&cmd,
 			(uint32_t)sizeof(struct sab_hash_one_go_msg),
 			(uint32_t *)&rsp,
-			(uint32_t)sizeof(struct sab_hash_one_go_rsp));
+			(uint32_t)sizeof(struct sab_hash_one_go_rsp),
+			bufs, 2u, MU_TRANSACTION_CMD_CRC);
 		if (error != 0) {
 			break;
 		}
@@ -1462,6 +1807,7 @@ hsm_err_t hsm_pub_key_reconstruction(hsm_hdl_t session_hdl,
 {
 	struct sab_public_key_reconstruct_msg cmd;
 	struct sab_public_key_reconstruct_rsp rsp;
+	struct seco_os_abs_buf bufs[4];
 	int32_t error = 1;
 	struct hsm_session_hdl_s *sess_ptr;
 	hsm_err_t err = HSM_GENERAL_ERROR;
@@ -1479,25 +1825,33 @@ hsm_err_t hsm_pub_key_reconstruction(hsm_hdl_t session_hdl,
 			(uint32_t)sizeof(struct sab_public_key_reconstruct_msg));
 		cmd.sesssion_handle = session_hdl;
 		cmd.pu_address_ext = 0u;
-		cmd.pu_address = (uint32_t)seco_os_abs_data_buf(sess_ptr->phdl,
+		cmd.pu_address = 0u;
+		seco_fill_data_buf(&bufs[0],
 					args->pub_rec,
 					args->pub_rec_size,
-					DATA_BUF_IS_INPUT);
+					DATA_BUF_IS_INPUT,
+					(uint32_t)offsetof(struct sab_public_key_reconstruct_msg, pu_address));
 		cmd.hash_address_ext = 0u;
-		cmd.hash_address = (uint32_t)seco_os_abs_data_buf(sess_ptr->phdl,
+		cmd.hash_address = 0u;
+		seco_fill_data_buf(&bufs[1],
 					args->hash,
 					args->hash_size,
-					DATA_BUF_IS_INPUT);
+					DATA_BUF_IS_INPUT,
+					(uint32_t)offsetof(struct sab_public_key_reconstruct_msg, hash_address));
 		cmd.ca_key_address_ext = 0u;
-		cmd.ca_key_address = (uint32_t)seco_os_abs_data_buf(sess_ptr->phdl,
+		cmd.ca_key_address = 0u;
+		seco_fill_data_buf(&bufs[2],
 					args->ca_key,
 					args->ca_key_size,
-					DATA_BUF_IS_INPUT);
+					DATA_BUF_IS_INPUT,
+					(uint32_t)offsetof(struct sab_public_key_reconstruct_msg, ca_key_address));
 		cmd.out_key_address_ext = 0u;
-		cmd.out_key_address = (uint32_t)seco_os_abs_data_buf(sess_ptr->phdl,
+		cmd.out_key_address = 0u;
+		seco_fill_data_buf(&bufs[3],
 					args->out_key,
 					args->out_key_size,
-					0u);
+					0u,
+					(uint32_t)offsetof(struct sab_public_key_reconstruct_msg, out_key_address));
 		cmd.pu_size = args->pub_rec_size;
 		cmd.hash_size = args->hash_size;
 		cmd.ca_key_size = args->ca_key_size;
@@ -1505,16 +1859,14 @@ hsm_err_t hsm_pub_key_reconstruction(hsm_hdl_t session_hdl,
 		cmd.key_type = args->key_type;
 		cmd.flags = args->flags;
 		cmd.rsv = 0u;
-		cmd.crc = 0u;
-		cmd.crc = seco_compute_msg_crc((uint32_t*)&cmd,
-				(uint32_t)(sizeof(cmd) - sizeof(uint32_t)));
 
 		/* Send the message to Seco. */
-		error = seco_send_msg_and_get_resp(sess_ptr->phdl,
+		error = seco_send_msg_with_bufs_and_get_resp(sess_ptr->phdl,
 			(uint32_t *)&cmd,
 			(uint32_t)sizeof(struct sab_public_key_reconstruct_msg),
 			(uint32_t *)&rsp,
-			(uint32_t)sizeof(struct sab_public_key_reconstruct_rsp));
+			(uint32_t)sizeof(struct sab_public_key_reconstruct_rsp),
+			bufs, 4u, MU_TRANSACTION_CMD_CRC);
 		if (error != 0) {
 			break;
 		}
@@ -1530,6 +1882,7 @@ hsm_err_t hsm_pub_key_decompression(hsm_hdl_t session_hdl,
 {
 	struct sab_public_key_decompression_msg cmd;
 	struct sab_public_key_decompression_rsp rsp;
+	struct seco_os_abs_buf bufs[2];
 	int32_t error = 1;
 	struct hsm_session_hdl_s *sess_ptr;
 	hsm_err_t err = HSM_GENERAL_ERROR;
@@ -1547,30 +1900,32 @@ hsm_err_t hsm_pub_key_decompression(hsm_hdl_t session_hdl,
 			(uint32_t)sizeof(struct sab_public_key_decompression_msg));
 		cmd.sesssion_handle = session_hdl;
 		cmd.input_address_ext = 0u;
-		cmd.input_address = (uint32_t)seco_os_abs_data_buf(sess_ptr->phdl,
+		cmd.input_address = 0u;
+		seco_fill_data_buf(&bufs[0],
 					args->key,
 					args->key_size,
-					DATA_BUF_IS_INPUT);
+					DATA_BUF_IS_INPUT,
+					(uint32_t)offsetof(struct sab_public_key_decompression_msg, input_address));
 		cmd.output_address_ext = 0u;
-		cmd.output_address = (uint32_t)seco_os_abs_data_buf(sess_ptr->phdl,
+		cmd.output_address = 0u;
+		seco_fill_data_buf(&bufs[1],
 					args->out_key,
 					args->out_key_size,
-					0u);
+					0u,
+					(uint32_t)offsetof(struct sab_public_key_decompression_msg, output_address));
 		cmd.input_size = args->key_size;
 		cmd.out_size = args->out_key_size;
 		cmd.key_type = args->key_type;
 		cmd.flags = args->flags;
 		cmd.rsv = 0u;
-		cmd.crc = 0u;
-		cmd.crc = seco_compute_msg_crc((uint32_t*)&cmd,
-				(uint32_t)(sizeof(cmd) - sizeof(uint32_t)));
 
 		/* Send the message to Seco. */
-		error = seco_send_msg_and_get_resp(sess_ptr->phdl,
+		error = seco_send_msg_with_bufs_and_get_resp(sess_ptr->phdl,
 			(uint32_t *)&cmd,
 			(uint32_t)sizeof(struct sab_public_key_decompression_msg),
 			(uint32_t *)&rsp,
-			(uint32_t)sizeof(struct sab_public_key_decompression_rsp));
+			(uint32_t)sizeof(struct sab_public_key_decompression_rsp),
+			bufs, 2u, MU_TRANSACTION_CMD_CRC);
 		if (error != 0) {
 			break;
 		}
@@ -1585,6 +1940,7 @@ hsm_err_t hsm_ecies_encryption(hsm_hdl_t session_hdl, hsm_op_ecies_enc_args_t *a
 {
 	struct sab_cmd_ecies_encrypt_msg cmd;
 	struct sab_cmd_ecies_encrypt_rsp rsp;
+	struct seco_os_abs_buf bufs[5];
 	int32_t error = 1;
 	struct hsm_session_hdl_s *sess_ptr;
 	hsm_err_t err = HSM_GENERAL_ERROR;
@@ -1602,30 +1958,40 @@ hsm_err_t hsm_ecies_encryption(hsm_hdl_t session_hdl, hsm_op_ecies_enc_args_t *a
 			(uint32_t)sizeof(struct sab_cmd_ecies_encrypt_msg));
 		cmd.sesssion_handle = session_hdl;
 		cmd.input_addr_ext = 0u;
-		cmd.input_addr = (uint32_t)seco_os_abs_data_buf(sess_ptr->phdl,
+		cmd.input_addr = 0u;
+		seco_fill_data_buf(&bufs[0],
 					args->input,
 					args->input_size,
-					DATA_BUF_IS_INPUT);
+					DATA_BUF_IS_INPUT,
+					(uint32_t)offsetof(struct sab_cmd_ecies_encrypt_msg, input_addr));
 		cmd.key_addr_ext = 0u;
-		cmd.key_addr = (uint32_t)seco_os_abs_data_buf(sess_ptr->phdl,
+		cmd.key_addr = 0u;
+		seco_fill_data_buf(&bufs[1],
 					args->pub_key,
 					args->pub_key_size,
-					DATA_BUF_IS_INPUT);
+					DATA_BUF_IS_INPUT,
+					(uint32_t)offsetof(struct sab_cmd_ecies_encrypt_msg, key_addr));
 		cmd.p1_addr_ext = 0u;
-		cmd.p1_addr = (uint32_t)seco_os_abs_data_buf(sess_ptr->phdl,
+		cmd.p1_addr = 0u;
+		seco_fill_data_buf(&bufs[2],
 					args->p1,
 					args->p1_size,
-					DATA_BUF_IS_INPUT);
+					DATA_BUF_IS_INPUT,
+					(uint32_t)offsetof(struct sab_cmd_ecies_encrypt_msg, p1_addr));
 		cmd.p2_addr_ext = 0u;
-		cmd.p2_addr = (uint32_t)seco_os_abs_data_buf(sess_ptr->phdl,
+		cmd.p2_addr = 0u;
+		seco_fill_data_buf(&bufs[3],
 					args->p2,
 					args->p2_size,
-					DATA_BUF_IS_INPUT);
+					DATA_BUF_IS_INPUT,
+					(uint32_t)offsetof(struct sab_cmd_ecies_encrypt_msg, p2_addr));
 		cmd.output_addr_ext = 0u;
-		cmd.output_addr = (uint32_t)seco_os_abs_data_buf(sess_ptr->phdl,
+		cmd.output_addr = 0u;
+		seco_fill_data_buf(&bufs[4],
 					args->output,
 					args->out_size,
-					0u);
+					0u,
+					(uint32_t)offsetof(struct sab_cmd_ecies_encrypt_msg, output_addr));
 		cmd.input_size = args->input_size;
 		cmd.p1_size = args->p1_size;
 		cmd.p2_size = args->p2_size;
@@ -1635,16 +2001,14 @@ hsm_err_t hsm_ecies_encryption(hsm_hdl_t session_hdl, hsm_op_ecies_enc_args_t *a
 		cmd.key_type = args->key_type;
 		cmd.flags = args->flags;
 		cmd.reserved = 0u;
-		cmd.crc = 0u;
-		cmd.crc = seco_compute_msg_crc((uint32_t*)&cmd,
-				(uint32_t)(sizeof(cmd) - sizeof(uint32_t)));
 
 		/* Send the message to Seco. */
-		error = seco_send_msg_and_get_resp(sess_ptr->phdl,
+		error = seco_send_msg_with_bufs_and_get_resp(sess_ptr->phdl,
 			(uint32_t *)&cmd,
 			(uint32_t)sizeof(struct sab_cmd_ecies_encrypt_msg),
 			(uint32_t *)&rsp,
-			(uint32_t)sizeof(struct sab_cmd_ecies_encrypt_rsp));
+			(uint32_t)sizeof(struct sab_cmd_ecies_encrypt_rsp),
+			bufs, 5u, MU_TRANSACTION_CMD_CRC);
 		if (error != 0) {
 			break;
 		}
@@ -1659,6 +2023,7 @@ hsm_err_t hsm_pub_key_recovery(hsm_hdl_t key_store_hdl, hsm_op_pub_key_recovery_
 {
 	struct sab_cmd_pub_key_recovery_msg cmd;
 	struct sab_cmd_pub_key_recovery_rsp rsp;
+	struct seco_os_abs_buf bufs[1];
 	int32_t error = 1;
 	struct hsm_service_hdl_s *key_store_serv_ptr;
 	hsm_err_t err = HSM_GENERAL_ERROR;
@@ -1676,23 +2041,23 @@ hsm_err_t hsm_pub_key_recovery(hsm_hdl_t key_store_hdl, hsm_op_pub_key_recovery_
 		cmd.key_store_handle = key_store_hdl;
 		cmd.key_identifier = args->key_identifier;
 		cmd.out_key_addr_ext = 0u;
-		cmd.out_key_addr = (uint32_t)seco_os_abs_data_buf(key_store_serv_ptr->session->phdl,
-					args->out_key,
-					args->out_key_size,
-					0u);
+		cmd.out_key_addr = 0u;
+		seco_fill_data_buf(&bufs[0],
+				args->out_key,
+				args->out_key_size,
+				0u,
+				(uint32_t)offsetof(struct sab_cmd_pub_key_recovery_msg, out_key_addr));
 		cmd.out_key_size = args->out_key_size;
 		cmd.key_type = args->key_type;
 		cmd.flags = args->flags;
-		cmd.crc = 0u;
-		cmd.crc = seco_compute_msg_crc((uint32_t*)&cmd,
-				(uint32_t)(sizeof(cmd) - sizeof(uint32_t)));
 
 		/* Send the message to Seco. */
-		error = seco_send_msg_and_get_resp(key_store_serv_ptr->session->phdl,
+		error = seco_send_msg_with_bufs_and_get_resp(key_store_serv_ptr->session->phdl,
 			(uint32_t *)&cmd,
 			(uint32_t)sizeof(struct sab_cmd_pub_key_recovery_msg),
 			(uint32_t *)&rsp,
-			(uint32_t)sizeof(struct sab_cmd_pub_key_recovery_rsp));
+			(uint32_t)sizeof(struct sab_cmd_pub_key_recovery_rsp),
+			bufs, 1u, MU_TRANSACTION_CMD_CRC);
 		if (error != 0) {
 			break;
 		}
@@ -1760,6 +2125,7 @@ hsm_err_t hsm_open_data_storage_service(hsm_hdl_t key_store_hdl,
 		}
 
 		data_storage_serv_ptr->service_hdl = rsp.data_storage_handle;
+		index_service(data_storage_serv_ptr);
 		*data_storage_hdl = rsp.data_storage_handle;
 	} while (false);
 
@@ -1807,6 +2173,7 @@ hsm_err_t hsm_data_storage(hsm_hdl_t data_storage_hdl,
 {
 	struct sab_cmd_data_storage_msg cmd;
 	struct sab_cmd_data_storage_rsp rsp;
+	struct seco_os_abs_buf bufs[1];
 	int32_t error = 1;
 	struct hsm_service_hdl_s *serv_ptr;
 	hsm_err_t err = HSM_GENERAL_ERROR;
@@ -1826,24 +2193,24 @@ hsm_err_t hsm_data_storage(hsm_hdl_t data_storage_hdl,
 			SAB_DATA_STORAGE_REQ,
 			(uint32_t)sizeof(struct sab_cmd_data_storage_msg));
 		cmd.data_storage_handle = data_storage_hdl;
-		cmd.data_address = (uint32_t)seco_os_abs_data_buf(serv_ptr->session->phdl,
-					args->data,
-					args->data_size,
-					((args->flags & HSM_OP_DATA_STORAGE_FLAGS_STORE)? DATA_BUF_IS_INPUT : 0));
+		cmd.data_address = 0u;
+		seco_fill_data_buf(&bufs[0],
+				args->data,
+				args->data_size,
+				((args->flags & HSM_OP_DATA_STORAGE_FLAGS_STORE)? DATA_BUF_IS_INPUT : 0),
+				(uint32_t)offsetof(struct sab_cmd_data_storage_msg, data_address));
 		cmd.data_size = args->data_size;
 		cmd.data_id = args->data_id;
 		cmd.flags = args->flags;
 		cmd.rsv = 0u;
- 		cmd.crc = 0u;
-		cmd.crc = seco_compute_msg_crc((uint32_t*)&cmd,
-				(uint32_t)(sizeof(cmd) - sizeof(uint32_t)));
 
 		/* Send the message to Seco. */
-		error = seco_send_msg_and_get_resp(serv_ptr->session->phdl,
+		error = seco_send_msg_with_bufs_and_get_resp(serv_ptr->session->phdl,
 			(uint32_t *)&cmd,
 			(uint32_t)sizeof(struct sab_cmd_data_storage_msg),
 			(uint32_t *)&rsp,
-			(uint32_t)sizeof(struct sab_cmd_data_storage_rsp));
+			(uint32_t)sizeof(struct sab_cmd_data_storage_rsp),
+			bufs, 1u, MU_TRANSACTION_CMD_CRC);
 		if (error != 0) {
 			break;
 		}
@@ -1859,6 +2226,7 @@ hsm_err_t hsm_auth_enc(hsm_hdl_t cipher_hdl, op_auth_enc_args_t* args)
 {
 	struct sab_cmd_auth_enc_msg cmd;
 	struct sab_cmd_auth_enc_rsp rsp;
+	struct seco_os_abs_buf bufs[4];
 	struct hsm_service_hdl_s *serv_ptr;
 	hsm_err_t err = HSM_GENERAL_ERROR;
 	uint32_t sab_err = 1;
@@ -1881,36 +2249,45 @@ hsm_err_t hsm_auth_enc(hsm_hdl_t cipher_hdl, op_auth_enc_args_t* args)
 
 		cmd.cipher_handle = cipher_hdl;
 		cmd.key_id = args->key_identifier;
-		cmd.iv_address = (uint32_t)seco_os_abs_data_buf(serv_ptr->session->phdl,
-								args->iv, args->iv_size, DATA_BUF_IS_INPUT);
+		cmd.iv_address = 0u;
+		seco_fill_data_buf(&bufs[3],
+								args->iv,
+								args->iv_size,
+								DATA_BUF_IS_INPUT,
+								(uint32_t)offsetof(struct sab_cmd_auth_enc_msg, iv_address));
 		cmd.iv_size = args->iv_size;
-		cmd.aad_address = (uint32_t)seco_os_abs_data_buf(serv_ptr->session->phdl,
+		cmd.aad_address = 0u;
+		seco_fill_data_buf(&bufs[0],
 							args->aad,
 							args->aad_size,
-							DATA_BUF_IS_INPUT);
+							DATA_BUF_IS_INPUT,
+							(uint32_t)offsetof(struct sab_cmd_auth_enc_msg, aad_address));
 		cmd.aad_size = args->aad_size;
 		cmd.rsv = 0;
 		cmd.ae_algo = args->ae_algo;
 		cmd.flags = args->flags;
-		cmd.input_address = (uint32_t)seco_os_abs_data_buf(serv_ptr->session->phdl,
+		cmd.input_address = 0u;
+		seco_fill_data_buf(&bufs[1],
 							args->input,
 							args->input_size,
-							DATA_BUF_IS_INPUT);
-		cmd.output_address = (uint32_t)seco_os_abs_data_buf(serv_ptr->session->phdl,
+							DATA_BUF_IS_INPUT,
+							(uint32_t)offsetof(struct sab_cmd_auth_enc_msg, input_address));
+		cmd.output_address = 0u;
+		seco_fill_data_buf(&bufs[2],
 							args->output,
 							args->output_size,
-							0u);
+							0u,
+							(uint32_t)offsetof(struct sab_cmd_auth_enc_msg, output_address));
 		cmd.input_length = args->input_size;
 		cmd.output_length = args->output_size;
-		cmd.crc = seco_compute_msg_crc((uint32_t*)&cmd,
-				(uint32_t)(sizeof(cmd) - sizeof(uint32_t)));
 
 		/* Send the message to Seco. */
-		err = seco_send_msg_and_get_resp(serv_ptr->session->phdl,
+		err = seco_send_msg_with_bufs_and_get_resp(serv_ptr->session->phdl,
 			(uint32_t *)&cmd,
 			(uint32_t)sizeof(struct sab_cmd_auth_enc_msg),
 			(uint32_t *)&rsp,
-			(uint32_t)sizeof(struct sab_cmd_auth_enc_rsp));
+			(uint32_t)sizeof(struct sab_cmd_auth_enc_rsp),
+			bufs, 4u, MU_TRANSACTION_CMD_CRC);
 		if (err != 0) {
 			break;
 		}
@@ -1927,6 +2304,7 @@ hsm_err_t hsm_export_root_key_encryption_key (hsm_hdl_t session_hdl,
 {
 	struct sab_kik_export_msg cmd;
 	struct sab_kik_export_rsp rsp;
+	struct seco_os_abs_buf bufs[1];
 	struct hsm_session_hdl_s *sess_ptr;
 	hsm_err_t err = HSM_GENERAL_ERROR;
 
@@ -1949,20 +2327,23 @@ hsm_err_t hsm_export_root_key_encryption_key (hsm_hdl_t session_hdl,
 			SAB_KIK_EXPORT_REQ,
 			(uint32_t)sizeof(struct sab_kik_export_msg));
 		cmd.session_handle = session_hdl;
-		cmd.kik_address = (uint32_t)seco_os_abs_data_buf(sess_ptr->phdl,
-							args->out_root_kek,
-							args->root_kek_size,
-							0u);
+		cmd.kik_address = 0u;
+		seco_fill_data_buf(&bufs[0],
+				args->out_root_kek,
+				args->root_kek_size,
+				0u,
+				(uint32_t)offsetof(struct sab_kik_export_msg, kik_address));
 		cmd.flags = args->flags;
 		cmd.kik_size = args->root_kek_size;
 		cmd.reserved = 0u;
 
 
-		err = seco_send_msg_and_get_resp(sess_ptr->phdl,
+		err = seco_send_msg_with_bufs_and_get_resp(sess_ptr->phdl,
 			(uint32_t *)&cmd,
 			(uint32_t)sizeof(struct sab_kik_export_msg),
 			(uint32_t *)&rsp,
-			(uint32_t)sizeof(struct sab_kik_export_rsp));
+			(uint32_t)sizeof(struct sab_kik_export_rsp),
+			bufs, 1u, 0u);
 
 		if (err != 0) {
 			break;
@@ -2035,6 +2416,7 @@ hsm_err_t hsm_open_mac_service(hsm_hdl_t key_store_hdl,
 			delete_service(mac_serv_ptr);
 			break;
 		}
+		index_service(mac_serv_ptr);
 		*mac_hdl = mac_serv_ptr->service_hdl;
 	} while (false);
 
@@ -2070,6 +2452,7 @@ hsm_err_t hsm_mac_one_go(hsm_hdl_t mac_hdl, op_mac_one_go_args_t* args, hsm_mac_
 {
 	struct sab_cmd_mac_one_go_msg cmd;
     struct sab_cmd_mac_one_go_rsp rsp;
+    struct seco_os_abs_buf bufs[2];
 	struct hsm_service_hdl_s *serv_ptr;
 
 	hsm_err_t err = HSM_GENERAL_ERROR;
@@ -2092,33 +2475,37 @@ hsm_err_t hsm_mac_one_go(hsm_hdl_t mac_hdl, op_mac_one_go_args_t* args, hsm_mac_
         cmd.key_id = args->key_identifier;
         cmd.algorithm = args->algorithm;
         cmd.flags = args->flags;
-        cmd.payload_address = seco_os_abs_data_buf(serv_ptr->session->phdl, 
+        cmd.payload_address = 0u;
+        seco_fill_data_buf(&bufs[0],
 											args->payload, 
 											args->payload_size, 
-											DATA_BUF_IS_INPUT);
+											DATA_BUF_IS_INPUT,
+											(uint32_t)offsetof(struct sab_cmd_mac_one_go_msg, payload_address));
+        cmd.mac_address = 0u;
         if (args->flags & HSM_OP_MAC_ONE_GO_FLAGS_MAC_GENERATION) {
-            cmd.mac_address = seco_os_abs_data_buf(serv_ptr->session->phdl, 
+            seco_fill_data_buf(&bufs[1],
 											args->mac, 
 											args->mac_size, 
-											0u);
+											0u,
+											(uint32_t)offsetof(struct sab_cmd_mac_one_go_msg, mac_address));
         }
         else {
-            cmd.mac_address = seco_os_abs_data_buf(serv_ptr->session->phdl, 
+            seco_fill_data_buf(&bufs[1],
 											args->mac, 
 											args->mac_size, 
-											DATA_BUF_IS_INPUT);
+											DATA_BUF_IS_INPUT,
+											(uint32_t)offsetof(struct sab_cmd_mac_one_go_msg, mac_address));
         }
         cmd.payload_size = args->payload_size;
         cmd.mac_size = args->mac_size;
         cmd.rsv[0] = 0u;
         cmd.rsv[1] = 0u;
- 		cmd.crc = 0u;
-        cmd.crc = seco_compute_msg_crc((uint32_t*)&cmd, (uint32_t)(sizeof(cmd) - sizeof(uint32_t)));
 
         /* Send the message to Seco. */
-        err = seco_send_msg_and_get_resp(serv_ptr->session->phdl,
+        err = seco_send_msg_with_bufs_and_get_resp(serv_ptr->session->phdl,
                     (uint32_t *)&cmd, (uint32_t)sizeof(struct sab_cmd_mac_one_go_msg),
-                    (uint32_t *)&rsp, (uint32_t)sizeof(struct sab_cmd_mac_one_go_rsp));
+                    (uint32_t *)&rsp, (uint32_t)sizeof(struct sab_cmd_mac_one_go_rsp),
+                    bufs, 2u, MU_TRANSACTION_CMD_CRC);
         if (err != 0) {
             break;
         }
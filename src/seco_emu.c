@@ -0,0 +1,4054 @@
+/*
+ * Copyright 2019 NXP
+ *
+ * NXP Confidential.
+ * This software is owned or controlled by NXP and may only be used strictly
+ * in accordance with the applicable license terms.  By expressly accepting
+ * such terms or by downloading, installing, activating and/or otherwise using
+ * the software, you are agreeing that you have read, and that you agree to
+ * comply with and are bound by, such license terms.  If you do not agree to be
+ * bound by the applicable license terms, then you may not retain, install,
+ * activate or otherwise use the software.
+ */
+
+/*
+ * Software model of SECO and of the seco_mu kernel driver.
+ *
+ * Driver model: each opened MU channel owns a queue of incoming messages. Buffers
+ * declared with SECO_MU_IOCTL_SETUP_IOBUF are attached to the next message written
+ * on the channel and travel with it: SECO resolves the addresses of a command
+ * against the buffers attached to it, and they are released (outputs copied back
+ * to the user) when the response is read. A channel file descriptor is an eventfd
+ * counting the messages ready to be read, so it can be polled like the device.
+ *
+ * SECO model: a single emulated SECO core executes the commands of all channels in
+ * arrival order. Key stores and key groups are kept in memory and are written to
+ * the NVM through the storage manager with the same SAB exchanges as the firmware
+ * (master export, chunk export, chunk get), so the NVM manager is exercised too.
+ *
+ * Not emulated: public key reconstruction, butterfly key expansion, KIK export
+ * and import of wrapped keys. These commands are rejected with the
+ * CMD_NOT_SUPPORTED rating.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <openssl/core_names.h>
+#include <openssl/crypto.h>
+#include <openssl/ec.h>
+#include <openssl/evp.h>
+#include <openssl/objects.h>
+#include <openssl/param_build.h>
+#include <openssl/rand.h>
+#include "seco_os_abs.h"
+#include "seco_sab_msg_def.h"
+#include "seco_sab_messaging.h"
+#include "seco_mu_ioctl.h"
+#include "seco_utils.h"
+#include "seco_emu.h"
+
+#define EMU_NB_MU                   3u
+#define EMU_MAX_CHANNELS            32u
+#define EMU_MAX_MSG_WORDS           64u
+#define EMU_MAX_IOBUFS              16u
+#define EMU_CMD_DEPTH               8u      /* Commands queued per channel. */
+#define EMU_MAX_REG_BUFS            16u
+#define EMU_MAX_SESSIONS            32u
+#define EMU_MAX_SERVICES            128u
+#define EMU_MAX_KEY_STORES          8u
+#define EMU_MAX_GROUPS              128u
+#define EMU_MAX_GROUP_KEYS          64u
+#define EMU_MAX_RESIDENT_GROUPS     16u
+#define EMU_MAX_DATA                16u
+#define EMU_MAX_DATA_SIZE           1024u
+#define EMU_MAX_PUB_KEYS            16u
+#define EMU_MAX_BLOB_SIZE           (16u * 1024u - 16u)
+#define EMU_NVM_TIMEOUT_S           5
+
+/* Secure RAM of a MU, shared by the sessions opened on it by 2kB partitions. */
+#define EMU_SEC_RAM_SIZE            0x8000u
+#define EMU_SEC_RAM_PART_SIZE       0x800u
+#define EMU_SEC_RAM_BASE            0x20800000u
+/* Window of addresses given to buffers located in DDR. */
+#define EMU_DDR_BASE                0x80000000u
+#define EMU_DDR_WINDOW              0x10000000u
+#define EMU_REG_BASE                0x90000000u     /* Registered buffers. */
+#define EMU_REG_WINDOW              0x10000000u
+
+#define EMU_LIFECYCLE               0x0010u
+#define EMU_VERSION                 0x00030000u
+#define EMU_USER_SAB_ID             0x00000001u
+
+#define EMU_KEY_INFO_PERMANENT      (1u << 0)
+#define EMU_KEY_INFO_TRANSIENT      (1u << 1)
+
+#define EMU_KEY_FLAGS_UPDATE        (1u << 0)
+#define EMU_KEY_FLAGS_CREATE        (1u << 1)
+#define EMU_KEY_FLAGS_DELETE        (1u << 2)
+#define EMU_KEY_FLAGS_STRICT        (1u << 7)
+
+#define EMU_GROUP_FLAGS_LOCKDOWN    (1u << 0)
+#define EMU_GROUP_FLAGS_UNLOCK      (1u << 1)
+#define EMU_GROUP_FLAGS_DELETE      (1u << 2)
+#define EMU_GROUP_FLAGS_STRICT      (1u << 7)
+
+#define EMU_KEY_TYPE_AES_128        0x30u
+#define EMU_KEY_TYPE_AES_192        0x31u
+#define EMU_KEY_TYPE_AES_256        0x32u
+
+#define EMU_CIPHER_ALGO_CCM         0x04u
+#define EMU_CIPHER_FLAGS_ENCRYPT    0x01u
+#define EMU_MAC_FLAGS_GENERATION    0x01u
+#define EMU_MAC_ALGO_CMAC           0x01u
+#define EMU_SIG_FLAGS_INPUT_MESSAGE (1u << 0)
+#define EMU_SIG_FLAGS_KEY_INTERNAL  (1u << 2)
+#define EMU_SIG_VERIFICATION_OK     0x5A3CC3A5u
+#define EMU_DATA_FLAGS_STORE        (1u << 0)
+#define EMU_AEAD_TAG_SIZE           16u
+#define EMU_AEAD_IV_SIZE            12u
+
+/* SHE key slots: 16 IDs for each of the 5 key extensions. */
+#define EMU_SHE_NB_KEYS             80u
+#define EMU_SHE_SECRET_KEY          0x0u
+#define EMU_SHE_MASTER_ECU_KEY      0x1u
+#define EMU_SHE_RAM_KEY             0xEu
+#define EMU_SHE_FID_WRITE_PROT      0x10u
+#define EMU_SHE_FID_BOOT_PROT       0x08u
+#define EMU_SHE_FID_DEBUG_PROT      0x04u
+#define EMU_SHE_FID_KEY_USAGE       0x02u
+#define EMU_SHE_FID_WILDCARD        0x01u
+#define EMU_SHE_SREG_RND_INIT       0x20u
+#define EMU_SHE_UID_SIZE            15u
+#define EMU_SHE_KEY_SIZE            16u
+
+#define EMU_MASTER_MAGIC            0x4D4D4553u     /* "SEMM" */
+#define EMU_CHUNK_MAGIC             0x434D4553u     /* "SEMC" */
+#define EMU_BLOB_VERSION            1u
+
+#define EMU_ERR(rating)             (SAB_FAILURE_STATUS | ((uint32_t)(rating) << 8u))
+#define EMU_MSG(ctx, type)          ((type *)(void *)(ctx)->cmd)
+#define EMU_RSP(ctx, type)          ((type *)(void *)(ctx)->rsp)
+
+/* Buffer declared through SECO_MU_IOCTL_SETUP_IOBUF. */
+struct emu_iobuf {
+    uint8_t *user;
+    uint8_t *data;      /* Bounce copy for DDR buffers, location in secure RAM otherwise. */
+    uint32_t len;
+    uint32_t flags;
+    uint32_t addr;      /* Address seen by SECO. */
+};
+
+/* Buffer registered through SECO_MU_IOCTL_REGISTER_BUF, accessed in place. */
+struct emu_reg_buf {
+    uint8_t *user;
+    uint32_t len;
+    uint32_t addr;
+};
+
+struct emu_bufset {
+    uint32_t nb;
+    struct emu_iobuf buf[EMU_MAX_IOBUFS];
+};
+
+struct emu_msg {
+    struct emu_msg *next;
+    struct emu_chan *chan;
+    uint32_t gen;
+    struct emu_bufset *bufs;
+    uint32_t len;
+    uint32_t words[EMU_MAX_MSG_WORDS];
+};
+
+struct emu_chan {
+    uint8_t in_use;
+    uint8_t mu;
+    uint8_t cmd_rcv;
+    int32_t fd;
+    uint32_t gen;
+    struct emu_msg *head;
+    struct emu_msg *tail;
+    pthread_cond_t cond;
+    struct emu_bufset *pending;
+    uint32_t outstanding;       /* Commands written and not answered yet. */
+    struct emu_reg_buf reg[EMU_MAX_REG_BUFS];
+    uint32_t reg_next;
+    uint32_t ddr_next;
+    uint32_t shared_off;
+    uint32_t shared_size;
+    uint32_t shared_pos;
+};
+
+struct emu_session {
+    uint32_t hdl;
+    uint8_t mu;
+    int8_t part;
+    struct emu_chan *chan;
+};
+
+enum emu_svc_type {
+    EMU_SVC_RNG = 1,
+    EMU_SVC_KEY_STORE,
+    EMU_SVC_KEY_MGMT,
+    EMU_SVC_CIPHER,
+    EMU_SVC_MAC,
+    EMU_SVC_SIG_GEN,
+    EMU_SVC_SIG_VER,
+    EMU_SVC_HASH,
+    EMU_SVC_DATA_STORAGE,
+    EMU_SVC_SHE_UTILS,
+    EMU_SVC_STORAGE,
+};
+
+struct emu_svc {
+    uint32_t hdl;
+    uint8_t type;
+    struct emu_session *sess;
+    struct emu_key_store *ks;
+};
+
+struct emu_key {
+    uint32_t id;
+    uint8_t type;
+    uint16_t info;
+    uint16_t priv_len;
+    uint16_t pub_len;
+    uint8_t priv[48];
+    uint8_t pub[96];
+};
+
+struct emu_group {
+    uint16_t id;
+    uint8_t resident;
+    uint8_t dirty;
+    uint8_t locked;
+    uint8_t in_nvm;
+    uint8_t transient;
+    uint32_t lru;
+    uint32_t nb_keys;
+    uint32_t key_ids[EMU_MAX_GROUP_KEYS];
+    struct emu_key *keys;       /* Key material, only while the group is resident. */
+};
+
+struct emu_data {
+    uint16_t id;
+    uint16_t len;
+    uint8_t *buf;
+};
+
+struct emu_she_key {
+    uint8_t present;
+    uint8_t fid;
+    uint8_t plain;
+    uint32_t counter;
+    uint8_t key[EMU_SHE_KEY_SIZE];
+};
+
+struct emu_key_store {
+    uint8_t in_use;
+    uint8_t she;
+    uint32_t id;
+    uint32_t nonce;
+    uint16_t max_updates;
+    uint16_t nb_updates;
+    uint32_t next_key_id;
+    uint32_t nb_groups;
+    struct emu_group *groups[EMU_MAX_GROUPS];
+    struct emu_data data[EMU_MAX_DATA];
+    struct emu_she_key she_keys[EMU_SHE_NB_KEYS];
+};
+
+struct emu_pub_key {
+    uint32_t ref;
+    uint8_t type;
+    uint16_t len;
+    uint8_t key[96];
+};
+
+struct emu_mu {
+    uint8_t sec_ram[EMU_SEC_RAM_SIZE];
+    uint16_t parts_used;
+    uint16_t counter;
+    uint8_t sreg;
+    uint32_t lru_tick;
+    struct emu_chan *nvm_chan;
+    uint32_t storage_hdl;
+    struct emu_msg *nvm_rsp;
+    struct emu_key_store ks[EMU_MAX_KEY_STORES];
+    struct emu_pub_key pub_keys[EMU_MAX_PUB_KEYS];
+};
+
+/* Execution context of one command. */
+struct emu_ctx {
+    struct emu_mu *mu;
+    uint8_t mu_idx;
+    struct emu_chan *chan;
+    struct emu_bufset *bufs;
+    uint32_t *cmd;
+    uint32_t rsp[EMU_MAX_MSG_WORDS];
+};
+
+struct emu_cmd {
+    uint8_t id;
+    uint8_t rsp_len;
+    uint8_t crc;
+    uint32_t (*handler)(struct emu_ctx *ctx);
+};
+
+struct emu_latency {
+    uint8_t set;
+    uint32_t base_us;
+    uint32_t ns_per_byte;
+};
+
+struct emu_curve {
+    uint8_t type;
+    uint16_t size;
+    const char *name;
+    const char *md;
+};
+
+static const struct emu_curve emu_curves[] = {
+    {0x02u, 32u, "prime256v1", "SHA256"},
+    {0x03u, 48u, "secp384r1", "SHA384"},
+    {0x13u, 32u, "brainpoolP256r1", "SHA256"},
+    {0x15u, 48u, "brainpoolP384r1", "SHA384"},
+};
+
+static const uint8_t emu_uid[8] = {0x4E, 0x58, 0x50, 0x53, 0x45, 0x43, 0x4F, 0x01};
+
+static const uint8_t emu_she_enc_c[16] = {0x01, 0x01, 0x53, 0x48, 0x45, 0x00, 0x80, 0x00,
+                                          0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xB0};
+static const uint8_t emu_she_mac_c[16] = {0x01, 0x02, 0x53, 0x48, 0x45, 0x00, 0x80, 0x00,
+                                          0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xB0};
+
+static pthread_mutex_t emu_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t emu_seco_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t emu_nvm_cond;
+static pthread_once_t emu_once = PTHREAD_ONCE_INIT;
+static uint8_t emu_ready;
+
+static struct emu_chan emu_chans[EMU_MAX_CHANNELS];
+static struct emu_session emu_sessions[EMU_MAX_SESSIONS];
+static struct emu_svc emu_svcs[EMU_MAX_SERVICES];
+static struct emu_mu emu_mus[EMU_NB_MU];
+static struct emu_msg *emu_queue_head;
+static struct emu_msg *emu_queue_tail;
+static uint32_t emu_handle_seq;
+static struct emu_latency emu_latency_default;
+static struct emu_latency emu_latency[256];
+
+/*
+ * Generic helpers.
+ */
+
+static uint32_t emu_new_handle(void)
+{
+    uint32_t hdl;
+
+    do {
+        emu_handle_seq++;
+        hdl = emu_handle_seq * 0x9E3779B1u;
+    } while (hdl == 0u);
+
+    return hdl;
+}
+
+static uint32_t emu_align8(uint32_t v)
+{
+    return (v + 7u) & ~7u;
+}
+
+static void emu_unlock(void *arg)
+{
+    (void)arg;
+    (void)pthread_mutex_unlock(&emu_lock);
+}
+
+static void emu_sleep(uint64_t ns)
+{
+    struct timespec ts;
+
+    ts.tv_sec = (time_t)(ns / 1000000000u);
+    ts.tv_nsec = (long)(ns % 1000000000u);
+    while ((nanosleep(&ts, &ts) != 0) && (errno == EINTR)) {
+    }
+}
+
+static uint64_t emu_latency_ns(uint8_t cmd, const struct emu_bufset *bufs)
+{
+    const struct emu_latency *lat = (emu_latency[cmd].set != 0u) ? &emu_latency[cmd] : &emu_latency_default;
+    uint64_t bytes = 0u;
+    uint32_t i;
+
+    if (bufs != NULL) {
+        for (i = 0u; i < bufs->nb; i++) {
+            bytes += bufs->buf[i].len;
+        }
+    }
+    return ((uint64_t)lat->base_us * 1000u) + ((uint64_t)lat->ns_per_byte * bytes);
+}
+
+static void emu_be32(uint8_t *dst, uint32_t v)
+{
+    dst[0] = (uint8_t)(v >> 24);
+    dst[1] = (uint8_t)(v >> 16);
+    dst[2] = (uint8_t)(v >> 8);
+    dst[3] = (uint8_t)v;
+}
+
+/*
+ * Serialization of the blobs exported to the NVM.
+ */
+
+struct emu_wr {
+    uint8_t *buf;
+    uint32_t size;
+    uint32_t pos;
+    uint32_t err;
+};
+
+struct emu_rd {
+    const uint8_t *buf;
+    uint32_t size;
+    uint32_t pos;
+    uint32_t err;
+};
+
+static void emu_wr_bytes(struct emu_wr *w, const void *src, uint32_t len)
+{
+    if ((w->err == 0u) && (len <= w->size - w->pos)) {
+        (void)memcpy(w->buf + w->pos, src, len);
+        w->pos += len;
+    } else {
+        w->err = 1u;
+    }
+}
+
+static void emu_wr32(struct emu_wr *w, uint32_t v)
+{
+    emu_wr_bytes(w, &v, (uint32_t)sizeof(v));
+}
+
+static void emu_wr16(struct emu_wr *w, uint16_t v)
+{
+    emu_wr_bytes(w, &v, (uint32_t)sizeof(v));
+}
+
+static void emu_wr_pad(struct emu_wr *w)
+{
+    static const uint8_t zero[4];
+
+    emu_wr_bytes(w, zero, (4u - (w->pos & 3u)) & 3u);
+}
+
+static void emu_rd_bytes(struct emu_rd *r, void *dst, uint32_t len)
+{
+    if ((r->err == 0u) && (len <= r->size - r->pos)) {
+        if (dst != NULL) {
+            (void)memcpy(dst, r->buf + r->pos, len);
+        }
+        r->pos += len;
+    } else {
+        r->err = 1u;
+    }
+}
+
+static uint32_t emu_rd32(struct emu_rd *r)
+{
+    uint32_t v = 0u;
+
+    emu_rd_bytes(r, &v, (uint32_t)sizeof(v));
+    return v;
+}
+
+static uint16_t emu_rd16(struct emu_rd *r)
+{
+    uint16_t v = 0u;
+
+    emu_rd_bytes(r, &v, (uint32_t)sizeof(v));
+    return v;
+}
+
+static void emu_rd_pad(struct emu_rd *r)
+{
+    emu_rd_bytes(r, NULL, (4u - (r->pos & 3u)) & 3u);
+}
+
+/*
+ * Crypto primitives.
+ */
+
+static const EVP_CIPHER *emu_aes_cipher(uint32_t key_len, uint8_t mode)
+{
+    static const char *names[3][4] = {
+        {"AES-128-ECB", "AES-128-CBC", "AES-128-CCM", "AES-128-GCM"},
+        {"AES-192-ECB", "AES-192-CBC", "AES-192-CCM", "AES-192-GCM"},
+        {"AES-256-ECB", "AES-256-CBC", "AES-256-CCM", "AES-256-GCM"},
+    };
+    static EVP_CIPHER *ciphers[3][4];
+    uint32_t idx;
+
+    switch (key_len) {
+    case 16u:
+        idx = 0u;
+        break;
+    case 24u:
+        idx = 1u;
+        break;
+    case 32u:
+        idx = 2u;
+        break;
+    default:
+        return NULL;
+    }
+    if (ciphers[idx][mode] == NULL) {
+        ciphers[idx][mode] = EVP_CIPHER_fetch(NULL, names[idx][mode], NULL);
+    }
+    return ciphers[idx][mode];
+}
+
+#define EMU_AES_ECB     0u
+#define EMU_AES_CBC     1u
+#define EMU_AES_CCM     2u
+#define EMU_AES_GCM     3u
+
+/* AES ECB or CBC without padding. Return 0 on success. */
+static int32_t emu_aes(const uint8_t *key, uint32_t key_len, uint8_t mode, int32_t enc,
+                       const uint8_t *iv, const uint8_t *in, uint8_t *out, uint32_t len)
+{
+    const EVP_CIPHER *cipher = emu_aes_cipher(key_len, mode);
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+    int32_t ret = -1;
+    int l1 = 0;
+    int l2 = 0;
+
+    do {
+        if ((ctx == NULL) || (cipher == NULL)) {
+            break;
+        }
+        if ((EVP_CipherInit_ex(ctx, cipher, NULL, key, iv, enc) != 1)
+            || (EVP_CIPHER_CTX_set_padding(ctx, 0) != 1)) {
+            break;
+        }
+        if ((EVP_CipherUpdate(ctx, out, &l1, in, (int)len) != 1)
+            || (EVP_CipherFinal_ex(ctx, out + l1, &l2) != 1)) {
+            break;
+        }
+        ret = 0;
+    } while (false);
+
+    EVP_CIPHER_CTX_free(ctx);
+    return ret;
+}
+
+/* AES CCM or GCM with a 12 bytes IV and a 16 bytes tag. Return 0 on success. */
+static int32_t emu_aead(const uint8_t *key, uint32_t key_len, uint8_t mode, int32_t enc,
+                        const uint8_t *iv, const uint8_t *aad, uint32_t aad_len,
+                        const uint8_t *in, uint8_t *out, uint32_t len, uint8_t *tag)
+{
+    const EVP_CIPHER *cipher = emu_aes_cipher(key_len, mode);
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+    int32_t ret = -1;
+    int l = 0;
+
+    do {
+        if ((ctx == NULL) || (cipher == NULL)) {
+            break;
+        }
+        if ((EVP_CipherInit_ex(ctx, cipher, NULL, NULL, NULL, enc) != 1)
+            || (EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_IVLEN, (int)EMU_AEAD_IV_SIZE, NULL) != 1)) {
+            break;
+        }
+        if (((mode == EMU_AES_CCM) || (enc == 0))
+            && (EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, (int)EMU_AEAD_TAG_SIZE,
+                                    (enc == 0) ? tag : NULL) != 1)) {
+            break;
+        }
+        if (EVP_CipherInit_ex(ctx, NULL, NULL, key, iv, enc) != 1) {
+            break;
+        }
+        /* CCM needs the total length before any data. */
+        if ((mode == EMU_AES_CCM) && (EVP_CipherUpdate(ctx, NULL, &l, NULL, (int)len) != 1)) {
+            break;
+        }
+        if ((aad_len != 0u) && (EVP_CipherUpdate(ctx, NULL, &l, aad, (int)aad_len) != 1)) {
+            break;
+        }
+        if ((len != 0u) && (EVP_CipherUpdate(ctx, out, &l, in, (int)len) != 1)) {
+            break;
+        }
+        if ((mode == EMU_AES_GCM) && (EVP_CipherFinal_ex(ctx, out + len, &l) != 1)) {
+            break;
+        }
+        if ((enc != 0) && (EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, (int)EMU_AEAD_TAG_SIZE, tag) != 1)) {
+            break;
+        }
+        ret = 0;
+    } while (false);
+
+    EVP_CIPHER_CTX_free(ctx);
+    return ret;
+}
+
+/* AES CMAC. Return 0 on success. */
+static int32_t emu_cmac(const uint8_t *key, uint32_t key_len, const uint8_t *in, uint32_t len, uint8_t *mac)
+{
+    const char *cipher;
+    size_t out_len = 0u;
+
+    switch (key_len) {
+    case 16u:
+        cipher = "AES-128-CBC";
+        break;
+    case 24u:
+        cipher = "AES-192-CBC";
+        break;
+    case 32u:
+        cipher = "AES-256-CBC";
+        break;
+    default:
+        return -1;
+    }
+
+    if (EVP_Q_mac(NULL, "CMAC", NULL, cipher, NULL, key, key_len, in, len, mac, 16u, &out_len) == NULL) {
+        return -1;
+    }
+    return 0;
+}
+
+static const struct emu_curve *emu_curve_get(uint8_t type)
+{
+    uint32_t i;
+
+    for (i = 0u; i < (uint32_t)(sizeof(emu_curves) / sizeof(emu_curves[0])); i++) {
+        if (emu_curves[i].type == type) {
+            return &emu_curves[i];
+        }
+    }
+    return NULL;
+}
+
+/* Build an EC key from its raw components. pub is X||Y, priv is optional. */
+static EVP_PKEY *emu_ec_key(const struct emu_curve *curve, const uint8_t *priv, const uint8_t *pub)
+{
+    OSSL_PARAM_BLD *bld = OSSL_PARAM_BLD_new();
+    OSSL_PARAM *params = NULL;
+    EVP_PKEY_CTX *ctx = NULL;
+    EVP_PKEY *pkey = NULL;
+    BIGNUM *d = NULL;
+    uint8_t point[97];
+
+    do {
+        if (bld == NULL) {
+            break;
+        }
+        point[0] = 0x04u;
+        (void)memcpy(&point[1], pub, 2u * curve->size);
+        if ((OSSL_PARAM_BLD_push_utf8_string(bld, OSSL_PKEY_PARAM_GROUP_NAME, curve->name, 0u) != 1)
+            || (OSSL_PARAM_BLD_push_octet_string(bld, OSSL_PKEY_PARAM_PUB_KEY, point, 1u + 2u * curve->size) != 1)) {
+            break;
+        }
+        if (priv != NULL) {
+            d = BN_bin2bn(priv, (int)curve->size, NULL);
+            if ((d == NULL) || (OSSL_PARAM_BLD_push_BN(bld, OSSL_PKEY_PARAM_PRIV_KEY, d) != 1)) {
+                break;
+            }
+        }
+        params = OSSL_PARAM_BLD_to_param(bld);
+        ctx = EVP_PKEY_CTX_new_from_name(NULL, "EC", NULL);
+        if ((params == NULL) || (ctx == NULL) || (EVP_PKEY_fromdata_init(ctx) != 1)) {
+            break;
+        }
+        if (EVP_PKEY_fromdata(ctx, &pkey, (priv != NULL) ? EVP_PKEY_KEYPAIR : EVP_PKEY_PUBLIC_KEY, params) != 1) {
+            pkey = NULL;
+        }
+    } while (false);
+
+    EVP_PKEY_CTX_free(ctx);
+    OSSL_PARAM_free(params);
+    OSSL_PARAM_BLD_free(bld);
+    BN_clear_free(d);
+    return pkey;
+}
+
+/* Generate an EC key pair. priv receives d, pub receives X||Y. Return 0 on success. */
+static int32_t emu_ec_generate(const struct emu_curve *curve, uint8_t *priv, uint8_t *pub)
+{
+    EVP_PKEY *pkey = EVP_PKEY_Q_keygen(NULL, NULL, "EC", curve->name);
+    BIGNUM *d = NULL;
+    uint8_t point[97];
+    size_t len = 0u;
+    int32_t ret = -1;
+
+    do {
+        if (pkey == NULL) {
+            break;
+        }
+        if ((EVP_PKEY_get_bn_param(pkey, OSSL_PKEY_PARAM_PRIV_KEY, &d) != 1)
+            || (BN_bn2binpad(d, priv, (int)curve->size) != (int)curve->size)) {
+            break;
+        }
+        if ((EVP_PKEY_get_octet_string_param(pkey, OSSL_PKEY_PARAM_PUB_KEY, point, sizeof(point), &len) != 1)
+            || (len != 1u + 2u * curve->size)) {
+            break;
+        }
+        (void)memcpy(pub, &point[1], 2u * curve->size);
+        ret = 0;
+    } while (false);
+
+    BN_clear_free(d);
+    EVP_PKEY_free(pkey);
+    return ret;
+}
+
+/* Compute the digest used by an ECDSA scheme. Return its length or 0 on error. */
+static uint32_t emu_ec_digest(const struct emu_curve *curve, uint8_t flags, const uint8_t *msg, uint32_t len, uint8_t *dgst)
+{
+    uint32_t out_len = 0u;
+    unsigned int l = 0u;
+
+    if ((flags & EMU_SIG_FLAGS_INPUT_MESSAGE) != 0u) {
+        if (EVP_Digest(msg, len, dgst, &l, EVP_get_digestbyname(curve->md), NULL) == 1) {
+            out_len = l;
+        }
+    } else if (len <= 64u) {
+        (void)memcpy(dgst, msg, len);
+        out_len = len;
+    }
+    return out_len;
+}
+
+/* ECDSA signature in r||s format. Return 0 on success. */
+static int32_t emu_ec_sign(const struct emu_curve *curve, const struct emu_key *key, const uint8_t *dgst, uint32_t dgst_len, uint8_t *sig)
+{
+    EVP_PKEY *pkey = emu_ec_key(curve, key->priv, key->pub);
+    EVP_PKEY_CTX *ctx = NULL;
+    ECDSA_SIG *s = NULL;
+    const BIGNUM *r_bn;
+    const BIGNUM *s_bn;
+    const uint8_t *p;
+    uint8_t der[160];
+    size_t der_len = sizeof(der);
+    int32_t ret = -1;
+
+    do {
+        if (pkey == NULL) {
+            break;
+        }
+        ctx = EVP_PKEY_CTX_new(pkey, NULL);
+        if ((ctx == NULL) || (EVP_PKEY_sign_init(ctx) != 1)
+            || (EVP_PKEY_sign(ctx, der, &der_len, dgst, dgst_len) != 1)) {
+            break;
+        }
+        p = der;
+        s = d2i_ECDSA_SIG(NULL, &p, (long)der_len);
+        if (s == NULL) {
+            break;
+        }
+        ECDSA_SIG_get0(s, &r_bn, &s_bn);
+        if ((BN_bn2binpad(r_bn, sig, (int)curve->size) != (int)curve->size)
+            || (BN_bn2binpad(s_bn, sig + curve->size, (int)curve->size) != (int)curve->size)) {
+            break;
+        }
+        ret = 0;
+    } while (false);
+
+    ECDSA_SIG_free(s);
+    EVP_PKEY_CTX_free(ctx);
+    EVP_PKEY_free(pkey);
+    return ret;
+}
+
+/* ECDSA verification of a r||s signature. Return 1 if valid. */
+static int32_t emu_ec_verify(const struct emu_curve *curve, const uint8_t *pub, const uint8_t *dgst, uint32_t dgst_len, const uint8_t *sig)
+{
+    EVP_PKEY *pkey = emu_ec_key(curve, NULL, pub);
+    EVP_PKEY_CTX *ctx = NULL;
+    ECDSA_SIG *s = ECDSA_SIG_new();
+    BIGNUM *r_bn = BN_bin2bn(sig, (int)curve->size, NULL);
+    BIGNUM *s_bn = BN_bin2bn(sig + curve->size, (int)curve->size, NULL);
+    uint8_t *der = NULL;
+    int der_len;
+    int32_t ret = 0;
+
+    do {
+        if ((pkey == NULL) || (s == NULL) || (r_bn == NULL) || (s_bn == NULL)) {
+            break;
+        }
+        if (ECDSA_SIG_set0(s, r_bn, s_bn) != 1) {
+            break;
+        }
+        r_bn = NULL;
+        s_bn = NULL;
+        der_len = i2d_ECDSA_SIG(s, &der);
+        ctx = EVP_PKEY_CTX_new(pkey, NULL);
+        if ((der_len <= 0) || (ctx == NULL) || (EVP_PKEY_verify_init(ctx) != 1)) {
+            break;
+        }
+        ret = (EVP_PKEY_verify(ctx, der, (size_t)der_len, dgst, dgst_len) == 1) ? 1 : 0;
+    } while (false);
+
+    OPENSSL_free(der);
+    BN_free(r_bn);
+    BN_free(s_bn);
+    ECDSA_SIG_free(s);
+    EVP_PKEY_CTX_free(ctx);
+    EVP_PKEY_free(pkey);
+    return ret;
+}
+
+/* Recover Y from X and the lsb of Y. Return 0 on success. */
+static int32_t emu_ec_decompress(const struct emu_curve *curve, const uint8_t *x, uint8_t lsb, uint8_t *out)
+{
+    EC_GROUP *group = EC_GROUP_new_by_curve_name(OBJ_sn2nid(curve->name));
+    EC_POINT *point = NULL;
+    uint8_t buf[97];
+    int32_t ret = -1;
+
+    do {
+        if (group == NULL) {
+            break;
+        }
+        point = EC_POINT_new(group);
+        if (point == NULL) {
+            break;
+        }
+        buf[0] = (uint8_t)(0x02u | (lsb & 0x01u));
+        (void)memcpy(&buf[1], x, curve->size);
+        if (EC_POINT_oct2point(group, point, buf, 1u + curve->size, NULL) != 1) {
+            break;
+        }
+        if (EC_POINT_point2oct(group, point, POINT_CONVERSION_UNCOMPRESSED, buf, sizeof(buf), NULL)
+            != 1u + 2u * curve->size) {
+            break;
+        }
+        (void)memcpy(out, &buf[1], 2u * curve->size);
+        ret = 0;
+    } while (false);
+
+    EC_POINT_free(point);
+    EC_GROUP_free(group);
+    return ret;
+}
+
+/* ECDH shared secret (X coordinate). Return 0 on success. */
+static int32_t emu_ecdh(const struct emu_curve *curve, const uint8_t *priv, const uint8_t *priv_pub, const uint8_t *peer_pub, uint8_t *z)
+{
+    EVP_PKEY *key = emu_ec_key(curve, priv, priv_pub);
+    EVP_PKEY *peer = emu_ec_key(curve, NULL, peer_pub);
+    EVP_PKEY_CTX *ctx = NULL;
+    size_t len = curve->size;
+    int32_t ret = -1;
+
+    do {
+        if ((key == NULL) || (peer == NULL)) {
+            break;
+        }
+        ctx = EVP_PKEY_CTX_new(key, NULL);
+        if ((ctx == NULL) || (EVP_PKEY_derive_init(ctx) != 1) || (EVP_PKEY_derive_set_peer(ctx, peer) != 1)) {
+            break;
+        }
+        if ((EVP_PKEY_derive(ctx, z, &len) != 1) || (len != curve->size)) {
+            break;
+        }
+        ret = 0;
+    } while (false);
+
+    EVP_PKEY_CTX_free(ctx);
+    EVP_PKEY_free(peer);
+    EVP_PKEY_free(key);
+    return ret;
+}
+
+/*
+ * ECIES as used by IEEE 1609.2: KDF2 with SHA-256 over Z and P1 produces the
+ * XOR encryption key followed by a 32 bytes HMAC-SHA-256 key; the tag covers
+ * C || P2. Return 0 on success.
+ */
+static int32_t emu_ecies_keys(const uint8_t *z, uint32_t z_len, const uint8_t *p1, uint32_t p1_len, uint8_t *k, uint32_t k_len)
+{
+    EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+    uint8_t cnt[4];
+    uint8_t h[32];
+    uint32_t i;
+    uint32_t pos = 0u;
+    int32_t ret = 0;
+
+    for (i = 1u; (pos < k_len) && (ret == 0) && (ctx != NULL); i++) {
+        emu_be32(cnt, i);
+        if ((EVP_DigestInit_ex(ctx, EVP_sha256(), NULL) != 1)
+            || (EVP_DigestUpdate(ctx, z, z_len) != 1)
+            || (EVP_DigestUpdate(ctx, cnt, sizeof(cnt)) != 1)
+            || ((p1_len != 0u) && (EVP_DigestUpdate(ctx, p1, p1_len) != 1))
+            || (EVP_DigestFinal_ex(ctx, h, NULL) != 1)) {
+            ret = -1;
+            break;
+        }
+        (void)memcpy(k + pos, h, ((k_len - pos) < 32u) ? (k_len - pos) : 32u);
+        pos += 32u;
+    }
+    if (ctx == NULL) {
+        ret = -1;
+    }
+    EVP_MD_CTX_free(ctx);
+    return ret;
+}
+
+static int32_t emu_ecies_tag(const uint8_t *k_mac, const uint8_t *c, uint32_t c_len, const uint8_t *p2, uint32_t p2_len, uint8_t *tag)
+{
+    uint8_t *buf = malloc(c_len + p2_len + 1u);
+    size_t len = 0u;
+    int32_t ret = -1;
+
+    if (buf != NULL) {
+        (void)memcpy(buf, c, c_len);
+        if (p2_len != 0u) {
+            (void)memcpy(buf + c_len, p2, p2_len);
+        }
+        if (EVP_Q_mac(NULL, "HMAC", NULL, "SHA256", NULL, k_mac, 32u, buf, c_len + p2_len, tag, 32u, &len) != NULL) {
+            ret = 0;
+        }
+        free(buf);
+    }
+    return ret;
+}
+
+/*
+ * Device model.
+ */
+
+static void emu_bufs_free(struct emu_bufset *set, bool copy_back)
+{
+    struct emu_iobuf *b;
+    uint32_t i;
+
+    if (set != NULL) {
+        for (i = 0u; i < set->nb; i++) {
+            b = &set->buf[i];
+            if ((b->flags & SECO_MU_IO_FLAGS_REGISTERED) != 0u) {
+                /* Accessed in place. */
+                continue;
+            }
+            if ((copy_back) && ((b->flags & DATA_BUF_IS_INPUT) == 0u)) {
+                (void)memcpy(b->user, b->data, b->len);
+            }
+            if ((b->flags & DATA_BUF_USE_SEC_MEM) == 0u) {
+                free(b->data);
+            }
+        }
+        free(set);
+    }
+}
+
+static void emu_msg_free(struct emu_msg *msg)
+{
+    if (msg != NULL) {
+        emu_bufs_free(msg->bufs, false);
+        free(msg);
+    }
+}
+
+static struct emu_msg *emu_msg_alloc(const void *words, uint32_t len)
+{
+    struct emu_msg *msg = calloc(1u, sizeof(struct emu_msg));
+
+    if (msg != NULL) {
+        (void)memcpy(msg->words, words, len);
+        msg->len = len;
+    }
+    return msg;
+}
+
+static struct emu_chan *emu_fd_to_chan(int32_t fd)
+{
+    uint32_t i;
+
+    for (i = 0u; i < EMU_MAX_CHANNELS; i++) {
+        if ((emu_chans[i].in_use != 0u) && (emu_chans[i].fd == fd)) {
+            return &emu_chans[i];
+        }
+    }
+    return NULL;
+}
+
+/* Queue a message to be read from a channel. */
+static void emu_chan_post(struct emu_chan *chan, struct emu_msg *msg)
+{
+    uint64_t one = 1u;
+    ssize_t n;
+
+    msg->next = NULL;
+    if (chan->tail == NULL) {
+        chan->head = msg;
+    } else {
+        chan->tail->next = msg;
+    }
+    chan->tail = msg;
+    n = write(chan->fd, &one, sizeof(one));
+    (void)n;
+    (void)pthread_cond_broadcast(&chan->cond);
+}
+
+/* Resolve an address received by SECO in a command. */
+static uint8_t *emu_resolve(struct emu_mu *mu, struct emu_bufset *set, uint32_t addr, uint32_t len)
+{
+    struct emu_iobuf *b;
+    uint32_t i;
+
+    if (len == 0u) {
+        /* Nothing will be accessed. */
+        return mu->sec_ram;
+    }
+    if ((addr < EMU_SEC_RAM_SIZE) && (len <= EMU_SEC_RAM_SIZE - addr)) {
+        return &mu->sec_ram[addr];
+    }
+    if ((addr >= EMU_SEC_RAM_BASE) && (addr - EMU_SEC_RAM_BASE < EMU_SEC_RAM_SIZE)
+        && (len <= EMU_SEC_RAM_SIZE - (addr - EMU_SEC_RAM_BASE))) {
+        return &mu->sec_ram[addr - EMU_SEC_RAM_BASE];
+    }
+    if (set != NULL) {
+        for (i = 0u; i < set->nb; i++) {
+            b = &set->buf[i];
+            if (((b->flags & DATA_BUF_USE_SEC_MEM) == 0u) && (addr >= b->addr)
+                && (addr - b->addr < b->len) && (len <= b->len - (addr - b->addr))) {
+                return b->data + (addr - b->addr);
+            }
+        }
+    }
+    return NULL;
+}
+
+/* Find the registered area of a channel containing a buffer. */
+static struct emu_reg_buf *emu_reg_find(struct emu_chan *chan, const uint8_t *user, uint32_t len)
+{
+    struct emu_reg_buf *r;
+    uint32_t i;
+
+    for (i = 0u; i < EMU_MAX_REG_BUFS; i++) {
+        r = &chan->reg[i];
+        if ((r->user != NULL) && (user >= r->user) && (len <= r->len)
+            && ((uint32_t)(user - r->user) <= r->len - len)) {
+            return r;
+        }
+    }
+    return NULL;
+}
+
+static int32_t emu_register_buf(struct emu_chan *chan, struct seco_mu_ioctl_register_buf *reg)
+{
+    struct emu_reg_buf *r = NULL;
+    uint32_t i;
+
+    if ((reg->user_buf == NULL) || (reg->length == 0u) || (reg->length > EMU_REG_WINDOW)) {
+        errno = EINVAL;
+        return -1;
+    }
+    for (i = 0u; i < EMU_MAX_REG_BUFS; i++) {
+        if (chan->reg[i].user == NULL) {
+            r = &chan->reg[i];
+            break;
+        }
+    }
+    if (r == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    if (chan->reg_next + reg->length > EMU_REG_WINDOW) {
+        chan->reg_next = 0u;
+    }
+    r->user = reg->user_buf;
+    r->len = reg->length;
+    r->addr = EMU_REG_BASE + chan->reg_next;
+    chan->reg_next = emu_align8(chan->reg_next + reg->length);
+    reg->seco_addr = r->addr;
+
+    return 0;
+}
+
+static int32_t emu_unregister_buf(struct emu_chan *chan, struct seco_mu_ioctl_register_buf *reg)
+{
+    uint32_t i;
+
+    for (i = 0u; i < EMU_MAX_REG_BUFS; i++) {
+        if ((chan->reg[i].user != NULL) && (chan->reg[i].user == reg->user_buf)) {
+            (void)memset(&chan->reg[i], 0, sizeof(chan->reg[i]));
+            return 0;
+        }
+    }
+    errno = EINVAL;
+    return -1;
+}
+
+static int32_t emu_setup_iobuf(struct emu_chan *chan, struct seco_mu_ioctl_setup_iobuf *io)
+{
+    struct emu_mu *mu = &emu_mus[chan->mu];
+    struct emu_reg_buf *r;
+    struct emu_iobuf *b;
+    uint32_t off;
+
+    io->seco_addr = 0u;
+    if ((io->length == 0u) || (io->user_buf == NULL)) {
+        /* Nothing to map: only report where such a buffer would be in secure memory. */
+        if ((io->flags & DATA_BUF_USE_SEC_MEM) != 0u) {
+            off = chan->shared_off + emu_align8(chan->shared_pos);
+            io->seco_addr = ((io->flags & DATA_BUF_SHORT_ADDR) != 0u) ? off : (EMU_SEC_RAM_BASE + off);
+        }
+        return 0;
+    }
+    if (chan->pending == NULL) {
+        chan->pending = calloc(1u, sizeof(struct emu_bufset));
+        if (chan->pending == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+    }
+    if (chan->pending->nb >= EMU_MAX_IOBUFS) {
+        errno = ENOMEM;
+        return -1;
+    }
+    b = &chan->pending->buf[chan->pending->nb];
+
+    if ((io->flags & SECO_MU_IO_FLAGS_REGISTERED) != 0u) {
+        r = emu_reg_find(chan, io->user_buf, io->length);
+        if (r == NULL) {
+            errno = EINVAL;
+            return -1;
+        }
+        b->data = io->user_buf;
+        b->addr = r->addr + (uint32_t)(io->user_buf - r->user);
+    } else if ((io->flags & DATA_BUF_USE_SEC_MEM) != 0u) {
+        off = emu_align8(chan->shared_pos);
+        if ((chan->shared_size == 0u) || (off > chan->shared_size) || (io->length > chan->shared_size - off)) {
+            errno = ENOMEM;
+            return -1;
+        }
+        chan->shared_pos = off + io->length;
+        off += chan->shared_off;
+        b->data = &mu->sec_ram[off];
+        b->addr = ((io->flags & DATA_BUF_SHORT_ADDR) != 0u) ? off : (EMU_SEC_RAM_BASE + off);
+    } else {
+        b->data = calloc(1u, io->length);
+        if (b->data == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+        if (chan->ddr_next + io->length > EMU_DDR_WINDOW) {
+            chan->ddr_next = 0u;
+        }
+        b->addr = EMU_DDR_BASE + chan->ddr_next;
+        chan->ddr_next = emu_align8(chan->ddr_next + io->length);
+    }
+    if (((io->flags & DATA_BUF_IS_INPUT) != 0u) && (b->data != io->user_buf)) {
+        (void)memcpy(b->data, io->user_buf, io->length);
+    }
+    b->user = io->user_buf;
+    b->len = io->length;
+    b->flags = io->flags;
+    chan->pending->nb++;
+
+    io->seco_addr = b->addr;
+    return 0;
+}
+
+/*
+ * SECO model: sessions, services and key stores.
+ */
+
+static struct emu_session *emu_session_get(struct emu_ctx *ctx, uint32_t hdl)
+{
+    uint32_t i;
+
+    for (i = 0u; i < EMU_MAX_SESSIONS; i++) {
+        if ((hdl != 0u) && (emu_sessions[i].hdl == hdl) && (emu_sessions[i].mu == ctx->mu_idx)) {
+            return &emu_sessions[i];
+        }
+    }
+    return NULL;
+}
+
+static struct emu_svc *emu_svc_get(struct emu_ctx *ctx, uint32_t hdl, uint8_t type)
+{
+    uint32_t i;
+
+    for (i = 0u; i < EMU_MAX_SERVICES; i++) {
+        if ((hdl != 0u) && (emu_svcs[i].hdl == hdl) && (emu_svcs[i].type == type)
+            && (emu_svcs[i].sess->mu == ctx->mu_idx)) {
+            return &emu_svcs[i];
+        }
+    }
+    return NULL;
+}
+
+static struct emu_svc *emu_svc_new(struct emu_session *sess, uint8_t type, struct emu_key_store *ks)
+{
+    uint32_t i;
+
+    for (i = 0u; i < EMU_MAX_SERVICES; i++) {
+        if (emu_svcs[i].hdl == 0u) {
+            emu_svcs[i].hdl = emu_new_handle();
+            emu_svcs[i].type = type;
+            emu_svcs[i].sess = sess;
+            emu_svcs[i].ks = ks;
+            return &emu_svcs[i];
+        }
+    }
+    return NULL;
+}
+
+static void emu_svc_close(struct emu_svc *svc)
+{
+    struct emu_mu *mu = &emu_mus[svc->sess->mu];
+
+    if ((svc->type == EMU_SVC_STORAGE) && (mu->storage_hdl == svc->hdl)) {
+        mu->storage_hdl = 0u;
+        mu->nvm_chan = NULL;
+        (void)pthread_cond_broadcast(&emu_nvm_cond);
+    }
+    (void)memset(svc, 0, sizeof(struct emu_svc));
+}
+
+static void emu_session_close(struct emu_session *sess)
+{
+    uint32_t i;
+
+    for (i = 0u; i < EMU_MAX_SERVICES; i++) {
+        if ((emu_svcs[i].hdl != 0u) && (emu_svcs[i].sess == sess)) {
+            emu_svc_close(&emu_svcs[i]);
+        }
+    }
+    if (sess->part >= 0) {
+        emu_mus[sess->mu].parts_used &= (uint16_t)~(1u << (uint32_t)sess->part);
+    }
+    (void)memset(sess, 0, sizeof(struct emu_session));
+}
+
+static struct emu_key_store *emu_ks_find(struct emu_mu *mu, uint32_t id)
+{
+    uint32_t i;
+
+    for (i = 0u; i < EMU_MAX_KEY_STORES; i++) {
+        if ((mu->ks[i].in_use != 0u) && (mu->ks[i].id == id)) {
+            return &mu->ks[i];
+        }
+    }
+    return NULL;
+}
+
+static void emu_ks_clear(struct emu_key_store *ks)
+{
+    uint32_t i;
+
+    for (i = 0u; i < ks->nb_groups; i++) {
+        if (ks->groups[i] != NULL) {
+            if (ks->groups[i]->keys != NULL) {
+                OPENSSL_cleanse(ks->groups[i]->keys, EMU_MAX_GROUP_KEYS * sizeof(struct emu_key));
+            }
+            free(ks->groups[i]->keys);
+            free(ks->groups[i]);
+        }
+    }
+    for (i = 0u; i < EMU_MAX_DATA; i++) {
+        free(ks->data[i].buf);
+    }
+    OPENSSL_cleanse(ks, sizeof(struct emu_key_store));
+}
+
+/* Serialize all the key stores of a MU in the master blob. */
+static uint32_t emu_master_serialize(struct emu_mu *mu, struct emu_wr *w)
+{
+    struct emu_key_store *ks;
+    struct emu_group *g;
+    uint32_t nb_ks = 0u;
+    uint32_t nb;
+    uint32_t i, j, k;
+
+    for (i = 0u; i < EMU_MAX_KEY_STORES; i++) {
+        if (mu->ks[i].in_use != 0u) {
+            nb_ks++;
+        }
+    }
+    emu_wr32(w, EMU_MASTER_MAGIC);
+    emu_wr32(w, EMU_BLOB_VERSION);
+    emu_wr32(w, mu->counter);
+    emu_wr32(w, nb_ks);
+
+    for (i = 0u; i < EMU_MAX_KEY_STORES; i++) {
+        ks = &mu->ks[i];
+        if (ks->in_use == 0u) {
+            continue;
+        }
+        emu_wr32(w, ks->id);
+        emu_wr32(w, ks->nonce);
+        emu_wr16(w, ks->max_updates);
+        emu_wr16(w, ks->nb_updates);
+        emu_wr32(w, ks->next_key_id);
+        emu_wr32(w, ks->she);
+
+        /* Only the groups already written in the NVM are known after a reset. */
+        nb = 0u;
+        for (j = 0u; j < ks->nb_groups; j++) {
+            if ((ks->groups[j]->in_nvm != 0u) && (ks->groups[j]->transient == 0u)) {
+                nb++;
+            }
+        }
+        emu_wr32(w, nb);
+        for (j = 0u; j < ks->nb_groups; j++) {
+            g = ks->groups[j];
+            if ((g->in_nvm == 0u) || (g->transient != 0u)) {
+                continue;
+            }
+            emu_wr16(w, g->id);
+            emu_wr16(w, (uint16_t)g->nb_keys);
+            for (k = 0u; k < g->nb_keys; k++) {
+                emu_wr32(w, g->key_ids[k]);
+            }
+        }
+
+        nb = 0u;
+        for (j = 0u; j < EMU_MAX_DATA; j++) {
+            if (ks->data[j].buf != NULL) {
+                nb++;
+            }
+        }
+        emu_wr32(w, nb);
+        for (j = 0u; j < EMU_MAX_DATA; j++) {
+            if (ks->data[j].buf != NULL) {
+                emu_wr16(w, ks->data[j].id);
+                emu_wr16(w, ks->data[j].len);
+                emu_wr_bytes(w, ks->data[j].buf, ks->data[j].len);
+                emu_wr_pad(w);
+            }
+        }
+
+        if (ks->she != 0u) {
+            nb = 0u;
+            for (j = 0u; j < EMU_SHE_NB_KEYS; j++) {
+                if ((ks->she_keys[j].present != 0u) && ((j & 0xFu) != EMU_SHE_RAM_KEY)) {
+                    nb++;
+                }
+            }
+            emu_wr32(w, nb);
+            for (j = 0u; j < EMU_SHE_NB_KEYS; j++) {
+                if ((ks->she_keys[j].present != 0u) && ((j & 0xFu) != EMU_SHE_RAM_KEY)) {
+                    emu_wr16(w, (uint16_t)j);
+                    emu_wr16(w, ks->she_keys[j].fid);
+                    emu_wr32(w, ks->she_keys[j].counter);
+                    emu_wr_bytes(w, ks->she_keys[j].key, EMU_SHE_KEY_SIZE);
+                }
+            }
+        }
+    }
+    return w->err;
+}
+
+static uint32_t emu_master_parse(struct emu_mu *mu, const uint8_t *blob, uint32_t len)
+{
+    struct emu_rd r = {blob, len, 0u, 0u};
+    struct emu_key_store *ks;
+    struct emu_group *g;
+    uint32_t nb_ks, nb, slot;
+    uint32_t i, j, k;
+
+    if ((emu_rd32(&r) != EMU_MASTER_MAGIC) || (emu_rd32(&r) != EMU_BLOB_VERSION)) {
+        return 1u;
+    }
+    mu->counter = (uint16_t)emu_rd32(&r);
+    nb_ks = emu_rd32(&r);
+    if (nb_ks > EMU_MAX_KEY_STORES) {
+        return 1u;
+    }
+
+    for (i = 0u; (i < nb_ks) && (r.err == 0u); i++) {
+        ks = &mu->ks[i];
+        ks->in_use = 1u;
+        ks->id = emu_rd32(&r);
+        ks->nonce = emu_rd32(&r);
+        ks->max_updates = emu_rd16(&r);
+        ks->nb_updates = emu_rd16(&r);
+        ks->next_key_id = emu_rd32(&r);
+        ks->she = (uint8_t)emu_rd32(&r);
+
+        nb = emu_rd32(&r);
+        if (nb > EMU_MAX_GROUPS) {
+            r.err = 1u;
+        }
+        for (j = 0u; (j < nb) && (r.err == 0u); j++) {
+            g = calloc(1u, sizeof(struct emu_group));
+            if (g == NULL) {
+                r.err = 1u;
+                break;
+            }
+            ks->groups[ks->nb_groups++] = g;
+            g->id = emu_rd16(&r);
+            g->nb_keys = emu_rd16(&r);
+            g->in_nvm = 1u;
+            if (g->nb_keys > EMU_MAX_GROUP_KEYS) {
+                r.err = 1u;
+                break;
+            }
+            for (k = 0u; k < g->nb_keys; k++) {
+                g->key_ids[k] = emu_rd32(&r);
+            }
+        }
+
+        nb = emu_rd32(&r);
+        if (nb > EMU_MAX_DATA) {
+            r.err = 1u;
+        }
+        for (j = 0u; (j < nb) && (r.err == 0u); j++) {
+            ks->data[j].id = emu_rd16(&r);
+            ks->data[j].len = emu_rd16(&r);
+            if (ks->data[j].len > EMU_MAX_DATA_SIZE) {
+                r.err = 1u;
+                break;
+            }
+            ks->data[j].buf = malloc((ks->data[j].len != 0u) ? ks->data[j].len : 1u);
+            if (ks->data[j].buf == NULL) {
+                r.err = 1u;
+                break;
+            }
+            emu_rd_bytes(&r, ks->data[j].buf, ks->data[j].len);
+            emu_rd_pad(&r);
+        }
+
+        if (ks->she != 0u) {
+            nb = emu_rd32(&r);
+            for (j = 0u; (j < nb) && (r.err == 0u); j++) {
+                slot = emu_rd16(&r);
+                if (slot >= EMU_SHE_NB_KEYS) {
+                    r.err = 1u;
+                    break;
+                }
+                ks->she_keys[slot].present = 1u;
+                ks->she_keys[slot].fid = (uint8_t)emu_rd16(&r);
+                ks->she_keys[slot].counter = emu_rd32(&r);
+                emu_rd_bytes(&r, ks->she_keys[slot].key, EMU_SHE_KEY_SIZE);
+            }
+        }
+    }
+
+    if (r.err != 0u) {
+        for (i = 0u; i < EMU_MAX_KEY_STORES; i++) {
+            emu_ks_clear(&mu->ks[i]);
+        }
+    }
+    return r.err;
+}
+
+/*
+ * Exchanges with the storage manager of a MU.
+ */
+
+/* Send a request to the storage manager and wait for its response. Return 0 on success. */
+static uint32_t emu_nvm_request(struct emu_mu *mu, void *req, uint32_t req_len, void *rsp, uint32_t rsp_len, struct emu_bufset **bufs)
+{
+    struct emu_chan *chan = mu->nvm_chan;
+    struct emu_msg *msg;
+    struct timespec ts;
+    uint8_t cmd;
+    int32_t err = 0;
+    uint32_t ret = 1u;
+
+    do {
+        if ((chan == NULL) || (mu->storage_hdl == 0u)) {
+            break;
+        }
+        /* Time taken before sending the request, modelled only when set for its command. */
+        cmd = ((const struct sab_mu_hdr *)req)->command;
+        if (emu_latency[cmd].set != 0u) {
+            (void)pthread_mutex_unlock(&emu_lock);
+            emu_sleep(emu_latency_ns(cmd, NULL));
+            (void)pthread_mutex_lock(&emu_lock);
+            if (mu->nvm_chan != chan) {
+                break;
+            }
+        }
+        msg = emu_msg_alloc(req, req_len);
+        if (msg == NULL) {
+            break;
+        }
+        msg->bufs = *bufs;
+        *bufs = NULL;
+        emu_msg_free(mu->nvm_rsp);
+        mu->nvm_rsp = NULL;
+        emu_chan_post(chan, msg);
+
+        (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+        ts.tv_sec += EMU_NVM_TIMEOUT_S;
+        while ((mu->nvm_rsp == NULL) && (mu->nvm_chan == chan) && (err == 0)) {
+            err = pthread_cond_timedwait(&emu_nvm_cond, &emu_lock, &ts);
+        }
+
+        msg = mu->nvm_rsp;
+        mu->nvm_rsp = NULL;
+        if (msg == NULL) {
+            break;
+        }
+        if (msg->len == rsp_len) {
+            (void)memcpy(rsp, msg->words, rsp_len);
+            ret = 0u;
+        }
+        *bufs = msg->bufs;
+        msg->bufs = NULL;
+        emu_msg_free(msg);
+    } while (false);
+
+    return ret;
+}
+
+/* Export the master blob (chunk == false) or a chunk to the NVM. Return 0 on success. */
+static uint32_t emu_nvm_export(struct emu_mu *mu, const uint8_t *blob, uint32_t len, bool chunk, uint32_t blob_id, uint32_t blob_id_ext)
+{
+    struct sab_cmd_key_store_export_start_msg start_msg;
+    struct sab_cmd_key_store_export_start_rsp start_rsp;
+    struct sab_cmd_key_store_chunk_export_msg chunk_msg;
+    struct sab_cmd_key_store_chunk_export_rsp chunk_rsp;
+    struct sab_cmd_key_store_export_finish_msg finish_msg;
+    struct sab_cmd_key_store_export_finish_rsp finish_rsp;
+    struct emu_bufset *bufs = NULL;
+    uint32_t rsp_code;
+    uint32_t addr;
+    uint8_t *dst;
+    uint32_t ret = 1u;
+
+    do {
+        if (chunk) {
+            seco_fill_cmd_msg_hdr(&chunk_msg.hdr, SAB_STORAGE_CHUNK_EXPORT_REQ, (uint32_t)sizeof(chunk_msg));
+            chunk_msg.storage_handle = mu->storage_hdl;
+            chunk_msg.chunk_size = len;
+            chunk_msg.blob_id = blob_id;
+            chunk_msg.blob_id_ext = blob_id_ext;
+            chunk_msg.crc = seco_compute_msg_crc((uint32_t *)&chunk_msg, (uint32_t)(sizeof(chunk_msg) - sizeof(uint32_t)));
+            if (emu_nvm_request(mu, &chunk_msg, (uint32_t)sizeof(chunk_msg), &chunk_rsp, (uint32_t)sizeof(chunk_rsp), &bufs) != 0u) {
+                break;
+            }
+            rsp_code = chunk_rsp.rsp_code;
+            addr = chunk_rsp.chunk_export_address;
+        } else {
+            seco_fill_cmd_msg_hdr(&start_msg.hdr, SAB_STORAGE_MASTER_EXPORT_REQ, (uint32_t)sizeof(start_msg));
+            start_msg.storage_handle = mu->storage_hdl;
+            start_msg.key_store_size = len;
+            if (emu_nvm_request(mu, &start_msg, (uint32_t)sizeof(start_msg), &start_rsp, (uint32_t)sizeof(start_rsp), &bufs) != 0u) {
+                break;
+            }
+            rsp_code = start_rsp.rsp_code;
+            addr = start_rsp.key_store_export_address;
+        }
+        if (GET_STATUS_CODE(rsp_code) != SAB_SUCCESS_STATUS) {
+            /* The storage manager does not wait for the finish message in that case. */
+            break;
+        }
+
+        seco_fill_cmd_msg_hdr(&finish_msg.hdr, SAB_STORAGE_EXPORT_FINISH_REQ, (uint32_t)sizeof(finish_msg));
+        finish_msg.storage_handle = mu->storage_hdl;
+        finish_msg.export_status = 0u;
+        dst = emu_resolve(mu, bufs, addr, len);
+        if (dst != NULL) {
+            (void)memcpy(dst, blob, len);
+            finish_msg.export_status = SAB_EXPORT_STATUS_SUCCESS;
+        }
+        if (emu_nvm_request(mu, &finish_msg, (uint32_t)sizeof(finish_msg), &finish_rsp, (uint32_t)sizeof(finish_rsp), &bufs) != 0u) {
+            break;
+        }
+        if ((finish_msg.export_status == SAB_EXPORT_STATUS_SUCCESS)
+            && (GET_STATUS_CODE(finish_rsp.rsp_code) == SAB_SUCCESS_STATUS)) {
+            ret = 0u;
+        }
+    } while (false);
+
+    emu_bufs_free(bufs, false);
+    return ret;
+}
+
+/* Read a chunk from the NVM. The returned blob must be freed by the caller. Return 0 on success. */
+static uint32_t emu_nvm_get_chunk(struct emu_mu *mu, uint32_t blob_id, uint32_t blob_id_ext, uint8_t **blob, uint32_t *len)
+{
+    struct sab_cmd_key_store_chunk_get_msg get_msg;
+    struct sab_cmd_key_store_chunk_get_rsp get_rsp;
+    struct sab_cmd_key_store_chunk_get_done_msg done_msg;
+    struct sab_cmd_key_store_chunk_get_done_rsp done_rsp;
+    struct emu_bufset *bufs = NULL;
+    uint8_t *src;
+    uint32_t ret = 1u;
+
+    *blob = NULL;
+    do {
+        seco_fill_cmd_msg_hdr(&get_msg.hdr, SAB_STORAGE_CHUNK_GET_REQ, (uint32_t)sizeof(get_msg));
+        get_msg.storage_handle = mu->storage_hdl;
+        get_msg.blob_id = blob_id;
+        get_msg.blob_id_ext = blob_id_ext;
+        if (emu_nvm_request(mu, &get_msg, (uint32_t)sizeof(get_msg), &get_rsp, (uint32_t)sizeof(get_rsp), &bufs) != 0u) {
+            break;
+        }
+        if (GET_STATUS_CODE(get_rsp.rsp_code) != SAB_SUCCESS_STATUS) {
+            break;
+        }
+
+        seco_fill_cmd_msg_hdr(&done_msg.hdr, SAB_STORAGE_CHUNK_GET_DONE_REQ, (uint32_t)sizeof(done_msg));
+        done_msg.storage_handle = mu->storage_hdl;
+        done_msg.get_status = 0u;
+        src = emu_resolve(mu, bufs, get_rsp.chunk_addr, get_rsp.chunk_size);
+        if ((src != NULL) && (get_rsp.chunk_size <= EMU_MAX_BLOB_SIZE)) {
+            *blob = malloc((get_rsp.chunk_size != 0u) ? get_rsp.chunk_size : 1u);
+            if (*blob != NULL) {
+                (void)memcpy(*blob, src, get_rsp.chunk_size);
+                *len = get_rsp.chunk_size;
+                done_msg.get_status = SAB_CHUNK_GET_STATUS_SUCCEEDED;
+            }
+        }
+        if (emu_nvm_request(mu, &done_msg, (uint32_t)sizeof(done_msg), &done_rsp, (uint32_t)sizeof(done_rsp), &bufs) != 0u) {
+            break;
+        }
+        if (done_msg.get_status == SAB_CHUNK_GET_STATUS_SUCCEEDED) {
+            ret = 0u;
+        }
+    } while (false);
+
+    if (ret != 0u) {
+        free(*blob);
+        *blob = NULL;
+    }
+    emu_bufs_free(bufs, false);
+    return ret;
+}
+
+static uint32_t emu_master_export(struct emu_mu *mu)
+{
+    struct emu_wr w;
+    uint32_t ret = 1u;
+
+    w.buf = malloc(EMU_MAX_BLOB_SIZE);
+    w.size = EMU_MAX_BLOB_SIZE;
+    w.pos = 0u;
+    w.err = 0u;
+    if (w.buf != NULL) {
+        if (emu_master_serialize(mu, &w) == 0u) {
+            ret = emu_nvm_export(mu, w.buf, w.pos, false, 0u, 0u);
+        }
+        OPENSSL_cleanse(w.buf, w.size);
+        free(w.buf);
+    }
+    return ret;
+}
+
+/*
+ * Key groups: a group is either resident (key material in memory) or only
+ * available in the NVM as a chunk. At most EMU_MAX_RESIDENT_GROUPS groups are
+ * resident per MU, the least recently used one is evicted to load another.
+ */
+
+static uint32_t emu_group_export(struct emu_mu *mu, struct emu_key_store *ks, struct emu_group *g)
+{
+    struct emu_key *key;
+    struct emu_wr w;
+    uint32_t i;
+    uint32_t ret = 1u;
+
+    w.buf = malloc(EMU_MAX_BLOB_SIZE);
+    w.size = EMU_MAX_BLOB_SIZE;
+    w.pos = 0u;
+    w.err = 0u;
+    if (w.buf != NULL) {
+        emu_wr32(&w, EMU_CHUNK_MAGIC);
+        emu_wr32(&w, ks->id);
+        emu_wr16(&w, g->id);
+        emu_wr16(&w, (uint16_t)g->nb_keys);
+        for (i = 0u; i < g->nb_keys; i++) {
+            key = &g->keys[i];
+            emu_wr32(&w, key->id);
+            emu_wr16(&w, key->type);
+            emu_wr16(&w, key->info);
+            emu_wr16(&w, key->priv_len);
+            emu_wr16(&w, key->pub_len);
+            emu_wr_bytes(&w, key->priv, key->priv_len);
+            emu_wr_bytes(&w, key->pub, key->pub_len);
+            emu_wr_pad(&w);
+        }
+        if (w.err == 0u) {
+            ret = emu_nvm_export(mu, w.buf, w.pos, true, g->id, ks->id);
+        }
+        OPENSSL_cleanse(w.buf, w.size);
+        free(w.buf);
+    }
+    if (ret == 0u) {
+        g->dirty = 0u;
+        g->in_nvm = 1u;
+    }
+    return ret;
+}
+
+static uint32_t emu_group_parse(struct emu_key_store *ks, struct emu_group *g, const uint8_t *blob, uint32_t len)
+{
+    struct emu_rd r = {blob, len, 0u, 0u};
+    struct emu_key key;
+    uint32_t nb, i, j;
+    uint32_t found = 0u;
+
+    if ((emu_rd32(&r) != EMU_CHUNK_MAGIC) || (emu_rd32(&r) != ks->id) || (emu_rd16(&r) != g->id)) {
+        return 1u;
+    }
+    nb = emu_rd16(&r);
+    for (i = 0u; (i < nb) && (r.err == 0u); i++) {
+        (void)memset(&key, 0, sizeof(key));
+        key.id = emu_rd32(&r);
+        key.type = (uint8_t)emu_rd16(&r);
+        key.info = emu_rd16(&r);
+        key.priv_len = emu_rd16(&r);
+        key.pub_len = emu_rd16(&r);
+        if ((key.priv_len > sizeof(key.priv)) || (key.pub_len > sizeof(key.pub))) {
+            r.err = 1u;
+            break;
+        }
+        emu_rd_bytes(&r, key.priv, key.priv_len);
+        emu_rd_bytes(&r, key.pub, key.pub_len);
+        emu_rd_pad(&r);
+        for (j = 0u; j < g->nb_keys; j++) {
+            if (g->key_ids[j] == key.id) {
+                g->keys[j] = key;
+                found++;
+                break;
+            }
+        }
+    }
+    OPENSSL_cleanse(&key, sizeof(key));
+    return ((r.err == 0u) && (found == g->nb_keys)) ? 0u : 1u;
+}
+
+static uint32_t emu_resident_count(struct emu_mu *mu)
+{
+    uint32_t i, j;
+    uint32_t nb = 0u;
+
+    for (i = 0u; i < EMU_MAX_KEY_STORES; i++) {
+        for (j = 0u; j < mu->ks[i].nb_groups; j++) {
+            if (mu->ks[i].groups[j]->resident != 0u) {
+                nb++;
+            }
+        }
+    }
+    return nb;
+}
+
+/* Evict the least recently used group that can be, except keep. Return 0 on success. */
+static uint32_t emu_group_evict(struct emu_mu *mu, struct emu_group *keep)
+{
+    struct emu_key_store *victim_ks = NULL;
+    struct emu_group *victim = NULL;
+    struct emu_group *g;
+    uint32_t i, j;
+
+    for (i = 0u; i < EMU_MAX_KEY_STORES; i++) {
+        for (j = 0u; j < mu->ks[i].nb_groups; j++) {
+            g = mu->ks[i].groups[j];
+            if ((g == keep) || (g->resident == 0u) || (g->locked != 0u) || (g->transient != 0u)) {
+                continue;
+            }
+            if ((victim == NULL) || (g->lru < victim->lru)) {
+                victim = g;
+                victim_ks = &mu->ks[i];
+            }
+        }
+    }
+    if (victim == NULL) {
+        return 1u;
+    }
+    if ((victim->dirty != 0u) || (victim->in_nvm == 0u)) {
+        if (emu_group_export(mu, victim_ks, victim) != 0u) {
+            return 1u;
+        }
+    }
+    OPENSSL_cleanse(victim->keys, EMU_MAX_GROUP_KEYS * sizeof(struct emu_key));
+    free(victim->keys);
+    victim->keys = NULL;
+    victim->resident = 0u;
+    return 0u;
+}
+
+/* Make a group resident. Return a SAB response code. */
+static uint32_t emu_group_load(struct emu_mu *mu, struct emu_key_store *ks, struct emu_group *g)
+{
+    uint8_t *blob = NULL;
+    uint32_t len = 0u;
+    uint32_t ret = SAB_SUCCESS_STATUS;
+
+    do {
+        if (g->resident != 0u) {
+            break;
+        }
+        while (emu_resident_count(mu) >= EMU_MAX_RESIDENT_GROUPS) {
+            if (emu_group_evict(mu, g) != 0u) {
+                break;
+            }
+        }
+        if (emu_resident_count(mu) >= EMU_MAX_RESIDENT_GROUPS) {
+            ret = EMU_ERR(SAB_OUT_OF_MEMORY_RATING);
+            break;
+        }
+        g->keys = calloc(EMU_MAX_GROUP_KEYS, sizeof(struct emu_key));
+        if (g->keys == NULL) {
+            ret = EMU_ERR(SAB_OUT_OF_MEMORY_RATING);
+            break;
+        }
+        if ((g->in_nvm == 0u) || (emu_nvm_get_chunk(mu, g->id, ks->id, &blob, &len) != 0u)
+            || (emu_group_parse(ks, g, blob, len) != 0u)) {
+            free(g->keys);
+            g->keys = NULL;
+            ret = EMU_ERR(SAB_KEY_STORAGE_ERROR_RATING);
+            break;
+        }
+        g->resident = 1u;
+        g->dirty = 0u;
+    } while (false);
+
+    if (blob != NULL) {
+        OPENSSL_cleanse(blob, len);
+        free(blob);
+    }
+    if (ret == SAB_SUCCESS_STATUS) {
+        g->lru = ++mu->lru_tick;
+    }
+    return ret;
+}
+
+/* Find a group and make it resident, creating it if requested. Return a SAB response code. */
+static uint32_t emu_group_get(struct emu_mu *mu, struct emu_key_store *ks, uint16_t id, bool create, struct emu_group **group)
+{
+    struct emu_group *g = NULL;
+    uint32_t i;
+    uint32_t ret;
+
+    for (i = 0u; i < ks->nb_groups; i++) {
+        if (ks->groups[i]->id == id) {
+            g = ks->groups[i];
+            break;
+        }
+    }
+    if (g != NULL) {
+        ret = emu_group_load(mu, ks, g);
+    } else if (!create) {
+        ret = EMU_ERR(SAB_UNKNOWN_ID_RATING);
+    } else if (ks->nb_groups >= EMU_MAX_GROUPS) {
+        ret = EMU_ERR(SAB_OUT_OF_MEMORY_RATING);
+    } else {
+        while (emu_resident_count(mu) >= EMU_MAX_RESIDENT_GROUPS) {
+            if (emu_group_evict(mu, NULL) != 0u) {
+                break;
+            }
+        }
+        g = calloc(1u, sizeof(struct emu_group));
+        if (g != NULL) {
+            g->keys = calloc(EMU_MAX_GROUP_KEYS, sizeof(struct emu_key));
+        }
+        if ((g == NULL) || (g->keys == NULL) || (emu_resident_count(mu) >= EMU_MAX_RESIDENT_GROUPS)) {
+            if (g != NULL) {
+                free(g->keys);
+            }
+            free(g);
+            g = NULL;
+            ret = EMU_ERR(SAB_OUT_OF_MEMORY_RATING);
+        } else {
+            g->id = id;
+            g->resident = 1u;
+            g->lru = ++mu->lru_tick;
+            ks->groups[ks->nb_groups++] = g;
+            ret = SAB_SUCCESS_STATUS;
+        }
+    }
+    *group = g;
+    return ret;
+}
+
+/* Find a key by identifier, loading its group if needed. Return a SAB response code. */
+static uint32_t emu_key_find(struct emu_mu *mu, struct emu_key_store *ks, uint32_t id, struct emu_group **group, struct emu_key **key)
+{
+    struct emu_group *g;
+    uint32_t ret = EMU_ERR(SAB_UNKNOWN_ID_RATING);
+    uint32_t i, j;
+
+    *key = NULL;
+    for (i = 0u; (i < ks->nb_groups) && (*key == NULL); i++) {
+        g = ks->groups[i];
+        for (j = 0u; j < g->nb_keys; j++) {
+            if (g->key_ids[j] == id) {
+                ret = emu_group_load(mu, ks, g);
+                if (ret == SAB_SUCCESS_STATUS) {
+                    *key = &g->keys[j];
+                    if (group != NULL) {
+                        *group = g;
+                    }
+                }
+                break;
+            }
+        }
+        if (j < g->nb_keys) {
+            break;
+        }
+    }
+    return ret;
+}
+
+/* Write all updated groups then the master blob to the NVM. Return a SAB response code. */
+static uint32_t emu_ks_commit(struct emu_mu *mu, struct emu_key_store *ks)
+{
+    struct emu_group *g;
+    uint32_t i;
+
+    for (i = 0u; i < ks->nb_groups; i++) {
+        g = ks->groups[i];
+        if ((g->resident != 0u) && (g->transient == 0u) && ((g->dirty != 0u) || (g->in_nvm == 0u))) {
+            if (emu_group_export(mu, ks, g) != 0u) {
+                return EMU_ERR(SAB_NVM_ERROR_RATING);
+            }
+        }
+    }
+    mu->counter++;
+    ks->nb_updates++;
+    if (emu_master_export(mu) != 0u) {
+        return EMU_ERR(SAB_NVM_ERROR_RATING);
+    }
+    return SAB_SUCCESS_STATUS;
+}
+
+/* Get an AES key usable for an operation. SHE key usage is checked against mac. */
+static uint32_t emu_aes_key(struct emu_ctx *ctx, struct emu_key_store *ks, uint32_t key_id, bool mac, const uint8_t **key, uint32_t *key_len)
+{
+    struct emu_she_key *she;
+    struct emu_key *k;
+    uint32_t slot;
+    uint32_t ret;
+
+    if (ks->she != 0u) {
+        slot = ((key_id >> 4) & 0xFu) * 16u + (key_id & 0xFu);
+        if ((slot >= EMU_SHE_NB_KEYS) || ((key_id & 0xFu) < 4u) || ((key_id & 0xFu) > EMU_SHE_RAM_KEY)) {
+            return EMU_ERR(SAB_SHE_KEY_INVALID_RATING);
+        }
+        she = &ks->she_keys[slot];
+        if (she->present == 0u) {
+            return EMU_ERR(SAB_SHE_KEY_EMPTY_RATING);
+        }
+        if (((key_id & 0xFu) != EMU_SHE_RAM_KEY)
+            && (((she->fid & EMU_SHE_FID_KEY_USAGE) != 0u) != mac)) {
+            return EMU_ERR(SAB_SHE_KEY_INVALID_RATING);
+        }
+        *key = she->key;
+        *key_len = EMU_SHE_KEY_SIZE;
+        return SAB_SUCCESS_STATUS;
+    }
+
+    ret = emu_key_find(ctx->mu, ks, key_id, NULL, &k);
+    if (ret == SAB_SUCCESS_STATUS) {
+        if ((k->type < EMU_KEY_TYPE_AES_128) || (k->type > EMU_KEY_TYPE_AES_256)) {
+            ret = EMU_ERR(SAB_INVALID_PARAM_RATING);
+        } else {
+            *key = k->priv;
+            *key_len = k->priv_len;
+        }
+    }
+    return ret;
+}
+
+/*
+ * Command handlers. Each one returns the response code, other fields of the
+ * response are written in ctx->rsp which is cleared beforehand.
+ */
+
+static uint32_t emu_unsupported(struct emu_ctx *ctx)
+{
+    (void)ctx;
+    return EMU_ERR(SAB_CMD_NOT_SUPPORTED_RATING);
+}
+
+static uint32_t emu_session_open(struct emu_ctx *ctx)
+{
+    struct sab_cmd_session_open_rsp *rsp = EMU_RSP(ctx, struct sab_cmd_session_open_rsp);
+    uint32_t i;
+
+    for (i = 0u; i < EMU_MAX_SESSIONS; i++) {
+        if (emu_sessions[i].hdl == 0u) {
+            emu_sessions[i].hdl = emu_new_handle();
+            emu_sessions[i].mu = ctx->mu_idx;
+            emu_sessions[i].part = -1;
+            emu_sessions[i].chan = ctx->chan;
+            rsp->session_handle = emu_sessions[i].hdl;
+            return SAB_SUCCESS_STATUS;
+        }
+    }
+    return EMU_ERR(SAB_OUT_OF_MEMORY_RATING);
+}
+
+static uint32_t emu_session_close_cmd(struct emu_ctx *ctx)
+{
+    struct sab_cmd_session_close_msg *msg = EMU_MSG(ctx, struct sab_cmd_session_close_msg);
+    struct emu_session *sess = emu_session_get(ctx, msg->session_handle);
+
+    if (sess == NULL) {
+        return EMU_ERR(SAB_UNKNOWN_HANDLE_RATING);
+    }
+    emu_session_close(sess);
+    return SAB_SUCCESS_STATUS;
+}
+
+static uint32_t emu_shared_buf(struct emu_ctx *ctx)
+{
+    struct sab_cmd_shared_buffer_msg *msg = EMU_MSG(ctx, struct sab_cmd_shared_buffer_msg);
+    struct sab_cmd_shared_buffer_rsp *rsp = EMU_RSP(ctx, struct sab_cmd_shared_buffer_rsp);
+    struct emu_session *sess = emu_session_get(ctx, msg->session_handle);
+    uint32_t i;
+
+    if (sess == NULL) {
+        return EMU_ERR(SAB_UNKNOWN_HANDLE_RATING);
+    }
+    if (sess->part < 0) {
+        for (i = 0u; i < EMU_SEC_RAM_SIZE / EMU_SEC_RAM_PART_SIZE; i++) {
+            if ((ctx->mu->parts_used & (1u << i)) == 0u) {
+                ctx->mu->parts_used |= (uint16_t)(1u << i);
+                sess->part = (int8_t)i;
+                break;
+            }
+        }
+    }
+    if (sess->part < 0) {
+        return EMU_ERR(SAB_OUT_OF_MEMORY_RATING);
+    }
+    rsp->shared_buf_offset = (uint16_t)((uint32_t)sess->part * EMU_SEC_RAM_PART_SIZE);
+    rsp->shared_buf_size = (uint16_t)EMU_SEC_RAM_PART_SIZE;
+    return SAB_SUCCESS_STATUS;
+}
+
+static uint32_t emu_get_info(struct emu_ctx *ctx)
+{
+    struct sab_cmd_get_info_msg *msg = EMU_MSG(ctx, struct sab_cmd_get_info_msg);
+    struct sab_cmd_get_info_rsp *rsp = EMU_RSP(ctx, struct sab_cmd_get_info_rsp);
+
+    if (emu_session_get(ctx, msg->session_handle) == NULL) {
+        return EMU_ERR(SAB_UNKNOWN_HANDLE_RATING);
+    }
+    rsp->user_sab_id = EMU_USER_SAB_ID;
+    (void)memcpy(&rsp->uid_lower, &emu_uid[0], sizeof(uint32_t));
+    (void)memcpy(&rsp->uid_upper, &emu_uid[4], sizeof(uint32_t));
+    rsp->monotonic_counter = ctx->mu->counter;
+    rsp->lifecycle = EMU_LIFECYCLE;
+    rsp->version = EMU_VERSION;
+    rsp->version_ext = 0u;
+    rsp->fips_mode = 0u;
+    return SAB_SUCCESS_STATUS;
+}
+
+/* Open a service on a session (session_based) or on a key store. */
+static uint32_t emu_svc_open(struct emu_ctx *ctx, uint32_t parent, bool session_based, uint8_t type, uint32_t *hdl)
+{
+    struct emu_session *sess;
+    struct emu_svc *ks_svc;
+    struct emu_svc *svc;
+
+    if (session_based) {
+        sess = emu_session_get(ctx, parent);
+        if (sess == NULL) {
+            return EMU_ERR(SAB_UNKNOWN_HANDLE_RATING);
+        }
+        svc = emu_svc_new(sess, type, NULL);
+    } else {
+        ks_svc = emu_svc_get(ctx, parent, EMU_SVC_KEY_STORE);
+        if (ks_svc == NULL) {
+            return EMU_ERR(SAB_UNKNOWN_HANDLE_RATING);
+        }
+        svc = emu_svc_new(ks_svc->sess, type, ks_svc->ks);
+    }
+    if (svc == NULL) {
+        return EMU_ERR(SAB_OUT_OF_MEMORY_RATING);
+    }
+    *hdl = svc->hdl;
+    return SAB_SUCCESS_STATUS;
+}
+
+static uint32_t emu_svc_close_cmd(struct emu_ctx *ctx, uint8_t type)
+{
+    /* All the close messages carry the service handle in their first word. */
+    struct emu_svc *svc = emu_svc_get(ctx, ctx->cmd[1], type);
+
+    if (svc == NULL) {
+        return EMU_ERR(SAB_UNKNOWN_HANDLE_RATING);
+    }
+    emu_svc_close(svc);
+    return SAB_SUCCESS_STATUS;
+}
+
+static uint32_t emu_rng_open(struct emu_ctx *ctx)
+{
+    struct sab_cmd_rng_open_msg *msg = EMU_MSG(ctx, struct sab_cmd_rng_open_msg);
+    struct sab_cmd_rng_open_rsp *rsp = EMU_RSP(ctx, struct sab_cmd_rng_open_rsp);
+    uint32_t ret = emu_svc_open(ctx, msg->session_handle, true, EMU_SVC_RNG, &rsp->rng_handle);
+
+    if ((ret == SAB_SUCCESS_STATUS) && ((msg->flags & 0x1u) != 0u)) {
+        /* SHE RNG initialization. */
+        ctx->mu->sreg |= EMU_SHE_SREG_RND_INIT;
+    }
+    return ret;
+}
+
+static uint32_t emu_rng_close(struct emu_ctx *ctx)
+{
+    return emu_svc_close_cmd(ctx, EMU_SVC_RNG);
+}
+
+static uint32_t emu_rng_get_random(struct emu_ctx *ctx)
+{
+    struct sab_cmd_get_rnd_msg *msg = EMU_MSG(ctx, struct sab_cmd_get_rnd_msg);
+    uint8_t *out;
+
+    if (emu_svc_get(ctx, msg->rng_handle, EMU_SVC_RNG) == NULL) {
+        return EMU_ERR(SAB_UNKNOWN_HANDLE_RATING);
+    }
+    out = emu_resolve(ctx->mu, ctx->bufs, msg->rnd_addr, msg->rnd_size);
+    if (out == NULL) {
+        return EMU_ERR(SAB_INVALID_ADDRESS_RATING);
+    }
+    if ((msg->rnd_size != 0u) && (RAND_bytes(out, (int)msg->rnd_size) != 1)) {
+        return EMU_ERR(SAB_RNG_NOT_STARTED_RATING);
+    }
+    return SAB_SUCCESS_STATUS;
+}
+
+static uint32_t emu_rng_extend_seed(struct emu_ctx *ctx)
+{
+    struct sab_cmd_extend_seed_msg *msg = EMU_MSG(ctx, struct sab_cmd_extend_seed_msg);
+
+    if (emu_svc_get(ctx, msg->rng_handle, EMU_SVC_RNG) == NULL) {
+        return EMU_ERR(SAB_UNKNOWN_HANDLE_RATING);
+    }
+    RAND_add(msg->entropy, (int)sizeof(msg->entropy), 0.0);
+    return SAB_SUCCESS_STATUS;
+}
+
+static uint32_t emu_key_store_open(struct emu_ctx *ctx)
+{
+    struct sab_cmd_key_store_open_msg *msg = EMU_MSG(ctx, struct sab_cmd_key_store_open_msg);
+    struct sab_cmd_key_store_open_rsp *rsp = EMU_RSP(ctx, struct sab_cmd_key_store_open_rsp);
+    struct emu_session *sess = emu_session_get(ctx, msg->session_handle);
+    struct emu_key_store *ks;
+    struct emu_svc *svc;
+    uint32_t ret = SAB_SUCCESS_STATUS;
+    uint32_t i;
+
+    if (sess == NULL) {
+        return EMU_ERR(SAB_UNKNOWN_HANDLE_RATING);
+    }
+    ks = emu_ks_find(ctx->mu, msg->key_store_id);
+
+    if ((msg->flags & KEY_STORE_OPEN_FLAGS_CREATE) != 0u) {
+        if (ks != NULL) {
+            return EMU_ERR(SAB_ID_CONFLICT_RATING);
+        }
+        for (i = 0u; i < EMU_MAX_KEY_STORES; i++) {
+            if (ctx->mu->ks[i].in_use == 0u) {
+                ks = &ctx->mu->ks[i];
+                break;
+            }
+        }
+        if (ks == NULL) {
+            return EMU_ERR(SAB_OUT_OF_MEMORY_RATING);
+        }
+        ks->in_use = 1u;
+        ks->id = msg->key_store_id;
+        ks->nonce = msg->password;
+        ks->max_updates = msg->max_updates;
+        ks->she = ((msg->flags & KEY_STORE_OPEN_FLAGS_SHE) != 0u) ? 1u : 0u;
+        if (ks->she != 0u) {
+            /* A SHE storage is written in the NVM at creation. */
+            if (emu_master_export(ctx->mu) != 0u) {
+                emu_ks_clear(ks);
+                return EMU_ERR(SAB_NVM_ERROR_RATING);
+            }
+            /* Emulated part is in OEM open lifecycle: creation is allowed with a warning. */
+            ret = SAB_SUCCESS_STATUS | ((uint32_t)SAB_INVALID_LIFECYCLE_RATING << 8u);
+        }
+    } else {
+        if (ks == NULL) {
+            return EMU_ERR(SAB_UNKNOWN_KEY_STORE_RATING);
+        }
+        if (ks->nonce != msg->password) {
+            return EMU_ERR(SAB_KEY_STORE_AUTH_RATING);
+        }
+    }
+
+    svc = emu_svc_new(sess, EMU_SVC_KEY_STORE, ks);
+    if (svc == NULL) {
+        return EMU_ERR(SAB_OUT_OF_MEMORY_RATING);
+    }
+    rsp->key_store_handle = svc->hdl;
+    return ret;
+}
+
+static uint32_t emu_key_store_close(struct emu_ctx *ctx)
+{
+    return emu_svc_close_cmd(ctx, EMU_SVC_KEY_STORE);
+}
+
+static uint32_t emu_pub_key_recovery(struct emu_ctx *ctx)
+{
+    struct sab_cmd_pub_key_recovery_msg *msg = EMU_MSG(ctx, struct sab_cmd_pub_key_recovery_msg);
+    struct emu_svc *svc = emu_svc_get(ctx, msg->key_store_handle, EMU_SVC_KEY_STORE);
+    struct emu_key *key;
+    uint8_t *out;
+    uint32_t ret;
+
+    if (svc == NULL) {
+        return EMU_ERR(SAB_UNKNOWN_HANDLE_RATING);
+    }
+    ret = emu_key_find(ctx->mu, svc->ks, msg->key_identifier, NULL, &key);
+    if (ret != SAB_SUCCESS_STATUS) {
+        return ret;
+    }
+    if ((key->pub_len == 0u) || (msg->out_key_size < key->pub_len)) {
+        return EMU_ERR(SAB_INVALID_PARAM_RATING);
+    }
+    out = emu_resolve(ctx->mu, ctx->bufs, msg->out_key_addr, key->pub_len);
+    if (out == NULL) {
+        return EMU_ERR(SAB_INVALID_ADDRESS_RATING);
+    }
+    (void)memcpy(out, key->pub, key->pub_len);
+    return SAB_SUCCESS_STATUS;
+}
+
+static uint32_t emu_pub_key_decompression(struct emu_ctx *ctx)
+{
+    struct sab_public_key_decompression_msg *msg = EMU_MSG(ctx, struct sab_public_key_decompression_msg);
+    const struct emu_curve *curve = emu_curve_get(msg->key_type);
+    uint8_t *in;
+    uint8_t *out;
+
+    if (emu_session_get(ctx, msg->sesssion_handle) == NULL) {
+        return EMU_ERR(SAB_UNKNOWN_HANDLE_RATING);
+    }
+    if ((curve == NULL) || (msg->input_size != curve->size + 1u) || (msg->out_size < 2u * curve->size)) {
+        return EMU_ERR(SAB_INVALID_PARAM_RATING);
+    }
+    in = emu_resolve(ctx->mu, ctx->bufs, msg->input_address, msg->input_size);
+    out = emu_resolve(ctx->mu, ctx->bufs, msg->output_address, 2u * curve->size);
+    if ((in == NULL) || (out == NULL)) {
+        return EMU_ERR(SAB_INVALID_ADDRESS_RATING);
+    }
+    if (emu_ec_decompress(curve, in, in[curve->size], out) != 0) {
+        return EMU_ERR(SAB_INVALID_PARAM_RATING);
+    }
+    return SAB_SUCCESS_STATUS;
+}
+
+static uint32_t emu_ecies_encrypt(struct emu_ctx *ctx)
+{
+    struct sab_cmd_ecies_encrypt_msg *msg = EMU_MSG(ctx, struct sab_cmd_ecies_encrypt_msg);
+    const struct emu_curve *curve = emu_curve_get(msg->key_type);
+    uint8_t eph_priv[48];
+    uint8_t z[48];
+    uint8_t k[EMU_MAX_DATA_SIZE + 32u];
+    uint8_t tag[32];
+    uint8_t *in, *pub, *p1, *p2, *out;
+    uint32_t n, i;
+    uint32_t ret = EMU_ERR(SAB_INVALID_PARAM_RATING);
+
+    if (emu_session_get(ctx, msg->sesssion_handle) == NULL) {
+        return EMU_ERR(SAB_UNKNOWN_HANDLE_RATING);
+    }
+    if ((curve == NULL) || (msg->key_size != 2u * curve->size) || (msg->input_size > EMU_MAX_DATA_SIZE)
+        || (msg->mac_size > 32u) || (msg->output_size < 2u * curve->size + msg->input_size + msg->mac_size)) {
+        return ret;
+    }
+    n = curve->size;
+    in = emu_resolve(ctx->mu, ctx->bufs, msg->input_addr, msg->input_size);
+    pub = emu_resolve(ctx->mu, ctx->bufs, msg->key_addr, msg->key_size);
+    p1 = emu_resolve(ctx->mu, ctx->bufs, msg->p1_addr, msg->p1_size);
+    p2 = emu_resolve(ctx->mu, ctx->bufs, msg->p2_addr, msg->p2_size);
+    out = emu_resolve(ctx->mu, ctx->bufs, msg->output_addr, msg->output_size);
+    if ((in == NULL) || (pub == NULL) || (p1 == NULL) || (p2 == NULL) || (out == NULL)) {
+        return EMU_ERR(SAB_INVALID_ADDRESS_RATING);
+    }
+
+    /* V = ephemeral public key, C = M xor K1, T = HMAC(K2, C || P2). */
+    if ((emu_ec_generate(curve, eph_priv, out) == 0)
+        && (emu_ecdh(curve, eph_priv, out, pub, z) == 0)
+        && (emu_ecies_keys(z, n, p1, msg->p1_size, k, msg->input_size + 32u) == 0)) {
+        for (i = 0u; i < msg->input_size; i++) {
+            out[2u * n + i] = in[i] ^ k[i];
+        }
+        if (emu_ecies_tag(&k[msg->input_size], &out[2u * n], msg->input_size, p2, msg->p2_size, tag) == 0) {
+            (void)memcpy(&out[2u * n + msg->input_size], tag, msg->mac_size);
+            ret = SAB_SUCCESS_STATUS;
+        }
+    }
+    OPENSSL_cleanse(eph_priv, sizeof(eph_priv));
+    OPENSSL_cleanse(z, sizeof(z));
+    OPENSSL_cleanse(k, sizeof(k));
+    return ret;
+}
+
+static uint32_t emu_ecies_decrypt(struct emu_ctx *ctx)
+{
+    struct sab_cmd_ecies_decrypt_msg *msg = EMU_MSG(ctx, struct sab_cmd_ecies_decrypt_msg);
+    struct emu_svc *svc = emu_svc_get(ctx, msg->cipher_handle, EMU_SVC_CIPHER);
+    const struct emu_curve *curve = emu_curve_get(msg->key_type);
+    struct emu_key *key;
+    uint8_t z[48];
+    uint8_t k[EMU_MAX_DATA_SIZE + 32u];
+    uint8_t tag[32];
+    uint8_t *in, *p1, *p2, *out;
+    uint32_t n, c_len, i;
+    uint32_t ret;
+
+    if (svc == NULL) {
+        return EMU_ERR(SAB_UNKNOWN_HANDLE_RATING);
+    }
+    if ((curve == NULL) || (msg->mac_size > 32u) || (msg->input_size < 2u * curve->size + msg->mac_size)) {
+        return EMU_ERR(SAB_INVALID_PARAM_RATING);
+    }
+    n = curve->size;
+    c_len = msg->input_size - 2u * n - msg->mac_size;
+    if ((c_len > EMU_MAX_DATA_SIZE) || (msg->output_size < c_len)) {
+        return EMU_ERR(SAB_INVALID_PARAM_RATING);
+    }
+    ret = emu_key_find(ctx->mu, svc->ks, msg->key_id, NULL, &key);
+    if (ret != SAB_SUCCESS_STATUS) {
+        return ret;
+    }
+    if (key->type != msg->key_type) {
+        return EMU_ERR(SAB_INVALID_PARAM_RATING);
+    }
+    in = emu_resolve(ctx->mu, ctx->bufs, msg->input_address, msg->input_size);
+    p1 = emu_resolve(ctx->mu, ctx->bufs, msg->p1_addr, msg->p1_size);
+    p2 = emu_resolve(ctx->mu, ctx->bufs, msg->p2_addr, msg->p2_size);
+    out = emu_resolve(ctx->mu, ctx->bufs, msg->output_address, c_len);
+    if ((in == NULL) || (p1 == NULL) || (p2 == NULL) || (out == NULL)) {
+        return EMU_ERR(SAB_INVALID_ADDRESS_RATING);
+    }
+
+    ret = EMU_ERR(SAB_INVALID_PARAM_RATING);
+    if ((emu_ecdh(curve, key->priv, key->pub, in, z) == 0)
+        && (emu_ecies_keys(z, n, p1, msg->p1_size, k, c_len + 32u) == 0)
+        && (emu_ecies_tag(&k[c_len], &in[2u * n], c_len, p2, msg->p2_size, tag) == 0)
+        && (CRYPTO_memcmp(tag, &in[2u * n + c_len], msg->mac_size) == 0)) {
+        for (i = 0u; i < c_len; i++) {
+            out[i] = in[2u * n + i] ^ k[i];
+        }
+        ret = SAB_SUCCESS_STATUS;
+    }
+    OPENSSL_cleanse(z, sizeof(z));
+    OPENSSL_cleanse(k, sizeof(k));
+    return ret;
+}
+
+static uint32_t emu_key_mgmt_open(struct emu_ctx *ctx)
+{
+    struct sab_cmd_key_management_open_msg *msg = EMU_MSG(ctx, struct sab_cmd_key_management_open_msg);
+    struct sab_cmd_key_management_open_rsp *rsp = EMU_RSP(ctx, struct sab_cmd_key_management_open_rsp);
+
+    return emu_svc_open(ctx, msg->key_store_handle, false, EMU_SVC_KEY_MGMT, &rsp->key_management_handle);
+}
+
+static uint32_t emu_key_mgmt_close(struct emu_ctx *ctx)
+{
+    return emu_svc_close_cmd(ctx, EMU_SVC_KEY_MGMT);
+}
+
+static uint32_t emu_key_generate(struct emu_ctx *ctx)
+{
+    struct sab_cmd_generate_key_msg *msg = EMU_MSG(ctx, struct sab_cmd_generate_key_msg);
+    struct sab_cmd_generate_key_rsp *rsp = EMU_RSP(ctx, struct sab_cmd_generate_key_rsp);
+    struct emu_svc *svc = emu_svc_get(ctx, msg->key_management_handle, EMU_SVC_KEY_MGMT);
+    const struct emu_curve *curve = emu_curve_get(msg->key_type);
+    struct emu_group *g = NULL;
+    struct emu_key *dst = NULL;
+    struct emu_key key;
+    uint8_t transient = ((msg->key_info & EMU_KEY_INFO_TRANSIENT) != 0u) ? 1u : 0u;
+    uint8_t *out = NULL;
+    uint32_t ret;
+
+    if (svc == NULL) {
+        return EMU_ERR(SAB_UNKNOWN_HANDLE_RATING);
+    }
+    (void)memset(&key, 0, sizeof(key));
+    key.type = msg->key_type;
+    key.info = msg->key_info;
+    if (curve != NULL) {
+        key.priv_len = curve->size;
+        key.pub_len = (uint16_t)(2u * curve->size);
+    } else if ((msg->key_type >= EMU_KEY_TYPE_AES_128) && (msg->key_type <= EMU_KEY_TYPE_AES_256)) {
+        key.priv_len = (uint16_t)(16u + 8u * (msg->key_type - EMU_KEY_TYPE_AES_128));
+    } else {
+        return EMU_ERR(SAB_INVALID_PARAM_RATING);
+    }
+    if (key.pub_len != 0u) {
+        if (msg->out_size < key.pub_len) {
+            return EMU_ERR(SAB_INVALID_PARAM_RATING);
+        }
+        out = emu_resolve(ctx->mu, ctx->bufs, msg->out_key_addr, key.pub_len);
+        if (out == NULL) {
+            return EMU_ERR(SAB_INVALID_ADDRESS_RATING);
+        }
+    }
+
+    /* Locate the destination slot before generating anything. */
+    if ((msg->flags & EMU_KEY_FLAGS_CREATE) != 0u) {
+        ret = emu_group_get(ctx->mu, svc->ks, msg->key_group, true, &g);
+        if (ret != SAB_SUCCESS_STATUS) {
+            return ret;
+        }
+        if ((g->nb_keys != 0u) && (g->transient != transient)) {
+            /* Transient and persistent keys cannot share a group. */
+            return EMU_ERR(SAB_INVALID_PARAM_RATING);
+        }
+        if (g->nb_keys >= EMU_MAX_GROUP_KEYS) {
+            return EMU_ERR(SAB_OUT_OF_MEMORY_RATING);
+        }
+        key.id = ++svc->ks->next_key_id;
+    } else if ((msg->flags & EMU_KEY_FLAGS_UPDATE) != 0u) {
+        ret = emu_key_find(ctx->mu, svc->ks, msg->key_identifier, &g, &dst);
+        if (ret != SAB_SUCCESS_STATUS) {
+            return ret;
+        }
+        if ((dst->type != msg->key_type) || ((dst->info & EMU_KEY_INFO_PERMANENT) != 0u)) {
+            return EMU_ERR(SAB_INVALID_PARAM_RATING);
+        }
+        key.id = dst->id;
+        key.info = dst->info;
+    } else {
+        return EMU_ERR(SAB_INVALID_PARAM_RATING);
+    }
+
+    if (curve != NULL) {
+        if (emu_ec_generate(curve, key.priv, key.pub) != 0) {
+            return EMU_ERR(SAB_INVALID_PARAM_RATING);
+        }
+        (void)memcpy(out, key.pub, key.pub_len);
+    } else if (RAND_bytes(key.priv, key.priv_len) != 1) {
+        return EMU_ERR(SAB_RNG_NOT_STARTED_RATING);
+    }
+
+    if (dst == NULL) {
+        dst = &g->keys[g->nb_keys];
+        g->key_ids[g->nb_keys] = key.id;
+        g->nb_keys++;
+        g->transient = transient;
+    }
+    *dst = key;
+    OPENSSL_cleanse(&key, sizeof(key));
+    g->dirty = 1u;
+    rsp->key_identifier = dst->id;
+
+    if (((msg->flags & EMU_KEY_FLAGS_STRICT) != 0u) && (g->transient == 0u)) {
+        return emu_ks_commit(ctx->mu, svc->ks);
+    }
+    return SAB_SUCCESS_STATUS;
+}
+
+static uint32_t emu_manage_key(struct emu_ctx *ctx)
+{
+    struct sab_cmd_manage_key_msg *msg = EMU_MSG(ctx, struct sab_cmd_manage_key_msg);
+    struct sab_cmd_manage_key_rsp *rsp = EMU_RSP(ctx, struct sab_cmd_manage_key_rsp);
+    struct emu_svc *svc = emu_svc_get(ctx, msg->key_management_handle, EMU_SVC_KEY_MGMT);
+    struct emu_group *g;
+    struct emu_key *key;
+    uint32_t idx;
+    uint32_t ret;
+
+    if (svc == NULL) {
+        return EMU_ERR(SAB_UNKNOWN_HANDLE_RATING);
+    }
+    if ((msg->flags & EMU_KEY_FLAGS_DELETE) == 0u) {
+        /* Import of keys wrapped by a root KEK is not emulated. */
+        return EMU_ERR(SAB_CMD_NOT_SUPPORTED_RATING);
+    }
+
+    ret = emu_key_find(ctx->mu, svc->ks, msg->dest_key_identifier, &g, &key);
+    if (ret != SAB_SUCCESS_STATUS) {
+        return ret;
+    }
+    if ((key->info & EMU_KEY_INFO_PERMANENT) != 0u) {
+        return EMU_ERR(SAB_INVALID_PARAM_RATING);
+    }
+    idx = (uint32_t)(key - g->keys);
+    OPENSSL_cleanse(key, sizeof(struct emu_key));
+    g->nb_keys--;
+    if (idx < g->nb_keys) {
+        (void)memmove(&g->keys[idx], &g->keys[idx + 1u], (g->nb_keys - idx) * sizeof(struct emu_key));
+        (void)memmove(&g->key_ids[idx], &g->key_ids[idx + 1u], (g->nb_keys - idx) * sizeof(uint32_t));
+    }
+    g->dirty = 1u;
+    rsp->key_identifier = msg->dest_key_identifier;
+
+    if (((msg->flags & EMU_KEY_FLAGS_STRICT) != 0u) && (g->transient == 0u)) {
+        return emu_ks_commit(ctx->mu, svc->ks);
+    }
+    return SAB_SUCCESS_STATUS;
+}
+
+static uint32_t emu_manage_key_group(struct emu_ctx *ctx)
+{
+    struct sab_cmd_manage_key_group_msg *msg = EMU_MSG(ctx, struct sab_cmd_manage_key_group_msg);
+    struct emu_svc *svc = emu_svc_get(ctx, msg->key_management_handle, EMU_SVC_KEY_MGMT);
+    struct emu_group *g;
+    uint32_t ret;
+
+    if (svc == NULL) {
+        return EMU_ERR(SAB_UNKNOWN_HANDLE_RATING);
+    }
+    if ((msg->flags & EMU_GROUP_FLAGS_DELETE) != 0u) {
+        return EMU_ERR(SAB_CMD_NOT_SUPPORTED_RATING);
+    }
+    ret = emu_group_get(ctx->mu, svc->ks, msg->key_group, false, &g);
+    if (ret != SAB_SUCCESS_STATUS) {
+        return ret;
+    }
+    if ((msg->flags & EMU_GROUP_FLAGS_LOCKDOWN) != 0u) {
+        g->locked = 1u;
+    }
+    if ((msg->flags & EMU_GROUP_FLAGS_UNLOCK) != 0u) {
+        g->locked = 0u;
+    }
+    if ((msg->flags & EMU_GROUP_FLAGS_STRICT) != 0u) {
+        ret = emu_ks_commit(ctx->mu, svc->ks);
+    }
+    return ret;
+}
+
+static uint32_t emu_mac_open(struct emu_ctx *ctx)
+{
+    struct sab_cmd_mac_open_msg *msg = EMU_MSG(ctx, struct sab_cmd_mac_open_msg);
+    struct sab_cmd_mac_open_rsp *rsp = EMU_RSP(ctx, struct sab_cmd_mac_open_rsp);
+
+    return emu_svc_open(ctx, msg->key_store_handle, false, EMU_SVC_MAC, &rsp->mac_handle);
+}
+
+static uint32_t emu_mac_close(struct emu_ctx *ctx)
+{
+    return emu_svc_close_cmd(ctx, EMU_SVC_MAC);
+}
+
+static uint32_t emu_mac_one_go(struct emu_ctx *ctx)
+{
+    struct sab_cmd_mac_one_go_msg *msg = EMU_MSG(ctx, struct sab_cmd_mac_one_go_msg);
+    struct sab_cmd_mac_one_go_rsp *rsp = EMU_RSP(ctx, struct sab_cmd_mac_one_go_rsp);
+    struct emu_svc *svc = emu_svc_get(ctx, msg->mac_handle, EMU_SVC_MAC);
+    const uint8_t *key;
+    uint32_t key_len;
+    uint8_t mac[16];
+    uint8_t *in, *out;
+    uint32_t ret;
+
+    if (svc == NULL) {
+        return EMU_ERR(SAB_UNKNOWN_HANDLE_RATING);
+    }
+    if ((msg->algorithm != EMU_MAC_ALGO_CMAC) || (msg->mac_size == 0u) || (msg->mac_size > sizeof(mac))) {
+        return EMU_ERR(SAB_INVALID_PARAM_RATING);
+    }
+    ret = emu_aes_key(ctx, svc->ks, msg->key_id, true, &key, &key_len);
+    if (ret != SAB_SUCCESS_STATUS) {
+        return ret;
+    }
+    in = emu_resolve(ctx->mu, ctx->bufs, msg->payload_address, msg->payload_size);
+    out = emu_resolve(ctx->mu, ctx->bufs, msg->mac_address, msg->mac_size);
+    if ((in == NULL) || (out == NULL)) {
+        return EMU_ERR(SAB_INVALID_ADDRESS_RATING);
+    }
+    if (emu_cmac(key, key_len, in, msg->payload_size, mac) != 0) {
+        return EMU_ERR(SAB_INVALID_PARAM_RATING);
+    }
+    if ((msg->flags & EMU_MAC_FLAGS_GENERATION) != 0u) {
+        (void)memcpy(out, mac, msg->mac_size);
+    } else if (CRYPTO_memcmp(out, mac, msg->mac_size) == 0) {
+        rsp->verification_status = SAB_HSM_MAC_ONE_GO_IND_VERIFICATION_STATUS_OK;
+    } else {
+        rsp->verification_status = SAB_HSM_MAC_ONE_GO_IND_VERIFICATION_STATUS_KO;
+    }
+    return SAB_SUCCESS_STATUS;
+}
+
+static uint32_t emu_cipher_open(struct emu_ctx *ctx)
+{
+    struct sab_cmd_cipher_open_msg *msg = EMU_MSG(ctx, struct sab_cmd_cipher_open_msg);
+    struct sab_cmd_cipher_open_rsp *rsp = EMU_RSP(ctx, struct sab_cmd_cipher_open_rsp);
+
+    return emu_svc_open(ctx, msg->key_store_handle, false, EMU_SVC_CIPHER, &rsp->cipher_handle);
+}
+
+static uint32_t emu_cipher_close(struct emu_ctx *ctx)
+{
+    return emu_svc_close_cmd(ctx, EMU_SVC_CIPHER);
+}
+
+static uint32_t emu_cipher_one_go(struct emu_ctx *ctx)
+{
+    struct sab_cmd_cipher_one_go_msg *msg = EMU_MSG(ctx, struct sab_cmd_cipher_one_go_msg);
+    struct emu_svc *svc = emu_svc_get(ctx, msg->cipher_handle, EMU_SVC_CIPHER);
+    int32_t enc = ((msg->flags & EMU_CIPHER_FLAGS_ENCRYPT) != 0u) ? 1 : 0;
+    const uint8_t *key;
+    uint32_t key_len;
+    uint32_t data_len;
+    uint8_t *iv, *in, *out;
+    int32_t err;
+    uint32_t ret;
+
+    if (svc == NULL) {
+        return EMU_ERR(SAB_UNKNOWN_HANDLE_RATING);
+    }
+    switch (msg->algo) {
+    case AHAB_CIPHER_ONE_GO_ALGO_ECB:
+    case AHAB_CIPHER_ONE_GO_ALGO_CBC:
+        if (((msg->input_size % 16u) != 0u) || (msg->output_size < msg->input_size)
+            || ((msg->algo == AHAB_CIPHER_ONE_GO_ALGO_CBC) && (msg->iv_size != 16u))) {
+            return EMU_ERR(SAB_INVALID_PARAM_RATING);
+        }
+        data_len = msg->input_size;
+        break;
+    case EMU_CIPHER_ALGO_CCM:
+        if ((msg->iv_size != EMU_AEAD_IV_SIZE)
+            || ((enc != 0) && (msg->output_size < msg->input_size + EMU_AEAD_TAG_SIZE))
+            || ((enc == 0) && ((msg->input_size < EMU_AEAD_TAG_SIZE)
+                               || (msg->output_size < msg->input_size - EMU_AEAD_TAG_SIZE)))) {
+            return EMU_ERR(SAB_INVALID_PARAM_RATING);
+        }
+        data_len = (enc != 0) ? msg->input_size : (msg->input_size - EMU_AEAD_TAG_SIZE);
+        break;
+    default:
+        return EMU_ERR(SAB_INVALID_PARAM_RATING);
+    }
+
+    ret = emu_aes_key(ctx, svc->ks, msg->key_id, false, &key, &key_len);
+    if (ret != SAB_SUCCESS_STATUS) {
+        return ret;
+    }
+    iv = emu_resolve(ctx->mu, ctx->bufs, msg->iv_address, msg->iv_size);
+    in = emu_resolve(ctx->mu, ctx->bufs, msg->input_address, msg->input_size);
+    out = emu_resolve(ctx->mu, ctx->bufs, msg->output_address, msg->output_size);
+    if ((iv == NULL) || (in == NULL) || (out == NULL)) {
+        return EMU_ERR(SAB_INVALID_ADDRESS_RATING);
+    }
+
+    if (msg->algo == EMU_CIPHER_ALGO_CCM) {
+        err = emu_aead(key, key_len, EMU_AES_CCM, enc, iv, NULL, 0u, in, out, data_len,
+                       (enc != 0) ? (out + data_len) : (in + data_len));
+    } else {
+        err = emu_aes(key, key_len, (msg->algo == AHAB_CIPHER_ONE_GO_ALGO_CBC) ? EMU_AES_CBC : EMU_AES_ECB,
+                      enc, (msg->iv_size != 0u) ? iv : NULL, in, out, data_len);
+    }
+    return (err == 0) ? SAB_SUCCESS_STATUS : EMU_ERR(SAB_INVALID_PARAM_RATING);
+}
+
+static uint32_t emu_auth_enc(struct emu_ctx *ctx)
+{
+    struct sab_cmd_auth_enc_msg *msg = EMU_MSG(ctx, struct sab_cmd_auth_enc_msg);
+    struct emu_svc *svc = emu_svc_get(ctx, msg->cipher_handle, EMU_SVC_CIPHER);
+    int32_t enc = ((msg->flags & SAB_AUTH_ENC_FLAGS_ENCRYPT) != 0u) ? 1 : 0;
+    const uint8_t *key;
+    uint32_t key_len;
+    uint32_t data_len;
+    uint8_t *iv, *aad, *in, *out;
+    uint32_t ret;
+
+    if (svc == NULL) {
+        return EMU_ERR(SAB_UNKNOWN_HANDLE_RATING);
+    }
+    if ((msg->ae_algo != SAB_AUTH_ENC_ALGO_GCM) || (msg->iv_size != EMU_AEAD_IV_SIZE)
+        || ((enc != 0) && (msg->output_length < msg->input_length + EMU_AEAD_TAG_SIZE))
+        || ((enc == 0) && ((msg->input_length < EMU_AEAD_TAG_SIZE)
+                           || (msg->output_length < msg->input_length - EMU_AEAD_TAG_SIZE)))) {
+        return EMU_ERR(SAB_INVALID_PARAM_RATING);
+    }
+    data_len = (enc != 0) ? msg->input_length : (msg->input_length - EMU_AEAD_TAG_SIZE);
+
+    ret = emu_aes_key(ctx, svc->ks, msg->key_id, false, &key, &key_len);
+    if (ret != SAB_SUCCESS_STATUS) {
+        return ret;
+    }
+    iv = emu_resolve(ctx->mu, ctx->bufs, msg->iv_address, msg->iv_size);
+    aad = emu_resolve(ctx->mu, ctx->bufs, msg->aad_address, msg->aad_size);
+    in = emu_resolve(ctx->mu, ctx->bufs, msg->input_address, msg->input_length);
+    out = emu_resolve(ctx->mu, ctx->bufs, msg->output_address, msg->output_length);
+    if ((iv == NULL) || (aad == NULL) || (in == NULL) || (out == NULL)) {
+        return EMU_ERR(SAB_INVALID_ADDRESS_RATING);
+    }
+    if (emu_aead(key, key_len, EMU_AES_GCM, enc, iv, aad, msg->aad_size, in, out, data_len,
+                 (enc != 0) ? (out + data_len) : (in + data_len)) != 0) {
+        return EMU_ERR(SAB_INVALID_PARAM_RATING);
+    }
+    return SAB_SUCCESS_STATUS;
+}
+
+static uint32_t emu_sig_gen_open(struct emu_ctx *ctx)
+{
+    struct sab_signature_gen_open_msg *msg = EMU_MSG(ctx, struct sab_signature_gen_open_msg);
+    struct sab_signature_gen_open_rsp *rsp = EMU_RSP(ctx, struct sab_signature_gen_open_rsp);
+
+    return emu_svc_open(ctx, msg->key_store_hdl, false, EMU_SVC_SIG_GEN, &rsp->sig_gen_hdl);
+}
+
+static uint32_t emu_sig_gen_close(struct emu_ctx *ctx)
+{
+    return emu_svc_close_cmd(ctx, EMU_SVC_SIG_GEN);
+}
+
+static uint32_t emu_sig_generate(struct emu_ctx *ctx)
+{
+    struct sab_signature_generate_msg *msg = EMU_MSG(ctx, struct sab_signature_generate_msg);
+    struct emu_svc *svc = emu_svc_get(ctx, msg->sig_gen_hdl, EMU_SVC_SIG_GEN);
+    const struct emu_curve *curve = emu_curve_get(msg->scheme_id);
+    struct emu_key *key;
+    uint8_t dgst[64];
+    uint32_t dgst_len;
+    uint8_t *in, *out;
+    uint32_t ret;
+
+    if (svc == NULL) {
+        return EMU_ERR(SAB_UNKNOWN_HANDLE_RATING);
+    }
+    if ((curve == NULL) || (msg->signature_size < 2u * curve->size)) {
+        return EMU_ERR(SAB_INVALID_PARAM_RATING);
+    }
+    ret = emu_key_find(ctx->mu, svc->ks, msg->key_identifier, NULL, &key);
+    if (ret != SAB_SUCCESS_STATUS) {
+        return ret;
+    }
+    if (key->type != msg->scheme_id) {
+        return EMU_ERR(SAB_INVALID_PARAM_RATING);
+    }
+    in = emu_resolve(ctx->mu, ctx->bufs, msg->message_addr, msg->message_size);
+    out = emu_resolve(ctx->mu, ctx->bufs, msg->signature_addr, msg->signature_size);
+    if ((in == NULL) || (out == NULL)) {
+        return EMU_ERR(SAB_INVALID_ADDRESS_RATING);
+    }
+    dgst_len = emu_ec_digest(curve, msg->flags, in, msg->message_size, dgst);
+    if ((dgst_len == 0u) || (emu_ec_sign(curve, key, dgst, dgst_len, out) != 0)) {
+        return EMU_ERR(SAB_INVALID_PARAM_RATING);
+    }
+    if (msg->signature_size > 2u * curve->size) {
+        /* Ry is not computed: only valid with compressed points, which are not emulated. */
+        out[2u * curve->size] = 0u;
+    }
+    return SAB_SUCCESS_STATUS;
+}
+
+static uint32_t emu_sig_prepare(struct emu_ctx *ctx)
+{
+    struct sab_prepare_signature_msg *msg = EMU_MSG(ctx, struct sab_prepare_signature_msg);
+
+    if (emu_svc_get(ctx, msg->sig_gen_hdl, EMU_SVC_SIG_GEN) == NULL) {
+        return EMU_ERR(SAB_UNKNOWN_HANDLE_RATING);
+    }
+    /* Low latency signatures are computed entirely at generation time. */
+    return SAB_SUCCESS_STATUS;
+}
+
+static uint32_t emu_sig_ver_open(struct emu_ctx *ctx)
+{
+    struct sab_signature_verif_open_msg *msg = EMU_MSG(ctx, struct sab_signature_verif_open_msg);
+    struct sab_signature_verif_open_rsp *rsp = EMU_RSP(ctx, struct sab_signature_verif_open_rsp);
+
+    return emu_svc_open(ctx, msg->session_handle, true, EMU_SVC_SIG_VER, &rsp->sig_ver_hdl);
+}
+
+static uint32_t emu_sig_ver_close(struct emu_ctx *ctx)
+{
+    return emu_svc_close_cmd(ctx, EMU_SVC_SIG_VER);
+}
+
+static uint32_t emu_sig_verify(struct emu_ctx *ctx)
+{
+    struct sab_signature_verify_msg *msg = EMU_MSG(ctx, struct sab_signature_verify_msg);
+    struct sab_signature_verify_rsp *rsp = EMU_RSP(ctx, struct sab_signature_verify_rsp);
+    const struct emu_curve *curve = emu_curve_get(msg->sig_scheme);
+    const uint8_t *pub = NULL;
+    uint8_t dgst[64];
+    uint32_t dgst_len;
+    uint32_t ref;
+    uint8_t *key, *in, *sig;
+    uint32_t i;
+
+    if (emu_svc_get(ctx, msg->sig_ver_hdl, EMU_SVC_SIG_VER) == NULL) {
+        return EMU_ERR(SAB_UNKNOWN_HANDLE_RATING);
+    }
+    if ((curve == NULL) || (msg->sig_size < 2u * curve->size)) {
+        return EMU_ERR(SAB_INVALID_PARAM_RATING);
+    }
+    key = emu_resolve(ctx->mu, ctx->bufs, msg->key_addr, msg->key_size);
+    in = emu_resolve(ctx->mu, ctx->bufs, msg->msg_addr, msg->message_size);
+    sig = emu_resolve(ctx->mu, ctx->bufs, msg->sig_addr, msg->sig_size);
+    if ((key == NULL) || (in == NULL) || (sig == NULL)) {
+        return EMU_ERR(SAB_INVALID_ADDRESS_RATING);
+    }
+    if ((msg->flags & EMU_SIG_FLAGS_KEY_INTERNAL) != 0u) {
+        if (msg->key_size < sizeof(uint32_t)) {
+            return EMU_ERR(SAB_INVALID_PARAM_RATING);
+        }
+        (void)memcpy(&ref, key, sizeof(ref));
+        for (i = 0u; i < EMU_MAX_PUB_KEYS; i++) {
+            if ((ctx->mu->pub_keys[i].ref == ref) && (ref != 0u)
+                && (ctx->mu->pub_keys[i].type == msg->sig_scheme)) {
+                pub = ctx->mu->pub_keys[i].key;
+            }
+        }
+        if (pub == NULL) {
+            return EMU_ERR(SAB_UNKNOWN_ID_RATING);
+        }
+    } else if (msg->key_size == 2u * curve->size) {
+        pub = key;
+    } else {
+        return EMU_ERR(SAB_INVALID_PARAM_RATING);
+    }
+
+    dgst_len = emu_ec_digest(curve, msg->flags, in, msg->message_size, dgst);
+    if (dgst_len == 0u) {
+        return EMU_ERR(SAB_INVALID_PARAM_RATING);
+    }
+    rsp->verification_status = (emu_ec_verify(curve, pub, dgst, dgst_len, sig) == 1) ? EMU_SIG_VERIFICATION_OK : 0u;
+    return SAB_SUCCESS_STATUS;
+}
+
+static uint32_t emu_import_pub_key(struct emu_ctx *ctx)
+{
+    struct sab_import_pub_key_msg *msg = EMU_MSG(ctx, struct sab_import_pub_key_msg);
+    struct sab_import_pub_key_rsp *rsp = EMU_RSP(ctx, struct sab_import_pub_key_rsp);
+    const struct emu_curve *curve = emu_curve_get(msg->key_type);
+    struct emu_pub_key *slot = NULL;
+    uint8_t *key;
+    uint32_t i;
+
+    if (emu_svc_get(ctx, msg->sig_ver_hdl, EMU_SVC_SIG_VER) == NULL) {
+        return EMU_ERR(SAB_UNKNOWN_HANDLE_RATING);
+    }
+    if ((curve == NULL) || (msg->key_size != 2u * curve->size)) {
+        return EMU_ERR(SAB_INVALID_PARAM_RATING);
+    }
+    key = emu_resolve(ctx->mu, ctx->bufs, msg->key_addr, msg->key_size);
+    if (key == NULL) {
+        return EMU_ERR(SAB_INVALID_ADDRESS_RATING);
+    }
+    for (i = 0u; (i < EMU_MAX_PUB_KEYS) && (slot == NULL); i++) {
+        if (ctx->mu->pub_keys[i].ref == 0u) {
+            slot = &ctx->mu->pub_keys[i];
+        }
+    }
+    if (slot == NULL) {
+        return EMU_ERR(SAB_OUT_OF_MEMORY_RATING);
+    }
+    slot->ref = emu_new_handle();
+    slot->type = msg->key_type;
+    slot->len = msg->key_size;
+    (void)memcpy(slot->key, key, msg->key_size);
+    rsp->key_ref = slot->ref;
+    return SAB_SUCCESS_STATUS;
+}
+
+static uint32_t emu_hash_open(struct emu_ctx *ctx)
+{
+    struct sab_hash_open_msg *msg = EMU_MSG(ctx, struct sab_hash_open_msg);
+    struct sab_hash_open_rsp *rsp = EMU_RSP(ctx, struct sab_hash_open_rsp);
+
+    return emu_svc_open(ctx, msg->session_handle, true, EMU_SVC_HASH, &rsp->hash_hdl);
+}
+
+static uint32_t emu_hash_close(struct emu_ctx *ctx)
+{
+    return emu_svc_close_cmd(ctx, EMU_SVC_HASH);
+}
+
+static uint32_t emu_hash_one_go(struct emu_ctx *ctx)
+{
+    static const char *names[] = {"SHA224", "SHA256", "SHA384", "SHA512"};
+    struct sab_hash_one_go_msg *msg = EMU_MSG(ctx, struct sab_hash_one_go_msg);
+    const EVP_MD *md;
+    uint8_t *in, *out;
+
+    if (emu_svc_get(ctx, msg->hash_hdl, EMU_SVC_HASH) == NULL) {
+        return EMU_ERR(SAB_UNKNOWN_HANDLE_RATING);
+    }
+    if (msg->algo >= (uint8_t)(sizeof(names) / sizeof(names[0]))) {
+        return EMU_ERR(SAB_INVALID_PARAM_RATING);
+    }
+    md = EVP_get_digestbyname(names[msg->algo]);
+    if ((md == NULL) || (msg->output_size < (uint32_t)EVP_MD_get_size(md))) {
+        return EMU_ERR(SAB_INVALID_PARAM_RATING);
+    }
+    in = emu_resolve(ctx->mu, ctx->bufs, msg->input_addr, msg->input_size);
+    out = emu_resolve(ctx->mu, ctx->bufs, msg->output_addr, (uint32_t)EVP_MD_get_size(md));
+    if ((in == NULL) || (out == NULL)) {
+        return EMU_ERR(SAB_INVALID_ADDRESS_RATING);
+    }
+    if (EVP_Digest(in, msg->input_size, out, NULL, md, NULL) != 1) {
+        return EMU_ERR(SAB_INVALID_PARAM_RATING);
+    }
+    return SAB_SUCCESS_STATUS;
+}
+
+static uint32_t emu_data_storage_open(struct emu_ctx *ctx)
+{
+    struct sab_cmd_data_storage_open_msg *msg = EMU_MSG(ctx, struct sab_cmd_data_storage_open_msg);
+    struct sab_cmd_data_storage_open_rsp *rsp = EMU_RSP(ctx, struct sab_cmd_data_storage_open_rsp);
+
+    return emu_svc_open(ctx, msg->key_store_handle, false, EMU_SVC_DATA_STORAGE, &rsp->data_storage_handle);
+}
+
+static uint32_t emu_data_storage_close(struct emu_ctx *ctx)
+{
+    return emu_svc_close_cmd(ctx, EMU_SVC_DATA_STORAGE);
+}
+
+static uint32_t emu_data_storage(struct emu_ctx *ctx)
+{
+    struct sab_cmd_data_storage_msg *msg = EMU_MSG(ctx, struct sab_cmd_data_storage_msg);
+    struct emu_svc *svc = emu_svc_get(ctx, msg->data_storage_handle, EMU_SVC_DATA_STORAGE);
+    struct emu_data *data = NULL;
+    struct emu_data *free_slot = NULL;
+    uint8_t *buf;
+    uint8_t *old;
+    uint32_t i;
+
+    if (svc == NULL) {
+        return EMU_ERR(SAB_UNKNOWN_HANDLE_RATING);
+    }
+    for (i = 0u; i < EMU_MAX_DATA; i++) {
+        if (svc->ks->data[i].buf == NULL) {
+            if (free_slot == NULL) {
+                free_slot = &svc->ks->data[i];
+            }
+        } else if (svc->ks->data[i].id == msg->data_id) {
+            data = &svc->ks->data[i];
+        }
+    }
+
+    if ((msg->flags & EMU_DATA_FLAGS_STORE) == 0u) {
+        if (data == NULL) {
+            return EMU_ERR(SAB_UNKNOWN_ID_RATING);
+        }
+        if (msg->data_size < data->len) {
+            return EMU_ERR(SAB_INVALID_PARAM_RATING);
+        }
+        buf = emu_resolve(ctx->mu, ctx->bufs, msg->data_address, data->len);
+        if (buf == NULL) {
+            return EMU_ERR(SAB_INVALID_ADDRESS_RATING);
+        }
+        (void)memcpy(buf, data->buf, data->len);
+        return SAB_SUCCESS_STATUS;
+    }
+
+    if (msg->data_size > EMU_MAX_DATA_SIZE) {
+        return EMU_ERR(SAB_INVALID_PARAM_RATING);
+    }
+    if (data == NULL) {
+        data = free_slot;
+    }
+    if (data == NULL) {
+        return EMU_ERR(SAB_OUT_OF_MEMORY_RATING);
+    }
+    buf = emu_resolve(ctx->mu, ctx->bufs, msg->data_address, msg->data_size);
+    if (buf == NULL) {
+        return EMU_ERR(SAB_INVALID_ADDRESS_RATING);
+    }
+    old = data->buf;
+    data->buf = malloc((msg->data_size != 0u) ? msg->data_size : 1u);
+    if (data->buf == NULL) {
+        data->buf = old;
+        return EMU_ERR(SAB_OUT_OF_MEMORY_RATING);
+    }
+    free(old);
+    (void)memcpy(data->buf, buf, msg->data_size);
+    data->id = msg->data_id;
+    data->len = (uint16_t)msg->data_size;
+
+    /* Data are written in the NVM immediately. */
+    if (emu_master_export(ctx->mu) != 0u) {
+        return EMU_ERR(SAB_NVM_ERROR_RATING);
+    }
+    return SAB_SUCCESS_STATUS;
+}
+
+static uint32_t emu_storage_open(struct emu_ctx *ctx)
+{
+    struct sab_cmd_storage_open_msg *msg = EMU_MSG(ctx, struct sab_cmd_storage_open_msg);
+    struct sab_cmd_storage_open_rsp *rsp = EMU_RSP(ctx, struct sab_cmd_storage_open_rsp);
+    uint32_t ret;
+
+    if (ctx->chan->cmd_rcv == 0u) {
+        /* The storage must be managed from a channel receiving SECO requests. */
+        return EMU_ERR(SAB_INVALID_PARAM_RATING);
+    }
+    ret = emu_svc_open(ctx, msg->session_handle, true, EMU_SVC_STORAGE, &rsp->storage_handle);
+    if (ret == SAB_SUCCESS_STATUS) {
+        ctx->mu->storage_hdl = rsp->storage_handle;
+        ctx->mu->nvm_chan = ctx->chan;
+    }
+    return ret;
+}
+
+static uint32_t emu_storage_close(struct emu_ctx *ctx)
+{
+    return emu_svc_close_cmd(ctx, EMU_SVC_STORAGE);
+}
+
+static uint32_t emu_storage_import(struct emu_ctx *ctx)
+{
+    struct sab_cmd_key_store_import_msg *msg = EMU_MSG(ctx, struct sab_cmd_key_store_import_msg);
+    uint8_t *blob;
+    uint32_t i;
+
+    if (emu_svc_get(ctx, msg->storage_handle, EMU_SVC_STORAGE) == NULL) {
+        return EMU_ERR(SAB_UNKNOWN_HANDLE_RATING);
+    }
+    for (i = 0u; i < EMU_MAX_KEY_STORES; i++) {
+        if (ctx->mu->ks[i].in_use != 0u) {
+            /* Key stores are only loaded from the NVM after a reset. */
+            return EMU_ERR(SAB_ID_CONFLICT_RATING);
+        }
+    }
+    blob = emu_resolve(ctx->mu, ctx->bufs, msg->key_store_address, msg->key_store_size);
+    if (blob == NULL) {
+        return EMU_ERR(SAB_INVALID_ADDRESS_RATING);
+    }
+    if (emu_master_parse(ctx->mu, blob, msg->key_store_size) != 0u) {
+        return EMU_ERR(SAB_KEY_STORAGE_ERROR_RATING);
+    }
+    return SAB_SUCCESS_STATUS;
+}
+
+/*
+ * SHE.
+ */
+
+static uint32_t emu_she_slot(uint32_t key_ext, uint32_t id)
+{
+    return (((key_ext >> 4) & 0xFu) * 16u) + (id & 0xFu);
+}
+
+static void emu_she_uid(uint8_t *uid)
+{
+    (void)memset(uid, 0, EMU_SHE_UID_SIZE);
+    (void)memcpy(&uid[EMU_SHE_UID_SIZE - sizeof(emu_uid)], emu_uid, sizeof(emu_uid));
+}
+
+/* SHE key derivation: Miyaguchi-Preneel compression of key || c. */
+static int32_t emu_she_kdf(const uint8_t *key, const uint8_t *c, uint8_t *out)
+{
+    uint8_t h[16];
+    uint8_t e[16];
+    const uint8_t *x;
+    uint32_t i, j;
+
+    (void)memset(h, 0, sizeof(h));
+    for (i = 0u; i < 2u; i++) {
+        x = (i == 0u) ? key : c;
+        if (emu_aes(h, 16u, EMU_AES_ECB, 1, NULL, x, e, 16u) != 0) {
+            return -1;
+        }
+        for (j = 0u; j < 16u; j++) {
+            h[j] = e[j] ^ x[j] ^ h[j];
+        }
+    }
+    (void)memcpy(out, h, sizeof(h));
+    return 0;
+}
+
+/* SHE SECRET_KEY of the emulated part, derived from its UID. */
+static void emu_she_secret_key(uint8_t *key)
+{
+    static const char label[] = "SECO emulator SHE SECRET_KEY";
+    uint8_t buf[sizeof(label) + sizeof(emu_uid)];
+    uint8_t h[32];
+
+    (void)memcpy(buf, label, sizeof(label));
+    (void)memcpy(&buf[sizeof(label)], emu_uid, sizeof(emu_uid));
+    (void)EVP_Digest(buf, sizeof(buf), h, NULL, EVP_sha256(), NULL);
+    (void)memcpy(key, h, EMU_SHE_KEY_SIZE);
+}
+
+/* Build M4 and M5 proving the update of a key with the given counter. */
+static int32_t emu_she_proof(const uint8_t *m1, const uint8_t *key, uint32_t counter, uint8_t *m4, uint8_t *m5)
+{
+    uint8_t k3[16];
+    uint8_t k4[16];
+    uint8_t c[16];
+    int32_t ret = -1;
+
+    (void)memset(c, 0, sizeof(c));
+    emu_be32(c, (counter << 4) | 0x8u);
+    (void)memcpy(m4, m1, 16u);
+    emu_she_uid(m4);
+    if ((emu_she_kdf(key, emu_she_enc_c, k3) == 0) && (emu_she_kdf(key, emu_she_mac_c, k4) == 0)
+        && (emu_aes(k3, 16u, EMU_AES_ECB, 1, NULL, c, &m4[16], 16u) == 0)
+        && (emu_cmac(k4, 16u, m4, 32u, m5) == 0)) {
+        ret = 0;
+    }
+    OPENSSL_cleanse(k3, sizeof(k3));
+    OPENSSL_cleanse(k4, sizeof(k4));
+    return ret;
+}
+
+static uint32_t emu_she_load_key(struct emu_ctx *ctx, struct emu_key_store *ks, uint32_t key_id,
+                                 const uint8_t *m1, const uint8_t *m2, const uint8_t *m3,
+                                 uint8_t *m4, uint8_t *m5, bool strict)
+{
+    struct emu_she_key *target;
+    struct emu_she_key *auth;
+    struct emu_she_key prev;
+    uint8_t uid[EMU_SHE_UID_SIZE];
+    uint8_t zero[EMU_SHE_UID_SIZE];
+    uint8_t buf[48];
+    uint8_t k[16];
+    uint8_t mac[16];
+    uint8_t plain[32];
+    uint8_t iv[16];
+    uint32_t id = (uint32_t)m1[15] >> 4;
+    uint32_t auth_id = (uint32_t)m1[15] & 0xFu;
+    uint32_t ext = key_id & 0xF0u;
+    uint32_t cid;
+    uint8_t fid;
+    uint32_t ret = EMU_ERR(SAB_SHE_KEY_UPDATE_ERROR_RATING);
+
+    (void)memset(&prev, 0, sizeof(prev));
+    do {
+        if ((ks->she == 0u) || (id != (key_id & 0xFu)) || (id == EMU_SHE_SECRET_KEY) || (id > EMU_SHE_RAM_KEY)
+            || (emu_she_slot(ext, id) >= EMU_SHE_NB_KEYS)) {
+            ret = EMU_ERR(SAB_SHE_KEY_INVALID_RATING);
+            break;
+        }
+        target = &ks->she_keys[emu_she_slot(ext, id)];
+        /* MASTER_ECU_KEY and boot keys are common to all key extensions. */
+        auth = &ks->she_keys[emu_she_slot((auth_id < 4u) ? 0u : ext, auth_id)];
+
+        /* An empty slot authenticates with the all-zero key. */
+        (void)memset(k, 0, sizeof(k));
+        if (auth->present != 0u) {
+            (void)memcpy(k, auth->key, sizeof(k));
+        }
+        (void)memcpy(buf, m1, 16u);
+        (void)memcpy(&buf[16], m2, 32u);
+        if ((emu_she_kdf(k, emu_she_mac_c, k) != 0) || (emu_cmac(k, 16u, buf, sizeof(buf), mac) != 0)
+            || (CRYPTO_memcmp(mac, m3, sizeof(mac)) != 0)) {
+            break;
+        }
+        (void)memset(k, 0, sizeof(k));
+        (void)memset(iv, 0, sizeof(iv));
+        if (auth->present != 0u) {
+            (void)memcpy(k, auth->key, sizeof(k));
+        }
+        if ((emu_she_kdf(k, emu_she_enc_c, k) != 0) || (emu_aes(k, 16u, EMU_AES_CBC, 0, iv, m2, plain, 32u) != 0)) {
+            break;
+        }
+
+        cid = (((uint32_t)plain[0] << 24) | ((uint32_t)plain[1] << 16) | ((uint32_t)plain[2] << 8) | plain[3]) >> 4;
+        fid = (uint8_t)(((plain[3] & 0x0Fu) << 1) | (plain[4] >> 7));
+
+        emu_she_uid(uid);
+        (void)memset(zero, 0, sizeof(zero));
+        if ((memcmp(m1, uid, EMU_SHE_UID_SIZE) != 0)
+            && ((memcmp(m1, zero, EMU_SHE_UID_SIZE) != 0)
+                || ((target->present != 0u) && ((target->fid & EMU_SHE_FID_WILDCARD) == 0u)))) {
+            break;
+        }
+        if ((target->present != 0u) && ((target->fid & EMU_SHE_FID_WRITE_PROT) != 0u)) {
+            ret = EMU_ERR(SAB_SHE_KEY_WRITE_PROTECTED_RATING);
+            break;
+        }
+        if ((id != EMU_SHE_RAM_KEY) && (target->present != 0u) && (cid <= target->counter)) {
+            break;
+        }
+
+        prev = *target;
+        target->present = 1u;
+        target->fid = (id == EMU_SHE_RAM_KEY) ? 0u : fid;
+        target->counter = cid;
+        target->plain = 0u;
+        (void)memcpy(target->key, &plain[16], EMU_SHE_KEY_SIZE);
+
+        if ((id != EMU_SHE_RAM_KEY) && strict) {
+            ctx->mu->counter++;
+            ks->nb_updates++;
+            if (emu_master_export(ctx->mu) != 0u) {
+                *target = prev;
+                ret = EMU_ERR(SAB_NVM_ERROR_RATING);
+                break;
+            }
+        }
+        if (emu_she_proof(m1, target->key, cid, m4, m5) != 0) {
+            ret = EMU_ERR(SAB_SHE_GENERAL_ERROR_RATING);
+            break;
+        }
+        ret = SAB_SUCCESS_STATUS;
+    } while (false);
+
+    OPENSSL_cleanse(k, sizeof(k));
+    OPENSSL_cleanse(plain, sizeof(plain));
+    OPENSSL_cleanse(&prev, sizeof(prev));
+    return ret;
+}
+
+static struct emu_svc *emu_she_svc(struct emu_ctx *ctx, uint32_t hdl)
+{
+    struct emu_svc *svc = emu_svc_get(ctx, hdl, EMU_SVC_SHE_UTILS);
+
+    if ((svc != NULL) && (svc->ks->she == 0u)) {
+        svc = NULL;
+    }
+    return svc;
+}
+
+static uint32_t emu_she_utils_open(struct emu_ctx *ctx)
+{
+    struct sab_cmd_she_utils_open_msg *msg = EMU_MSG(ctx, struct sab_cmd_she_utils_open_msg);
+    struct sab_cmd_she_utils_open_rsp *rsp = EMU_RSP(ctx, struct sab_cmd_she_utils_open_rsp);
+
+    return emu_svc_open(ctx, msg->key_store_handle, false, EMU_SVC_SHE_UTILS, &rsp->utils_handle);
+}
+
+static uint32_t emu_she_utils_close(struct emu_ctx *ctx)
+{
+    return emu_svc_close_cmd(ctx, EMU_SVC_SHE_UTILS);
+}
+
+static uint32_t emu_she_key_update(struct emu_ctx *ctx)
+{
+    struct sab_she_key_update_msg *msg = EMU_MSG(ctx, struct sab_she_key_update_msg);
+    struct sab_she_key_update_rsp *rsp = EMU_RSP(ctx, struct sab_she_key_update_rsp);
+    struct emu_svc *svc = emu_she_svc(ctx, msg->utils_handle);
+
+    if (svc == NULL) {
+        return EMU_ERR(SAB_SHE_SEQUENCE_ERROR_RATING);
+    }
+    return emu_she_load_key(ctx, svc->ks, msg->key_id, (uint8_t *)msg->m1, (uint8_t *)msg->m2, (uint8_t *)msg->m3,
+                            (uint8_t *)rsp->m4, (uint8_t *)rsp->m5, true);
+}
+
+static uint32_t emu_she_key_update_ext(struct emu_ctx *ctx)
+{
+    struct sab_she_key_update_ext_msg *msg = EMU_MSG(ctx, struct sab_she_key_update_ext_msg);
+    struct sab_she_key_update_ext_rsp *rsp = EMU_RSP(ctx, struct sab_she_key_update_ext_rsp);
+    struct emu_svc *svc = emu_she_svc(ctx, msg->utils_handle);
+
+    if (svc == NULL) {
+        return EMU_ERR(SAB_SHE_SEQUENCE_ERROR_RATING);
+    }
+    return emu_she_load_key(ctx, svc->ks, msg->key_id, (uint8_t *)msg->m1, (uint8_t *)msg->m2, (uint8_t *)msg->m3,
+                            (uint8_t *)rsp->m4, (uint8_t *)rsp->m5, ((msg->flags & EMU_KEY_FLAGS_STRICT) != 0u));
+}
+
+static uint32_t emu_she_plain_key_update(struct emu_ctx *ctx)
+{
+    struct she_cmd_load_plain_key_msg *msg = EMU_MSG(ctx, struct she_cmd_load_plain_key_msg);
+    struct emu_svc *svc = emu_she_svc(ctx, msg->she_utils_handle);
+    struct emu_she_key *ram;
+
+    if (svc == NULL) {
+        return EMU_ERR(SAB_SHE_SEQUENCE_ERROR_RATING);
+    }
+    ram = &svc->ks->she_keys[emu_she_slot(0u, EMU_SHE_RAM_KEY)];
+    ram->present = 1u;
+    ram->plain = 1u;
+    ram->fid = 0u;
+    ram->counter = 0u;
+    (void)memcpy(ram->key, msg->key, EMU_SHE_KEY_SIZE);
+    return SAB_SUCCESS_STATUS;
+}
+
+static uint32_t emu_she_plain_key_export(struct emu_ctx *ctx)
+{
+    struct sab_she_plain_key_export_msg *msg = EMU_MSG(ctx, struct sab_she_plain_key_export_msg);
+    struct sab_she_plain_key_export_rsp *rsp = EMU_RSP(ctx, struct sab_she_plain_key_export_rsp);
+    struct emu_svc *svc = emu_she_svc(ctx, msg->utils_handle);
+    struct emu_she_key *ram;
+    uint8_t secret[16];
+    uint8_t k[16];
+    uint8_t iv[16];
+    uint8_t plain[32];
+    uint8_t *m1 = (uint8_t *)rsp->m1;
+    uint8_t *m2 = (uint8_t *)rsp->m2;
+    uint32_t ret = EMU_ERR(SAB_SHE_GENERAL_ERROR_RATING);
+
+    if (svc == NULL) {
+        return EMU_ERR(SAB_SHE_SEQUENCE_ERROR_RATING);
+    }
+    ram = &svc->ks->she_keys[emu_she_slot(0u, EMU_SHE_RAM_KEY)];
+    if ((ram->present == 0u) || (ram->plain == 0u)) {
+        return EMU_ERR(SAB_SHE_KEY_INVALID_RATING);
+    }
+
+    /* M1..M3 load the RAM key authenticated by the SECRET_KEY, with CID and FID set to 0. */
+    emu_she_uid(m1);
+    m1[15] = (uint8_t)((EMU_SHE_RAM_KEY << 4) | EMU_SHE_SECRET_KEY);
+    (void)memset(plain, 0, 16u);
+    (void)memcpy(&plain[16], ram->key, EMU_SHE_KEY_SIZE);
+    (void)memset(iv, 0, sizeof(iv));
+    emu_she_secret_key(secret);
+    do {
+        if ((emu_she_kdf(secret, emu_she_enc_c, k) != 0)
+            || (emu_aes(k, 16u, EMU_AES_CBC, 1, iv, plain, m2, 32u) != 0)) {
+            break;
+        }
+        if ((emu_she_kdf(secret, emu_she_mac_c, k) != 0)
+            || (emu_cmac(k, 16u, m1, 48u, (uint8_t *)rsp->m3) != 0)) {
+            break;
+        }
+        if (emu_she_proof(m1, ram->key, 0u, (uint8_t *)rsp->m4, (uint8_t *)rsp->m5) != 0) {
+            break;
+        }
+        ret = SAB_SUCCESS_STATUS;
+    } while (false);
+
+    OPENSSL_cleanse(secret, sizeof(secret));
+    OPENSSL_cleanse(k, sizeof(k));
+    OPENSSL_cleanse(plain, sizeof(plain));
+    return ret;
+}
+
+static uint32_t emu_she_get_id(struct emu_ctx *ctx)
+{
+    struct she_cmd_get_id_msg *msg = EMU_MSG(ctx, struct she_cmd_get_id_msg);
+    struct she_cmd_get_id_rsp *rsp = EMU_RSP(ctx, struct she_cmd_get_id_rsp);
+    struct emu_svc *svc = emu_she_svc(ctx, msg->she_utils_handle);
+    struct emu_she_key *master;
+    uint8_t buf[32];
+
+    if (svc == NULL) {
+        return EMU_ERR(SAB_SHE_SEQUENCE_ERROR_RATING);
+    }
+    emu_she_uid(rsp->id);
+    rsp->sreg = ctx->mu->sreg;
+
+    /* The MAC is computed with the MASTER_ECU_KEY over challenge || UID || SREG. */
+    master = &svc->ks->she_keys[emu_she_slot(0u, EMU_SHE_MASTER_ECU_KEY)];
+    if (master->present != 0u) {
+        (void)memcpy(buf, msg->challenge, 16u);
+        (void)memcpy(&buf[16], rsp->id, EMU_SHE_UID_SIZE);
+        buf[31] = rsp->sreg;
+        if (emu_cmac(master->key, EMU_SHE_KEY_SIZE, buf, sizeof(buf), rsp->mac) != 0) {
+            return EMU_ERR(SAB_SHE_GENERAL_ERROR_RATING);
+        }
+    }
+    return SAB_SUCCESS_STATUS;
+}
+
+static uint32_t emu_she_get_status(struct emu_ctx *ctx)
+{
+    struct she_cmd_get_status_msg *msg = EMU_MSG(ctx, struct she_cmd_get_status_msg);
+    struct she_cmd_get_status_rsp *rsp = EMU_RSP(ctx, struct she_cmd_get_status_rsp);
+
+    if (emu_she_svc(ctx, msg->she_utils_handle) == NULL) {
+        return EMU_ERR(SAB_SHE_SEQUENCE_ERROR_RATING);
+    }
+    rsp->sreg = ctx->mu->sreg;
+    return SAB_SUCCESS_STATUS;
+}
+
+static uint32_t emu_she_fast_mac(struct emu_ctx *ctx)
+{
+    struct sab_she_fast_mac_msg *msg = EMU_MSG(ctx, struct sab_she_fast_mac_msg);
+    struct sab_she_fast_mac_rsp *rsp = EMU_RSP(ctx, struct sab_she_fast_mac_rsp);
+    struct emu_svc *svc = emu_she_svc(ctx, msg->she_utils_handle);
+    const uint8_t *key;
+    uint32_t key_len;
+    uint32_t mac_len = (msg->mac_length == 0u) ? 16u : msg->mac_length;
+    uint8_t mac[16];
+    uint8_t *in, *out;
+    uint32_t ret;
+
+    if (svc == NULL) {
+        return EMU_ERR(SAB_SHE_SEQUENCE_ERROR_RATING);
+    }
+    if (mac_len > sizeof(mac)) {
+        return EMU_ERR(SAB_INVALID_PARAM_RATING);
+    }
+    ret = emu_aes_key(ctx, svc->ks, msg->key_id, true, &key, &key_len);
+    if (ret != SAB_SUCCESS_STATUS) {
+        return ret;
+    }
+    /* The MAC is located in secure memory right after the message. */
+    in = emu_resolve(ctx->mu, NULL, msg->data_offset, msg->data_length);
+    out = emu_resolve(ctx->mu, NULL, emu_align8((uint32_t)msg->data_offset + msg->data_length), sizeof(mac));
+    if ((in == NULL) || (out == NULL)) {
+        return EMU_ERR(SAB_INVALID_ADDRESS_RATING);
+    }
+    if (emu_cmac(key, key_len, in, msg->data_length, mac) != 0) {
+        return EMU_ERR(SAB_SHE_GENERAL_ERROR_RATING);
+    }
+    if ((msg->flags & SAB_SHE_FAST_MAC_FLAGS_VERIFICATION) == 0u) {
+        (void)memcpy(out, mac, sizeof(mac));
+    } else if (CRYPTO_memcmp(out, mac, mac_len) == 0) {
+        rsp->verification_status = SAB_SHE_FAST_MAC_VERIFICATION_STATUS_OK;
+    } else {
+        rsp->verification_status = SAB_SHE_FAST_MAC_VERIFICATION_STATUS_KO;
+    }
+    return SAB_SUCCESS_STATUS;
+}
+
+#define EMU_CMD(id, rsp_type, crc, handler) {(id), (uint8_t)sizeof(rsp_type), (crc), (handler)}
+
+static const struct emu_cmd emu_cmds[] = {
+    EMU_CMD(SAB_SESSION_OPEN_REQ, struct sab_cmd_session_open_rsp, 0u, emu_session_open),
+    EMU_CMD(SAB_SESSION_CLOSE_REQ, struct sab_cmd_session_close_rsp, 0u, emu_session_close_cmd),
+    EMU_CMD(SAB_SHARED_BUF_REQ, struct sab_cmd_shared_buffer_rsp, 0u, emu_shared_buf),
+    EMU_CMD(SAB_PUB_KEY_RECONSTRUCTION_REQ, struct sab_public_key_reconstruct_rsp, 0u, emu_unsupported),
+    EMU_CMD(SAB_PUB_KEY_DECOMPRESSION_REQ, struct sab_public_key_decompression_rsp, 0u, emu_pub_key_decompression),
+    EMU_CMD(SAB_ECIES_ENC_REQ, struct sab_cmd_ecies_encrypt_rsp, 0u, emu_ecies_encrypt),
+    EMU_CMD(SAB_GET_INFO_REQ, struct sab_cmd_get_info_rsp, 1u, emu_get_info),
+    EMU_CMD(SAB_RNG_OPEN_REQ, struct sab_cmd_rng_open_rsp, 0u, emu_rng_open),
+    EMU_CMD(SAB_RNG_CLOSE_REQ, struct sab_cmd_rng_close_rsp, 0u, emu_rng_close),
+    EMU_CMD(SAB_RNG_GET_RANDOM, struct sab_cmd_get_rnd_rsp, 0u, emu_rng_get_random),
+    EMU_CMD(SAB_RNG_EXTEND_SEED, struct sab_cmd_extend_seed_rsp, 0u, emu_rng_extend_seed),
+    EMU_CMD(SAB_KEY_STORE_OPEN_REQ, struct sab_cmd_key_store_open_rsp, 0u, emu_key_store_open),
+    EMU_CMD(SAB_KEY_STORE_CLOSE_REQ, struct sab_cmd_key_store_close_rsp, 0u, emu_key_store_close),
+    EMU_CMD(SAB_PUB_KEY_RECOVERY_REQ, struct sab_cmd_pub_key_recovery_rsp, 0u, emu_pub_key_recovery),
+    EMU_CMD(SAB_KEY_MANAGEMENT_OPEN_REQ, struct sab_cmd_key_management_open_rsp, 0u, emu_key_mgmt_open),
+    EMU_CMD(SAB_KEY_MANAGEMENT_CLOSE_REQ, struct sab_cmd_key_management_close_rsp, 0u, emu_key_mgmt_close),
+    EMU_CMD(SAB_KEY_GENERATE_REQ, struct sab_cmd_generate_key_rsp, 0u, emu_key_generate),
+    EMU_CMD(SAB_MANAGE_KEY_REQ, struct sab_cmd_manage_key_rsp, 0u, emu_manage_key),
+    EMU_CMD(SAB_BUT_KEY_EXP_REQ, struct sab_cmd_butterfly_key_exp_rsp, 0u, emu_unsupported),
+    EMU_CMD(SAB_MANAGE_KEY_GROUP_REQ, struct sab_cmd_manage_key_group_rsp, 0u, emu_manage_key_group),
+    EMU_CMD(SAB_KIK_EXPORT_REQ, struct sab_kik_export_rsp, 0u, emu_unsupported),
+    EMU_CMD(SAB_MAC_OPEN_REQ, struct sab_cmd_mac_open_rsp, 0u, emu_mac_open),
+    EMU_CMD(SAB_MAC_CLOSE_REQ, struct sab_cmd_mac_close_rsp, 0u, emu_mac_close),
+    EMU_CMD(SAB_MAC_ONE_GO_REQ, struct sab_cmd_mac_one_go_rsp, 0u, emu_mac_one_go),
+    EMU_CMD(SAB_CIPHER_OPEN_REQ, struct sab_cmd_cipher_open_rsp, 0u, emu_cipher_open),
+    EMU_CMD(SAB_CIPHER_CLOSE_REQ, struct sab_cmd_cipher_close_rsp, 0u, emu_cipher_close),
+    EMU_CMD(SAB_CIPHER_ONE_GO_REQ, struct sab_cmd_cipher_one_go_rsp, 0u, emu_cipher_one_go),
+    EMU_CMD(SAB_CIPHER_ECIES_DECRYPT_REQ, struct sab_cmd_ecies_decrypt_rsp, 0u, emu_ecies_decrypt),
+    EMU_CMD(SAB_AUTH_ENC_REQ, struct sab_cmd_auth_enc_rsp, 0u, emu_auth_enc),
+    EMU_CMD(SAB_SIGNATURE_GENERATION_OPEN_REQ, struct sab_signature_gen_open_rsp, 0u, emu_sig_gen_open),
+    EMU_CMD(SAB_SIGNATURE_GENERATION_CLOSE_REQ, struct sab_signature_gen_close_rsp, 0u, emu_sig_gen_close),
+    EMU_CMD(SAB_SIGNATURE_GENERATE_REQ, struct sab_signature_generate_rsp, 0u, emu_sig_generate),
+    EMU_CMD(SAB_SIGNATURE_PREPARE_REQ, struct sab_prepare_signature_rsp, 0u, emu_sig_prepare),
+    EMU_CMD(SAB_SIGNATURE_VERIFICATION_OPEN_REQ, struct sab_signature_verif_open_rsp, 0u, emu_sig_ver_open),
+    EMU_CMD(SAB_SIGNATURE_VERIFICATION_CLOSE_REQ, struct sab_signature_verif_close_rsp, 0u, emu_sig_ver_close),
+    EMU_CMD(SAB_SIGNATURE_VERIFY_REQ, struct sab_signature_verify_rsp, 0u, emu_sig_verify),
+    EMU_CMD(SAB_IMPORT_PUB_KEY, struct sab_import_pub_key_rsp, 0u, emu_import_pub_key),
+    EMU_CMD(SAB_HASH_OPEN_REQ, struct sab_hash_open_rsp, 0u, emu_hash_open),
+    EMU_CMD(SAB_HASH_CLOSE_REQ, struct sab_hash_close_rsp, 0u, emu_hash_close),
+    EMU_CMD(SAB_HASH_ONE_GO_REQ, struct sab_hash_one_go_rsp, 0u, emu_hash_one_go),
+    EMU_CMD(SAB_DATA_STORAGE_OPEN_REQ, struct sab_cmd_data_storage_open_rsp, 0u, emu_data_storage_open),
+    EMU_CMD(SAB_DATA_STORAGE_CLOSE_REQ, struct sab_cmd_data_storage_close_rsp, 0u, emu_data_storage_close),
+    EMU_CMD(SAB_DATA_STORAGE_REQ, struct sab_cmd_data_storage_rsp, 0u, emu_data_storage),
+    EMU_CMD(SAB_STORAGE_OPEN_REQ, struct sab_cmd_storage_open_rsp, 0u, emu_storage_open),
+    EMU_CMD(SAB_STORAGE_CLOSE_REQ, struct sab_cmd_storage_close_rsp, 0u, emu_storage_close),
+    EMU_CMD(SAB_STORAGE_MASTER_IMPORT_REQ, struct sab_cmd_key_store_import_rsp, 0u, emu_storage_import),
+    EMU_CMD(SAB_SHE_UTILS_OPEN, struct sab_cmd_she_utils_open_rsp, 0u, emu_she_utils_open),
+    EMU_CMD(SAB_SHE_UTILS_CLOSE, struct sab_cmd_she_utils_close_rsp, 0u, emu_she_utils_close),
+    EMU_CMD(SAB_SHE_KEY_UPDATE, struct sab_she_key_update_rsp, 1u, emu_she_key_update),
+    EMU_CMD(SAB_SHE_PLAIN_KEY_UPDATE, struct she_cmd_load_plain_key_rsp, 0u, emu_she_plain_key_update),
+    EMU_CMD(SAB_SHE_PLAIN_KEY_EXPORT, struct sab_she_plain_key_export_rsp, 1u, emu_she_plain_key_export),
+    EMU_CMD(SAB_SHE_GET_ID, struct she_cmd_get_id_rsp, 1u, emu_she_get_id),
+    EMU_CMD(SAB_SHE_GET_STATUS, struct she_cmd_get_status_rsp, 0u, emu_she_get_status),
+    EMU_CMD(SAB_FAST_MAC_REQ, struct sab_she_fast_mac_rsp, 0u, emu_she_fast_mac),
+    EMU_CMD(SAB_SHE_KEY_UPDATE_EXT, struct sab_she_key_update_ext_rsp, 1u, emu_she_key_update_ext),
+};
+
+/*
+ * SECO core.
+ */
+
+/* Execute a command and build its response. */
+static struct emu_msg *emu_process(struct emu_msg *msg, uint64_t *latency)
+{
+    struct sab_mu_hdr *hdr = (struct sab_mu_hdr *)(void *)msg->words;
+    const struct emu_cmd *cmd = NULL;
+    struct emu_msg *rsp_msg;
+    struct emu_ctx ctx;
+    uint32_t rsp_len = 2u * (uint32_t)sizeof(uint32_t);
+    uint32_t code;
+    uint32_t i;
+
+    (void)memset(&ctx, 0, sizeof(ctx));
+    ctx.mu_idx = msg->chan->mu;
+    ctx.mu = &emu_mus[ctx.mu_idx];
+    ctx.chan = msg->chan;
+    ctx.bufs = msg->bufs;
+    ctx.cmd = msg->words;
+
+    for (i = 0u; i < (uint32_t)(sizeof(emu_cmds) / sizeof(emu_cmds[0])); i++) {
+        if (emu_cmds[i].id == hdr->command) {
+            cmd = &emu_cmds[i];
+            break;
+        }
+    }
+
+    if ((msg->len < 2u * sizeof(uint32_t)) || (hdr->ver != MESSAGING_VERSION_6)
+        || (hdr->tag != MESSAGING_TAG_COMMAND) || (((uint32_t)hdr->size * sizeof(uint32_t)) != msg->len)) {
+        code = EMU_ERR(SAB_INVALID_MESSAGE_RATING);
+    } else if (cmd == NULL) {
+        code = EMU_ERR(SAB_CMD_NOT_SUPPORTED_RATING);
+    } else {
+        /* Missing trailing fields of the command read as 0. */
+        rsp_len = cmd->rsp_len;
+        code = cmd->handler(&ctx);
+    }
+
+    ctx.rsp[1] = code;
+    seco_fill_rsp_msg_hdr((struct sab_mu_hdr *)(void *)ctx.rsp, hdr->command, rsp_len);
+    if ((cmd != NULL) && (cmd->crc != 0u) && (rsp_len == cmd->rsp_len)) {
+        ctx.rsp[(rsp_len / sizeof(uint32_t)) - 1u] = seco_compute_msg_crc(ctx.rsp, rsp_len - (uint32_t)sizeof(uint32_t));
+    }
+
+    *latency = emu_latency_ns(hdr->command, msg->bufs);
+    rsp_msg = emu_msg_alloc(ctx.rsp, rsp_len);
+    OPENSSL_cleanse(ctx.rsp, sizeof(ctx.rsp));
+    if (rsp_msg != NULL) {
+        rsp_msg->chan = msg->chan;
+        rsp_msg->gen = msg->gen;
+        rsp_msg->bufs = msg->bufs;
+        msg->bufs = NULL;
+    }
+    return rsp_msg;
+}
+
+static void *emu_seco_thread(void *arg)
+{
+    struct emu_msg *msg;
+    struct emu_msg *rsp;
+    struct emu_chan *chan;
+    uint64_t latency;
+
+    (void)arg;
+    (void)pthread_mutex_lock(&emu_lock);
+    for (;;) {
+        while (emu_queue_head == NULL) {
+            (void)pthread_cond_wait(&emu_seco_cond, &emu_lock);
+        }
+        msg = emu_queue_head;
+        emu_queue_head = msg->next;
+        if (emu_queue_head == NULL) {
+            emu_queue_tail = NULL;
+        }
+        chan = msg->chan;
+        if ((chan->in_use == 0u) || (chan->gen != msg->gen)) {
+            /* Channel closed before the command was executed. */
+            emu_msg_free(msg);
+            continue;
+        }
+
+        latency = 0u;
+        rsp = emu_process(msg, &latency);
+        emu_msg_free(msg);
+        if (latency != 0u) {
+            (void)pthread_mutex_unlock(&emu_lock);
+            emu_sleep(latency);
+            (void)pthread_mutex_lock(&emu_lock);
+        }
+        if (rsp != NULL) {
+            if ((chan->in_use != 0u) && (chan->gen == rsp->gen)) {
+                emu_chan_post(chan, rsp);
+            } else {
+                emu_msg_free(rsp);
+            }
+        }
+    }
+    return NULL;
+}
+
+static void emu_latency_set(uint32_t cmd, uint32_t base_us, uint32_t ns_per_byte)
+{
+    struct emu_latency *lat = NULL;
+
+    if (cmd == SECO_EMU_ALL_COMMANDS) {
+        lat = &emu_latency_default;
+    } else if (cmd < (uint32_t)(sizeof(emu_latency) / sizeof(emu_latency[0]))) {
+        lat = &emu_latency[cmd];
+    }
+    if (lat != NULL) {
+        lat->set = 1u;
+        lat->base_us = base_us;
+        lat->ns_per_byte = ns_per_byte;
+    }
+}
+
+/* Parse "<us>[:<ns_per_byte>][,<cmd>=<us>[:<ns_per_byte>]]...". */
+static void emu_latency_parse(const char *str)
+{
+    const char *s = str;
+    char *end;
+    unsigned long v;
+    unsigned long ns;
+    uint32_t cmd;
+
+    while (*s != '\0') {
+        cmd = SECO_EMU_ALL_COMMANDS;
+        v = strtoul(s, &end, 0);
+        if (end == s) {
+            break;
+        }
+        if (*end == '=') {
+            cmd = (uint32_t)v;
+            s = end + 1;
+            v = strtoul(s, &end, 0);
+            if (end == s) {
+                break;
+            }
+        }
+        ns = 0u;
+        if (*end == ':') {
+            s = end + 1;
+            ns = strtoul(s, &end, 0);
+        }
+        emu_latency_set(cmd, (uint32_t)v, (uint32_t)ns);
+        if (*end != ',') {
+            break;
+        }
+        s = end + 1;
+    }
+}
+
+static void emu_init(void)
+{
+    pthread_condattr_t cattr;
+    pthread_attr_t attr;
+    pthread_t thread;
+    const char *env;
+    uint32_t i;
+
+    (void)pthread_condattr_init(&cattr);
+    (void)pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+    (void)pthread_cond_init(&emu_nvm_cond, &cattr);
+    (void)pthread_condattr_destroy(&cattr);
+    for (i = 0u; i < EMU_MAX_CHANNELS; i++) {
+        (void)pthread_cond_init(&emu_chans[i].cond, NULL);
+    }
+
+    env = getenv("SECO_EMU_LATENCY");
+    if (env != NULL) {
+        emu_latency_parse(env);
+    }
+
+    (void)pthread_attr_init(&attr);
+    (void)pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread, &attr, emu_seco_thread, NULL) == 0) {
+        emu_ready = 1u;
+    }
+    (void)pthread_attr_destroy(&attr);
+}
+
+/*
+ * Public API.
+ */
+
+void seco_emu_set_latency(uint32_t cmd, uint32_t base_us, uint32_t ns_per_byte)
+{
+    (void)pthread_once(&emu_once, emu_init);
+    (void)pthread_mutex_lock(&emu_lock);
+    emu_latency_set(cmd, base_us, ns_per_byte);
+    (void)pthread_mutex_unlock(&emu_lock);
+}
+
+int32_t seco_emu_open(const char *path, int32_t flags)
+{
+    struct emu_chan *chan = NULL;
+    unsigned int mu = 0u;
+    unsigned int ch = 0u;
+    int32_t fd;
+    uint32_t i;
+
+    (void)flags;
+    (void)pthread_once(&emu_once, emu_init);
+    if (emu_ready == 0u) {
+        errno = ENODEV;
+        return -1;
+    }
+    if ((sscanf(path, "/dev/seco_mu%u_ch%u", &mu, &ch) != 2) || (mu < 1u) || (mu > EMU_NB_MU)) {
+        errno = ENOENT;
+        return -1;
+    }
+    fd = eventfd(0u, EFD_SEMAPHORE | EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+
+    (void)pthread_mutex_lock(&emu_lock);
+    for (i = 0u; i < EMU_MAX_CHANNELS; i++) {
+        if (emu_chans[i].in_use == 0u) {
+            chan = &emu_chans[i];
+            break;
+        }
+    }
+    if (chan != NULL) {
+        chan->in_use = 1u;
+        chan->mu = (uint8_t)(mu - 1u);
+        chan->cmd_rcv = 0u;
+        chan->fd = fd;
+        chan->gen++;
+        chan->head = NULL;
+        chan->tail = NULL;
+        chan->pending = NULL;
+        chan->outstanding = 0u;
+        (void)memset(chan->reg, 0, sizeof(chan->reg));
+        chan->reg_next = 0u;
+        chan->ddr_next = 0u;
+        chan->shared_off = 0u;
+        chan->shared_size = 0u;
+        chan->shared_pos = 0u;
+    }
+    (void)pthread_mutex_unlock(&emu_lock);
+
+    if (chan == NULL) {
+        (void)close(fd);
+        errno = EMFILE;
+        fd = -1;
+    }
+    return fd;
+}
+
+int32_t seco_emu_close(int32_t fd)
+{
+    struct emu_chan *chan;
+    struct emu_mu *mu;
+    struct emu_msg *msg;
+    uint32_t i;
+
+    (void)pthread_mutex_lock(&emu_lock);
+    chan = emu_fd_to_chan(fd);
+    if (chan == NULL) {
+        (void)pthread_mutex_unlock(&emu_lock);
+        errno = EBADF;
+        return -1;
+    }
+    for (i = 0u; i < EMU_MAX_SESSIONS; i++) {
+        if ((emu_sessions[i].hdl != 0u) && (emu_sessions[i].chan == chan)) {
+            emu_session_close(&emu_sessions[i]);
+        }
+    }
+    mu = &emu_mus[chan->mu];
+    if (mu->nvm_chan == chan) {
+        mu->nvm_chan = NULL;
+        mu->storage_hdl = 0u;
+        (void)pthread_cond_broadcast(&emu_nvm_cond);
+    }
+    while (chan->head != NULL) {
+        msg = chan->head;
+        chan->head = msg->next;
+        emu_msg_free(msg);
+    }
+    chan->tail = NULL;
+    emu_bufs_free(chan->pending, false);
+    chan->pending = NULL;
+    chan->in_use = 0u;
+    chan->fd = -1;
+    (void)pthread_cond_broadcast(&chan->cond);
+    (void)pthread_mutex_unlock(&emu_lock);
+
+    return close(fd);
+}
+
+ssize_t seco_emu_read(int32_t fd, void *buf, size_t len)
+{
+    struct emu_chan *chan;
+    struct emu_msg *msg;
+    uint64_t cnt;
+    uint32_t gen;
+    int32_t state;
+    ssize_t n;
+    ssize_t ret = -1;
+
+    (void)pthread_mutex_lock(&emu_lock);
+    /* Blocking read is a cancellation point: release the lock if the thread is cancelled. */
+    pthread_cleanup_push(emu_unlock, NULL);
+    chan = emu_fd_to_chan(fd);
+    if (chan != NULL) {
+        gen = chan->gen;
+        while ((chan->in_use != 0u) && (chan->gen == gen) && (chan->head == NULL)) {
+            (void)pthread_cond_wait(&chan->cond, &emu_lock);
+        }
+        /* Like the driver, a message taken is returned to the reader even if cancelled. */
+        (void)pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+        if ((chan->in_use != 0u) && (chan->gen == gen)) {
+            msg = chan->head;
+            chan->head = msg->next;
+            if (chan->head == NULL) {
+                chan->tail = NULL;
+            }
+            n = read(chan->fd, &cnt, sizeof(cnt));
+            (void)n;
+            ret = (ssize_t)((len < msg->len) ? len : msg->len);
+            (void)memcpy(buf, msg->words, (size_t)ret);
+            /* Outputs of the exchange are available once the message is read. */
+            emu_bufs_free(msg->bufs, true);
+            msg->bufs = NULL;
+            if (chan->outstanding > 0u) {
+                chan->outstanding--;
+            }
+            /* Secure memory is reused once no queued command refers to it. */
+            if (chan->outstanding == 0u) {
+                chan->shared_pos = 0u;
+            }
+            emu_msg_free(msg);
+        }
+        (void)pthread_setcancelstate(state, NULL);
+    }
+    if (ret < 0) {
+        errno = EBADF;
+    }
+    pthread_cleanup_pop(1);
+
+    return ret;
+}
+
+ssize_t seco_emu_write(int32_t fd, const void *buf, size_t len)
+{
+    struct emu_chan *chan;
+    struct emu_msg *msg;
+    struct emu_mu *mu;
+    const struct sab_mu_hdr *hdr = (const struct sab_mu_hdr *)buf;
+    ssize_t ret = -1;
+
+    (void)pthread_mutex_lock(&emu_lock);
+    chan = emu_fd_to_chan(fd);
+    if (chan == NULL) {
+        errno = EBADF;
+    } else if ((len < sizeof(uint32_t)) || (len > EMU_MAX_MSG_WORDS * sizeof(uint32_t)) || ((len % sizeof(uint32_t)) != 0u)) {
+        errno = EINVAL;
+    } else if ((hdr->tag != MESSAGING_TAG_RESPONSE) && (chan->outstanding >= EMU_CMD_DEPTH)) {
+        errno = EBUSY;
+    } else if ((msg = emu_msg_alloc(buf, (uint32_t)len)) == NULL) {
+        errno = ENOMEM;
+    } else {
+        msg->chan = chan;
+        msg->gen = chan->gen;
+        msg->bufs = chan->pending;
+        chan->pending = NULL;
+        mu = &emu_mus[chan->mu];
+        if ((chan->cmd_rcv != 0u) && (hdr->tag == MESSAGING_TAG_RESPONSE)) {
+            /* Response of the storage manager to a request of SECO. */
+            if (mu->nvm_chan == chan) {
+                emu_msg_free(mu->nvm_rsp);
+                mu->nvm_rsp = msg;
+                (void)pthread_cond_broadcast(&emu_nvm_cond);
+            } else {
+                emu_msg_free(msg);
+            }
+        } else {
+            chan->outstanding++;
+            msg->next = NULL;
+            if (emu_queue_tail == NULL) {
+                emu_queue_head = msg;
+            } else {
+                emu_queue_tail->next = msg;
+            }
+            emu_queue_tail = msg;
+            (void)pthread_cond_signal(&emu_seco_cond);
+        }
+        ret = (ssize_t)len;
+    }
+    (void)pthread_mutex_unlock(&emu_lock);
+
+    return ret;
+}
+
+/* Transaction: same sequence as an application doing the separate calls. */
+static int32_t emu_xfer(int32_t fd, struct seco_mu_ioctl_xfer *xfer)
+{
+    struct seco_mu_ioctl_setup_iobuf io;
+    struct seco_mu_ioctl_xfer_buf *b;
+    struct emu_chan *chan;
+    uint32_t cmd[EMU_MAX_MSG_WORDS];
+    uint32_t nb_words = xfer->cmd_len / (uint32_t)sizeof(uint32_t);
+    uint16_t addr16;
+    uint32_t addr32;
+    uint32_t i;
+    ssize_t n;
+
+    if (xfer->cmd_len == 0u) {
+        /* Support check. */
+        return 0;
+    }
+    if ((xfer->cmd_len < sizeof(uint32_t)) || (xfer->cmd_len > sizeof(cmd)) || ((xfer->cmd_len % sizeof(uint32_t)) != 0u)) {
+        errno = EINVAL;
+        return -1;
+    }
+    (void)memcpy(cmd, xfer->cmd, xfer->cmd_len);
+
+    for (i = 0u; i < xfer->nb_bufs; i++) {
+        b = &xfer->bufs[i];
+        io.user_buf = b->user_buf;
+        io.length = b->length;
+        io.flags = b->flags;
+        if (seco_emu_ioctl(fd, SECO_MU_IOCTL_SETUP_IOBUF, &io) != 0) {
+            break;
+        }
+        if (b->cmd_offset == SECO_MU_XFER_NO_ADDR) {
+            continue;
+        }
+        if ((b->flags & SECO_MU_IO_FLAGS_USE_SHORT_ADDR) != 0u) {
+            if (b->cmd_offset > xfer->cmd_len - sizeof(addr16)) {
+                errno = EINVAL;
+                break;
+            }
+            addr16 = (uint16_t)io.seco_addr;
+            (void)memcpy((uint8_t *)cmd + b->cmd_offset, &addr16, sizeof(addr16));
+        } else {
+            if (b->cmd_offset > xfer->cmd_len - sizeof(addr32)) {
+                errno = EINVAL;
+                break;
+            }
+            addr32 = (uint32_t)io.seco_addr;
+            (void)memcpy((uint8_t *)cmd + b->cmd_offset, &addr32, sizeof(addr32));
+        }
+    }
+    if (i < xfer->nb_bufs) {
+        /* Drop the buffers already set up. */
+        (void)pthread_mutex_lock(&emu_lock);
+        chan = emu_fd_to_chan(fd);
+        if (chan != NULL) {
+            emu_bufs_free(chan->pending, false);
+            chan->pending = NULL;
+        }
+        (void)pthread_mutex_unlock(&emu_lock);
+        return -1;
+    }
+    if ((xfer->flags & SECO_MU_XFER_FLAGS_CMD_CRC) != 0u) {
+        cmd[nb_words - 1u] = seco_compute_msg_crc(cmd, xfer->cmd_len - (uint32_t)sizeof(uint32_t));
+    }
+
+    if (seco_emu_write(fd, cmd, xfer->cmd_len) != (ssize_t)xfer->cmd_len) {
+        return -1;
+    }
+    n = seco_emu_read(fd, xfer->rsp, xfer->rsp_len);
+    if (n < 0) {
+        return -1;
+    }
+    xfer->rsp_len = (uint32_t)n;
+
+    return 0;
+}
+
+int32_t seco_emu_ioctl(int32_t fd, unsigned long req, ...)
+{
+    struct seco_mu_ioctl_shared_mem_cfg *cfg;
+    struct seco_mu_ioctl_get_mu_info *info;
+    struct seco_mu_ioctl_setup_iobufs *iobufs;
+    struct emu_chan *chan;
+    uint32_t i;
+    va_list ap;
+    void *arg = NULL;
+    int32_t ret = -1;
+
+    if (req != SECO_MU_IOCTL_ENABLE_CMD_RCV) {
+        va_start(ap, req);
+        arg = va_arg(ap, void *);
+        va_end(ap);
+    }
+    if (req == SECO_MU_IOCTL_XFER) {
+        return emu_xfer(fd, (struct seco_mu_ioctl_xfer *)arg);
+    }
+
+    (void)pthread_mutex_lock(&emu_lock);
+    chan = emu_fd_to_chan(fd);
+    if (chan == NULL) {
+        errno = EBADF;
+    } else {
+        switch (req) {
+        case SECO_MU_IOCTL_ENABLE_CMD_RCV:
+            chan->cmd_rcv = 1u;
+            ret = 0;
+            break;
+        case SECO_MU_IOCTL_SHARED_BUF_CFG:
+            cfg = (struct seco_mu_ioctl_shared_mem_cfg *)arg;
+            if ((cfg->base_offset > EMU_SEC_RAM_SIZE) || (cfg->size > EMU_SEC_RAM_SIZE - cfg->base_offset)) {
+                errno = EINVAL;
+                break;
+            }
+            chan->shared_off = cfg->base_offset;
+            chan->shared_size = cfg->size;
+            chan->shared_pos = 0u;
+            ret = 0;
+            break;
+        case SECO_MU_IOCTL_SETUP_IOBUF:
+            ret = emu_setup_iobuf(chan, (struct seco_mu_ioctl_setup_iobuf *)arg);
+            break;
+        case SECO_MU_IOCTL_REGISTER_BUF:
+            ret = emu_register_buf(chan, (struct seco_mu_ioctl_register_buf *)arg);
+            break;
+        case SECO_MU_IOCTL_UNREGISTER_BUF:
+            ret = emu_unregister_buf(chan, (struct seco_mu_ioctl_register_buf *)arg);
+            break;
+        case SECO_MU_IOCTL_SETUP_IOBUFS:
+            iobufs = (struct seco_mu_ioctl_setup_iobufs *)arg;
+            ret = 0;
+            for (i = 0u; (i < iobufs->nb_iobufs) && (ret == 0); i++) {
+                ret = emu_setup_iobuf(chan, &iobufs->iobufs[i]);
+            }
+            break;
+        case SECO_MU_IOCTL_GET_MU_INFO:
+            info = (struct seco_mu_ioctl_get_mu_info *)arg;
+            info->seco_mu_idx = (uint8_t)(chan->mu + 1u);
+            info->interrupt_idx = 0u;
+            info->tz = 0u;
+            info->did = 0u;
+            ret = 0;
+            break;
+        case SECO_MU_IOCTL_GET_CMD_DEPTH:
+            ((struct seco_mu_ioctl_cmd_depth *)arg)->depth = EMU_CMD_DEPTH;
+            ret = 0;
+            break;
+        default:
+            /* Signed messages are forwarded to the SCU, which is not emulated.
+             * As the seco_mu driver, EINVAL for the commands not known.
+             */
+            errno = EINVAL;
+            break;
+        }
+    }
+    (void)pthread_mutex_unlock(&emu_lock);
+
+    return ret;
+}
+
+/* Mapping of the MU device: the secure RAM partition configured as shared buffer. */
+void *seco_emu_mmap(int32_t fd, size_t len)
+{
+    struct emu_chan *chan;
+    void *addr = MAP_FAILED;
+
+    (void)pthread_mutex_lock(&emu_lock);
+    chan = emu_fd_to_chan(fd);
+    if (chan == NULL) {
+        errno = EBADF;
+    } else if ((chan->shared_size == 0u) || (len == 0u) || (len > chan->shared_size)) {
+        errno = EINVAL;
+    } else {
+        addr = &emu_mus[chan->mu].sec_ram[chan->shared_off];
+    }
+    (void)pthread_mutex_unlock(&emu_lock);
+
+    return addr;
+}
+
+int32_t seco_emu_munmap(void *addr, size_t len)
+{
+    /* Secure RAM stays allocated with the emulated MU. */
+    (void)addr;
+    (void)len;
+    return 0;
+}
+
+const char *seco_emu_storage_path(const char *path, char *buf, uint32_t size)
+{
+    const char *root = getenv("SECO_EMU_ROOT");
+    const char *ret = path;
+    char *p;
+    int n;
+
+    if ((root != NULL) && (root[0] != '\0') && (path != NULL)) {
+        n = snprintf(buf, size, "%s%s", root, path);
+        if ((n > 0) && ((uint32_t)n < size)) {
+            /* Create the missing parent directories. */
+            for (p = strchr(buf + 1, '/'); p != NULL; p = strchr(p + 1, '/')) {
+                *p = '\0';
+                (void)mkdir(buf, S_IRWXU);
+                *p = '/';
+            }
+            ret = buf;
+        }
+    }
+    return ret;
+}
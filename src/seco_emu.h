@@ -0,0 +1,85 @@
+/*
+ * Copyright 2019 NXP
+ *
+ * NXP Confidential.
+ * This software is owned or controlled by NXP and may only be used strictly
+ * in accordance with the applicable license terms.  By expressly accepting
+ * such terms or by downloading, installing, activating and/or otherwise using
+ * the software, you are agreeing that you have read, and that you agree to
+ * comply with and are bound by, such license terms.  If you do not agree to be
+ * bound by the applicable license terms, then you may not retain, install,
+ * activate or otherwise use the software.
+ */
+
+#ifndef SECO_EMU_H
+#define SECO_EMU_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ *  @defgroup group900 SECO emulator
+ * Software model of SECO and of the seco_mu kernel driver.
+ *
+ * When the libraries are built with "make OS_ABS=emu", the Linux OS abstraction
+ * layer sends its MU device calls (open/close/read/write/ioctl on /dev/seco_mu*)
+ * to this module instead of the kernel. The SAB protocol is then executed in
+ * software by an emulated SECO core thread, so that she_lib, hsm_lib and the NVM
+ * manager can be functionally tested and load-tested on any Linux host.
+ *
+ * Execution time of each command can be modelled with a per-command latency:
+ * a fixed part in microseconds plus an optional part proportional to the
+ * payload size. The latency can be set with seco_emu_set_latency() or through
+ * the SECO_EMU_LATENCY environment variable, read when the first device is opened:
+ *
+ *     SECO_EMU_LATENCY="<us>[:<ns_per_byte>][,<cmd>=<us>[:<ns_per_byte>]]..."
+ *
+ * The first field is the default for all commands, then overrides follow per
+ * SAB command ID (e.g. "20,0x82=900" models 20us per command and 900us for
+ * signature verification).
+ *
+ * A latency set for one of the storage requests SECO sends to the NVM manager (e.g. 0xE4,
+ * export finish) delays the sending of this request. They are not delayed by default.
+ *
+ * The storage files written by the NVM manager can be relocated under a
+ * directory given by the SECO_EMU_ROOT environment variable.
+ *  @{
+ */
+
+#define SECO_EMU_ALL_COMMANDS   0xFFFFFFFFu
+
+/**
+ * Set the execution latency modelled for a SAB command.
+ *
+ * \param cmd SAB command ID or SECO_EMU_ALL_COMMANDS.
+ * \param base_us fixed execution time in microseconds.
+ * \param ns_per_byte additional execution time per byte of payload, in nanoseconds.
+ */
+void seco_emu_set_latency(uint32_t cmd, uint32_t base_us, uint32_t ns_per_byte);
+
+/**
+ * Emulated MU device entry points, with the same semantic as the corresponding
+ * system calls on the seco_mu device files.
+ */
+int32_t seco_emu_open(const char *path, int32_t flags);
+int32_t seco_emu_close(int32_t fd);
+ssize_t seco_emu_read(int32_t fd, void *buf, size_t len);
+ssize_t seco_emu_write(int32_t fd, const void *buf, size_t len);
+int32_t seco_emu_ioctl(int32_t fd, unsigned long req, ...);
+void *seco_emu_mmap(int32_t fd, size_t len);
+int32_t seco_emu_munmap(void *addr, size_t len);
+
+/**
+ * Return the location of an NVM storage file, relocated under SECO_EMU_ROOT
+ * when it is set. Missing parent directories are created.
+ *
+ * \param path default location of the file.
+ * \param buf buffer where the relocated path is built.
+ * \param size size of buf.
+ *
+ * \return the path to be used for the file.
+ */
+const char *seco_emu_storage_path(const char *path, char *buf, uint32_t size);
+
+/** @} end of SECO emulator group */
+#endif
@@ -21,6 +21,16 @@ struct seco_mu_ioctl_setup_iobuf {
 	uint32_t flags;
 	uint64_t seco_addr;
 };
+struct seco_mu_ioctl_setup_iobufs {
+	struct seco_mu_ioctl_setup_iobuf *iobufs;
+	uint32_t nb_iobufs;
+};
+struct seco_mu_ioctl_register_buf {
+	uint8_t *user_buf;
+	uint32_t length;
+	uint32_t flags;
+	uint64_t seco_addr;
+};
 struct seco_mu_ioctl_shared_mem_cfg {
 	uint32_t base_offset;
 	uint32_t size;
@@ -39,12 +49,39 @@ struct seco_mu_ioctl_signed_message {
 	uint32_t error_code;
 };
 
+struct seco_mu_ioctl_cmd_depth {
+	uint32_t depth;
+};
+
+struct seco_mu_ioctl_xfer_buf {
+	uint8_t *user_buf;
+	uint32_t length;
+	uint32_t flags;
+	uint32_t cmd_offset;	/* where the SECO address is written in the command. */
+};
+
+struct seco_mu_ioctl_xfer {
+	uint32_t *cmd;
+	uint32_t *rsp;
+	struct seco_mu_ioctl_xfer_buf *bufs;
+	uint32_t cmd_len;
+	uint32_t rsp_len;	/* in: size of rsp, out: length of the response. */
+	uint32_t nb_bufs;
+	uint32_t flags;
+};
+
 #define SECO_MU_IO_FLAGS_IS_INTPUT	(0x01u)
 #define SECO_MU_IO_FLAGS_USE_SEC_MEM	(0x02u)
 #define SECO_MU_IO_FLAGS_USE_SHORT_ADDR	(0x04u)
+/* Buffer in an area registered with SECO_MU_IOCTL_REGISTER_BUF: no copy. */
+#define SECO_MU_IO_FLAGS_REGISTERED	(0x08u)
+
+#define SECO_MU_XFER_NO_ADDR		(0xFFFFFFFFu)
+#define SECO_MU_XFER_FLAGS_CMD_CRC	(0x01u)
 
 #define SECO_MU_IOCTL			0x0A /* like MISC_MAJOR. */
 #define SECO_MU_IOCTL_ENABLE_CMD_RCV	_IO(SECO_MU_IOCTL, 0x01)
+/* Once configured, the shared buffer can be mapped with mmap() at offset 0. */
 #define SECO_MU_IOCTL_SHARED_BUF_CFG	_IOW(SECO_MU_IOCTL, 0x02, \
 			struct seco_mu_ioctl_shared_mem_cfg)
 #define SECO_MU_IOCTL_SETUP_IOBUF	_IOWR(SECO_MU_IOCTL, 0x03, \
@@ -53,5 +90,28 @@ struct seco_mu_ioctl_signed_message {
 			struct seco_mu_ioctl_get_mu_info)
 #define SECO_MU_IOCTL_SIGNED_MESSAGE	_IOWR(SECO_MU_IOCTL, 0x05, \
 			struct seco_mu_ioctl_signed_message)
+/* Number of commands that can be written before reading the first response.
+ * Drivers not implementing it handle a single command at a time.
+ * Numbered apart from the upstream commands: 0x06 is SECO_MU_IOCTL_GET_SOC_INFO there,
+ * with an argument of the same size.
+ */
+#define SECO_MU_IOCTL_GET_CMD_DEPTH	_IOR(SECO_MU_IOCTL, 0x80, \
+			struct seco_mu_ioctl_cmd_depth)
+#define SECO_MU_MAX_CMD_DEPTH		(32u)
+/* Set up the I/O buffers, send the command and read its response in one call.
+ * A transfer without command (cmd_len 0) sends nothing: it only checks that the call is supported.
+ */
+#define SECO_MU_IOCTL_XFER		_IOWR(SECO_MU_IOCTL, 0x07, \
+			struct seco_mu_ioctl_xfer)
+/* Same as SECO_MU_IOCTL_SETUP_IOBUF for an array of buffers. An empty array only checks that
+ * the call is supported.
+ */
+#define SECO_MU_IOCTL_SETUP_IOBUFS	_IOWR(SECO_MU_IOCTL, 0x08, \
+			struct seco_mu_ioctl_setup_iobufs)
+/* Pin a user buffer for the lifetime of the file or until unregistered. */
+#define SECO_MU_IOCTL_REGISTER_BUF	_IOWR(SECO_MU_IOCTL, 0x09, \
+			struct seco_mu_ioctl_register_buf)
+#define SECO_MU_IOCTL_UNREGISTER_BUF	_IOW(SECO_MU_IOCTL, 0x0A, \
+			struct seco_mu_ioctl_register_buf)
 
 #endif
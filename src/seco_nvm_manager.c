@@ -11,19 +11,155 @@
  * activate or otherwise use the software.
  */
 
+#include <pthread.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <time.h>
 #include "seco_os_abs.h"
 #include "seco_sab_msg_def.h"
 #include "seco_sab_messaging.h"
 #include "seco_utils.h"
 #include "seco_nvm.h"
 
+/* Chunks are cached as stored: header followed by the blob. The cache is write-through:
+ * an exported chunk is cached once it is written to the storage. Chunks loaded at start
+ * by the warm-up are resident: they are not part of the LRU list and never evicted.
+ */
+#ifndef SECO_NVM_CACHE_MAX_BYTES
+#define SECO_NVM_CACHE_MAX_BYTES    (256u * 1024u)
+#endif
+#define SECO_NVM_CACHE_BUCKETS      64u
+
+struct seco_nvm_cache_entry {
+    uint64_t blob_id;
+    uint32_t len;
+    uint8_t *data;
+    uint8_t resident;
+    struct seco_nvm_cache_entry *hnext;     /* Next in the bucket. */
+    struct seco_nvm_cache_entry *prev;      /* LRU list, most recently used first. */
+    struct seco_nvm_cache_entry *next;
+};
+
+struct seco_nvm_cache {
+    struct seco_nvm_cache_entry *buckets[SECO_NVM_CACHE_BUCKETS];
+    struct seco_nvm_cache_entry *head;
+    struct seco_nvm_cache_entry *tail;
+    uint32_t bytes;
+    uint32_t lru_bytes;                     /* Bytes of the chunks which can be evicted. */
+    uint32_t entries;
+};
+
+/* Dedup index: what the storage holds for each chunk, so that a chunk exported again
+ * unchanged is acknowledged without being written. Filled when a chunk is written or
+ * read from the storage. The CRC only selects the candidates, the digest decides.
+ */
+#define SECO_NVM_INDEX_BUCKETS      256u
+#define SECO_NVM_DIGEST_SIZE        32u
+
+struct seco_nvm_index_entry {
+    uint64_t blob_id;
+    uint32_t len;                           /* Size of the chunk stored, header included. */
+    uint32_t crc;                           /* CRC of the blob. */
+    uint8_t digest[SECO_NVM_DIGEST_SIZE];   /* SHA-256 of the blob. */
+    struct seco_nvm_index_entry *next;
+};
+
+struct seco_nvm_index {
+    struct seco_nvm_index_entry *buckets[SECO_NVM_INDEX_BUCKETS];
+};
+
+/* Warm-up: all the chunks of the storage are loaded by background threads when the
+ * manager starts, then handed to the cache as resident chunks. The threads only read
+ * the storage: writing a chunk first waits for them to complete.
+ */
+#define SECO_NVM_PREFETCH_MAX_THREADS   8u
+
+struct seco_nvm_prefetch_item {
+    uint64_t blob_id;
+    uint32_t len;
+    uint8_t *data;                          /* Set by the threads once loaded and checked. */
+    uint32_t crc;                           /* Index of the chunk, computed by the threads. */
+    uint8_t digest[SECO_NVM_DIGEST_SIZE];
+};
+
+struct seco_nvm_prefetch {
+    struct seco_os_abs_hdl *phdl;
+    struct seco_nvm_prefetch_item *items;
+    uint32_t nb_items;
+    uint32_t max_items;
+    uint32_t next;                          /* Next item to load, taken atomically by the threads. */
+    uint32_t running;                       /* Threads still loading. */
+    pthread_t threads[SECO_NVM_PREFETCH_MAX_THREADS];
+    uint32_t nb_threads;
+    uint64_t start_us;
+    struct seco_nvm_prefetch_stats *stats;  /* Published to the manager. */
+};
+
+/* Write coalescing: an exported chunk is acknowledged to SECO once kept in memory, its
+ * durable write is deferred. Only the newest payload of each blob_id is kept, written by
+ * a background thread at the end of the window opened by the first pending chunk, or
+ * before the master is exported: SECO exports it to commit its storage.
+ * Requests and flushes are serialized by the lock: only one of them uses the storage.
+ */
+#define SECO_NVM_COALESCE_MAX_CHUNKS    32u
+
+struct seco_nvm_pending {
+    uint64_t blob_id;
+    uint32_t len;
+    uint8_t *data;                          /* Chunk as stored: header followed by the blob. */
+    struct seco_nvm_pending *next;
+};
+
+struct seco_nvm_coalesce {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    uint32_t window_ms;
+    struct seco_nvm_pending *pending;
+    uint32_t nb_pending;
+    uint64_t deadline_us;                   /* End of the window, 0 if nothing is pending. */
+    bool stop;
+};
+
+/* Buffers exchanged with SECO are taken from a pool allocated once per session: page
+ * aligned, locked in memory when possible and registered to the driver, so that export
+ * and import requests neither allocate nor fault and are accessed in place by SECO.
+ * Requests are processed one at a time: two buffers cover the need.
+ * Larger blobs, up to SECO_NVM_MAX_STREAM_SIZE, get a buffer of their own for the request:
+ * SECO reads and writes them in place, they are written to the storage by segments and are
+ * neither cached nor kept for a deferred write.
+ */
+#define SECO_NVM_MAX_BLOB_SIZE      (16u * 1024u)
+#ifndef SECO_NVM_MAX_STREAM_SIZE
+#define SECO_NVM_MAX_STREAM_SIZE    (1024u * 1024u)
+#endif
+#ifndef SECO_NVM_POOL_BUFS
+#define SECO_NVM_POOL_BUFS          2u
+#endif
+#define SECO_NVM_POOL_BUF_SIZE      ((SECO_NVM_MAX_BLOB_SIZE + 2u * (uint32_t)sizeof(struct seco_nvm_header_s) + 4095u) & ~4095u)
+
+struct seco_nvm_pool {
+    uint8_t *base;
+    uint32_t free_mask;                     /* Bit i set when buffer i is available. */
+};
+
 struct seco_nvm_ctx {
     struct seco_os_abs_hdl *phdl;
     uint32_t session_handle;
     uint32_t storage_handle;
     uint32_t blob_size;
+    struct seco_nvm_cache cache;
+    struct seco_nvm_pool pool;
+    struct seco_nvm_prefetch *prefetch;     /* Warm-up not yet handed to the cache. */
+    struct seco_nvm_coalesce *coalesce;     /* Set when chunk writes are deferred. */
+    struct seco_nvm_index index;
+    struct seco_nvm_metrics *metrics;
 };
 
+/* Statistics of the chunk cache, read by other threads. */
+static struct seco_nvm_cache_stats seco_nvm_cache_stats;
+
 struct seco_nvm_header_s {
     uint32_t size;
     uint32_t crc;
@@ -36,21 +172,230 @@ struct nvm_chunk_hdr {
     uint8_t *data;
 };
 
+/* Metrics of each storage, read by other threads. Updated by the thread serving the
+ * channel and by the one writing the deferred chunks.
+ */
+static struct seco_nvm_metrics seco_nvm_metrics[2];     /* SHE, HSM. */
+
+static uint64_t seco_nvm_time_us(void)
+{
+    struct timespec ts;
+
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t)ts.tv_sec * 1000000u) + ((uint64_t)ts.tv_nsec / 1000u);
+}
+
+/* The value itself below 4, then 4 buckets per power of two. */
+static uint32_t seco_nvm_metrics_bucket(uint64_t us)
+{
+    uint32_t exp;
+    uint32_t bucket = (uint32_t)us;
+
+    if (us >= 4u) {
+        exp = 63u - (uint32_t)__builtin_clzll(us);
+        bucket = ((exp - 1u) * 4u) + (uint32_t)((us >> (exp - 2u)) & 3u);
+        if (bucket >= NVM_METRICS_BUCKETS) {
+            bucket = NVM_METRICS_BUCKETS - 1u;
+        }
+    }
+
+    return bucket;
+}
+
+uint64_t seco_nvm_metrics_bucket_us(uint32_t bucket)
+{
+    uint64_t us = bucket;
+
+    if (bucket >= 4u) {
+        us = (uint64_t)(4u + (bucket & 3u)) << ((bucket / 4u) - 1u);
+    }
+
+    return us;
+}
+
+/* Count the time elapsed since start_us. */
+static void seco_nvm_latency_add(struct seco_nvm_latency *lat, uint64_t start_us)
+{
+    uint64_t us = seco_nvm_time_us() - start_us;
+    uint64_t max = __atomic_load_n(&lat->max_us, __ATOMIC_RELAXED);
+
+    __atomic_fetch_add(&lat->count, 1u, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&lat->total_us, us, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&lat->buckets[seco_nvm_metrics_bucket(us)], 1u, __ATOMIC_RELAXED);
+    while ((us > max)
+           && !__atomic_compare_exchange_n(&lat->max_us, &max, us, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        /* max updated with the current value, try again. */
+    }
+}
+
+static void seco_nvm_latency_load(struct seco_nvm_latency *dst, struct seco_nvm_latency *src)
+{
+    uint32_t i;
+
+    dst->count = __atomic_load_n(&src->count, __ATOMIC_RELAXED);
+    dst->total_us = __atomic_load_n(&src->total_us, __ATOMIC_RELAXED);
+    dst->max_us = __atomic_load_n(&src->max_us, __ATOMIC_RELAXED);
+    for (i = 0u; i < NVM_METRICS_BUCKETS; i++) {
+        dst->buckets[i] = __atomic_load_n(&src->buckets[i], __ATOMIC_RELAXED);
+    }
+}
+
+/* Account a storage write started at start_us. */
+static void seco_nvm_metrics_write(struct seco_nvm_metrics *m, uint64_t start_us, uint32_t len, bool done)
+{
+    seco_nvm_latency_add(&m->write, start_us);
+    if (done) {
+        __atomic_fetch_add(&m->bytes_written, len, __ATOMIC_RELAXED);
+    } else {
+        __atomic_fetch_add(&m->write_errors, 1u, __ATOMIC_RELAXED);
+    }
+}
+
+/* Account a storage read started at start_us. */
+static void seco_nvm_metrics_read(struct seco_nvm_metrics *m, uint64_t start_us, int32_t len)
+{
+    seco_nvm_latency_add(&m->read, start_us);
+    if (len > 0) {
+        __atomic_fetch_add(&m->bytes_read, (uint64_t)len, __ATOMIC_RELAXED);
+    }
+}
+
+/* Account a request processed from start_us. */
+static void seco_nvm_metrics_req(struct seco_nvm_metrics *m, uint32_t req, uint64_t start_us, uint32_t err)
+{
+    __atomic_fetch_add(&m->req[req].count, 1u, __ATOMIC_RELAXED);
+    if (err != 0u) {
+        __atomic_fetch_add(&m->req[req].errors, 1u, __ATOMIC_RELAXED);
+    }
+    seco_nvm_latency_add(&m->req[req].total, start_us);
+}
+
+void seco_nvm_get_metrics(uint8_t flags, struct seco_nvm_metrics *metrics)
+{
+    struct seco_nvm_metrics *m = &seco_nvm_metrics[((flags & NVM_FLAGS_SHE) != 0u) ? 0u : 1u];
+    uint32_t i;
+
+    if (metrics != NULL) {
+        for (i = 0u; i < NVM_REQ_NB; i++) {
+            metrics->req[i].count = __atomic_load_n(&m->req[i].count, __ATOMIC_RELAXED);
+            metrics->req[i].errors = __atomic_load_n(&m->req[i].errors, __ATOMIC_RELAXED);
+            metrics->req[i].bytes = __atomic_load_n(&m->req[i].bytes, __ATOMIC_RELAXED);
+            seco_nvm_latency_load(&metrics->req[i].total, &m->req[i].total);
+            seco_nvm_latency_load(&metrics->req[i].seco, &m->req[i].seco);
+        }
+        seco_nvm_latency_load(&metrics->write, &m->write);
+        metrics->write_errors = __atomic_load_n(&m->write_errors, __ATOMIC_RELAXED);
+        metrics->write_skipped = __atomic_load_n(&m->write_skipped, __ATOMIC_RELAXED);
+        metrics->bytes_written = __atomic_load_n(&m->bytes_written, __ATOMIC_RELAXED);
+        seco_nvm_latency_load(&metrics->read, &m->read);
+        metrics->bytes_read = __atomic_load_n(&m->bytes_read, __ATOMIC_RELAXED);
+    }
+}
+
+/* Lowest value of the bucket holding the given percentile. */
+static uint64_t seco_nvm_latency_percentile(const struct seco_nvm_latency *lat, uint32_t percent)
+{
+    uint64_t rank = ((lat->count * percent) + 99u) / 100u;
+    uint64_t seen = 0u;
+    uint32_t i;
+
+    for (i = 0u; (i < NVM_METRICS_BUCKETS - 1u) && (seen + lat->buckets[i] < rank); i++) {
+        seen += lat->buckets[i];
+    }
+
+    return (lat->count != 0u) ? seco_nvm_metrics_bucket_us(i) : 0u;
+}
+
+/* Append to the text being formatted, len counting the whole text as snprintf. */
+static void seco_nvm_format(char *buf, uint32_t size, uint32_t *len, const char *fmt, ...)
+{
+    va_list ap;
+    int32_t n;
+
+    va_start(ap, fmt);
+    n = vsnprintf((*len < size) ? (buf + *len) : NULL, (*len < size) ? (size - *len) : 0u, fmt, ap);
+    va_end(ap);
+    *len += (n > 0) ? (uint32_t)n : 0u;
+}
+
+static void seco_nvm_format_latency(char *buf, uint32_t size, uint32_t *len, const char *name, const struct seco_nvm_latency *lat)
+{
+    seco_nvm_format(buf, size, len, " %s_us avg %llu p50 %llu p99 %llu max %llu", name,
+                    (unsigned long long)((lat->count != 0u) ? (lat->total_us / lat->count) : 0u),
+                    (unsigned long long)seco_nvm_latency_percentile(lat, 50u),
+                    (unsigned long long)seco_nvm_latency_percentile(lat, 99u),
+                    (unsigned long long)lat->max_us);
+}
+
+int32_t seco_nvm_format_metrics(uint8_t flags, char *buf, uint32_t size)
+{
+    static const uint8_t storage_flags[2] = {NVM_FLAGS_SHE, NVM_FLAGS_HSM};
+    static const char *const storage_names[2] = {"she", "hsm"};
+    static const char *const req_names[NVM_REQ_NB] = {"master_import", "master_export", "chunk_export", "chunk_get"};
+    struct seco_nvm_metrics *m;
+    uint32_t len = 0u;
+    uint32_t i;
+    uint32_t j;
+    int32_t ret = -1;
+
+    if (buf == NULL) {
+        size = 0u;
+    } else if (size != 0u) {
+        buf[0] = '\0';
+    }
+
+    /* Too large for the stack of the caller. */
+    m = (struct seco_nvm_metrics *)seco_os_abs_malloc((uint32_t)sizeof(struct seco_nvm_metrics));
+    for (i = 0u; (m != NULL) && (i < 2u); i++) {
+        if ((flags & storage_flags[i]) == 0u) {
+            continue;
+        }
+        seco_nvm_get_metrics(storage_flags[i], m);
+        for (j = 0u; j < NVM_REQ_NB; j++) {
+            seco_nvm_format(buf, size, &len, "%s %s count %llu errors %llu bytes %llu", storage_names[i], req_names[j],
+                            (unsigned long long)m->req[j].count, (unsigned long long)m->req[j].errors,
+                            (unsigned long long)m->req[j].bytes);
+            seco_nvm_format_latency(buf, size, &len, "total", &m->req[j].total);
+            seco_nvm_format_latency(buf, size, &len, "seco", &m->req[j].seco);
+            seco_nvm_format(buf, size, &len, "\n");
+        }
+        seco_nvm_format(buf, size, &len, "%s storage_write count %llu errors %llu skipped %llu bytes %llu", storage_names[i],
+                        (unsigned long long)m->write.count, (unsigned long long)m->write_errors,
+                        (unsigned long long)m->write_skipped, (unsigned long long)m->bytes_written);
+        seco_nvm_format_latency(buf, size, &len, "write", &m->write);
+        seco_nvm_format(buf, size, &len, "\n%s storage_read count %llu bytes %llu", storage_names[i],
+                        (unsigned long long)m->read.count, (unsigned long long)m->bytes_read);
+        seco_nvm_format_latency(buf, size, &len, "read", &m->read);
+        seco_nvm_format(buf, size, &len, "\n");
+    }
+    if (m != NULL) {
+        seco_os_abs_free(m);
+        ret = (int32_t)len;
+    }
+
+    return ret;
+}
+
 /* Storage import processing. Return 0 on success.  */
 static uint32_t seco_nvm_storage_import(struct seco_nvm_ctx *nvm_ctx, uint8_t *data, uint32_t len)
 {
     struct sab_cmd_key_store_import_msg msg;
     struct sab_cmd_key_store_import_rsp rsp;
-    uint64_t seco_addr;
+    struct seco_os_abs_buf bufs[1];
     struct seco_nvm_header_s *blob_hdr;
     uint32_t ret = SAB_FAILURE_STATUS;
     int32_t error;
+    uint64_t start_us;
 
     do {
         if (nvm_ctx->storage_handle == 0u) {
             break;
         }
    
+        if (len < (uint32_t)sizeof(struct seco_nvm_header_s)) {
+            break;
+        }
         blob_hdr = (struct seco_nvm_header_s *)data;
       
         /* Sanity check on the provided data. */
@@ -62,17 +407,21 @@ static uint32_t seco_nvm_storage_import(struct seco_nvm_ctx *nvm_ctx, uint8_t *d
             break;
         }
       
-        seco_addr = seco_os_abs_data_buf(nvm_ctx->phdl, data + sizeof(struct seco_nvm_header_s), blob_hdr->size, DATA_BUF_IS_INPUT);
-  
         /* Prepare command message. */
         seco_fill_cmd_msg_hdr(&msg.hdr, SAB_STORAGE_MASTER_IMPORT_REQ, (uint32_t)sizeof(struct sab_cmd_key_store_import_msg));
         msg.storage_handle = nvm_ctx->storage_handle;
-        msg.key_store_address = (uint32_t)(seco_addr & 0xFFFFFFFFu);
+        msg.key_store_address = 0u;
+        seco_fill_data_buf(&bufs[0], data + sizeof(struct seco_nvm_header_s), blob_hdr->size, DATA_BUF_IS_INPUT,
+                           (uint32_t)offsetof(struct sab_cmd_key_store_import_msg, key_store_address));
         msg.key_store_size = blob_hdr->size;
      
-        error = seco_send_msg_and_get_resp(nvm_ctx->phdl,
+        start_us = seco_nvm_time_us();
+        error = seco_send_msg_with_bufs_and_get_resp(nvm_ctx->phdl,
                     (uint32_t *)&msg, (uint32_t)sizeof(struct sab_cmd_key_store_import_msg),
-                    (uint32_t *)&rsp, (uint32_t)sizeof(struct sab_cmd_key_store_import_rsp));
+                    (uint32_t *)&rsp, (uint32_t)sizeof(struct sab_cmd_key_store_import_rsp),
+                    bufs, 1u, 0u);
+        seco_nvm_latency_add(&nvm_ctx->metrics->req[NVM_REQ_MASTER_IMPORT].seco, start_us);
+        __atomic_fetch_add(&nvm_ctx->metrics->req[NVM_REQ_MASTER_IMPORT].bytes, blob_hdr->size, __ATOMIC_RELAXED);
         if (error != 0) {        
             break;
         }
@@ -82,9 +431,658 @@ static uint32_t seco_nvm_storage_import(struct seco_nvm_ctx *nvm_ctx, uint8_t *d
     return ret;
 }
 
+static uint32_t seco_nvm_cache_bucket(uint64_t blob_id)
+{
+    return (uint32_t)((blob_id * 0x9E3779B97F4A7C15ull) >> 58);
+}
+
+static void seco_nvm_cache_publish(struct seco_nvm_cache *cache)
+{
+    __atomic_store_n(&seco_nvm_cache_stats.entries, cache->entries, __ATOMIC_RELAXED);
+    __atomic_store_n(&seco_nvm_cache_stats.bytes, cache->bytes, __ATOMIC_RELAXED);
+}
+
+static void seco_nvm_cache_unlink(struct seco_nvm_cache *cache, struct seco_nvm_cache_entry *e)
+{
+    if (e->prev != NULL) {
+        e->prev->next = e->next;
+    } else {
+        cache->head = e->next;
+    }
+    if (e->next != NULL) {
+        e->next->prev = e->prev;
+    } else {
+        cache->tail = e->prev;
+    }
+    e->prev = NULL;
+    e->next = NULL;
+}
+
+static void seco_nvm_cache_push_front(struct seco_nvm_cache *cache, struct seco_nvm_cache_entry *e)
+{
+    e->prev = NULL;
+    e->next = cache->head;
+    if (cache->head != NULL) {
+        cache->head->prev = e;
+    } else {
+        cache->tail = e;
+    }
+    cache->head = e;
+}
+
+static struct seco_nvm_cache_entry *seco_nvm_cache_lookup(struct seco_nvm_cache *cache, uint64_t blob_id)
+{
+    struct seco_nvm_cache_entry *e = cache->buckets[seco_nvm_cache_bucket(blob_id)];
+
+    while ((e != NULL) && (e->blob_id != blob_id)) {
+        e = e->hnext;
+    }
+
+    return e;
+}
+
+/* Look for a chunk and make it the most recently used. */
+static struct seco_nvm_cache_entry *seco_nvm_cache_find(struct seco_nvm_cache *cache, uint64_t blob_id)
+{
+    struct seco_nvm_cache_entry *e = seco_nvm_cache_lookup(cache, blob_id);
+
+    if ((e != NULL) && (e->resident == 0u)) {
+        seco_nvm_cache_unlink(cache, e);
+        seco_nvm_cache_push_front(cache, e);
+    }
+
+    return e;
+}
+
+static void seco_nvm_cache_remove(struct seco_nvm_cache *cache, uint64_t blob_id)
+{
+    struct seco_nvm_cache_entry **pe = &cache->buckets[seco_nvm_cache_bucket(blob_id)];
+    struct seco_nvm_cache_entry *e;
+
+    while ((*pe != NULL) && ((*pe)->blob_id != blob_id)) {
+        pe = &(*pe)->hnext;
+    }
+    e = *pe;
+    if (e != NULL) {
+        *pe = e->hnext;
+        if (e->resident == 0u) {
+            seco_nvm_cache_unlink(cache, e);
+            cache->lru_bytes -= e->len;
+        }
+        cache->bytes -= e->len;
+        cache->entries--;
+        seco_os_abs_free(e->data);
+        seco_os_abs_free(e);
+        seco_nvm_cache_publish(cache);
+    }
+}
+
+/* Insert a chunk, taking ownership of data. Least recently used chunks are evicted to
+ * stay within the size of the cache, resident chunks are not counted. Return 0 if the
+ * chunk is cached.
+ */
+static uint32_t seco_nvm_cache_add(struct seco_nvm_cache *cache, uint64_t blob_id, uint8_t *data, uint32_t len, bool resident)
+{
+    struct seco_nvm_cache_entry *e = NULL;
+    uint32_t b;
+    uint32_t err = 1u;
+
+    do {
+        seco_nvm_cache_remove(cache, blob_id);
+        if (!resident) {
+            if (len > SECO_NVM_CACHE_MAX_BYTES) {
+                break;
+            }
+            while ((cache->tail != NULL) && ((cache->lru_bytes + len) > SECO_NVM_CACHE_MAX_BYTES)) {
+                seco_nvm_cache_remove(cache, cache->tail->blob_id);
+            }
+        }
+        e = (struct seco_nvm_cache_entry *)seco_os_abs_malloc((uint32_t)sizeof(struct seco_nvm_cache_entry));
+        if (e == NULL) {
+            break;
+        }
+        b = seco_nvm_cache_bucket(blob_id);
+        e->blob_id = blob_id;
+        e->len = len;
+        e->data = data;
+        e->resident = resident ? 1u : 0u;
+        e->prev = NULL;
+        e->next = NULL;
+        e->hnext = cache->buckets[b];
+        cache->buckets[b] = e;
+        if (!resident) {
+            seco_nvm_cache_push_front(cache, e);
+            cache->lru_bytes += len;
+        }
+        cache->bytes += len;
+        cache->entries++;
+        seco_nvm_cache_publish(cache);
+        err = 0u;
+    } while (false);
+
+    return err;
+}
+
+/* Insert or update a chunk. A resident chunk stays resident. */
+static uint32_t seco_nvm_cache_insert(struct seco_nvm_cache *cache, uint64_t blob_id, uint8_t *data, uint32_t len)
+{
+    struct seco_nvm_cache_entry *e = seco_nvm_cache_lookup(cache, blob_id);
+
+    return seco_nvm_cache_add(cache, blob_id, data, len, (e != NULL) && (e->resident != 0u));
+}
+
+static void seco_nvm_cache_clear(struct seco_nvm_cache *cache)
+{
+    uint32_t i;
+
+    for (i = 0u; i < SECO_NVM_CACHE_BUCKETS; i++) {
+        while (cache->buckets[i] != NULL) {
+            seco_nvm_cache_remove(cache, cache->buckets[i]->blob_id);
+        }
+    }
+}
+
+void seco_nvm_get_cache_stats(struct seco_nvm_cache_stats *stats)
+{
+    if (stats != NULL) {
+        stats->hits = __atomic_load_n(&seco_nvm_cache_stats.hits, __ATOMIC_RELAXED);
+        stats->misses = __atomic_load_n(&seco_nvm_cache_stats.misses, __ATOMIC_RELAXED);
+        stats->entries = __atomic_load_n(&seco_nvm_cache_stats.entries, __ATOMIC_RELAXED);
+        stats->bytes = __atomic_load_n(&seco_nvm_cache_stats.bytes, __ATOMIC_RELAXED);
+    }
+}
+
+static void seco_nvm_pool_init(struct seco_nvm_ctx *nvm_ctx)
+{
+    struct seco_nvm_pool *pool = &nvm_ctx->pool;
+
+    pool->base = seco_os_abs_malloc_locked(SECO_NVM_POOL_BUFS * SECO_NVM_POOL_BUF_SIZE);
+    if (pool->base != NULL) {
+        pool->free_mask = (1u << SECO_NVM_POOL_BUFS) - 1u;
+        /* Without registration the buffers are still set up for each request. */
+        (void)seco_os_abs_register_buf(nvm_ctx->phdl, pool->base, SECO_NVM_POOL_BUFS * SECO_NVM_POOL_BUF_SIZE, NULL);
+    }
+}
+
+static void seco_nvm_pool_release(struct seco_nvm_ctx *nvm_ctx)
+{
+    struct seco_nvm_pool *pool = &nvm_ctx->pool;
+
+    if (pool->base != NULL) {
+        (void)seco_os_abs_unregister_buf(nvm_ctx->phdl, pool->base);
+        seco_os_abs_free_locked(pool->base, SECO_NVM_POOL_BUFS * SECO_NVM_POOL_BUF_SIZE);
+        pool->base = NULL;
+        pool->free_mask = 0u;
+    }
+}
+
+/* Get a buffer for a request. Allocated if the pool cannot provide it. */
+static uint8_t *seco_nvm_buf_get(struct seco_nvm_ctx *nvm_ctx, uint32_t size)
+{
+    struct seco_nvm_pool *pool = &nvm_ctx->pool;
+    uint8_t *buf = NULL;
+    uint32_t i;
+
+    if ((size <= SECO_NVM_POOL_BUF_SIZE) && (pool->free_mask != 0u)) {
+        i = (uint32_t)__builtin_ctz(pool->free_mask);
+        pool->free_mask &= ~(1u << i);
+        buf = pool->base + (i * SECO_NVM_POOL_BUF_SIZE);
+    } else {
+        buf = seco_os_abs_malloc(size);
+    }
+
+    return buf;
+}
+
+static void seco_nvm_buf_put(struct seco_nvm_ctx *nvm_ctx, uint8_t *buf)
+{
+    struct seco_nvm_pool *pool = &nvm_ctx->pool;
+    uint32_t i;
+
+    if ((pool->base != NULL) && (buf >= pool->base)
+        && (buf < (pool->base + (SECO_NVM_POOL_BUFS * SECO_NVM_POOL_BUF_SIZE)))) {
+        i = (uint32_t)(buf - pool->base) / SECO_NVM_POOL_BUF_SIZE;
+        pool->free_mask |= (1u << i);
+    } else {
+        seco_os_abs_free(buf);
+    }
+}
+
+/* Cache a copy of a chunk once the request using it is completed. */
+static void seco_nvm_cache_copy(struct seco_nvm_ctx *nvm_ctx, uint64_t blob_id, uint8_t *data, uint32_t len)
+{
+    uint8_t *copy = seco_os_abs_malloc(len);
+
+    if (copy != NULL) {
+        seco_os_abs_memcpy(copy, data, len);
+        if (seco_nvm_cache_insert(&nvm_ctx->cache, blob_id, copy, len) != 0u) {
+            seco_os_abs_free(copy);
+        }
+    }
+}
+
+static uint32_t seco_nvm_index_bucket(uint64_t blob_id)
+{
+    return (uint32_t)((blob_id * 0x9E3779B97F4A7C15ull) >> 56);
+}
+
+static struct seco_nvm_index_entry *seco_nvm_index_lookup(struct seco_nvm_index *index, uint64_t blob_id)
+{
+    struct seco_nvm_index_entry *e = index->buckets[seco_nvm_index_bucket(blob_id)];
+
+    while ((e != NULL) && (e->blob_id != blob_id)) {
+        e = e->next;
+    }
+
+    return e;
+}
+
+static void seco_nvm_index_remove(struct seco_nvm_index *index, uint64_t blob_id)
+{
+    struct seco_nvm_index_entry **pe = &index->buckets[seco_nvm_index_bucket(blob_id)];
+    struct seco_nvm_index_entry *e;
+
+    while ((*pe != NULL) && ((*pe)->blob_id != blob_id)) {
+        pe = &(*pe)->next;
+    }
+    e = *pe;
+    if (e != NULL) {
+        *pe = e->next;
+        seco_os_abs_free(e);
+    }
+}
+
+/* Record what the storage holds for a chunk. Without memory the chunk is just not indexed. */
+static void seco_nvm_index_set(struct seco_nvm_index *index, uint64_t blob_id, uint32_t len, uint32_t crc, uint8_t *digest)
+{
+    struct seco_nvm_index_entry *e = seco_nvm_index_lookup(index, blob_id);
+    uint32_t b;
+
+    if (e == NULL) {
+        e = (struct seco_nvm_index_entry *)seco_os_abs_malloc((uint32_t)sizeof(struct seco_nvm_index_entry));
+        if (e != NULL) {
+            b = seco_nvm_index_bucket(blob_id);
+            e->blob_id = blob_id;
+            e->next = index->buckets[b];
+            index->buckets[b] = e;
+        }
+    }
+    if (e != NULL) {
+        e->len = len;
+        e->crc = crc;
+        seco_os_abs_memcpy(e->digest, digest, SECO_NVM_DIGEST_SIZE);
+    }
+}
+
+static void seco_nvm_index_clear(struct seco_nvm_index *index)
+{
+    uint32_t i;
+
+    for (i = 0u; i < SECO_NVM_INDEX_BUCKETS; i++) {
+        while (index->buckets[i] != NULL) {
+            seco_nvm_index_remove(index, index->buckets[i]->blob_id);
+        }
+    }
+}
+
+/* Index a chunk read from the storage: its header may come from an older format. */
+static void seco_nvm_index_loaded(struct seco_nvm_index *index, uint64_t blob_id, uint8_t *data, uint32_t len)
+{
+    uint8_t digest[SECO_NVM_DIGEST_SIZE];
+    uint8_t *blob = data + sizeof(struct seco_nvm_header_s);
+    uint32_t size = len - (uint32_t)sizeof(struct seco_nvm_header_s);
+
+    seco_os_abs_sha256(blob, size, digest);
+    seco_nvm_index_set(index, blob_id, len, seco_os_abs_crc(blob, size), digest);
+}
+
+/* Write a chunk, header filled, unless the storage already holds the same one. Return 0
+ * once the chunk is stored.
+ */
+static uint32_t seco_nvm_store_chunk(struct seco_nvm_ctx *nvm_ctx, uint64_t blob_id, uint8_t *data, uint32_t len)
+{
+    struct seco_nvm_header_s *hdr = (struct seco_nvm_header_s *)data;
+    struct seco_nvm_index_entry *e = seco_nvm_index_lookup(&nvm_ctx->index, blob_id);
+    uint8_t digest[SECO_NVM_DIGEST_SIZE];
+    uint8_t diff = 1u;
+    uint32_t err = 0u;
+    uint32_t i;
+    uint64_t start_us;
+
+    seco_os_abs_sha256(data + sizeof(struct seco_nvm_header_s), len - (uint32_t)sizeof(struct seco_nvm_header_s), digest);
+    if ((e != NULL) && (e->len == len) && (e->crc == hdr->crc)) {
+        diff = 0u;
+        for (i = 0u; i < SECO_NVM_DIGEST_SIZE; i++) {
+            diff |= e->digest[i] ^ digest[i];
+        }
+    }
+    if (diff == 0u) {
+        /* Unchanged: neither written nor synced. */
+        __atomic_fetch_add(&nvm_ctx->metrics->write_skipped, 1u, __ATOMIC_RELAXED);
+    } else {
+        start_us = seco_nvm_time_us();
+        err = (seco_os_abs_storage_write_chunk(nvm_ctx->phdl, data, len, blob_id) == (int32_t)len) ? 0u : 1u;
+        seco_nvm_metrics_write(nvm_ctx->metrics, start_us, len, err == 0u);
+        if (err == 0u) {
+            seco_nvm_index_set(&nvm_ctx->index, blob_id, len, hdr->crc, digest);
+        } else {
+            /* What the storage holds is unknown. */
+            seco_nvm_index_remove(&nvm_ctx->index, blob_id);
+        }
+    }
+
+    return err;
+}
+
+/* Called by the last thread of the warm-up, or by the manager if none could be started. */
+static void seco_nvm_prefetch_done(struct seco_nvm_prefetch *pf)
+{
+    __atomic_store_n(&pf->stats->time_us, seco_nvm_time_us() - pf->start_us, __ATOMIC_RELAXED);
+    __atomic_store_n(&pf->stats->state, NVM_PREFETCH_DONE, __ATOMIC_RELEASE);
+}
+
+static void *seco_nvm_prefetch_thread(void *arg)
+{
+    struct seco_nvm_prefetch *pf = (struct seco_nvm_prefetch *)arg;
+    struct seco_nvm_prefetch_item *item;
+    struct seco_nvm_header_s hdr;
+    uint8_t *data;
+    uint32_t i;
+
+    for (i = __atomic_fetch_add(&pf->next, 1u, __ATOMIC_RELAXED); i < pf->nb_items;
+         i = __atomic_fetch_add(&pf->next, 1u, __ATOMIC_RELAXED)) {
+        item = &pf->items[i];
+        data = (item->len >= (uint32_t)sizeof(hdr)) ? seco_os_abs_malloc(item->len) : NULL;
+        /* The storage checks the CRC of the chunk while reading it. */
+        if ((data != NULL)
+            && (seco_os_abs_storage_load_chunk(pf->phdl, item->blob_id, data, item->len) == (int32_t)item->len)) {
+            seco_os_abs_memcpy((uint8_t *)&hdr, data, (uint32_t)sizeof(hdr));
+            if ((hdr.size == item->len) && (hdr.blob_id == item->blob_id)) {
+                seco_os_abs_sha256(data + sizeof(hdr), item->len - (uint32_t)sizeof(hdr), item->digest);
+                item->crc = seco_os_abs_crc(data + sizeof(hdr), item->len - (uint32_t)sizeof(hdr));
+                item->data = data;
+                data = NULL;
+                __atomic_fetch_add(&pf->stats->chunks, 1u, __ATOMIC_RELAXED);
+                __atomic_fetch_add(&pf->stats->bytes, item->len + (uint32_t)sizeof(struct seco_nvm_cache_entry), __ATOMIC_RELAXED);
+            }
+        }
+        if (item->data == NULL) {
+            __atomic_fetch_add(&pf->stats->errors, 1u, __ATOMIC_RELAXED);
+            seco_os_abs_free(data);
+        }
+    }
+
+    if (__atomic_sub_fetch(&pf->running, 1u, __ATOMIC_ACQ_REL) == 0u) {
+        seco_nvm_prefetch_done(pf);
+    }
+
+    return NULL;
+}
+
+static void seco_nvm_prefetch_add(void *arg, uint64_t blob_id, uint32_t size)
+{
+    struct seco_nvm_prefetch *pf = (struct seco_nvm_prefetch *)arg;
+
+    /* Chunks larger than the pool buffers are not kept in memory, they are read on use. */
+    if ((pf->nb_items < pf->max_items) && (size <= SECO_NVM_POOL_BUF_SIZE)) {
+        pf->items[pf->nb_items].blob_id = blob_id;
+        pf->items[pf->nb_items].len = size;
+        pf->items[pf->nb_items].data = NULL;
+        pf->nb_items++;
+    }
+}
+
+/* Start loading all the chunks of the storage on background threads. */
+static void seco_nvm_prefetch_start(struct seco_nvm_ctx *nvm_ctx, uint32_t nb_threads, struct seco_nvm_prefetch_stats *stats)
+{
+    struct seco_nvm_prefetch *pf;
+    int32_t nb;
+    uint32_t i;
+
+    do {
+        pf = (struct seco_nvm_prefetch *)seco_os_abs_malloc((uint32_t)sizeof(struct seco_nvm_prefetch));
+        if (pf == NULL) {
+            break;
+        }
+        seco_os_abs_memset((uint8_t *)pf, 0u, (uint32_t)sizeof(struct seco_nvm_prefetch));
+        pf->phdl = nvm_ctx->phdl;
+        pf->stats = stats;
+        pf->start_us = seco_nvm_time_us();
+        __atomic_store_n(&stats->state, NVM_PREFETCH_RUNNING, __ATOMIC_RELAXED);
+
+        nb = seco_os_abs_storage_enumerate(nvm_ctx->phdl, NULL, NULL);
+        if (nb > 0) {
+            pf->items = (struct seco_nvm_prefetch_item *)seco_os_abs_malloc((uint32_t)nb * (uint32_t)sizeof(struct seco_nvm_prefetch_item));
+            if (pf->items != NULL) {
+                pf->max_items = (uint32_t)nb;
+                (void)seco_os_abs_storage_enumerate(nvm_ctx->phdl, seco_nvm_prefetch_add, pf);
+            }
+        }
+
+        if (nb_threads > SECO_NVM_PREFETCH_MAX_THREADS) {
+            nb_threads = SECO_NVM_PREFETCH_MAX_THREADS;
+        }
+        if (nb_threads > pf->nb_items) {
+            nb_threads = pf->nb_items;
+        }
+        pf->running = nb_threads;
+        for (i = 0u; i < nb_threads; i++) {
+            if (pthread_create(&pf->threads[i], NULL, seco_nvm_prefetch_thread, pf) != 0) {
+                break;
+            }
+        }
+        pf->nb_threads = i;
+        if (nb_threads == 0u) {
+            seco_nvm_prefetch_done(pf);
+        } else if ((i < nb_threads) && (__atomic_sub_fetch(&pf->running, nb_threads - i, __ATOMIC_ACQ_REL) == 0u)) {
+            /* The threads started took the share of the others and are already done. */
+            seco_nvm_prefetch_done(pf);
+        }
+        nvm_ctx->prefetch = pf;
+    } while (false);
+}
+
+/* Wait for the warm-up and hand the chunks loaded to the cache. */
+static void seco_nvm_prefetch_finish(struct seco_nvm_ctx *nvm_ctx)
+{
+    struct seco_nvm_prefetch *pf = nvm_ctx->prefetch;
+    struct seco_nvm_prefetch_item *item;
+    uint32_t i;
+
+    if (pf != NULL) {
+        for (i = 0u; i < pf->nb_threads; i++) {
+            (void)pthread_join(pf->threads[i], NULL);
+        }
+        /* No chunk was written meanwhile: what was loaded is up to date. */
+        for (i = 0u; i < pf->nb_items; i++) {
+            item = &pf->items[i];
+            if (item->data != NULL) {
+                seco_nvm_index_set(&nvm_ctx->index, item->blob_id, item->len, item->crc, item->digest);
+            }
+            if ((item->data != NULL)
+                && (seco_nvm_cache_add(&nvm_ctx->cache, item->blob_id, item->data, item->len, true) != 0u)) {
+                seco_os_abs_free(item->data);
+            }
+        }
+        seco_os_abs_free(pf->items);
+        seco_os_abs_free(pf);
+        nvm_ctx->prefetch = NULL;
+    }
+}
+
+/* Hand the warm-up to the cache if it is complete, without waiting. */
+static void seco_nvm_prefetch_poll(struct seco_nvm_ctx *nvm_ctx)
+{
+    if ((nvm_ctx->prefetch != NULL) && (__atomic_load_n(&nvm_ctx->prefetch->running, __ATOMIC_ACQUIRE) == 0u)) {
+        seco_nvm_prefetch_finish(nvm_ctx);
+    }
+}
+
+static struct seco_nvm_pending *seco_nvm_coalesce_find(struct seco_nvm_coalesce *co, uint64_t blob_id)
+{
+    struct seco_nvm_pending *p = co->pending;
+
+    while ((p != NULL) && (p->blob_id != blob_id)) {
+        p = p->next;
+    }
+
+    return p;
+}
+
+/* Write the pending chunks to the storage, lock held. Written chunks are handed to the
+ * cache, the others stay pending for the next window. Return 0 if all were written.
+ */
+static uint32_t seco_nvm_coalesce_flush(struct seco_nvm_ctx *nvm_ctx)
+{
+    struct seco_nvm_coalesce *co = nvm_ctx->coalesce;
+    struct seco_nvm_pending **pp = &co->pending;
+    struct seco_nvm_pending *p;
+
+    while (*pp != NULL) {
+        p = *pp;
+        if (seco_nvm_store_chunk(nvm_ctx, p->blob_id, p->data, p->len) == 0u) {
+            *pp = p->next;
+            co->nb_pending--;
+            if (seco_nvm_cache_insert(&nvm_ctx->cache, p->blob_id, p->data, p->len) != 0u) {
+                seco_os_abs_free(p->data);
+            }
+            seco_os_abs_free(p);
+        } else {
+            pp = &p->next;
+        }
+    }
+    co->deadline_us = (co->pending != NULL) ? (seco_nvm_time_us() + ((uint64_t)co->window_ms * 1000u)) : 0u;
+
+    return (co->pending != NULL) ? 1u : 0u;
+}
+
+/* Keep the newest payload of a chunk until the next flush, lock held. Takes ownership of
+ * data on success. Return 0 if the chunk is pending.
+ */
+static uint32_t seco_nvm_coalesce_add(struct seco_nvm_ctx *nvm_ctx, uint64_t blob_id, uint8_t *data, uint32_t len)
+{
+    struct seco_nvm_coalesce *co = nvm_ctx->coalesce;
+    struct seco_nvm_pending *p;
+    uint32_t err = 1u;
+
+    do {
+        p = seco_nvm_coalesce_find(co, blob_id);
+        if (p == NULL) {
+            if ((co->nb_pending >= SECO_NVM_COALESCE_MAX_CHUNKS) && (seco_nvm_coalesce_flush(nvm_ctx) != 0u)) {
+                break;
+            }
+            p = (struct seco_nvm_pending *)seco_os_abs_malloc((uint32_t)sizeof(struct seco_nvm_pending));
+            if (p == NULL) {
+                break;
+            }
+            p->blob_id = blob_id;
+            p->next = co->pending;
+            co->pending = p;
+            co->nb_pending++;
+        } else {
+            seco_os_abs_free(p->data);
+        }
+        p->data = data;
+        p->len = len;
+        /* The pending payload is the one served to SECO. */
+        seco_nvm_cache_remove(&nvm_ctx->cache, blob_id);
+        if (co->deadline_us == 0u) {
+            co->deadline_us = seco_nvm_time_us() + ((uint64_t)co->window_ms * 1000u);
+            (void)pthread_cond_signal(&co->cond);
+        }
+        err = 0u;
+    } while (false);
+
+    return err;
+}
+
+static void *seco_nvm_coalesce_thread(void *arg)
+{
+    struct seco_nvm_ctx *nvm_ctx = (struct seco_nvm_ctx *)arg;
+    struct seco_nvm_coalesce *co = nvm_ctx->coalesce;
+    struct timespec ts;
+
+    (void)pthread_mutex_lock(&co->lock);
+    while (!co->stop) {
+        if (co->deadline_us == 0u) {
+            (void)pthread_cond_wait(&co->cond, &co->lock);
+        } else if (seco_nvm_time_us() >= co->deadline_us) {
+            (void)seco_nvm_coalesce_flush(nvm_ctx);
+        } else {
+            ts.tv_sec = (time_t)(co->deadline_us / 1000000u);
+            ts.tv_nsec = (long)((co->deadline_us % 1000000u) * 1000u);
+            (void)pthread_cond_timedwait(&co->cond, &co->lock, &ts);
+        }
+    }
+    (void)pthread_mutex_unlock(&co->lock);
+
+    return NULL;
+}
+
+/* Defer the chunk writes of a session by window_ms. Writes stay synchronous on error. */
+static void seco_nvm_coalesce_start(struct seco_nvm_ctx *nvm_ctx, uint32_t window_ms)
+{
+    struct seco_nvm_coalesce *co;
+    pthread_condattr_t attr;
+
+    do {
+        co = (struct seco_nvm_coalesce *)seco_os_abs_malloc((uint32_t)sizeof(struct seco_nvm_coalesce));
+        if (co == NULL) {
+            break;
+        }
+        seco_os_abs_memset((uint8_t *)co, 0u, (uint32_t)sizeof(struct seco_nvm_coalesce));
+        co->window_ms = window_ms;
+        (void)pthread_mutex_init(&co->lock, NULL);
+        (void)pthread_condattr_init(&attr);
+        (void)pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        (void)pthread_cond_init(&co->cond, &attr);
+        (void)pthread_condattr_destroy(&attr);
+
+        nvm_ctx->coalesce = co;
+        if (pthread_create(&co->thread, NULL, seco_nvm_coalesce_thread, nvm_ctx) != 0) {
+            nvm_ctx->coalesce = NULL;
+            (void)pthread_cond_destroy(&co->cond);
+            (void)pthread_mutex_destroy(&co->lock);
+            seco_os_abs_free(co);
+        }
+    } while (false);
+}
+
+/* Stop deferring the chunk writes and write the pending chunks. */
+static void seco_nvm_coalesce_stop(struct seco_nvm_ctx *nvm_ctx)
+{
+    struct seco_nvm_coalesce *co = nvm_ctx->coalesce;
+    struct seco_nvm_pending *p;
+
+    if (co != NULL) {
+        (void)pthread_mutex_lock(&co->lock);
+        co->stop = true;
+        (void)pthread_cond_signal(&co->cond);
+        (void)pthread_mutex_unlock(&co->lock);
+        (void)pthread_join(co->thread, NULL);
+
+        (void)seco_nvm_coalesce_flush(nvm_ctx);
+        /* Chunks which could not be written are lost. */
+        while (co->pending != NULL) {
+            p = co->pending;
+            co->pending = p->next;
+            seco_os_abs_free(p->data);
+            seco_os_abs_free(p);
+        }
+        (void)pthread_cond_destroy(&co->cond);
+        (void)pthread_mutex_destroy(&co->lock);
+        seco_os_abs_free(co);
+        nvm_ctx->coalesce = NULL;
+    }
+}
+
 static void seco_nvm_close_session(struct seco_nvm_ctx *nvm_ctx)
 {
     if (nvm_ctx != NULL) {
+        seco_nvm_coalesce_stop(nvm_ctx);
+        seco_nvm_prefetch_finish(nvm_ctx);
+        seco_nvm_cache_clear(&nvm_ctx->cache);
+        seco_nvm_index_clear(&nvm_ctx->index);
         if (nvm_ctx->phdl != NULL) {
             if (nvm_ctx->storage_handle != 0u) {
                 (void)sab_close_storage_command (nvm_ctx->phdl, nvm_ctx->storage_handle);
@@ -94,6 +1092,7 @@ static void seco_nvm_close_session(struct seco_nvm_ctx *nvm_ctx)
                 (void)sab_close_session_command (nvm_ctx->phdl, nvm_ctx->session_handle);
                 nvm_ctx->session_handle = 0u;
             }
+            seco_nvm_pool_release(nvm_ctx);
             seco_os_abs_close_session(nvm_ctx->phdl);
             nvm_ctx->phdl = NULL;
         }
@@ -101,7 +1100,7 @@ static void seco_nvm_close_session(struct seco_nvm_ctx *nvm_ctx)
     }
 }
 
-static struct seco_nvm_ctx *seco_nvm_open_session(uint8_t flags)
+static struct seco_nvm_ctx *seco_nvm_open_session(uint8_t flags, const struct seco_nvm_storage_cfg *storage)
 {
     struct seco_nvm_ctx *nvm_ctx = NULL;
     uint32_t err = SAB_FAILURE_STATUS;
@@ -115,6 +1114,7 @@ static struct seco_nvm_ctx *seco_nvm_open_session(uint8_t flags)
         }
 
         seco_os_abs_memset((uint8_t *)nvm_ctx, 0u, (uint32_t)sizeof(struct seco_nvm_ctx));
+        nvm_ctx->metrics = &seco_nvm_metrics[((flags & NVM_FLAGS_SHE) != 0u) ? 0u : 1u];
 
         /* Open the Storage session on the MU */
         if ((flags & NVM_FLAGS_SHE) != 0u) {
@@ -127,6 +1127,12 @@ static struct seco_nvm_ctx *seco_nvm_open_session(uint8_t flags)
         if (nvm_ctx->phdl == NULL) {
             break;
         }
+        seco_nvm_pool_init(nvm_ctx);
+
+        /* Open the backend keeping the storage before anything is requested by SECO. */
+        if (seco_os_abs_storage_open(nvm_ctx->phdl, storage) != 0) {
+            break;
+        }
 
         /* Open the SHE session on SECO side */
         err = sab_open_session_command(nvm_ctx->phdl,
@@ -198,8 +1204,11 @@ static uint32_t seco_nvm_manager_export_master(struct seco_nvm_ctx *nvm_ctx, str
     struct nvm_chunk_hdr *chunk;
     struct sab_cmd_key_store_export_start_rsp resp;
     struct sab_cmd_key_store_export_finish_msg finish_msg;
-    uint64_t seco_addr;
+    struct seco_os_abs_buf bufs[1];
+    uint32_t nb_bufs = 0u;
     struct seco_nvm_header_s *blob_hdr;
+    uint64_t start_us;
+    bool written;
 
     do {
         /* Consistency check of message length. */
@@ -210,24 +1219,26 @@ static uint32_t seco_nvm_manager_export_master(struct seco_nvm_ctx *nvm_ctx, str
         /* Extract length of the blob from the message. */
         nvm_ctx->blob_size = msg->key_store_size;
         data_len = msg->key_store_size + (uint32_t)sizeof(struct seco_nvm_header_s);
-        if ((data_len == 0u) || (data_len > 16u*1024u)) {
-            /* Fixing arbitrary maximum blob size to 16k for sanity checks.*/
+        if ((data_len == 0u) || (data_len > SECO_NVM_MAX_STREAM_SIZE)) {
+            /* Maximum blob size for sanity checks. */
             break;
         }
 
-        /* Allocate memory for receiving data. */
-        data = seco_os_abs_malloc(data_len);
+        /* Get a buffer for receiving data. */
+        data = seco_nvm_buf_get(nvm_ctx, data_len);
         /* If data is NULL the response should be sent to SECO with an error code. Process is stopped after. */
 
         /* Build the response indicating the destination address to SECO. */
         seco_fill_rsp_msg_hdr(&resp.hdr, SAB_STORAGE_MASTER_EXPORT_REQ, (uint32_t)sizeof(struct sab_cmd_key_store_export_start_rsp));
 
         if (data != NULL) {
-            seco_addr = seco_os_abs_data_buf(nvm_ctx->phdl,
-                                            data + (uint32_t)sizeof(struct seco_nvm_header_s),
-                                            nvm_ctx->blob_size,
-                                            0u);
-            resp.key_store_export_address = (uint32_t)(seco_addr & 0xFFFFFFFFu);
+            resp.key_store_export_address = 0u;
+            seco_fill_data_buf(&bufs[0],
+                               data + (uint32_t)sizeof(struct seco_nvm_header_s),
+                               nvm_ctx->blob_size,
+                               0u,
+                               (uint32_t)offsetof(struct sab_cmd_key_store_export_start_rsp, key_store_export_address));
+            nb_bufs = 1u;
             resp.rsp_code = SAB_SUCCESS_STATUS;
         } else {
             resp.key_store_export_address = 0;
@@ -235,7 +1246,8 @@ static uint32_t seco_nvm_manager_export_master(struct seco_nvm_ctx *nvm_ctx, str
         }
         resp.storage_handle = nvm_ctx->storage_handle;
 
-        len = seco_os_abs_send_mu_message(nvm_ctx->phdl, (uint32_t *)&resp, (uint32_t)sizeof(struct sab_cmd_key_store_export_start_rsp));
+        len = seco_os_abs_send_mu_message_with_bufs(nvm_ctx->phdl, (uint32_t *)&resp, (uint32_t)sizeof(struct sab_cmd_key_store_export_start_rsp),
+                                                    bufs, nb_bufs);
         if (len != (int32_t)sizeof(struct sab_cmd_key_store_export_start_rsp)) {
             break;
         }
@@ -245,7 +1257,9 @@ static uint32_t seco_nvm_manager_export_master(struct seco_nvm_ctx *nvm_ctx, str
         }
 
         /* Wait for the message from SECO indicating that the data are available at the specified destination. */
+        start_us = seco_nvm_time_us();
         len = seco_os_abs_read_mu_message(nvm_ctx->phdl, (uint32_t *)&finish_msg, (uint32_t)sizeof(struct sab_cmd_key_store_export_finish_msg));
+        seco_nvm_latency_add(&nvm_ctx->metrics->req[NVM_REQ_MASTER_EXPORT].seco, start_us);
         if ((finish_msg.hdr.command != SAB_STORAGE_EXPORT_FINISH_REQ)
             || (len != (int32_t)sizeof(struct sab_cmd_key_store_export_finish_msg))) {
             break;
@@ -263,18 +1277,32 @@ static uint32_t seco_nvm_manager_export_master(struct seco_nvm_ctx *nvm_ctx, str
         blob_hdr->size = nvm_ctx->blob_size;
         blob_hdr->crc = seco_os_abs_crc(data + sizeof(struct seco_nvm_header_s),  nvm_ctx->blob_size);
         blob_hdr->blob_id = 0u; /* Used only for chunks. */
+        __atomic_fetch_add(&nvm_ctx->metrics->req[NVM_REQ_MASTER_EXPORT].bytes, nvm_ctx->blob_size, __ATOMIC_RELAXED);
         nvm_ctx->blob_size = 0u;
-        /* Data have been provided by SECO. Write them in NVM and acknowledge. */
-        if (seco_os_abs_storage_write(nvm_ctx->phdl, data, data_len) == (int32_t)data_len) {
+        /* Data have been provided by SECO. Write them in NVM and acknowledge once they are durable,
+         * after the chunks still pending: the master must not refer to chunks not yet written.
+         */
+        written = ((nvm_ctx->coalesce == NULL) || (seco_nvm_coalesce_flush(nvm_ctx) == 0u));
+        if (written) {
+            start_us = seco_nvm_time_us();
+            written = (seco_os_abs_storage_write(nvm_ctx->phdl, data, data_len) == (int32_t)data_len);
+            /* Also makes durable the chunks written before, some storages flushing in the background. */
+            written = written && (seco_os_abs_storage_sync(nvm_ctx->phdl) == 0);
+            seco_nvm_metrics_write(nvm_ctx->metrics, start_us, data_len, written);
+        }
+        if (written) {
             /* Success. */
             (void)seco_nvm_export_finish_rsp(nvm_ctx, 0u);
         } else {
             /* Notify SECO of an error during write to NVM. */
+            __atomic_fetch_add(&nvm_ctx->metrics->req[NVM_REQ_MASTER_EXPORT].errors, 1u, __ATOMIC_RELAXED);
             (void)seco_nvm_export_finish_rsp(nvm_ctx, 1u);
         }
     } while (false);
 
-    seco_os_abs_free(data);
+    if (data != NULL) {
+        seco_nvm_buf_put(nvm_ctx, data);
+    }
 
     return err;
 }
@@ -284,89 +1312,129 @@ static uint32_t seco_nvm_manager_export_chunk(struct seco_nvm_ctx *nvm_ctx, stru
     uint32_t err = 1u;
     uint32_t data_len;
     int32_t len = 0;
-    struct nvm_chunk_hdr *chunk = NULL;
+    struct nvm_chunk_hdr chunk = {0};
     struct sab_cmd_key_store_chunk_export_rsp resp;
     struct sab_cmd_key_store_export_finish_msg finish_msg;
-    uint64_t seco_addr;
+    struct seco_os_abs_buf bufs[1];
+    uint32_t nb_bufs = 0u;
     struct seco_nvm_header_s *blob_hdr;
+    uint8_t *copy = NULL;
+    uint32_t crc;
+    bool written = false;
+    bool deferred = false;
+    uint64_t start_us;
 
     do {
         /* Consistency check of message length. */
         if (msg_len != (int32_t)sizeof(struct sab_cmd_key_store_chunk_export_msg)) {
             break;
         }
+        /* The storage is not read by the warm-up while a chunk is written. */
+        seco_nvm_prefetch_finish(nvm_ctx);
+
         /* Extract length of the blob from the message. */
         nvm_ctx->blob_size = msg->chunk_size;
         data_len = msg->chunk_size + (uint32_t)sizeof(struct seco_nvm_header_s);
-        if ((data_len == 0u) || (data_len > 16u*1024u)) {
-            /* Fixing arbitrary maximum blob size to 16k for sanity checks.*/
+        if ((data_len == 0u) || (data_len > SECO_NVM_MAX_STREAM_SIZE)) {
+            /* Maximum blob size for sanity checks. */
             break;
         }
-        /* Allocate memory for receiving data. */
-        chunk = (struct nvm_chunk_hdr *)seco_os_abs_malloc((uint32_t)sizeof(struct nvm_chunk_hdr));
-        if (chunk != NULL) {
-            chunk->data = seco_os_abs_malloc(data_len + (uint32_t)sizeof(struct seco_nvm_header_s));
-            chunk->blob_id = ((uint64_t)(msg->blob_id_ext) << 32u) | (uint64_t)(msg->blob_id);
-            chunk->len = data_len;
-        }
+        /* Get a buffer for receiving data. */
+        chunk.data = seco_nvm_buf_get(nvm_ctx, data_len + (uint32_t)sizeof(struct seco_nvm_header_s));
+        chunk.blob_id = ((uint64_t)(msg->blob_id_ext) << 32u) | (uint64_t)(msg->blob_id);
+        chunk.len = data_len;
         /* If allocation failed the response should be sent to SECO with an error code. Process is stopped after. */
 
         /* Build the response indicating the destination address to SECO. */
         seco_fill_rsp_msg_hdr(&resp.hdr, SAB_STORAGE_CHUNK_EXPORT_REQ, (uint32_t)sizeof(struct sab_cmd_key_store_chunk_export_rsp));
 
-        if ((chunk != NULL) && (chunk->data != NULL)) {
-            seco_addr = seco_os_abs_data_buf(nvm_ctx->phdl,
-                                            chunk->data + (uint32_t)sizeof(struct seco_nvm_header_s),
-                                            nvm_ctx->blob_size,
-                                            0u);
-            resp.chunk_export_address = (uint32_t)(seco_addr & 0xFFFFFFFFu);
+        if (chunk.data != NULL) {
+            resp.chunk_export_address = 0u;
+            seco_fill_data_buf(&bufs[0],
+                               chunk.data + (uint32_t)sizeof(struct seco_nvm_header_s),
+                               nvm_ctx->blob_size,
+                               0u,
+                               (uint32_t)offsetof(struct sab_cmd_key_store_chunk_export_rsp, chunk_export_address));
+            nb_bufs = 1u;
             resp.rsp_code = SAB_SUCCESS_STATUS;
         } else {
             resp.chunk_export_address = 0;
             resp.rsp_code = SAB_FAILURE_STATUS;
         }
 
-        len = seco_os_abs_send_mu_message(nvm_ctx->phdl, (uint32_t *)&resp, (uint32_t)sizeof(struct sab_cmd_key_store_chunk_export_rsp));
+        len = seco_os_abs_send_mu_message_with_bufs(nvm_ctx->phdl, (uint32_t *)&resp, (uint32_t)sizeof(struct sab_cmd_key_store_chunk_export_rsp),
+                                                    bufs, nb_bufs);
         if (len != (int32_t)sizeof(struct sab_cmd_key_store_chunk_export_rsp)) {
             break;
         }
 
-        if ((chunk == NULL) || (chunk->data == NULL)) {
+        if (chunk.data == NULL) {
             break;
         }
 
         /* Wait for the message from SECO indicating that the data are available at the specified destination. */
+        start_us = seco_nvm_time_us();
         len = seco_os_abs_read_mu_message(nvm_ctx->phdl, (uint32_t *)&finish_msg, (uint32_t)sizeof(struct sab_cmd_key_store_export_finish_msg));
+        seco_nvm_latency_add(&nvm_ctx->metrics->req[NVM_REQ_CHUNK_EXPORT].seco, start_us);
         if ((finish_msg.hdr.command != SAB_STORAGE_EXPORT_FINISH_REQ)
             || (len != (int32_t)sizeof(struct sab_cmd_key_store_export_finish_msg))) {
             break;
         }
 
         if (finish_msg.export_status == SAB_EXPORT_STATUS_SUCCESS) {
+            __atomic_fetch_add(&nvm_ctx->metrics->req[NVM_REQ_CHUNK_EXPORT].bytes, msg->chunk_size, __ATOMIC_RELAXED);
 
-            blob_hdr = (struct seco_nvm_header_s *)chunk->data;
-            blob_hdr->size = chunk->len;
-            blob_hdr->crc = seco_os_abs_crc(chunk->data + sizeof(struct seco_nvm_header_s), chunk->len);
-            blob_hdr->blob_id = chunk->blob_id;
-
-            if (seco_os_abs_storage_write_chunk(nvm_ctx->phdl, chunk->data, chunk->len , chunk->blob_id) != (int32_t)(chunk->len)) {
-                err = 1u;
+            /* The copy kept in the cache is made while the CRC of the blob is computed.
+             * Chunks larger than the pool buffers are not copied.
+             */
+            if (chunk.len <= SECO_NVM_POOL_BUF_SIZE) {
+                copy = seco_os_abs_malloc(chunk.len);
+            }
+            if (copy != NULL) {
+                crc = seco_os_abs_crc_copy(copy + sizeof(struct seco_nvm_header_s), chunk.data + sizeof(struct seco_nvm_header_s), msg->chunk_size);
+            } else {
+                crc = seco_os_abs_crc(chunk.data + sizeof(struct seco_nvm_header_s), msg->chunk_size);
+            }
+            blob_hdr = (struct seco_nvm_header_s *)chunk.data;
+            blob_hdr->size = chunk.len;
+            blob_hdr->crc = crc;
+            blob_hdr->blob_id = chunk.blob_id;
+
+            if ((nvm_ctx->coalesce != NULL) && (copy != NULL)) {
+                /* Deferred write: the copy is kept until the chunk is written. */
+                seco_os_abs_memcpy(copy, chunk.data, (uint32_t)sizeof(struct seco_nvm_header_s));
+                if (seco_nvm_coalesce_add(nvm_ctx, chunk.blob_id, copy, chunk.len) == 0u) {
+                    copy = NULL;
+                    deferred = true;
+                }
+            }
+            if (!deferred) {
+                written = (seco_nvm_store_chunk(nvm_ctx, chunk.blob_id, chunk.data, chunk.len) == 0u);
+                if (!written) {
+                    __atomic_fetch_add(&nvm_ctx->metrics->req[NVM_REQ_CHUNK_EXPORT].errors, 1u, __ATOMIC_RELAXED);
+                    seco_nvm_cache_remove(&nvm_ctx->cache, chunk.blob_id);
+                }
             }
         }
-        seco_os_abs_free(chunk->data);
-        seco_os_abs_free(chunk);
 
         /* Send success to SECO. */
         (void)seco_nvm_export_finish_rsp(nvm_ctx, 0);
 
+        if (written && (copy != NULL)) {
+            seco_os_abs_memcpy(copy, chunk.data, (uint32_t)sizeof(struct seco_nvm_header_s));
+            if (seco_nvm_cache_insert(&nvm_ctx->cache, chunk.blob_id, copy, chunk.len) == 0u) {
+                copy = NULL;
+            }
+        }
+
         err = 0u;
     } while (false);
 
-    if (err != 0u) {
-        if (chunk != NULL) {
-            seco_os_abs_free(chunk->data);
-        }
-        seco_os_abs_free(chunk);
+    if (copy != NULL) {
+        seco_os_abs_free(copy);
+    }
+    if (chunk.data != NULL) {
+        seco_nvm_buf_put(nvm_ctx, chunk.data);
     }
 
     return err;
@@ -380,9 +1448,15 @@ static uint32_t seco_nvm_manager_get_chunk(struct seco_nvm_ctx *nvm_ctx, struct
     struct sab_cmd_key_store_chunk_get_done_msg finish_msg;
     struct sab_cmd_key_store_chunk_get_done_rsp finish_rsp;
     uint64_t blob_id;
-    uint64_t seco_addr;
+    struct seco_os_abs_buf bufs[1];
+    uint32_t nb_bufs = 0u;
     int32_t len = 0;
+    uint32_t size;
     uint8_t *data = NULL;
+    uint8_t *blob = NULL;
+    uint64_t start_us;
+    struct seco_nvm_cache_entry *entry;
+    struct seco_nvm_pending *pending;
 
     do {
         /* Consistency check of message length. */
@@ -392,10 +1466,40 @@ static uint32_t seco_nvm_manager_get_chunk(struct seco_nvm_ctx *nvm_ctx, struct
 
         blob_id = ((uint64_t)(msg->blob_id_ext) << 32u) | (uint64_t)msg->blob_id;
 
-        if (seco_os_abs_storage_read_chunk(nvm_ctx->phdl, (uint8_t *)&nvm_hdr, (uint32_t)sizeof(nvm_hdr), blob_id) == (int32_t)sizeof(nvm_hdr)) {
-            data = seco_os_abs_malloc(nvm_hdr.size);
-            if (data != NULL) {;
-                if (seco_os_abs_storage_read_chunk(nvm_ctx->phdl, data, nvm_hdr.size, blob_id) == (int32_t)nvm_hdr.size) {
+        seco_nvm_prefetch_poll(nvm_ctx);
+        pending = (nvm_ctx->coalesce != NULL) ? seco_nvm_coalesce_find(nvm_ctx->coalesce, blob_id) : NULL;
+        entry = (pending == NULL) ? seco_nvm_cache_find(&nvm_ctx->cache, blob_id) : NULL;
+        if (pending != NULL) {
+            __atomic_fetch_add(&seco_nvm_cache_stats.hits, 1u, __ATOMIC_RELAXED);
+            seco_os_abs_memcpy((uint8_t *)&nvm_hdr, pending->data, (uint32_t)sizeof(nvm_hdr));
+            /* Not written meanwhile: the flush waits for the end of the request. */
+            blob = pending->data;
+            err = 0u;
+        } else if (entry != NULL) {
+            __atomic_fetch_add(&seco_nvm_cache_stats.hits, 1u, __ATOMIC_RELAXED);
+            seco_os_abs_memcpy((uint8_t *)&nvm_hdr, entry->data, (uint32_t)sizeof(nvm_hdr));
+            /* Owned by the cache: not evicted before the next request. */
+            blob = entry->data;
+            err = 0u;
+        } else {
+            __atomic_fetch_add(&seco_nvm_cache_stats.misses, 1u, __ATOMIC_RELAXED);
+            size = (uint32_t)seco_os_abs_storage_chunk_size(nvm_ctx->phdl, blob_id);
+            if (size <= SECO_NVM_POOL_BUF_SIZE) {
+                size = SECO_NVM_POOL_BUF_SIZE;
+            }
+            if (size <= SECO_NVM_MAX_STREAM_SIZE) {
+                data = seco_nvm_buf_get(nvm_ctx, size);
+            }
+            if (data != NULL) {
+                start_us = seco_nvm_time_us();
+                len = seco_os_abs_storage_load_chunk(nvm_ctx->phdl, blob_id, data, size);
+                seco_nvm_metrics_read(nvm_ctx->metrics, start_us, len);
+            }
+            if (len >= (int32_t)sizeof(nvm_hdr)) {
+                seco_os_abs_memcpy((uint8_t *)&nvm_hdr, data, (uint32_t)sizeof(nvm_hdr));
+                /* Sanity check on the loaded data. */
+                if (nvm_hdr.size == (uint32_t)len) {
+                    blob = data;
                     err = 0u;
                 }
             }
@@ -405,11 +1509,13 @@ static uint32_t seco_nvm_manager_get_chunk(struct seco_nvm_ctx *nvm_ctx, struct
         seco_fill_rsp_msg_hdr(&resp.hdr, SAB_STORAGE_CHUNK_GET_REQ, (uint32_t)sizeof(struct sab_cmd_key_store_chunk_get_rsp));
         if (err == 0u) {
             resp.chunk_size = nvm_hdr.size - (uint32_t)sizeof(struct seco_nvm_header_s);
-            seco_addr = seco_os_abs_data_buf(nvm_ctx->phdl,
-                                            data + (uint32_t)sizeof(struct seco_nvm_header_s),
-                                            nvm_hdr.size - (uint32_t)sizeof(struct seco_nvm_header_s),
-                                            DATA_BUF_IS_INPUT);
-            resp.chunk_addr =  (uint32_t)(seco_addr & 0xFFFFFFFFu);
+            resp.chunk_addr = 0u;
+            seco_fill_data_buf(&bufs[0],
+                               blob + (uint32_t)sizeof(struct seco_nvm_header_s),
+                               nvm_hdr.size - (uint32_t)sizeof(struct seco_nvm_header_s),
+                               DATA_BUF_IS_INPUT,
+                               (uint32_t)offsetof(struct sab_cmd_key_store_chunk_get_rsp, chunk_addr));
+            nb_bufs = 1u;
             resp.rsp_code = SAB_SUCCESS_STATUS;
         } else {
             resp.chunk_size = 0u;
@@ -418,18 +1524,23 @@ static uint32_t seco_nvm_manager_get_chunk(struct seco_nvm_ctx *nvm_ctx, struct
         }
 
         err = 1u;
-        len = seco_os_abs_send_mu_message(nvm_ctx->phdl, (uint32_t *)&resp, (uint32_t)sizeof(struct sab_cmd_key_store_chunk_get_rsp));
+        len = seco_os_abs_send_mu_message_with_bufs(nvm_ctx->phdl, (uint32_t *)&resp, (uint32_t)sizeof(struct sab_cmd_key_store_chunk_get_rsp),
+                                                    bufs, nb_bufs);
         if (len != (int32_t)sizeof(struct sab_cmd_key_store_chunk_get_rsp)) {
             break;
         }
 
         if (resp.rsp_code == SAB_FAILURE_STATUS) {
+            __atomic_fetch_add(&nvm_ctx->metrics->req[NVM_REQ_CHUNK_GET].errors, 1u, __ATOMIC_RELAXED);
             err = 0u; /* not killing due to this error */
             break;
         }
+        __atomic_fetch_add(&nvm_ctx->metrics->req[NVM_REQ_CHUNK_GET].bytes, resp.chunk_size, __ATOMIC_RELAXED);
 
         /* Wait for the message from SECO indicating that the data are no more in use. */
+        start_us = seco_nvm_time_us();
         len = seco_os_abs_read_mu_message(nvm_ctx->phdl, (uint32_t *)&finish_msg, (uint32_t)sizeof(struct sab_cmd_key_store_chunk_get_done_msg));
+        seco_nvm_latency_add(&nvm_ctx->metrics->req[NVM_REQ_CHUNK_GET].seco, start_us);
         if (
             (finish_msg.hdr.command != SAB_STORAGE_CHUNK_GET_DONE_REQ) || 
             (len != (int32_t)sizeof(struct sab_cmd_key_store_chunk_get_done_msg))
@@ -454,88 +1565,405 @@ static uint32_t seco_nvm_manager_get_chunk(struct seco_nvm_ctx *nvm_ctx, struct
 
     } while (false);
 
-    seco_os_abs_free(data);
+    if (data != NULL) {
+        /* Chunk loaded from the storage: keep it for the next requests. */
+        if (blob == data) {
+            seco_nvm_index_loaded(&nvm_ctx->index, blob_id, data, nvm_hdr.size);
+            if (nvm_hdr.size <= SECO_NVM_POOL_BUF_SIZE) {
+                seco_nvm_cache_copy(nvm_ctx, blob_id, data, nvm_hdr.size);
+            }
+        }
+        seco_nvm_buf_put(nvm_ctx, data);
+    }
 
     return err;
 }
 
 #define MAX_RCV_MSG_SIZE ((uint32_t)sizeof(struct sab_cmd_key_store_chunk_export_msg))
 
-void seco_nvm_manager(uint8_t flags, uint32_t *status)
+/* Give the storage saved in NVM to SECO. */
+static void seco_nvm_import_master(struct seco_nvm_ctx *nvm_ctx)
+{
+    uint8_t *data = NULL;
+    int32_t len;
+    uint32_t err;
+    uint64_t start_us = seco_nvm_time_us();
+
+    /*
+     * Map the whole storage, its header gives the expected length. It is checked
+     * on the mapping and the blob is given to SECO from there.
+     */
+    len = seco_os_abs_storage_map(nvm_ctx->phdl, &data);
+    seco_nvm_metrics_read(nvm_ctx->metrics, start_us, len);
+    if (len > 0) {
+        /* In case of error then start anyway the storage manager process so SECO can create
+         * and export a storage.
+         */
+        err = seco_nvm_storage_import(nvm_ctx, data, (uint32_t)len);
+        seco_os_abs_storage_unmap(nvm_ctx->phdl, data, (uint32_t)len);
+        seco_nvm_metrics_req(nvm_ctx->metrics, NVM_REQ_MASTER_IMPORT, start_us, err);
+    }
+}
+
+/* Receive a message from SECO and process it according its type. Return 0 on success. */
+static uint32_t seco_nvm_process_msg(struct seco_nvm_ctx *nvm_ctx)
 {
-    struct seco_nvm_ctx *nvm_ctx;
-    int32_t len = 0;
-    uint32_t data_len = 0u;
-    struct seco_nvm_header_s nvm_hdr;
     uint32_t recv_msg[MAX_RCV_MSG_SIZE / sizeof(uint32_t)];
     struct sab_mu_hdr *hdr = (struct sab_mu_hdr *)recv_msg;
-    uint32_t err = 0u;
-    uint8_t *data = NULL;
+    int32_t len;
+    uint32_t err;
+    uint32_t req = NVM_REQ_NB;
+    uint64_t start_us;
+
+    len = seco_os_abs_read_mu_message(nvm_ctx->phdl, recv_msg, MAX_RCV_MSG_SIZE);
+    start_us = seco_nvm_time_us();
+    if (nvm_ctx->coalesce != NULL) {
+        (void)pthread_mutex_lock(&nvm_ctx->coalesce->lock);
+    }
+    switch (hdr->command) {
+        case SAB_STORAGE_MASTER_EXPORT_REQ:
+            req = NVM_REQ_MASTER_EXPORT;
+            err = seco_nvm_manager_export_master(nvm_ctx, (struct sab_cmd_key_store_export_start_msg *)recv_msg, len);
+        break;
+        case SAB_STORAGE_CHUNK_EXPORT_REQ:
+            req = NVM_REQ_CHUNK_EXPORT;
+            err = seco_nvm_manager_export_chunk(nvm_ctx, (struct sab_cmd_key_store_chunk_export_msg *)recv_msg, len);
+        break;
+        case SAB_STORAGE_CHUNK_GET_REQ:
+            req = NVM_REQ_CHUNK_GET;
+            err = seco_nvm_manager_get_chunk(nvm_ctx, (struct sab_cmd_key_store_chunk_get_msg *)recv_msg, len);
+        break;
+        default:
+            err = 1u;
+        break;
+    }
+    if (nvm_ctx->coalesce != NULL) {
+        (void)pthread_mutex_unlock(&nvm_ctx->coalesce->lock);
+    }
+    if (req < NVM_REQ_NB) {
+        seco_nvm_metrics_req(nvm_ctx->metrics, req, start_us, err);
+    }
+
+    return err;
+}
+
+static int32_t seco_nvm_serve_msg(struct seco_os_abs_hdl *phdl, void *ctx)
+{
+    (void)phdl;
+
+    /* Stop serving the channel in case of any error. */
+    return (seco_nvm_process_msg((struct seco_nvm_ctx *)ctx) == 0u) ? 0 : -1;
+}
+
+/* Storage manager, run by seco_nvm_manager() or on its own thread by seco_nvm_manager_start(). */
+struct seco_nvm_manager_s {
+    uint8_t flags;
+    uint32_t *status;                       /* Status reported to the caller of seco_nvm_manager(), or NULL. */
+    const struct seco_nvm_storage_cfg *storage; /* Only used while starting. */
+    struct seco_nvm_prefetch_stats prefetch;
+    uint32_t state;
+    struct seco_os_abs_server *server;      /* Set when the manager can be stopped. */
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct seco_nvm_dump *dump;             /* Set when the metrics are dumped periodically. */
+};
+
+/* Periodic text dump of the metrics of the storages served. */
+struct seco_nvm_dump {
+    uint8_t flags;
+    uint32_t period_ms;
+    const char *path;                       /* path_buf, or NULL for stderr. */
+    char path_buf[256];
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool stop;
+};
 
-    if (status != NULL) {
-        *status = NVM_STATUS_STARTING;
+static void seco_nvm_dump_write(struct seco_nvm_dump *dump)
+{
+    int32_t len = seco_nvm_format_metrics(dump->flags, NULL, 0u);
+    char *text = (len >= 0) ? (char *)seco_os_abs_malloc((uint32_t)len + 1u) : NULL;
+
+    if (text != NULL) {
+        len = seco_nvm_format_metrics(dump->flags, text, (uint32_t)len + 1u);
+        if (len >= 0) {
+            (void)seco_os_abs_write_report(dump->path, text, (uint32_t)len);
+        }
+        seco_os_abs_free(text);
+    }
+}
+
+static void *seco_nvm_dump_thread(void *arg)
+{
+    struct seco_nvm_dump *dump = (struct seco_nvm_dump *)arg;
+    uint64_t next_us = seco_nvm_time_us() + ((uint64_t)dump->period_ms * 1000u);
+    struct timespec ts;
+
+    (void)pthread_mutex_lock(&dump->lock);
+    while (!dump->stop) {
+        if (seco_nvm_time_us() >= next_us) {
+            seco_nvm_dump_write(dump);
+            next_us += (uint64_t)dump->period_ms * 1000u;
+        } else {
+            ts.tv_sec = (time_t)(next_us / 1000000u);
+            ts.tv_nsec = (long)((next_us % 1000000u) * 1000u);
+            (void)pthread_cond_timedwait(&dump->cond, &dump->lock, &ts);
+        }
     }
+    (void)pthread_mutex_unlock(&dump->lock);
+
+    return NULL;
+}
+
+static void seco_nvm_dump_start(struct seco_nvm_manager_s *mgr, const struct seco_nvm_storage_cfg *storage)
+{
+    struct seco_nvm_dump *dump;
+    pthread_condattr_t attr;
 
     do {
-        nvm_ctx = seco_nvm_open_session(flags);
-        if (nvm_ctx == NULL) {
+        if ((storage == NULL) || (storage->metrics_dump_ms == 0u)) {
+            break;
+        }
+        dump = (struct seco_nvm_dump *)seco_os_abs_malloc((uint32_t)sizeof(struct seco_nvm_dump));
+        if (dump == NULL) {
             break;
         }
+        seco_os_abs_memset((uint8_t *)dump, 0u, (uint32_t)sizeof(struct seco_nvm_dump));
+        dump->flags = mgr->flags;
+        dump->period_ms = storage->metrics_dump_ms;
+        /* The configuration is not kept by the caller. */
+        if (storage->metrics_path != NULL) {
+            if (snprintf(dump->path_buf, sizeof(dump->path_buf), "%s", storage->metrics_path) >= (int)sizeof(dump->path_buf)) {
+                seco_os_abs_free(dump);
+                break;
+            }
+            dump->path = dump->path_buf;
+        }
+        (void)pthread_mutex_init(&dump->lock, NULL);
+        (void)pthread_condattr_init(&attr);
+        (void)pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        (void)pthread_cond_init(&dump->cond, &attr);
+        (void)pthread_condattr_destroy(&attr);
+
+        if (pthread_create(&dump->thread, NULL, seco_nvm_dump_thread, dump) != 0) {
+            (void)pthread_cond_destroy(&dump->cond);
+            (void)pthread_mutex_destroy(&dump->lock);
+            seco_os_abs_free(dump);
+            break;
+        }
+        mgr->dump = dump;
+    } while (false);
+}
 
-        /*
-         * Try to read the storage header which length is known.
-         * Then if successful extract the full length and read the whole storage into an allocated buffer.
-         */
-        if (seco_os_abs_storage_read(nvm_ctx->phdl, (uint8_t *)&nvm_hdr, (uint32_t)sizeof(nvm_hdr)) == (int32_t)sizeof(nvm_hdr)) {
-            data_len = nvm_hdr.size + (uint32_t)sizeof(nvm_hdr);
-            data = seco_os_abs_malloc(data_len);
-            if (data != NULL) {
-                if (seco_os_abs_storage_read(nvm_ctx->phdl, data, data_len) == (int32_t)data_len) {
-                    /* In case of error then start anyway the storage manager process so SECO can create
-                     * and export a storage.
-                     */
-                    (void)seco_nvm_storage_import(nvm_ctx, data, data_len);
+/* Stop the periodic dump, once the manager is stopped: the last dump holds the final metrics. */
+static void seco_nvm_dump_stop(struct seco_nvm_manager_s *mgr)
+{
+    struct seco_nvm_dump *dump = mgr->dump;
+
+    if (dump != NULL) {
+        (void)pthread_mutex_lock(&dump->lock);
+        dump->stop = true;
+        (void)pthread_cond_signal(&dump->cond);
+        (void)pthread_mutex_unlock(&dump->lock);
+        (void)pthread_join(dump->thread, NULL);
+
+        seco_nvm_dump_write(dump);
+        (void)pthread_cond_destroy(&dump->cond);
+        (void)pthread_mutex_destroy(&dump->lock);
+        seco_os_abs_free(dump);
+        mgr->dump = NULL;
+    }
+}
+
+static void seco_nvm_manager_set_status(struct seco_nvm_manager_s *mgr, uint32_t status)
+{
+    if (mgr->status != NULL) {
+        *mgr->status = status;
+    }
+    (void)pthread_mutex_lock(&mgr->lock);
+    mgr->state = status;
+    (void)pthread_cond_broadcast(&mgr->cond);
+    (void)pthread_mutex_unlock(&mgr->lock);
+}
+
+static void seco_nvm_manager_run(struct seco_nvm_manager_s *mgr)
+{
+    static const uint8_t channel_flags[2] = {NVM_FLAGS_SHE, NVM_FLAGS_HSM};
+    struct seco_nvm_ctx *nvm_ctx[2] = {NULL, NULL};
+    struct seco_os_abs_hdl *phdls[2];
+    struct seco_os_abs_server *server = mgr->server;
+    void *ctxs[2];
+    uint32_t nb = 0u;
+    uint32_t err;
+    uint32_t i;
+
+    seco_nvm_manager_set_status(mgr, NVM_STATUS_STARTING);
+
+    do {
+        for (i = 0u; i < 2u; i++) {
+            if ((mgr->flags & channel_flags[i]) == 0u) {
+                continue;
+            }
+            nvm_ctx[i] = seco_nvm_open_session(channel_flags[i], mgr->storage);
+            if (nvm_ctx[i] != NULL) {
+                seco_nvm_import_master(nvm_ctx[i]);
+                if ((channel_flags[i] == NVM_FLAGS_HSM) && (mgr->storage != NULL) && (mgr->storage->prefetch_threads != 0u)) {
+                    seco_nvm_prefetch_start(nvm_ctx[i], mgr->storage->prefetch_threads, &mgr->prefetch);
                 }
-                seco_os_abs_free(data);
-                data = NULL;
-                len = 0;
+                if ((channel_flags[i] == NVM_FLAGS_HSM) && (mgr->storage != NULL) && (mgr->storage->coalesce_ms != 0u)) {
+                    seco_nvm_coalesce_start(nvm_ctx[i], mgr->storage->coalesce_ms);
+                }
+                phdls[nb] = nvm_ctx[i]->phdl;
+                ctxs[nb] = nvm_ctx[i];
+                nb++;
             }
         }
-        if (status != NULL) {
-            *status = NVM_STATUS_RUNNING;
+        if (nb == 0u) {
+            break;
         }
 
-        /* Infinite loop waiting for SECO commands. */
-        while (true)
-        {
-            /* Receive a message from SECO and process it according its type. */
-            len = seco_os_abs_read_mu_message(nvm_ctx->phdl, recv_msg, MAX_RCV_MSG_SIZE);
-            switch (hdr->command) {
-                case SAB_STORAGE_MASTER_EXPORT_REQ:
-                    err = seco_nvm_manager_export_master(nvm_ctx, (struct sab_cmd_key_store_export_start_msg *)recv_msg, len);
-                break;
-                case SAB_STORAGE_CHUNK_EXPORT_REQ:
-                    err = seco_nvm_manager_export_chunk(nvm_ctx, (struct sab_cmd_key_store_chunk_export_msg *)recv_msg, len);
-                break;
-                case SAB_STORAGE_CHUNK_GET_REQ:
-                    err = seco_nvm_manager_get_chunk(nvm_ctx, (struct sab_cmd_key_store_chunk_get_msg *)recv_msg, len);
-                break;
-                default:
-                    err = 1u;
-                break;
+        if ((server == NULL) && (nb == 1u)) {
+            seco_nvm_manager_set_status(mgr, NVM_STATUS_RUNNING);
+            /* Infinite loop waiting for SECO commands. Stop storage manager in case of any error. */
+            do {
+                err = seco_nvm_process_msg((struct seco_nvm_ctx *)ctxs[0]);
+            } while (err == 0u);
+        } else {
+            /* Wait for the channels, each one processed on its own worker, until they all
+             * stopped on error or the manager is stopped. Only reported running once the
+             * channels can be waited for.
+             */
+            if (mgr->server == NULL) {
+                server = seco_os_abs_server_open();
             }
-            if (err != 0u) {
-                /* Stop storage manager in case of any error. */
-                break;
+            if (seco_os_abs_server_add_channels(server, phdls, ctxs, nb, seco_nvm_serve_msg) == 0) {
+                seco_nvm_manager_set_status(mgr, NVM_STATUS_RUNNING);
+                (void)seco_os_abs_serve_mu_channels(server);
+            }
+            if (mgr->server == NULL) {
+                seco_os_abs_server_close(server);
             }
         }
     } while (false);
 
-    if (status != NULL) {
-        *status = NVM_STATUS_STOPPED;
+    for (i = 0u; i < 2u; i++) {
+        if (nvm_ctx[i] != NULL) {
+            seco_nvm_close_session(nvm_ctx[i]);
+        }
     }
 
-    if (nvm_ctx != NULL) {
-        seco_nvm_close_session(nvm_ctx);
+    seco_nvm_manager_set_status(mgr, NVM_STATUS_STOPPED);
+}
+
+void seco_nvm_manager(uint8_t flags, uint32_t *status)
+{
+    struct seco_nvm_manager_s mgr;
+
+    seco_os_abs_memset((uint8_t *)&mgr, 0u, (uint32_t)sizeof(mgr));
+    mgr.flags = flags;
+    mgr.status = status;
+    (void)pthread_mutex_init(&mgr.lock, NULL);
+    (void)pthread_cond_init(&mgr.cond, NULL);
+
+    seco_nvm_manager_run(&mgr);
+
+    (void)pthread_cond_destroy(&mgr.cond);
+    (void)pthread_mutex_destroy(&mgr.lock);
+}
+
+static void *seco_nvm_manager_thread(void *arg)
+{
+    seco_nvm_manager_run((struct seco_nvm_manager_s *)arg);
+
+    return NULL;
+}
+
+uint32_t seco_nvm_manager_start(uint8_t flags, const struct seco_nvm_storage_cfg *storage, struct seco_nvm_manager_s **manager)
+{
+    struct seco_nvm_manager_s *mgr;
+    uint32_t status = NVM_STATUS_STOPPED;
+
+    do {
+        if (manager == NULL) {
+            break;
+        }
+        *manager = NULL;
+
+        mgr = (struct seco_nvm_manager_s *)seco_os_abs_malloc((uint32_t)sizeof(struct seco_nvm_manager_s));
+        if (mgr == NULL) {
+            break;
+        }
+        seco_os_abs_memset((uint8_t *)mgr, 0u, (uint32_t)sizeof(struct seco_nvm_manager_s));
+        mgr->flags = flags;
+        mgr->storage = storage;
+        mgr->state = NVM_STATUS_UNDEF;
+        (void)pthread_mutex_init(&mgr->lock, NULL);
+        (void)pthread_cond_init(&mgr->cond, NULL);
+
+        mgr->server = seco_os_abs_server_open();
+        if ((mgr->server == NULL)
+            || (pthread_create(&mgr->thread, NULL, seco_nvm_manager_thread, mgr) != 0)) {
+            seco_os_abs_server_close(mgr->server);
+            (void)pthread_cond_destroy(&mgr->cond);
+            (void)pthread_mutex_destroy(&mgr->lock);
+            seco_os_abs_free(mgr);
+            break;
+        }
+
+        /* Wait for the storage to be given to SECO and the channels to be served. */
+        (void)pthread_mutex_lock(&mgr->lock);
+        while (mgr->state <= NVM_STATUS_STARTING) {
+            (void)pthread_cond_wait(&mgr->cond, &mgr->lock);
+        }
+        status = mgr->state;
+        (void)pthread_mutex_unlock(&mgr->lock);
+
+        if (status == NVM_STATUS_RUNNING) {
+            seco_nvm_dump_start(mgr, storage);
+            *manager = mgr;
+        } else {
+            seco_nvm_manager_stop(mgr);
+        }
+    } while (false);
+
+    return status;
+}
+
+uint32_t seco_nvm_manager_get_status(struct seco_nvm_manager_s *manager)
+{
+    uint32_t status = NVM_STATUS_STOPPED;
+
+    if (manager != NULL) {
+        (void)pthread_mutex_lock(&manager->lock);
+        status = manager->state;
+        (void)pthread_mutex_unlock(&manager->lock);
+    }
+
+    return status;
+}
+
+void seco_nvm_manager_get_prefetch_stats(struct seco_nvm_manager_s *manager, struct seco_nvm_prefetch_stats *stats)
+{
+    if ((manager != NULL) && (stats != NULL)) {
+        stats->state = __atomic_load_n(&manager->prefetch.state, __ATOMIC_ACQUIRE);
+        stats->chunks = __atomic_load_n(&manager->prefetch.chunks, __ATOMIC_RELAXED);
+        stats->errors = __atomic_load_n(&manager->prefetch.errors, __ATOMIC_RELAXED);
+        stats->bytes = __atomic_load_n(&manager->prefetch.bytes, __ATOMIC_RELAXED);
+        stats->time_us = __atomic_load_n(&manager->prefetch.time_us, __ATOMIC_RELAXED);
+    }
+}
+
+void seco_nvm_manager_stop(struct seco_nvm_manager_s *manager)
+{
+    if (manager != NULL) {
+        seco_os_abs_server_stop(manager->server);
+        (void)pthread_join(manager->thread, NULL);
+        seco_nvm_dump_stop(manager);
+        seco_os_abs_server_close(manager->server);
+        (void)pthread_cond_destroy(&manager->cond);
+        (void)pthread_mutex_destroy(&manager->lock);
+        seco_os_abs_free(manager);
     }
 }
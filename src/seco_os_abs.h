@@ -134,6 +134,166 @@ int32_t seco_os_abs_send_mu_message(struct seco_os_abs_hdl *phdl, uint32_t *mess
  */
 int32_t seco_os_abs_read_mu_message(struct seco_os_abs_hdl *phdl, uint32_t *message, uint32_t size);
 
+/**
+ * Send a command to Seco and wait for its response.
+ *
+ * Seco processes the commands of a MU channel in order. When the driver accepts several commands
+ * before the first response is read, commands from other threads or submitted with
+ * seco_os_abs_submit_mu_message() are queued on the channel, and each response is matched back
+ * to its command by order and command ID. Throughput is then bounded by Seco execution and not by
+ * the round trip of each command.
+ *
+ * \param phdl pointer to handle identifying the session to be used to carry the message.
+ * \param cmd pointer to the command message.
+ * \param cmd_len length in bytes of the command message.
+ * \param rsp pointer to the area where the response is written.
+ * \param rsp_len max length in bytes of the response.
+ *
+ * \return length in bytes of the response or negative value in case of error.
+ */
+int32_t seco_os_abs_exchange_mu_message(struct seco_os_abs_hdl *phdl, uint32_t *cmd, uint32_t cmd_len, uint32_t *rsp, uint32_t rsp_len);
+
+/**
+ * Asynchronous exchange with Seco.
+ *
+ * Instead of sending a command and blocking in seco_os_abs_read_mu_message() until Seco answers,
+ * the caller can submit a request and collect its response later. This lets the caller overlap
+ * its own processing with the execution of the command by Seco.
+ *
+ * The request descriptor is owned by the abstraction layer from its submission until its
+ * completion is reported, so it must not be modified or freed in between. The command and
+ * response buffers it points to follow the same rule.
+ *
+ * Completion is reported either:
+ * - through the callback of the request if provided. It is called from a thread of the
+ *   abstraction layer so it should not block.
+ * - or, if no callback is provided, by queuing the request in a completion queue. An event
+ *   is then signaled on a file descriptor that can be polled (see seco_os_abs_get_completion_fd()),
+ *   and the request is retrieved with seco_os_abs_get_completion().
+ *
+ * The command is written to the MU by seco_os_abs_submit_mu_message() itself. Several commands
+ * can be queued on a MU channel when the driver supports it (see seco_os_abs_exchange_mu_message()).
+ * Otherwise seco_os_abs_submit_mu_message() blocks until the previous command of the channel is
+ * completed. As for synchronous exchanges, the data buffers of a command (see seco_os_abs_data_buf())
+ * must be set up right before its submission.
+ */
+struct seco_os_abs_req;
+typedef void (*seco_os_abs_req_cb)(struct seco_os_abs_req *req);
+
+struct seco_os_abs_req {
+    uint32_t *cmd;                  /**< command message. */
+    uint32_t cmd_len;               /**< length in bytes of the command message. */
+    uint32_t *rsp;                  /**< area where the response message is written. */
+    uint32_t rsp_len;               /**< max length in bytes of the response message. */
+    int32_t status;                 /**< on completion: length in bytes of the response or negative value in case of error. */
+    seco_os_abs_req_cb callback;    /**< function called on completion. If NULL the completion is queued. */
+    void *user_data;                /**< free for use by the caller. */
+    struct seco_os_abs_req *next;   /**< reserved for the abstraction layer. */
+};
+
+/**
+ * Submit a command to Seco without waiting for its response.
+ *
+ * \param phdl pointer to handle identifying the session to be used to carry the message.
+ * \param req pointer to the request descriptor.
+ *
+ * \return 0 if the request has been submitted. Completion is then always reported.
+ *         Any other value means error and the request is not submitted.
+ */
+int32_t seco_os_abs_submit_mu_message(struct seco_os_abs_hdl *phdl, struct seco_os_abs_req *req);
+
+/**
+ * Get the file descriptor signaling completed requests.
+ *
+ * The descriptor is readable (POLLIN) as long as completed requests are waiting in the completion
+ * queue of the session. It must not be read or closed by the caller.
+ *
+ * \param phdl pointer to the session handle.
+ *
+ * \return file descriptor or negative value in case of error.
+ */
+int32_t seco_os_abs_get_completion_fd(struct seco_os_abs_hdl *phdl);
+
+/**
+ * Retrieve a completed request from the completion queue of the session.
+ *
+ * This API does not block.
+ *
+ * \param phdl pointer to the session handle.
+ *
+ * \return pointer to the oldest completed request or NULL if none.
+ */
+struct seco_os_abs_req *seco_os_abs_get_completion(struct seco_os_abs_hdl *phdl);
+
+/**
+ * Process a message received on a channel.
+ *
+ * \param phdl pointer to the handle of the channel where a message is available.
+ * \param ctx context given for this channel to seco_os_abs_server_add_channels().
+ *
+ * \return 0 to keep serving the channel. Any other value stops it.
+ */
+typedef int32_t (*seco_os_abs_mu_handler)(struct seco_os_abs_hdl *phdl, void *ctx);
+
+struct seco_os_abs_server;
+
+/**
+ * Allocate a server, used to serve channels with seco_os_abs_serve_mu_channels().
+ *
+ * \return pointer to the server or NULL in case of error.
+ */
+struct seco_os_abs_server *seco_os_abs_server_open(void);
+
+/**
+ * Give the channels to serve to a server.
+ *
+ * Several channels are waited for with epoll, which needs a driver supporting poll: they are
+ * registered here so that a failure is known before serving. A single channel works with any
+ * driver.
+ *
+ * Can be called once per server.
+ *
+ * \param server pointer to the server.
+ * \param phdls handles of the channels, opened for incoming commands.
+ * \param ctxs context passed to the handler for each channel.
+ * \param nb number of channels (up to 4).
+ * \param handler function called on a worker when a message is available on a channel.
+ *
+ * \return 0 once the channels are ready to be served. Any other value means error.
+ */
+int32_t seco_os_abs_server_add_channels(struct seco_os_abs_server *server, struct seco_os_abs_hdl **phdls, void **ctxs, uint32_t nb, seco_os_abs_mu_handler handler);
+
+/**
+ * Serve the messages received from Seco on the channels of a server.
+ *
+ * The calling thread waits for messages on all the channels and hands them to a pool of
+ * workers, one per channel, so that a long processing on one channel (e.g. a storage
+ * write) does not delay the others. The messages of a channel are processed in order:
+ * the handler is not called again for a channel before its previous call returned.
+ * A single channel is served by one worker calling the handler in a loop.
+ *
+ * \param server pointer to the server, with its channels added.
+ *
+ * \return 0 once the handler stopped all the channels or the server was stopped. Any other value means error.
+ */
+int32_t seco_os_abs_serve_mu_channels(struct seco_os_abs_server *server);
+
+/**
+ * Stop a server. Can be called from any thread, before or during seco_os_abs_serve_mu_channels().
+ * The messages already received are processed before seco_os_abs_serve_mu_channels() returns,
+ * including the further messages of a request in progress.
+ *
+ * \param server pointer to the server.
+ */
+void seco_os_abs_server_stop(struct seco_os_abs_server *server);
+
+/**
+ * Release a server. seco_os_abs_serve_mu_channels() must have returned.
+ *
+ * \param server pointer to the server.
+ */
+void seco_os_abs_server_close(struct seco_os_abs_server *server);
+
 /**
  * Configure the use of shared buffer in secure memory
  *
@@ -174,6 +334,11 @@ int32_t seco_os_abs_configure_shared_buf(struct seco_os_abs_hdl *phdl, uint32_t
  * Once this API has been called the buffers should no more be accessed by the caller until the command has
  * been sent to Seco and its response has been received.
  *
+ * The buffers are attached to the next command written by the calling thread on the session: other threads
+ * using the session wait until this command is written, so a command must always follow. The library
+ * itself describes the buffers to seco_os_abs_mu_transaction() or seco_os_abs_send_mu_message_with_bufs()
+ * instead, which set them up and write the command in the same call.
+ *
  * \param phdl pointer to the session handle for which this data buffer is used.
  * \param src pointer to the data if input or to the area where the output should be written.
  * \param size size in bytes of the input data or max size of the output.
@@ -187,6 +352,159 @@ uint64_t seco_os_abs_data_buf(struct seco_os_abs_hdl *phdl, uint8_t *src, uint32
 #define DATA_BUF_SHORT_ADDR       0x04u
 #define SEC_MEM_SHORT_ADDR_MASK   0xFFFFu
 
+/**
+ * Send a command with its data buffers to Seco and wait for its response.
+ *
+ * Same as setting up each buffer with seco_os_abs_data_buf(), writing its address in the command and
+ * calling seco_os_abs_exchange_mu_message(), but the buffers are described to this API instead: when the
+ * driver supports it, the buffers set up, the command sent and the response read in a single call
+ * to the kernel.
+ *
+ * The address of each buffer is written in the command at the given offset, on 16 bits for buffers
+ * using DATA_BUF_SHORT_ADDR and on 32 bits otherwise. DATA_BUF_NO_ADDR can be used as offset for
+ * buffers not referenced by the command (e.g. fast MAC output following the input in secure memory).
+ *
+ * \param phdl pointer to handle identifying the session to be used to carry the message.
+ * \param cmd pointer to the command message.
+ * \param cmd_len length in bytes of the command message.
+ * \param rsp pointer to the area where the response is written.
+ * \param rsp_len max length in bytes of the response.
+ * \param bufs array of data buffers of the command, in the order they must be set up.
+ * \param nb_bufs number of data buffers.
+ * \param flags MU_TRANSACTION_CMD_CRC if the last word of the command is its CRC, to be updated once the
+ *        addresses are written.
+ *
+ * \return length in bytes of the response or negative value in case of error.
+ */
+struct seco_os_abs_buf {
+    uint8_t *data;          /**< pointer to the input data or to the area where the output is written. */
+    uint32_t size;          /**< size in bytes of the buffer. */
+    uint32_t flags;         /**< DATA_BUF_* flags, as for seco_os_abs_data_buf(). */
+    uint32_t cmd_offset;    /**< offset in bytes in the command where the address of the buffer is written. */
+};
+int32_t seco_os_abs_mu_transaction(struct seco_os_abs_hdl *phdl, uint32_t *cmd, uint32_t cmd_len, uint32_t *rsp, uint32_t rsp_len,
+                                   struct seco_os_abs_buf *bufs, uint32_t nb_bufs, uint32_t flags);
+#define DATA_BUF_NO_ADDR          0xFFFFFFFFu
+#define MU_TRANSACTION_CMD_CRC    0x01u
+
+/**
+ * Setup several data buffers at once.
+ *
+ * Same as calling seco_os_abs_data_buf() for each buffer of the array, in order, but done in a single
+ * call to the driver when it supports it. The cmd_offset field of the buffers is not used here.
+ *
+ * \param phdl pointer to the session handle for which these data buffers are used.
+ * \param bufs array of buffers descriptions.
+ * \param nb_bufs number of buffers.
+ * \param addrs array of nb_bufs elements where the address of each buffer is written.
+ *
+ * \return 0 on success. Any other value means error.
+ */
+int32_t seco_os_abs_data_bufs(struct seco_os_abs_hdl *phdl, struct seco_os_abs_buf *bufs, uint32_t nb_bufs, uint64_t *addrs);
+
+/**
+ * Send a message referencing data buffers to Seco.
+ *
+ * Same as seco_os_abs_send_mu_message() once the buffers are set up and their addresses written
+ * in the message as done by seco_os_abs_mu_transaction(). Used for the responses to the requests
+ * of Seco (e.g. storage manager) that carry the address of a buffer.
+ *
+ * \param phdl pointer to handle identifying the session to be used to carry the message.
+ * \param message pointer to the message itself. It has to be aligned on 32bits.
+ * \param size size in bytes of the message. It has to be multiple of 4 bytes.
+ * \param bufs array of data buffers referenced by the message.
+ * \param nb_bufs number of data buffers.
+ *
+ * \return length in bytes written to the MU or negative value in case of error.
+ */
+int32_t seco_os_abs_send_mu_message_with_bufs(struct seco_os_abs_hdl *phdl, uint32_t *message, uint32_t size,
+                                              struct seco_os_abs_buf *bufs, uint32_t nb_bufs);
+
+/**
+ * Lock the handle tables of the library for reading.
+ *
+ * The tables are shared by all the threads of the process. Any number of threads can hold
+ * the lock for reading at a time, the lock for writing is exclusive.
+ */
+void seco_os_abs_tables_rdlock(void);
+
+/**
+ * Lock the handle tables of the library for writing.
+ */
+void seco_os_abs_tables_wrlock(void);
+
+/**
+ * Release the lock taken by seco_os_abs_tables_rdlock() or seco_os_abs_tables_wrlock().
+ */
+void seco_os_abs_tables_unlock(void);
+
+/**
+ * Allocate memory in the shared buffer configured by seco_os_abs_configure_shared_buf().
+ *
+ * The secure RAM partition is mapped in the caller address space, so that data can be written
+ * or read there directly and passed to Seco by its offset. Allocations are taken from the end of
+ * the partition and are no more available for the DATA_BUF_USE_SEC_MEM buffers set up by the driver.
+ * They remain valid until seco_os_abs_shared_buf_reset(), a new configuration of the shared buffer
+ * or the end of the session.
+ *
+ * \param phdl pointer to the session handle.
+ * \param size size in bytes of the allocation.
+ * \param offset if not NULL, where the short address of the allocation for Seco is written.
+ *
+ * \return pointer to the allocated memory, 8 bytes aligned. NULL if not enough space or if the
+ * driver does not support the mapping of the shared buffer.
+ */
+uint8_t *seco_os_abs_shared_buf_alloc(struct seco_os_abs_hdl *phdl, uint32_t size, uint32_t *offset);
+
+/**
+ * Release all the allocations made with seco_os_abs_shared_buf_alloc() on a session.
+ *
+ * \param phdl pointer to the session handle.
+ */
+void seco_os_abs_shared_buf_reset(struct seco_os_abs_hdl *phdl);
+
+/**
+ * Get the short address for Seco of a buffer allocated with seco_os_abs_shared_buf_alloc().
+ *
+ * \param phdl pointer to the session handle.
+ * \param ptr pointer to the buffer.
+ * \param size size in bytes of the buffer.
+ * \param offset where the short address is written.
+ *
+ * \return 0 if the buffer lies in the allocated part of the shared buffer. Any other value otherwise.
+ */
+int32_t seco_os_abs_shared_buf_offset(struct seco_os_abs_hdl *phdl, uint8_t *ptr, uint32_t size, uint32_t *offset);
+
+/**
+ * Register a long-lived data buffer.
+ *
+ * The driver pins the buffer and maps it once at a persistent address. Any data buffer then
+ * set up inside it for a command (seco_os_abs_data_buf(), seco_os_abs_data_bufs(),
+ * seco_os_abs_mu_transaction()) is accessed in place by Seco, without copy. Drivers without
+ * this support accept the registration but keep setting up the buffer for each command.
+ *
+ * \param phdl pointer to the session handle.
+ * \param buf pointer to the buffer.
+ * \param size size in bytes of the buffer.
+ * \param seco_addr if not NULL, where the address of the buffer for Seco is written (0 if not pinned).
+ *
+ * \return 0 on success. Any other value means error.
+ */
+int32_t seco_os_abs_register_buf(struct seco_os_abs_hdl *phdl, uint8_t *buf, uint32_t size, uint64_t *seco_addr);
+
+/**
+ * Unregister a buffer registered with seco_os_abs_register_buf().
+ *
+ * Waits for the commands in flight on the session to complete. Registered buffers are also
+ * released when the session is closed.
+ *
+ * \param phdl pointer to the session handle.
+ * \param buf pointer to the buffer, as passed at registration.
+ *
+ * \return 0 on success. Any other value means error.
+ */
+int32_t seco_os_abs_unregister_buf(struct seco_os_abs_hdl *phdl, uint8_t *buf);
+
 /**
  * Compute the CRC of a buffer.
  *
@@ -203,6 +521,46 @@ uint64_t seco_os_abs_data_buf(struct seco_os_abs_hdl *phdl, uint8_t *src, uint32
  */
 uint32_t seco_os_abs_crc(uint8_t *data, uint32_t size);
 
+/**
+ * Copy a buffer and compute the CRC of the data copied, in a single pass.
+ *
+ * Same CRC as seco_os_abs_crc(). To be used where the data are moved anyway, instead of
+ * a copy followed by seco_os_abs_crc().
+ *
+ * \param dst pointer to the destination buffer.
+ * \param src pointer to the data to be copied.
+ * \param size size in bytes of the data.
+ *
+ * \return 32bits value of the CRC.
+ */
+uint32_t seco_os_abs_crc_copy(uint8_t *dst, uint8_t *src, uint32_t size);
+
+/**
+ * Continue the CRC of data processed in several parts.
+ *
+ * seco_os_abs_crc_update(seco_os_abs_crc(a, size_a), b, size_b) gives the CRC of a followed
+ * by b, as computed by seco_os_abs_crc(). Starting from 0 gives the CRC of the first part.
+ *
+ * \param crc CRC of the data processed so far.
+ * \param data pointer to the next part of the data.
+ * \param size size in bytes of this part.
+ *
+ * \return 32bits value of the CRC of all the data processed.
+ */
+uint32_t seco_os_abs_crc_update(uint32_t crc, uint8_t *data, uint32_t size);
+
+/**
+ * Compute the SHA-256 digest of a buffer.
+ *
+ * Used to recognize data identical to the one already in the storage, where a CRC match is
+ * not a strong enough proof.
+ *
+ * \param data pointer to the data on which the digest must be computed.
+ * \param size size in bytes of the data.
+ * \param digest pointer to where the 32 bytes digest must be written.
+ */
+void seco_os_abs_sha256(uint8_t *data, uint32_t size, uint8_t *digest);
+
 /**
  * Force all bytes of a buffer to a given value.
  *
@@ -239,14 +597,50 @@ uint8_t *seco_os_abs_malloc(uint32_t size);
  */
 void seco_os_abs_free(void *ptr);
 
+/**
+ * Allocate a page aligned buffer, locked in memory when the process is allowed to
+ * so that accessing it never causes a page fault.
+ *
+ * \param size number of bytes to be allocated
+ *
+ * \return pointer to the allocated buffer or NULL in case of error.
+ */
+uint8_t *seco_os_abs_malloc_locked(uint32_t size);
+
+/**
+ * Free a buffer allocated by seco_os_abs_malloc_locked.
+ *
+ * \param ptr pointer to the buffer to free
+ * \param size number of bytes given at allocation
+ */
+void seco_os_abs_free_locked(uint8_t *ptr, uint32_t size);
+
+/**
+ * Select the non volatile storage of a storage channel.
+ *
+ * The storage is kept by a backend chosen when the storage manager starts: files in a directory,
+ * a raw block device or MTD partition, or RAM flushed to files by a background thread.
+ * If this API is not called the storage is kept in files in /etc.
+ *
+ * \param phdl pointer to the session handle of the storage channel.
+ * \param cfg storage configuration (see seco_nvm.h). NULL selects the default file storage.
+ *
+ * \return 0 on success. Any other value means error.
+ */
+struct seco_nvm_storage_cfg;
+int32_t seco_os_abs_storage_open(struct seco_os_abs_hdl *phdl, const struct seco_nvm_storage_cfg *cfg);
+
 /**
  * Write data to the non volatile storage.
  *
+ * The previous content is replaced atomically: after a power loss the storage holds
+ * either the previous or the new data, never a mix of both.
+ *
  * \param phdl pointer to the session handle for which this data buffer is used.
  * \param src pointer to the data to be written to storage.
  * \param size number of bytes to be written.
  *
- * \return number of bytes written.
+ * \return number of bytes written, once they are durable in the storage.
  */
 int32_t seco_os_abs_storage_write(struct seco_os_abs_hdl *phdl, uint8_t *src, uint32_t size);
 
@@ -261,6 +655,25 @@ int32_t seco_os_abs_storage_write(struct seco_os_abs_hdl *phdl, uint8_t *src, ui
  */
 int32_t seco_os_abs_storage_read(struct seco_os_abs_hdl *phdl, uint8_t *dst, uint32_t size);
 
+/**
+ * Map the whole non volatile storage read-only, opening it once.
+ *
+ * \param phdl pointer to the session handle for which this data buffer is used.
+ * \param data pointer to where the address of the mapping must be written.
+ *
+ * \return size of the storage, 0 if it is not available.
+ */
+int32_t seco_os_abs_storage_map(struct seco_os_abs_hdl *phdl, uint8_t **data);
+
+/**
+ * Release a mapping returned by seco_os_abs_storage_map.
+ *
+ * \param phdl pointer to the session handle given to seco_os_abs_storage_map.
+ * \param data address of the mapping.
+ * \param size size of the storage returned by seco_os_abs_storage_map.
+ */
+void seco_os_abs_storage_unmap(struct seco_os_abs_hdl *phdl, uint8_t *data, uint32_t size);
+
 /**
  * Write a subset of data to the non volatile storage.
  *
@@ -293,6 +706,75 @@ int32_t seco_os_abs_storage_write_chunk(struct seco_os_abs_hdl *phdl, uint8_t *s
  */
 int32_t seco_os_abs_storage_read_chunk(struct seco_os_abs_hdl *phdl, uint8_t *dst, uint32_t size, uint64_t blob_id);
 
+/**
+ * Read a whole chunk from the non volatile storage with a single access.
+ *
+ * Can be called from several threads at the same time, as long as no data is written
+ * to the storage meanwhile.
+ *
+ * \param phdl pointer to the session handle for which this data buffer is used.
+ * \param blob_id unique identifier of the blob corresponding to the storage chunk to be read
+ * \param dst pointer to the data where the chunk should be copied.
+ * \param size size of dst.
+ *
+ * \return size of the chunk, 0 if it is not available or larger than size.
+ */
+int32_t seco_os_abs_storage_load_chunk(struct seco_os_abs_hdl *phdl, uint64_t blob_id, uint8_t *dst, uint32_t size);
+
+/**
+ * Size of a chunk of the non volatile storage, to get a buffer large enough to load it.
+ *
+ * \param phdl pointer to the session handle of the storage channel.
+ * \param blob_id unique identifier of the blob corresponding to the storage chunk.
+ *
+ * \return size of the chunk, 0 if it is not in the storage.
+ */
+int32_t seco_os_abs_storage_chunk_size(struct seco_os_abs_hdl *phdl, uint64_t blob_id);
+
+/**
+ * Make all the data written so far to the non volatile storage durable.
+ *
+ * Writes are durable when they return, except with a storage flushed in the background.
+ *
+ * \param phdl pointer to the session handle of the storage channel.
+ *
+ * \return 0 on success. Any other value means error.
+ */
+int32_t seco_os_abs_storage_sync(struct seco_os_abs_hdl *phdl);
+
+/**
+ * Function called for each chunk of the non volatile storage.
+ *
+ * \param arg argument given to seco_os_abs_storage_enumerate().
+ * \param blob_id unique identifier of the blob corresponding to the storage chunk.
+ * \param size size in bytes of the chunk.
+ */
+typedef void (*seco_os_abs_chunk_cb)(void *arg, uint64_t blob_id, uint32_t size);
+
+/**
+ * List the chunks of the non volatile storage.
+ *
+ * \param phdl pointer to the session handle of the storage channel.
+ * \param cb function called for each chunk. May be NULL to only count them.
+ * \param arg argument passed to cb.
+ *
+ * \return number of chunks.
+ */
+int32_t seco_os_abs_storage_enumerate(struct seco_os_abs_hdl *phdl, seco_os_abs_chunk_cb cb, void *arg);
+
+/**
+ * Write a text report, such as the metrics of the storage manager.
+ *
+ * The file is replaced as a whole: a reader never sees a partial report.
+ *
+ * \param path file to be written, NULL to write the report to the standard error.
+ * \param text report to be written.
+ * \param size length of the report.
+ *
+ * \return 0 on success. Any other value means error.
+ */
+int32_t seco_os_abs_write_report(const char *path, const char *text, uint32_t size);
+
 /**
  * Start the RNG from a system point of view.
  *
@@ -0,0 +1,370 @@
+/*
+ * Copyright 2019 NXP
+ *
+ * NXP Confidential.
+ * This software is owned or controlled by NXP and may only be used strictly
+ * in accordance with the applicable license terms.  By expressly accepting
+ * such terms or by downloading, installing, activating and/or otherwise using
+ * the software, you are agreeing that you have read, and that you agree to
+ * comply with and are bound by, such license terms.  If you do not agree to be
+ * bound by the applicable license terms, then you may not retain, install,
+ * activate or otherwise use the software.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <zlib.h>
+#include "seco_os_abs.h"
+
+/*
+ * CRC of the NVM storage: CRC-32 (polynomial 0x04C11DB7 reflected, as zlib crc32()) with a
+ * register initialized to 0 and no final inversion. The implementation is selected on first
+ * use according to the CPU:
+ * - ARMv8 CRC32 instructions when the core implements them,
+ * - carry-less multiplication folding (PCLMULQDQ) on x86, for host builds,
+ * - zlib otherwise.
+ * All of them give the same result, the storage format does not depend on the CPU.
+ */
+
+#if defined(__aarch64__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1u << 7)
+#endif
+#define SECO_CRC_ARMV8
+#elif defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SECO_CRC_PCLMUL
+#endif
+
+/* Data processed at a time by the software fused copy, kept in L1 between the copy and the CRC. */
+#define SECO_CRC_SOFT_BLOCK     2048u
+
+/* Update the CRC register with len bytes of src, copied to dst when dst is not NULL. */
+typedef uint32_t (*seco_crc_fn)(uint32_t crc, uint8_t *dst, const uint8_t *src, uint32_t len);
+
+static seco_crc_fn seco_crc_impl;
+
+static uint32_t crc_soft(uint32_t crc, uint8_t *dst, const uint8_t *src, uint32_t len)
+{
+    uint32_t n;
+
+    /* zlib inverts the register before and after the update. */
+    crc = ~crc;
+    while (len > 0u) {
+        n = (len < SECO_CRC_SOFT_BLOCK) ? len : SECO_CRC_SOFT_BLOCK;
+        if (dst != NULL) {
+            (void)memcpy(dst, src, n);
+            dst += n;
+        }
+        crc = (uint32_t)crc32(crc, src, n);
+        src += n;
+        len -= n;
+    }
+
+    return ~crc;
+}
+
+#ifdef SECO_CRC_ARMV8
+__attribute__((target("+crc")))
+static uint32_t crc_armv8(uint32_t crc, uint8_t *dst, const uint8_t *src, uint32_t len)
+{
+    uint64_t v;
+
+    while (len >= 8u) {
+        (void)memcpy(&v, src, sizeof(v));
+        if (dst != NULL) {
+            (void)memcpy(dst, &v, sizeof(v));
+            dst += 8;
+        }
+        crc = __crc32d(crc, v);
+        src += 8;
+        len -= 8u;
+    }
+    while (len > 0u) {
+        if (dst != NULL) {
+            *dst = *src;
+            dst++;
+        }
+        crc = __crc32b(crc, *src);
+        src++;
+        len--;
+    }
+
+    return crc;
+}
+#endif
+
+#ifdef SECO_CRC_PCLMUL
+/*
+ * Folding of 64 bytes blocks by carry-less multiplication then Barrett reduction, as described
+ * in "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction" (Intel), with
+ * the constants of the bit-reflected CRC-32 polynomial. len must be a multiple of 16, at least 64.
+ */
+__attribute__((target("pclmul,sse4.1")))
+static inline uint32_t crc_pclmul_fold(uint32_t crc, uint8_t *dst, const uint8_t *src, uint32_t len, int copy)
+{
+    const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+    const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+    const __m128i k5k0 = _mm_set_epi64x(0x0000000000, 0x0163cd6124);
+    const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+    const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+    x1 = _mm_loadu_si128((const __m128i *)(src + 0x00));
+    x2 = _mm_loadu_si128((const __m128i *)(src + 0x10));
+    x3 = _mm_loadu_si128((const __m128i *)(src + 0x20));
+    x4 = _mm_loadu_si128((const __m128i *)(src + 0x30));
+    if (copy != 0) {
+        _mm_storeu_si128((__m128i *)(dst + 0x00), x1);
+        _mm_storeu_si128((__m128i *)(dst + 0x10), x2);
+        _mm_storeu_si128((__m128i *)(dst + 0x20), x3);
+        _mm_storeu_si128((__m128i *)(dst + 0x30), x4);
+        dst += 64;
+    }
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int32_t)crc));
+    x0 = k1k2;
+    src += 64;
+    len -= 64u;
+
+    /* Fold 4 x 128 bits in parallel. */
+    while (len >= 64u) {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+        y5 = _mm_loadu_si128((const __m128i *)(src + 0x00));
+        y6 = _mm_loadu_si128((const __m128i *)(src + 0x10));
+        y7 = _mm_loadu_si128((const __m128i *)(src + 0x20));
+        y8 = _mm_loadu_si128((const __m128i *)(src + 0x30));
+        if (copy != 0) {
+            _mm_storeu_si128((__m128i *)(dst + 0x00), y5);
+            _mm_storeu_si128((__m128i *)(dst + 0x10), y6);
+            _mm_storeu_si128((__m128i *)(dst + 0x20), y7);
+            _mm_storeu_si128((__m128i *)(dst + 0x30), y8);
+            dst += 64;
+        }
+
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+
+        src += 64;
+        len -= 64u;
+    }
+
+    /* Fold into 128 bits. */
+    x0 = k3k4;
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    /* Fold the remaining blocks of 16 bytes. */
+    while (len >= 16u) {
+        x2 = _mm_loadu_si128((const __m128i *)src);
+        if (copy != 0) {
+            _mm_storeu_si128((__m128i *)dst, x2);
+            dst += 16;
+        }
+
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+        src += 16;
+        len -= 16u;
+    }
+
+    /* Fold 128 bits to 64 bits. */
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x1 = _mm_srli_si128(x1, 8);
+    x1 = _mm_xor_si128(x1, x2);
+
+    x0 = k5k0;
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, mask32);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    /* Barrett reduction to 32 bits. */
+    x0 = poly;
+    x2 = _mm_and_si128(x1, mask32);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, mask32);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return (uint32_t)_mm_extract_epi32(x1, 1);
+}
+
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc_pclmul(uint32_t crc, uint8_t *dst, const uint8_t *src, uint32_t len)
+{
+    uint32_t n = len & ~15u;
+
+    if (len >= 64u) {
+        if (dst != NULL) {
+            crc = crc_pclmul_fold(crc, dst, src, n, 1);
+            dst += n;
+        } else {
+            crc = crc_pclmul_fold(crc, NULL, src, n, 0);
+        }
+        src += n;
+        len -= n;
+    }
+
+    /* Less than 16 bytes left, or less than 64 in total. */
+    return crc_soft(crc, dst, src, len);
+}
+#endif
+
+static seco_crc_fn seco_crc_select(void)
+{
+    seco_crc_fn fn = crc_soft;
+
+#ifdef SECO_CRC_ARMV8
+    if ((getauxval(AT_HWCAP) & HWCAP_CRC32) != 0u) {
+        fn = crc_armv8;
+    }
+#endif
+#ifdef SECO_CRC_PCLMUL
+    __builtin_cpu_init();
+    if ((__builtin_cpu_supports("pclmul") != 0) && (__builtin_cpu_supports("sse4.1") != 0)) {
+        fn = crc_pclmul;
+    }
+#endif
+
+    return fn;
+}
+
+static uint32_t seco_crc_update(uint32_t crc, uint8_t *dst, const uint8_t *src, uint32_t len)
+{
+    seco_crc_fn fn = __atomic_load_n(&seco_crc_impl, __ATOMIC_ACQUIRE);
+
+    /* The selection gives the same result in every thread: no need to serialize it. */
+    if (fn == NULL) {
+        fn = seco_crc_select();
+        __atomic_store_n(&seco_crc_impl, fn, __ATOMIC_RELEASE);
+    }
+
+    return fn(crc, dst, src, len);
+}
+
+uint32_t seco_os_abs_crc(uint8_t *data, uint32_t size)
+{
+    return seco_crc_update(0u, NULL, data, size);
+}
+
+uint32_t seco_os_abs_crc_copy(uint8_t *dst, uint8_t *src, uint32_t size)
+{
+    return seco_crc_update(0u, dst, src, size);
+}
+
+uint32_t seco_os_abs_crc_update(uint32_t crc, uint8_t *data, uint32_t size)
+{
+    return seco_crc_update(crc, NULL, data, size);
+}
+
+/*
+ * SHA-256 (FIPS 180-4) of the NVM storage, used to recognize data already stored.
+ * Plain C: the libraries do not depend on a crypto library for it. Kept with the CRC so
+ * that it is linked with the libraries using the storage.
+ */
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98u, 0x71374491u, 0xb5c0fbcfu, 0xe9b5dba5u, 0x3956c25bu, 0x59f111f1u, 0x923f82a4u, 0xab1c5ed5u,
+    0xd807aa98u, 0x12835b01u, 0x243185beu, 0x550c7dc3u, 0x72be5d74u, 0x80deb1feu, 0x9bdc06a7u, 0xc19bf174u,
+    0xe49b69c1u, 0xefbe4786u, 0x0fc19dc6u, 0x240ca1ccu, 0x2de92c6fu, 0x4a7484aau, 0x5cb0a9dcu, 0x76f988dau,
+    0x983e5152u, 0xa831c66du, 0xb00327c8u, 0xbf597fc7u, 0xc6e00bf3u, 0xd5a79147u, 0x06ca6351u, 0x14292967u,
+    0x27b70a85u, 0x2e1b2138u, 0x4d2c6dfcu, 0x53380d13u, 0x650a7354u, 0x766a0abbu, 0x81c2c92eu, 0x92722c85u,
+    0xa2bfe8a1u, 0xa81a664bu, 0xc24b8b70u, 0xc76c51a3u, 0xd192e819u, 0xd6990624u, 0xf40e3585u, 0x106aa070u,
+    0x19a4c116u, 0x1e376c08u, 0x2748774cu, 0x34b0bcb5u, 0x391c0cb3u, 0x4ed8aa4au, 0x5b9cca4fu, 0x682e6ff3u,
+    0x748f82eeu, 0x78a5636fu, 0x84c87814u, 0x8cc70208u, 0x90befffau, 0xa4506cebu, 0xbef9a3f7u, 0xc67178f2u,
+};
+
+#define SHA256_ROR(x, n)    (((x) >> (n)) | ((x) << (32u - (n))))
+
+/* Process one 64 bytes block. */
+static void sha256_block(uint32_t *h, const uint8_t *p)
+{
+    uint32_t w[64];
+    uint32_t a, b, c, d, e, f, g, k;
+    uint32_t s0, s1, t1, t2;
+    uint32_t i;
+
+    for (i = 0u; i < 16u; i++) {
+        w[i] = ((uint32_t)p[4u * i] << 24) | ((uint32_t)p[(4u * i) + 1u] << 16)
+               | ((uint32_t)p[(4u * i) + 2u] << 8) | (uint32_t)p[(4u * i) + 3u];
+    }
+    for (i = 16u; i < 64u; i++) {
+        s0 = SHA256_ROR(w[i - 15u], 7u) ^ SHA256_ROR(w[i - 15u], 18u) ^ (w[i - 15u] >> 3);
+        s1 = SHA256_ROR(w[i - 2u], 17u) ^ SHA256_ROR(w[i - 2u], 19u) ^ (w[i - 2u] >> 10);
+        w[i] = w[i - 16u] + s0 + w[i - 7u] + s1;
+    }
+
+    a = h[0]; b = h[1]; c = h[2]; d = h[3];
+    e = h[4]; f = h[5]; g = h[6]; k = h[7];
+    for (i = 0u; i < 64u; i++) {
+        s1 = SHA256_ROR(e, 6u) ^ SHA256_ROR(e, 11u) ^ SHA256_ROR(e, 25u);
+        t1 = k + s1 + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+        s0 = SHA256_ROR(a, 2u) ^ SHA256_ROR(a, 13u) ^ SHA256_ROR(a, 22u);
+        t2 = s0 + ((a & b) ^ (a & c) ^ (b & c));
+        k = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+    h[4] += e; h[5] += f; h[6] += g; h[7] += k;
+}
+
+void seco_os_abs_sha256(uint8_t *data, uint32_t size, uint8_t *digest)
+{
+    uint32_t h[8] = {
+        0x6a09e667u, 0xbb67ae85u, 0x3c6ef372u, 0xa54ff53au, 0x510e527fu, 0x9b05688cu, 0x1f83d9abu, 0x5be0cd19u,
+    };
+    uint8_t last[128] = {0};
+    uint64_t bits = (uint64_t)size * 8u;
+    uint32_t rem = size % 64u;
+    uint32_t nb_last;
+    uint32_t i;
+
+    for (i = 0u; (i + 64u) <= size; i += 64u) {
+        sha256_block(h, data + i);
+    }
+
+    /* Padding: 0x80, zeros then the length in bits, in one or two blocks. */
+    for (i = 0u; i < rem; i++) {
+        last[i] = data[size - rem + i];
+    }
+    last[rem] = 0x80u;
+    nb_last = (rem < 56u) ? 64u : 128u;
+    for (i = 0u; i < 8u; i++) {
+        last[nb_last - 1u - i] = (uint8_t)(bits >> (8u * i));
+    }
+    for (i = 0u; i < nb_last; i += 64u) {
+        sha256_block(h, last + i);
+    }
+
+    for (i = 0u; i < 8u; i++) {
+        digest[4u * i] = (uint8_t)(h[i] >> 24);
+        digest[(4u * i) + 1u] = (uint8_t)(h[i] >> 16);
+        digest[(4u * i) + 2u] = (uint8_t)(h[i] >> 8);
+        digest[(4u * i) + 3u] = (uint8_t)h[i];
+    }
+}
@@ -13,19 +13,52 @@
 
 #include <stdio.h>
 #include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/uio.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
-#include <zlib.h>
 #include "she_api.h"
+#include "seco_nvm.h"
 #include "seco_os_abs.h"
+#include "seco_os_abs_storage.h"
 #include "seco_mu_ioctl.h"
+#include "seco_sab_msg_def.h"
 
+#ifdef SECO_OS_ABS_EMU
+/* MU devices are provided by the SECO emulator. */
+#include "seco_emu.h"
+#define mu_open(path, flags)        seco_emu_open((path), (flags))
+#define mu_close(fd)                seco_emu_close(fd)
+#define mu_read(fd, buf, len)       seco_emu_read((fd), (buf), (len))
+#define mu_write(fd, buf, len)      seco_emu_write((fd), (buf), (len))
+#define mu_ioctl                    seco_emu_ioctl
+#define mu_mmap(fd, len)            seco_emu_mmap((fd), (len))
+#define mu_munmap(addr, len)        seco_emu_munmap((addr), (len))
+#else
+#define mu_open(path, flags)        open((path), (flags))
+#define mu_close(fd)                close(fd)
+#define mu_read(fd, buf, len)       read((fd), (buf), (len))
+#define mu_write(fd, buf, len)      write((fd), (buf), (len))
+#define mu_ioctl                    ioctl
+#define mu_mmap(fd, len)            mmap(NULL, (len), PROT_READ | PROT_WRITE, MAP_SHARED, (fd), 0)
+#define mu_munmap(addr, len)        munmap((addr), (len))
+#endif
+
+#define SECO_MU_MAX_BUFS          8u
+#define SECO_MU_MAX_REG_BUFS      16u
+
+#define SECO_MU_MAX_SERVED          4u
 
 #define SHE_DEFAULT_DID             0x0u
 #define SHE_DEFAULT_TZ              0x0u
@@ -34,9 +67,51 @@
 #define SHE_DEFAULT_PRIORITY        0x0u
 #define SHE_DEFAULT_OPERATING_MODE  0x0u
 
+/* Commands in flight on a session. Seco answers the commands of a channel in order. */
+struct seco_os_abs_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t depth;                     /* Commands the driver accepts before the first response is read. */
+    uint32_t inflight;
+    struct seco_os_abs_req *sent_head;  /* Commands written, waiting for their response. */
+    struct seco_os_abs_req *sent_tail;
+    /* Completion of asynchronous requests, set up on first use. */
+    pthread_t thread;
+    int32_t efd;
+    uint8_t stop;
+    uint8_t no_xfer;                    /* Driver without SECO_MU_IOCTL_XFER. */
+    uint8_t no_iobufs;                  /* Driver without SECO_MU_IOCTL_SETUP_IOBUFS. */
+    uint8_t tx_busy;                    /* Data buffers set up by tx_owner for its next command. */
+    pthread_t tx_owner;
+    struct seco_os_abs_req *done_head;
+    struct seco_os_abs_req *done_tail;
+};
+
+/* Buffer registered by the user. Pinned when the driver gave it a persistent address. */
+struct seco_os_abs_reg_buf {
+    uint8_t *data;
+    uint32_t size;
+    uint8_t pinned;
+};
+
+/* Secure RAM partition shared with Seco. Its upper part can be handed out to the user,
+ * the driver stages the SEC_MEM data buffers in the rest.
+ */
+struct seco_os_abs_shm {
+    uint8_t *base;                      /* Mapping of the partition, set up on first allocation. */
+    uint32_t off;                       /* Offset of the partition in secure RAM. */
+    uint32_t size;
+    uint32_t arena;                     /* Bytes allocated to the user at the end of the partition. */
+};
+
 struct seco_os_abs_hdl {
     int32_t fd;
     uint32_t type;
+    struct seco_os_abs_queue q;
+    struct seco_os_abs_shm shm;         /* Protected by the queue lock. */
+    struct seco_os_abs_reg_buf reg[SECO_MU_MAX_REG_BUFS];   /* Protected by the queue lock. */
+    struct seco_storage *storage;       /* Storage channel: backend, opened on first use if not selected. */
+    uint8_t cancel_read;                /* Next read, first of a request, cancelled on server stop. */
 };
 
 /*
@@ -45,14 +120,33 @@ struct seco_os_abs_hdl {
  * MU3: unused
  */
 
+/* Handle tables of the libraries: looked up on each call, rarely modified. */
+static pthread_rwlock_t seco_os_abs_tables_lock = PTHREAD_RWLOCK_INITIALIZER;
+
 static char SECO_MU_SHE_PATH[] = "/dev/seco_mu1_ch0";
 static char SECO_MU_SHE_NVM_PATH[] = "/dev/seco_mu1_ch1";
 static char SECO_MU_HSM_PATH[] = "/dev/seco_mu2_ch0";
 static char SECO_MU_HSM_NVM_PATH[] = "/dev/seco_mu2_ch1";
 
-static char SECO_NVM_SHE_STORAGE_FILE[] = "/etc/seco_she_nvm";
-static char SECO_NVM_HSM_STORAGE_FILE[] = "/etc/seco_hsm/seco_nvm_master";
-static char SECO_NVM_HSM_STORAGE_CHUNK_PATH[] = "/etc/seco_hsm/";
+/* Check the optional calls of the driver before anything is sent on the channel: the
+ * seco_mu driver fails the commands it does not know with EINVAL, which cannot be told
+ * apart from an error once a command is sent.
+ */
+static void seco_os_abs_probe_driver(struct seco_os_abs_hdl *phdl)
+{
+    struct seco_mu_ioctl_xfer xfer;
+    struct seco_mu_ioctl_setup_iobufs ios;
+
+    (void)memset(&xfer, 0, sizeof(xfer));
+    if (mu_ioctl(phdl->fd, SECO_MU_IOCTL_XFER, &xfer) != 0) {
+        phdl->q.no_xfer = 1u;
+    }
+    ios.iobufs = NULL;
+    ios.nb_iobufs = 0u;
+    if (mu_ioctl(phdl->fd, SECO_MU_IOCTL_SETUP_IOBUFS, &ios) != 0) {
+        phdl->q.no_iobufs = 1u;
+    }
+}
 
 /* Open a SHE session and returns a pointer to the handle or NULL in case of error.
  * Here it consists in opening the decicated seco MU device file.
@@ -62,6 +156,7 @@ struct seco_os_abs_hdl *seco_os_abs_open_mu_channel(uint32_t type, struct seco_m
     char *device_path;
     struct seco_os_abs_hdl *phdl = malloc(sizeof(struct seco_os_abs_hdl));
     struct seco_mu_ioctl_get_mu_info info_ioctl;
+    struct seco_mu_ioctl_cmd_depth depth_ioctl;
     int32_t error;
     uint8_t is_nvm = 0u;
 
@@ -86,15 +181,33 @@ struct seco_os_abs_hdl *seco_os_abs_open_mu_channel(uint32_t type, struct seco_m
     }
 
     if ((phdl != NULL) && (device_path != NULL) && (mu_params != NULL)) {
-        phdl->fd = open(device_path, O_RDWR);
+        phdl->fd = mu_open(device_path, O_RDWR);
         /* If open failed return NULL handle. */
         if (phdl->fd < 0) {
             free(phdl);
             phdl = NULL;
         } else {
             phdl->type = type;
+            phdl->q.depth = 1u;
+            phdl->q.inflight = 0u;
+            phdl->q.sent_head = NULL;
+            phdl->q.sent_tail = NULL;
+            phdl->q.efd = -1;
+            phdl->q.stop = 0u;
+            phdl->q.no_xfer = 0u;
+            phdl->q.no_iobufs = 0u;
+            phdl->q.tx_busy = 0u;
+            phdl->q.done_head = NULL;
+            phdl->q.done_tail = NULL;
+            (void)memset(phdl->reg, 0, sizeof(phdl->reg));
+            (void)memset(&phdl->shm, 0, sizeof(phdl->shm));
+            phdl->storage = NULL;
+            phdl->cancel_read = 0u;
+            (void)pthread_mutex_init(&phdl->q.lock, NULL);
+            (void)pthread_cond_init(&phdl->q.cond, NULL);
+            seco_os_abs_probe_driver(phdl);
 
-            error = ioctl(phdl->fd, SECO_MU_IOCTL_GET_MU_INFO, &info_ioctl);
+            error = mu_ioctl(phdl->fd, SECO_MU_IOCTL_GET_MU_INFO, &info_ioctl);
             if (error == 0) {
                 mu_params->mu_id = info_ioctl.seco_mu_idx;
                 mu_params->interrupt_idx = info_ioctl.interrupt_idx;
@@ -111,10 +224,21 @@ struct seco_os_abs_hdl *seco_os_abs_open_mu_channel(uint32_t type, struct seco_m
 
             if (is_nvm != 0u) {
                 /* for NVM: configure the device to accept incoming commands. */
-                if (ioctl(phdl->fd, SECO_MU_IOCTL_ENABLE_CMD_RCV)) {
+                if (mu_ioctl(phdl->fd, SECO_MU_IOCTL_ENABLE_CMD_RCV)) {
+                    (void)pthread_cond_destroy(&phdl->q.cond);
+                    (void)pthread_mutex_destroy(&phdl->q.lock);
                     free(phdl);
                     phdl = NULL;
                 }
+            } else {
+                /* Queue several commands if the driver supports it. A depth out of range is
+                 * not the answer of a driver implementing the call: keep one command at a time.
+                 */
+                depth_ioctl.depth = 0u;
+                if ((mu_ioctl(phdl->fd, SECO_MU_IOCTL_GET_CMD_DEPTH, &depth_ioctl) == 0)
+                    && (depth_ioctl.depth > 1u) && (depth_ioctl.depth <= SECO_MU_MAX_CMD_DEPTH)) {
+                    phdl->q.depth = depth_ioctl.depth;
+                }
             }
         }
     }
@@ -122,11 +246,205 @@ struct seco_os_abs_hdl *seco_os_abs_open_mu_channel(uint32_t type, struct seco_m
 }
 
 
+/* Marks the requests of seco_os_abs_exchange_mu_message(): their response is read
+ * by the caller itself. Never called.
+ */
+static void seco_os_abs_sync_req(struct seco_os_abs_req *req)
+{
+    (void)req;
+}
+
+/* Wait until no command is in flight on the session. Called with the queue lock held. */
+static void seco_os_abs_wait_idle(struct seco_os_abs_queue *q)
+{
+    while (q->inflight != 0u) {
+        (void)pthread_cond_wait(&q->cond, &q->lock);
+    }
+}
+
+/* The driver attaches the data buffers set up to the next command written on the channel.
+ * From its first data buffer until its command is written, the channel belongs to a thread:
+ * the others wait before setting up buffers or writing a command.
+ * Called with the queue lock held.
+ */
+static void seco_os_abs_tx_wait(struct seco_os_abs_queue *q)
+{
+    while ((q->tx_busy != 0u) && (pthread_equal(q->tx_owner, pthread_self()) == 0)) {
+        (void)pthread_cond_wait(&q->cond, &q->lock);
+    }
+}
+
+static void seco_os_abs_tx_acquire(struct seco_os_abs_queue *q)
+{
+    seco_os_abs_tx_wait(q);
+    q->tx_busy = 1u;
+    q->tx_owner = pthread_self();
+}
+
+static void seco_os_abs_tx_release(struct seco_os_abs_queue *q)
+{
+    if ((q->tx_busy != 0u) && (pthread_equal(q->tx_owner, pthread_self()) != 0)) {
+        q->tx_busy = 0u;
+        (void)pthread_cond_broadcast(&q->cond);
+    }
+}
+
+/* Write the command of a request and queue it for its response.
+ * Called with the queue lock held so that the order of the queue is the order of the writes.
+ */
+static int32_t seco_os_abs_queue_send(struct seco_os_abs_hdl *phdl, struct seco_os_abs_req *req)
+{
+    struct seco_os_abs_queue *q = &phdl->q;
+    int32_t err = -1;
+
+    do {
+        seco_os_abs_tx_wait(q);
+        while (q->inflight >= q->depth) {
+            (void)pthread_cond_wait(&q->cond, &q->lock);
+        }
+        /* The channel may have been taken while waiting for a free entry. */
+    } while ((q->tx_busy != 0u) && (pthread_equal(q->tx_owner, pthread_self()) == 0));
+
+    if (mu_write(phdl->fd, req->cmd, req->cmd_len) == (ssize_t)req->cmd_len) {
+        req->status = 0;
+        req->next = NULL;
+        if (q->sent_tail != NULL) {
+            q->sent_tail->next = req;
+        } else {
+            q->sent_head = req;
+        }
+        q->sent_tail = req;
+        q->inflight++;
+        err = 0;
+    }
+    seco_os_abs_tx_release(q);
+
+    return err;
+}
+
+/* Read the response of the request at the head of the queue.
+ * Called without the queue lock: only the reader of the head accesses the MU.
+ */
+static void seco_os_abs_queue_read(struct seco_os_abs_hdl *phdl, struct seco_os_abs_req *req)
+{
+    req->status = (int32_t)mu_read(phdl->fd, req->rsp, req->rsp_len);
+
+    /* Responses carry the ID of the command they answer: check the match. */
+    if ((req->status >= (int32_t)sizeof(uint32_t))
+        && (((struct sab_mu_hdr *)req->rsp)->command != ((struct sab_mu_hdr *)req->cmd)->command)) {
+        req->status = -1;
+    }
+}
+
+/* Remove the head of the queue once its response is read and report its completion.
+ * Called with the queue lock held.
+ */
+static void seco_os_abs_queue_complete(struct seco_os_abs_queue *q, struct seco_os_abs_req *req)
+{
+    uint64_t event = 1u;
+
+    q->sent_head = req->next;
+    if (q->sent_head == NULL) {
+        q->sent_tail = NULL;
+    }
+    req->next = NULL;
+    q->inflight--;
+    (void)pthread_cond_broadcast(&q->cond);
+
+    if (req->callback == seco_os_abs_sync_req) {
+        /* The caller is waiting for it: nothing else to do. */
+    } else if (req->callback != NULL) {
+        (void)pthread_mutex_unlock(&q->lock);
+        req->callback(req);
+        (void)pthread_mutex_lock(&q->lock);
+    } else {
+        if (q->done_tail != NULL) {
+            q->done_tail->next = req;
+        } else {
+            q->done_head = req;
+        }
+        q->done_tail = req;
+        (void)write(q->efd, &event, sizeof(event));
+    }
+}
+
+/* Worker thread reading the responses of the asynchronous requests of a session. */
+static void *seco_os_abs_async_thread(void *arg)
+{
+    struct seco_os_abs_hdl *phdl = (struct seco_os_abs_hdl *)arg;
+    struct seco_os_abs_queue *q = &phdl->q;
+    struct seco_os_abs_req *req;
+
+    (void)pthread_mutex_lock(&q->lock);
+    for (;;) {
+        /* Responses of synchronous requests are read by their caller. */
+        while (((q->sent_head == NULL) || (q->sent_head->callback == seco_os_abs_sync_req))
+               && (q->stop == 0u)) {
+            (void)pthread_cond_wait(&q->cond, &q->lock);
+        }
+        if (q->stop != 0u) {
+            break;
+        }
+        req = q->sent_head;
+        (void)pthread_mutex_unlock(&q->lock);
+        seco_os_abs_queue_read(phdl, req);
+        (void)pthread_mutex_lock(&q->lock);
+        seco_os_abs_queue_complete(q, req);
+    }
+    (void)pthread_mutex_unlock(&q->lock);
+
+    return NULL;
+}
+
+/* Start the completion of asynchronous requests. Called with the queue lock held. */
+static int32_t seco_os_abs_async_start(struct seco_os_abs_hdl *phdl)
+{
+    struct seco_os_abs_queue *q = &phdl->q;
+    int32_t err = 0;
+
+    if (q->efd < 0) {
+        q->efd = eventfd(0u, EFD_CLOEXEC | EFD_NONBLOCK | EFD_SEMAPHORE);
+        if ((q->efd >= 0)
+            && (pthread_create(&q->thread, NULL, seco_os_abs_async_thread, phdl) != 0)) {
+            (void)close(q->efd);
+            q->efd = -1;
+        }
+        if (q->efd < 0) {
+            err = -1;
+        }
+    }
+
+    return err;
+}
+
 /* Close a previously opened session (SHE or storage). */
 void seco_os_abs_close_session(struct seco_os_abs_hdl *phdl)
 {
-    /* Close the device. */
-    (void)close(phdl->fd);
+    struct seco_os_abs_queue *q = &phdl->q;
+
+    /* Let the commands in flight complete then stop the worker. */
+    (void)pthread_mutex_lock(&q->lock);
+    seco_os_abs_wait_idle(q);
+    q->stop = 1u;
+    (void)pthread_cond_broadcast(&q->cond);
+    (void)pthread_mutex_unlock(&q->lock);
+    if (q->efd >= 0) {
+        (void)pthread_join(q->thread, NULL);
+        (void)close(q->efd);
+    }
+    (void)pthread_cond_destroy(&q->cond);
+    (void)pthread_mutex_destroy(&q->lock);
+
+    if (phdl->shm.base != NULL) {
+        (void)mu_munmap(phdl->shm.base, phdl->shm.size);
+    }
+
+    if (phdl->storage != NULL) {
+        phdl->storage->ops->close(phdl->storage);
+    }
+
+    /* Close the device. This also releases the registered buffers. */
+    (void)mu_close(phdl->fd);
 
     free(phdl);
 }
@@ -134,15 +452,578 @@ void seco_os_abs_close_session(struct seco_os_abs_hdl *phdl)
 /* Send a message to Seco on the MU. Return the size of the data written. */
 int32_t seco_os_abs_send_mu_message(struct seco_os_abs_hdl *phdl, uint32_t *message, uint32_t size)
 {
-    return (int32_t)write(phdl->fd, message, size);
+    int32_t len;
+
+    (void)pthread_mutex_lock(&phdl->q.lock);
+    seco_os_abs_tx_wait(&phdl->q);
+    seco_os_abs_wait_idle(&phdl->q);
+    len = (int32_t)mu_write(phdl->fd, message, size);
+    seco_os_abs_tx_release(&phdl->q);
+    (void)pthread_mutex_unlock(&phdl->q.lock);
+
+    return len;
 }
 
 /* Read a message from Seco on the MU. Return the size of the data that were read. */
 int32_t seco_os_abs_read_mu_message(struct seco_os_abs_hdl *phdl, uint32_t *message, uint32_t size)
 {
-    return (int32_t)read(phdl->fd, message, size);
+    int32_t state;
+    int32_t len;
+
+    if (phdl->cancel_read != 0u) {
+        /* Waiting for a new request: nothing is left half done if cancelled. */
+        phdl->cancel_read = 0u;
+        (void)pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &state);
+        len = (int32_t)mu_read(phdl->fd, message, size);
+        (void)pthread_setcancelstate(state, NULL);
+    } else {
+        len = (int32_t)mu_read(phdl->fd, message, size);
+    }
+
+    return len;
 };
 
+/* Send a command and wait for its response. Return the size of the response. */
+int32_t seco_os_abs_exchange_mu_message(struct seco_os_abs_hdl *phdl, uint32_t *cmd, uint32_t cmd_len, uint32_t *rsp, uint32_t rsp_len)
+{
+    struct seco_os_abs_queue *q = &phdl->q;
+    struct seco_os_abs_req req;
+
+    req.cmd = cmd;
+    req.cmd_len = cmd_len;
+    req.rsp = rsp;
+    req.rsp_len = rsp_len;
+    req.status = -1;
+    req.callback = seco_os_abs_sync_req;
+    req.user_data = NULL;
+
+    (void)pthread_mutex_lock(&q->lock);
+    if (seco_os_abs_queue_send(phdl, &req) == 0) {
+        /* Commands queued before this one are answered first. */
+        while (q->sent_head != &req) {
+            (void)pthread_cond_wait(&q->cond, &q->lock);
+        }
+        (void)pthread_mutex_unlock(&q->lock);
+        seco_os_abs_queue_read(phdl, &req);
+        (void)pthread_mutex_lock(&q->lock);
+        seco_os_abs_queue_complete(q, &req);
+    }
+    (void)pthread_mutex_unlock(&q->lock);
+
+    return req.status;
+}
+
+/* Write the address of a data buffer in a command. */
+static void seco_os_abs_set_buf_addr(uint32_t *cmd, uint32_t cmd_len, struct seco_os_abs_buf *buf, uint64_t addr)
+{
+    uint8_t *dst = (uint8_t *)cmd + buf->cmd_offset;
+    uint16_t addr16 = (uint16_t)(addr & SEC_MEM_SHORT_ADDR_MASK);
+    uint32_t addr32 = (uint32_t)addr;
+
+    if (buf->cmd_offset == DATA_BUF_NO_ADDR) {
+        /* Buffer not referenced by the command. */
+    } else if ((buf->flags & DATA_BUF_SHORT_ADDR) != 0u) {
+        if ((cmd_len >= sizeof(addr16)) && (buf->cmd_offset <= cmd_len - sizeof(addr16))) {
+            (void)memcpy(dst, &addr16, sizeof(addr16));
+        }
+    } else {
+        if ((cmd_len >= sizeof(addr32)) && (buf->cmd_offset <= cmd_len - sizeof(addr32))) {
+            (void)memcpy(dst, &addr32, sizeof(addr32));
+        }
+    }
+}
+
+/* Flags of a data buffer: tell the driver when it lies in a pinned registered buffer. */
+static uint32_t seco_os_abs_buf_flags(struct seco_os_abs_hdl *phdl, uint8_t *data, uint32_t size, uint32_t flags)
+{
+    struct seco_os_abs_reg_buf *r;
+    uint32_t i;
+
+    if ((data != NULL) && (size != 0u) && ((flags & DATA_BUF_USE_SEC_MEM) == 0u)) {
+        (void)pthread_mutex_lock(&phdl->q.lock);
+        for (i = 0u; i < SECO_MU_MAX_REG_BUFS; i++) {
+            r = &phdl->reg[i];
+            if ((r->pinned != 0u) && (data >= r->data) && (size <= r->size)
+                && ((size_t)(data - r->data) <= (size_t)(r->size - size))) {
+                flags |= SECO_MU_IO_FLAGS_REGISTERED;
+                break;
+            }
+        }
+        (void)pthread_mutex_unlock(&phdl->q.lock);
+    }
+
+    return flags;
+}
+
+/* Carry a whole transaction in one call to the driver.
+ * Return 0 if the transaction was handled (successfully or not), 1 if it must go through
+ * the separate buffer setup, write and read.
+ */
+static int32_t seco_os_abs_xfer(struct seco_os_abs_hdl *phdl, uint32_t *cmd, uint32_t cmd_len, uint32_t *rsp, uint32_t rsp_len,
+                                struct seco_os_abs_buf *bufs, uint32_t nb_bufs, uint32_t flags, int32_t *len)
+{
+    struct seco_os_abs_queue *q = &phdl->q;
+    struct seco_mu_ioctl_xfer xfer;
+    struct seco_mu_ioctl_xfer_buf xfer_bufs[SECO_MU_MAX_BUFS];
+    int32_t ret = 1;
+    uint32_t i;
+
+    for (i = 0u; (i < nb_bufs) && (i < SECO_MU_MAX_BUFS); i++) {
+        xfer_bufs[i].flags = seco_os_abs_buf_flags(phdl, bufs[i].data, bufs[i].size, bufs[i].flags);
+    }
+
+    (void)pthread_mutex_lock(&q->lock);
+    /* The driver answers the transaction itself: only possible if nothing else is in flight. */
+    if ((q->no_xfer == 0u) && (q->inflight == 0u) && (q->tx_busy == 0u) && (nb_bufs <= SECO_MU_MAX_BUFS)) {
+        /* Hold the channel for the duration of the transaction. */
+        q->inflight = q->depth;
+        seco_os_abs_tx_acquire(q);
+        (void)pthread_mutex_unlock(&q->lock);
+
+        for (i = 0u; i < nb_bufs; i++) {
+            xfer_bufs[i].user_buf = bufs[i].data;
+            xfer_bufs[i].length = bufs[i].size;
+            xfer_bufs[i].cmd_offset = bufs[i].cmd_offset;
+        }
+        xfer.cmd = cmd;
+        xfer.rsp = rsp;
+        xfer.bufs = xfer_bufs;
+        xfer.cmd_len = cmd_len;
+        xfer.rsp_len = rsp_len;
+        xfer.nb_bufs = nb_bufs;
+        xfer.flags = ((flags & MU_TRANSACTION_CMD_CRC) != 0u) ? SECO_MU_XFER_FLAGS_CMD_CRC : 0u;
+
+        /* Supported by the driver (see seco_os_abs_probe_driver()): a failure is the result. */
+        *len = -1;
+        if (mu_ioctl(phdl->fd, SECO_MU_IOCTL_XFER, &xfer) == 0) {
+            *len = (int32_t)xfer.rsp_len;
+            if ((*len >= (int32_t)sizeof(uint32_t))
+                && (((struct sab_mu_hdr *)rsp)->command != ((struct sab_mu_hdr *)cmd)->command)) {
+                *len = -1;
+            }
+        }
+        ret = 0;
+
+        (void)pthread_mutex_lock(&q->lock);
+        q->inflight = 0u;
+        seco_os_abs_tx_release(q);
+        (void)pthread_cond_broadcast(&q->cond);
+    }
+    (void)pthread_mutex_unlock(&q->lock);
+
+    return ret;
+}
+
+/* Send a command with its data buffers and wait for its response. Return the size of the response. */
+int32_t seco_os_abs_mu_transaction(struct seco_os_abs_hdl *phdl, uint32_t *cmd, uint32_t cmd_len, uint32_t *rsp, uint32_t rsp_len,
+                                   struct seco_os_abs_buf *bufs, uint32_t nb_bufs, uint32_t flags)
+{
+    uint64_t addrs[SECO_MU_MAX_BUFS];
+    int32_t len = -1;
+    uint32_t nb_words = cmd_len / (uint32_t)sizeof(uint32_t);
+    uint32_t i;
+
+    if (seco_os_abs_xfer(phdl, cmd, cmd_len, rsp, rsp_len, bufs, nb_bufs, flags, &len) != 0) {
+        if ((nb_bufs > SECO_MU_MAX_BUFS)
+            || ((nb_bufs != 0u) && (seco_os_abs_data_bufs(phdl, bufs, nb_bufs, addrs) != 0))) {
+            return -1;
+        }
+        for (i = 0u; i < nb_bufs; i++) {
+            seco_os_abs_set_buf_addr(cmd, cmd_len, &bufs[i], addrs[i]);
+        }
+        if (((flags & MU_TRANSACTION_CMD_CRC) != 0u) && (nb_words > 0u)) {
+            cmd[nb_words - 1u] = 0u;
+            for (i = 0u; i < nb_words - 1u; i++) {
+                cmd[nb_words - 1u] ^= cmd[i];
+            }
+        }
+        len = seco_os_abs_exchange_mu_message(phdl, cmd, cmd_len, rsp, rsp_len);
+    }
+
+    return len;
+}
+
+/* Write the command of a request. Its response is read by the worker of the session.
+ * Return 0 if the request was submitted.
+ */
+int32_t seco_os_abs_submit_mu_message(struct seco_os_abs_hdl *phdl, struct seco_os_abs_req *req)
+{
+    int32_t err = -1;
+
+    if ((req != NULL) && (req->callback != seco_os_abs_sync_req)) {
+        (void)pthread_mutex_lock(&phdl->q.lock);
+        if (seco_os_abs_async_start(phdl) == 0) {
+            err = seco_os_abs_queue_send(phdl, req);
+        }
+        (void)pthread_mutex_unlock(&phdl->q.lock);
+    }
+
+    return err;
+}
+
+/* Return the eventfd counting the requests waiting in the completion queue. */
+int32_t seco_os_abs_get_completion_fd(struct seco_os_abs_hdl *phdl)
+{
+    int32_t efd;
+
+    (void)pthread_mutex_lock(&phdl->q.lock);
+    (void)seco_os_abs_async_start(phdl);
+    efd = phdl->q.efd;
+    (void)pthread_mutex_unlock(&phdl->q.lock);
+
+    return efd;
+}
+
+/* Pop the oldest completed request, if any. */
+struct seco_os_abs_req *seco_os_abs_get_completion(struct seco_os_abs_hdl *phdl)
+{
+    struct seco_os_abs_queue *q = &phdl->q;
+    struct seco_os_abs_req *req;
+    uint64_t event;
+
+    (void)pthread_mutex_lock(&q->lock);
+    req = q->done_head;
+    if (req != NULL) {
+        q->done_head = req->next;
+        if (q->done_head == NULL) {
+            q->done_tail = NULL;
+        }
+        req->next = NULL;
+        /* Consume the event signaled for this request. */
+        (void)read(q->efd, &event, sizeof(event));
+    }
+    (void)pthread_mutex_unlock(&q->lock);
+
+    return req;
+}
+
+/* Channels served by seco_os_abs_serve_mu_channels(). The calling thread waits for the
+ * channels to become readable and queues them to the workers. A channel is armed in one-shot
+ * mode: it is not reported again before its handler returned, so that its messages are
+ * processed in order by one worker at a time.
+ * A single channel is served by one worker, waiting with poll for a request or the stop
+ * before calling the handler. If the driver does not support poll, the worker waits in the
+ * first read of a request instead, cancelled on stop.
+ */
+struct seco_os_abs_server {
+    int32_t epfd;
+    int32_t wake_fd;                    /* Signaled when the last channel is dropped or on stop. */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t ready[SECO_MU_MAX_SERVED]; /* Channels readable, waiting for a worker. */
+    uint32_t ready_head;
+    uint32_t ready_count;
+    uint32_t active;                    /* Channels still served. */
+    uint8_t stop;
+    uint8_t pollable;                   /* Single channel: the driver supports poll. */
+    uint32_t nb;
+    struct seco_os_abs_hdl **phdls;
+    void **ctxs;
+    seco_os_abs_mu_handler handler;
+};
+
+static int32_t seco_os_abs_server_arm(struct seco_os_abs_server *s, uint32_t i, int32_t op)
+{
+    struct epoll_event ev;
+
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ev.data.u32 = i;
+
+    return epoll_ctl(s->epfd, op, s->phdls[i]->fd, &ev);
+}
+
+static void *seco_os_abs_server_worker(void *arg)
+{
+    struct seco_os_abs_server *s = (struct seco_os_abs_server *)arg;
+    uint64_t one = 1u;
+    uint32_t i;
+    int32_t err;
+
+    (void)pthread_mutex_lock(&s->lock);
+    for (;;) {
+        while ((s->ready_count == 0u) && (s->stop == 0u)) {
+            (void)pthread_cond_wait(&s->cond, &s->lock);
+        }
+        if (s->ready_count == 0u) {
+            break;
+        }
+        i = s->ready[s->ready_head];
+        s->ready_head = (s->ready_head + 1u) % SECO_MU_MAX_SERVED;
+        s->ready_count--;
+        (void)pthread_mutex_unlock(&s->lock);
+
+        err = s->handler(s->phdls[i], s->ctxs[i]);
+
+        /* Re-armed under the lock: the next message of the channel can go to another
+         * worker, which must see what this one did.
+         */
+        (void)pthread_mutex_lock(&s->lock);
+        if (err == 0) {
+            err = seco_os_abs_server_arm(s, i, EPOLL_CTL_MOD);
+        }
+        if (err != 0) {
+            /* Stop serving this channel. */
+            (void)epoll_ctl(s->epfd, EPOLL_CTL_DEL, s->phdls[i]->fd, NULL);
+            s->active--;
+            if (s->active == 0u) {
+                (void)write(s->wake_fd, &one, sizeof(one));
+            }
+        }
+    }
+    (void)pthread_mutex_unlock(&s->lock);
+
+    return NULL;
+}
+
+/* Allocate the resources needed to serve channels. */
+struct seco_os_abs_server *seco_os_abs_server_open(void)
+{
+    struct seco_os_abs_server *s;
+    struct epoll_event ev;
+    int32_t err = -1;
+
+    s = (struct seco_os_abs_server *)malloc(sizeof(struct seco_os_abs_server));
+    if (s != NULL) {
+        (void)memset(s, 0, sizeof(struct seco_os_abs_server));
+        (void)pthread_mutex_init(&s->lock, NULL);
+        (void)pthread_cond_init(&s->cond, NULL);
+
+        do {
+            s->epfd = epoll_create1(EPOLL_CLOEXEC);
+            s->wake_fd = eventfd(0u, EFD_CLOEXEC);
+            if ((s->epfd < 0) || (s->wake_fd < 0)) {
+                break;
+            }
+            ev.events = EPOLLIN;
+            ev.data.u32 = SECO_MU_MAX_SERVED;
+            err = epoll_ctl(s->epfd, EPOLL_CTL_ADD, s->wake_fd, &ev);
+        } while (false);
+
+        if (err != 0) {
+            seco_os_abs_server_close(s);
+            s = NULL;
+        }
+    }
+
+    return s;
+}
+
+/* Wait for a request on the single channel served. Return 0 if one is available, -1 on stop. */
+static int32_t seco_os_abs_server_wait(struct seco_os_abs_server *s)
+{
+    struct pollfd fds[2];
+    int32_t n;
+    int32_t err = -1;
+
+    fds[0].fd = s->phdls[0]->fd;
+    fds[0].events = POLLIN;
+    fds[0].revents = 0;
+    fds[1].fd = s->wake_fd;
+    fds[1].events = POLLIN;
+    fds[1].revents = 0;
+    do {
+        n = poll(fds, 2u, -1);
+    } while ((n < 0) && (errno == EINTR));
+    if ((n > 0) && (fds[1].revents == 0) && (fds[0].revents != 0)) {
+        err = 0;
+    }
+
+    return err;
+}
+
+/* Serve a single channel. The handler is only called for a request received: once called,
+ * the request is completed whatever the stop.
+ */
+static void *seco_os_abs_server_reader(void *arg)
+{
+    struct seco_os_abs_server *s = (struct seco_os_abs_server *)arg;
+    int32_t err = 0;
+
+    (void)pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+    (void)pthread_mutex_lock(&s->lock);
+    while ((err == 0) && (s->stop == 0u)) {
+        (void)pthread_mutex_unlock(&s->lock);
+        if (s->pollable != 0u) {
+            err = seco_os_abs_server_wait(s);
+        } else {
+            s->phdls[0]->cancel_read = 1u;
+        }
+        if (err == 0) {
+            err = s->handler(s->phdls[0], s->ctxs[0]);
+        }
+        (void)pthread_mutex_lock(&s->lock);
+    }
+    s->active = 0u;
+    (void)pthread_cond_broadcast(&s->cond);
+    (void)pthread_mutex_unlock(&s->lock);
+
+    return NULL;
+}
+
+/* Register the channels to serve. Return 0 once they can all be waited for. */
+int32_t seco_os_abs_server_add_channels(struct seco_os_abs_server *s, struct seco_os_abs_hdl **phdls, void **ctxs, uint32_t nb, seco_os_abs_mu_handler handler)
+{
+    uint32_t nb_armed = 0u;
+    uint32_t i;
+    int32_t err = -1;
+
+    do {
+        if ((s == NULL) || (s->nb != 0u) || (phdls == NULL) || (handler == NULL)
+            || (nb == 0u) || (nb > SECO_MU_MAX_SERVED)) {
+            break;
+        }
+        s->phdls = phdls;
+        s->ctxs = ctxs;
+        s->handler = handler;
+        if (nb > 1u) {
+            /* Fails if the driver does not support poll. */
+            for (i = 0u; i < nb; i++) {
+                if (seco_os_abs_server_arm(s, i, EPOLL_CTL_ADD) != 0) {
+                    break;
+                }
+                nb_armed++;
+            }
+            if (nb_armed < nb) {
+                for (i = 0u; i < nb_armed; i++) {
+                    (void)epoll_ctl(s->epfd, EPOLL_CTL_DEL, phdls[i]->fd, NULL);
+                }
+                break;
+            }
+        } else if (seco_os_abs_server_arm(s, 0u, EPOLL_CTL_ADD) == 0) {
+            /* Only checks that the driver supports poll. */
+            s->pollable = 1u;
+            (void)epoll_ctl(s->epfd, EPOLL_CTL_DEL, phdls[0]->fd, NULL);
+        } else {
+            s->pollable = 0u;
+        }
+        s->nb = nb;
+        s->active = nb;
+        err = 0;
+    } while (false);
+
+    return err;
+}
+
+/* Serve incoming messages of the channels added. Return once no channel is served anymore or
+ * when stopped.
+ */
+int32_t seco_os_abs_serve_mu_channels(struct seco_os_abs_server *s)
+{
+    struct epoll_event evs[SECO_MU_MAX_SERVED + 1u];
+    pthread_t workers[SECO_MU_MAX_SERVED];
+    uint32_t nb_workers = 0u;
+    uint64_t val;
+    uint32_t i;
+    int32_t n;
+    int32_t k;
+    int32_t err = -1;
+
+    do {
+        if ((s == NULL) || (s->nb == 0u)) {
+            break;
+        }
+
+        if (s->nb == 1u) {
+            if (pthread_create(&workers[0], NULL, seco_os_abs_server_reader, s) != 0) {
+                break;
+            }
+            nb_workers = 1u;
+            err = 0;
+
+            (void)pthread_mutex_lock(&s->lock);
+            while ((s->active != 0u) && (s->stop == 0u)) {
+                (void)pthread_cond_wait(&s->cond, &s->lock);
+            }
+            if ((s->active != 0u) && (s->pollable == 0u)) {
+                /* Only acts while waiting for a new request, see seco_os_abs_read_mu_message(). */
+                (void)pthread_cancel(workers[0]);
+            }
+            (void)pthread_mutex_unlock(&s->lock);
+            break;
+        }
+
+        /* One worker per channel: storage I/O of a channel never delays the others. */
+        for (i = 0u; i < s->nb; i++) {
+            if (pthread_create(&workers[i], NULL, seco_os_abs_server_worker, s) != 0) {
+                break;
+            }
+            nb_workers++;
+        }
+        if (nb_workers == 0u) {
+            break;
+        }
+        err = 0;
+
+        (void)pthread_mutex_lock(&s->lock);
+        while ((s->active != 0u) && (s->stop == 0u)) {
+            (void)pthread_mutex_unlock(&s->lock);
+            n = epoll_wait(s->epfd, evs, (int32_t)(s->nb + 1u), -1);
+            (void)pthread_mutex_lock(&s->lock);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                err = -1;
+                break;
+            }
+            for (k = 0; k < n; k++) {
+                if (evs[k].data.u32 == SECO_MU_MAX_SERVED) {
+                    (void)read(s->wake_fd, &val, sizeof(val));
+                } else {
+                    s->ready[(s->ready_head + s->ready_count) % SECO_MU_MAX_SERVED] = evs[k].data.u32;
+                    s->ready_count++;
+                    (void)pthread_cond_signal(&s->cond);
+                }
+            }
+        }
+        /* Workers complete the messages already received then exit. */
+        s->stop = 1u;
+        (void)pthread_cond_broadcast(&s->cond);
+        (void)pthread_mutex_unlock(&s->lock);
+    } while (false);
+
+    for (i = 0u; i < nb_workers; i++) {
+        (void)pthread_join(workers[i], NULL);
+    }
+    if ((s != NULL) && (s->nb > 1u)) {
+        for (i = 0u; i < s->nb; i++) {
+            (void)epoll_ctl(s->epfd, EPOLL_CTL_DEL, s->phdls[i]->fd, NULL);
+        }
+    }
+
+    return err;
+}
+
+/* Make seco_os_abs_serve_mu_channels() return, or return at once if not called yet. */
+void seco_os_abs_server_stop(struct seco_os_abs_server *s)
+{
+    uint64_t one = 1u;
+
+    if (s != NULL) {
+        (void)pthread_mutex_lock(&s->lock);
+        s->stop = 1u;
+        (void)write(s->wake_fd, &one, sizeof(one));
+        (void)pthread_cond_broadcast(&s->cond);
+        (void)pthread_mutex_unlock(&s->lock);
+    }
+}
+
+void seco_os_abs_server_close(struct seco_os_abs_server *s)
+{
+    if (s != NULL) {
+        if (s->wake_fd >= 0) {
+            (void)close(s->wake_fd);
+        }
+        if (s->epfd >= 0) {
+            (void)close(s->epfd);
+        }
+        (void)pthread_cond_destroy(&s->cond);
+        (void)pthread_mutex_destroy(&s->lock);
+        free(s);
+    }
+}
+
 /* Map the shared buffer allocated by Seco. */
 int32_t seco_os_abs_configure_shared_buf(struct seco_os_abs_hdl *phdl, uint32_t shared_buf_off, uint32_t size)
 {
@@ -151,7 +1032,18 @@ int32_t seco_os_abs_configure_shared_buf(struct seco_os_abs_hdl *phdl, uint32_t
 
     cfg.base_offset = shared_buf_off;
     cfg.size = size;
-    error = ioctl(phdl->fd, SECO_MU_IOCTL_SHARED_BUF_CFG, &cfg);
+    error = mu_ioctl(phdl->fd, SECO_MU_IOCTL_SHARED_BUF_CFG, &cfg);
+    if (error == 0) {
+        (void)pthread_mutex_lock(&phdl->q.lock);
+        if (phdl->shm.base != NULL) {
+            (void)mu_munmap(phdl->shm.base, phdl->shm.size);
+            phdl->shm.base = NULL;
+        }
+        phdl->shm.off = shared_buf_off;
+        phdl->shm.size = size;
+        phdl->shm.arena = 0u;
+        (void)pthread_mutex_unlock(&phdl->q.lock);
+    }
 
     return error;
 }
@@ -162,11 +1054,21 @@ uint64_t seco_os_abs_data_buf(struct seco_os_abs_hdl *phdl, uint8_t *src, uint32
     struct seco_mu_ioctl_setup_iobuf io;
     int32_t err;
 
+    /* Buffers are attached to the next command written. Unless the driver keeps them
+     * per command, wait for the command in flight to complete.
+     */
+    (void)pthread_mutex_lock(&phdl->q.lock);
+    seco_os_abs_tx_acquire(&phdl->q);
+    if (phdl->q.depth == 1u) {
+        seco_os_abs_wait_idle(&phdl->q);
+    }
+    (void)pthread_mutex_unlock(&phdl->q.lock);
+
     io.user_buf = src;
     io.length = size;
-    io.flags = flags;
+    io.flags = seco_os_abs_buf_flags(phdl, src, size, flags);
 
-    err = ioctl(phdl->fd, SECO_MU_IOCTL_SETUP_IOBUF, &io);
+    err = mu_ioctl(phdl->fd, SECO_MU_IOCTL_SETUP_IOBUF, &io);
 
     if (err != 0) {
         io.seco_addr = 0;
@@ -175,129 +1077,466 @@ uint64_t seco_os_abs_data_buf(struct seco_os_abs_hdl *phdl, uint8_t *src, uint32
     return io.seco_addr;
 }
 
-uint32_t seco_os_abs_crc(uint8_t *data, uint32_t size)
+/* Setup several data buffers, in one call to the driver when possible. Return 0 on success. */
+int32_t seco_os_abs_data_bufs(struct seco_os_abs_hdl *phdl, struct seco_os_abs_buf *bufs, uint32_t nb_bufs, uint64_t *addrs)
 {
-    return ((uint32_t)crc32(0xFFFFFFFFu, data, size) ^ 0xFFFFFFFFu);
+    struct seco_mu_ioctl_setup_iobufs ios;
+    struct seco_mu_ioctl_setup_iobuf io[SECO_MU_MAX_BUFS];
+    int32_t err = 1;
+    uint32_t i;
+
+    /* Buffers are attached to the next command written: same constraint as seco_os_abs_data_buf(). */
+    (void)pthread_mutex_lock(&phdl->q.lock);
+    seco_os_abs_tx_acquire(&phdl->q);
+    if (phdl->q.depth == 1u) {
+        seco_os_abs_wait_idle(&phdl->q);
+    }
+    (void)pthread_mutex_unlock(&phdl->q.lock);
+
+    if ((phdl->q.no_iobufs == 0u) && (nb_bufs <= SECO_MU_MAX_BUFS)) {
+        for (i = 0u; i < nb_bufs; i++) {
+            io[i].user_buf = bufs[i].data;
+            io[i].length = bufs[i].size;
+            io[i].flags = seco_os_abs_buf_flags(phdl, bufs[i].data, bufs[i].size, bufs[i].flags);
+            io[i].seco_addr = 0u;
+        }
+        ios.iobufs = io;
+        ios.nb_iobufs = nb_bufs;
+        /* Supported by the driver (see seco_os_abs_probe_driver()): a failure is the result. */
+        err = mu_ioctl(phdl->fd, SECO_MU_IOCTL_SETUP_IOBUFS, &ios);
+        if (err == 0) {
+            for (i = 0u; i < nb_bufs; i++) {
+                addrs[i] = io[i].seco_addr;
+            }
+        } else {
+            err = -1;
+        }
+    }
+    if (err > 0) {
+        for (i = 0u; i < nb_bufs; i++) {
+            addrs[i] = seco_os_abs_data_buf(phdl, bufs[i].data, bufs[i].size, bufs[i].flags);
+        }
+        err = 0;
+    }
+
+    if (err != 0) {
+        /* No command will follow. */
+        (void)pthread_mutex_lock(&phdl->q.lock);
+        seco_os_abs_tx_release(&phdl->q);
+        (void)pthread_mutex_unlock(&phdl->q.lock);
+    }
+
+    return err;
 }
 
-/* Write data in a file located in NVM. Return the size of the written data. */
-int32_t seco_os_abs_storage_write(struct seco_os_abs_hdl *phdl, uint8_t *src, uint32_t size)
+/* Send a message referencing data buffers, set up in the same call. */
+int32_t seco_os_abs_send_mu_message_with_bufs(struct seco_os_abs_hdl *phdl, uint32_t *message, uint32_t size,
+                                              struct seco_os_abs_buf *bufs, uint32_t nb_bufs)
 {
-    int32_t fd = -1;
-    int32_t l = 0;
-    char *path;
+    uint64_t addrs[SECO_MU_MAX_BUFS];
+    uint32_t i;
 
-    switch(phdl->type) {
-    case MU_CHANNEL_SHE_NVM:
-        path = SECO_NVM_SHE_STORAGE_FILE;
-        break;
-    case MU_CHANNEL_HSM_NVM:
-        path = SECO_NVM_HSM_STORAGE_FILE;
-        break;
-    default:
-        path = NULL;
-        break;
+    if ((nb_bufs > SECO_MU_MAX_BUFS)
+        || ((nb_bufs != 0u) && (seco_os_abs_data_bufs(phdl, bufs, nb_bufs, addrs) != 0))) {
+        return -1;
+    }
+    for (i = 0u; i < nb_bufs; i++) {
+        seco_os_abs_set_buf_addr(message, size, &bufs[i], addrs[i]);
     }
-    if (path != NULL) {
-        /* Open or create the file with access reserved to the current user. */
-        fd = open(path, O_CREAT|O_WRONLY|O_SYNC, S_IRUSR|S_IWUSR);
-        if (fd >= 0) {
-            /* Write the data. */
-            l = (int32_t)write(fd, src, size);
 
-            (void)close(fd);
-        }
+    return seco_os_abs_send_mu_message(phdl, message, size);
+}
+
+/* Give the driver the part of the shared buffer not allocated to the user.
+ * Called with the queue lock held and no command in flight.
+ */
+static int32_t seco_os_abs_shared_buf_resize(struct seco_os_abs_hdl *phdl, uint32_t arena)
+{
+    struct seco_mu_ioctl_shared_mem_cfg cfg;
+    int32_t err;
+
+    cfg.base_offset = phdl->shm.off;
+    cfg.size = phdl->shm.size - arena;
+    err = mu_ioctl(phdl->fd, SECO_MU_IOCTL_SHARED_BUF_CFG, &cfg);
+    if (err == 0) {
+        phdl->shm.arena = arena;
     }
 
-    return l;
+    return err;
 }
 
-int32_t seco_os_abs_storage_read(struct seco_os_abs_hdl *phdl, uint8_t *dst, uint32_t size)
+/* Allocate from the end of the shared buffer. Return NULL if not possible. */
+uint8_t *seco_os_abs_shared_buf_alloc(struct seco_os_abs_hdl *phdl, uint32_t size, uint32_t *offset)
 {
-    int32_t fd = -1;
-    int32_t l = 0;
-    char *path;
+    struct seco_os_abs_shm *shm = &phdl->shm;
+    uint8_t *ptr = NULL;
+    void *base;
+    uint32_t pos;
 
-    switch(phdl->type) {
-    case MU_CHANNEL_SHE_NVM:
-        path = SECO_NVM_SHE_STORAGE_FILE;
-        break;
-    case MU_CHANNEL_HSM_NVM:
-        path = SECO_NVM_HSM_STORAGE_FILE;
-        break;
-    default:
-        path = NULL;
-        break;
+    (void)pthread_mutex_lock(&phdl->q.lock);
+    do {
+        if ((size == 0u) || (shm->size == 0u) || (size > shm->size - shm->arena)) {
+            break;
+        }
+        /* The driver may be staging buffers of the commands in flight. */
+        seco_os_abs_wait_idle(&phdl->q);
+        if (shm->base == NULL) {
+            base = mu_mmap(phdl->fd, shm->size);
+            if (base == MAP_FAILED) {
+                break;
+            }
+            shm->base = (uint8_t *)base;
+        }
+        /* 8 bytes aligned, as the buffers set up by the driver. */
+        pos = (shm->size - shm->arena - size) & ~0x7u;
+        if (seco_os_abs_shared_buf_resize(phdl, shm->size - pos) != 0) {
+            break;
+        }
+        ptr = shm->base + pos;
+        if (offset != NULL) {
+            *offset = shm->off + pos;
+        }
+    } while (false);
+    (void)pthread_mutex_unlock(&phdl->q.lock);
+
+    return ptr;
+}
+
+/* Release all the allocations of the shared buffer. */
+void seco_os_abs_shared_buf_reset(struct seco_os_abs_hdl *phdl)
+{
+    (void)pthread_mutex_lock(&phdl->q.lock);
+    if (phdl->shm.arena != 0u) {
+        seco_os_abs_wait_idle(&phdl->q);
+        (void)seco_os_abs_shared_buf_resize(phdl, 0u);
     }
+    (void)pthread_mutex_unlock(&phdl->q.lock);
+}
 
-    if (path != NULL) {
-        /* Open the file as read only. */
-        fd = open(path, O_RDONLY);
-        if (fd >= 0) {
-            /* Read the data. */
-            l = (int32_t)read(fd, dst, size);
+/* Offset for Seco of a buffer allocated in the shared buffer. Return 0 if found. */
+int32_t seco_os_abs_shared_buf_offset(struct seco_os_abs_hdl *phdl, uint8_t *ptr, uint32_t size, uint32_t *offset)
+{
+    struct seco_os_abs_shm *shm = &phdl->shm;
+    int32_t err = -1;
+    uint32_t pos;
 
-            (void)close(fd);
+    (void)pthread_mutex_lock(&phdl->q.lock);
+    if ((shm->base != NULL) && (ptr >= shm->base + (shm->size - shm->arena)) && (ptr < shm->base + shm->size)) {
+        pos = (uint32_t)(ptr - shm->base);
+        if (size <= shm->size - pos) {
+            *offset = shm->off + pos;
+            err = 0;
         }
     }
-    return l;
+    (void)pthread_mutex_unlock(&phdl->q.lock);
+
+    return err;
 }
 
-/* Write data in a file located in NVM. Return the size of the written data. */
-int32_t seco_os_abs_storage_write_chunk(struct seco_os_abs_hdl *phdl, uint8_t *src, uint32_t size, uint64_t blob_id)
+void seco_os_abs_tables_rdlock(void)
 {
-    int32_t fd = -1;
-    int32_t l = 0;
-    int n = -1;
-    char *path = malloc(sizeof(SECO_NVM_HSM_STORAGE_CHUNK_PATH)+16u);
+    (void)pthread_rwlock_rdlock(&seco_os_abs_tables_lock);
+}
+
+void seco_os_abs_tables_wrlock(void)
+{
+    (void)pthread_rwlock_wrlock(&seco_os_abs_tables_lock);
+}
+
+void seco_os_abs_tables_unlock(void)
+{
+    (void)pthread_rwlock_unlock(&seco_os_abs_tables_lock);
+}
+
+/* Register a long-lived buffer. Return 0 on success. */
+int32_t seco_os_abs_register_buf(struct seco_os_abs_hdl *phdl, uint8_t *buf, uint32_t size, uint64_t *seco_addr)
+{
+    struct seco_mu_ioctl_register_buf reg;
+    struct seco_os_abs_reg_buf *r = NULL;
+    int32_t err = -1;
+    uint32_t i;
+
+    do {
+        if ((buf == NULL) || (size == 0u)) {
+            break;
+        }
+        (void)pthread_mutex_lock(&phdl->q.lock);
+        for (i = 0u; i < SECO_MU_MAX_REG_BUFS; i++) {
+            if (phdl->reg[i].data == buf) {
+                /* Already registered. */
+                r = NULL;
+                break;
+            }
+            if ((r == NULL) && (phdl->reg[i].data == NULL)) {
+                r = &phdl->reg[i];
+            }
+        }
+        if (r != NULL) {
+            /* Reserve the entry: not used for lookups until pinned. */
+            r->data = buf;
+            r->size = size;
+            r->pinned = 0u;
+        }
+        (void)pthread_mutex_unlock(&phdl->q.lock);
+        if (r == NULL) {
+            break;
+        }
+
+        reg.user_buf = buf;
+        reg.length = size;
+        reg.flags = 0u;
+        reg.seco_addr = 0u;
+        err = mu_ioctl(phdl->fd, SECO_MU_IOCTL_REGISTER_BUF, &reg);
+        if ((err != 0) && ((errno == ENOTTY) || (errno == EINVAL))) {
+            /* Not supported by the driver (the seco_mu driver answers EINVAL), or not for this
+             * buffer: it is set up for each command as any other.
+             */
+            err = 0;
+        }
+
+        (void)pthread_mutex_lock(&phdl->q.lock);
+        if (err != 0) {
+            (void)memset(r, 0, sizeof(*r));
+        } else if (reg.seco_addr != 0u) {
+            r->pinned = 1u;
+        }
+        (void)pthread_mutex_unlock(&phdl->q.lock);
+
+        if (seco_addr != NULL) {
+            *seco_addr = reg.seco_addr;
+        }
+    } while (false);
+
+    return err;
+}
+
+/* Unregister a buffer once the commands in flight are completed. Return 0 on success. */
+int32_t seco_os_abs_unregister_buf(struct seco_os_abs_hdl *phdl, uint8_t *buf)
+{
+    struct seco_mu_ioctl_register_buf reg;
+    uint8_t pinned = 0u;
+    int32_t err = -1;
+    uint32_t i;
+
+    (void)pthread_mutex_lock(&phdl->q.lock);
+    seco_os_abs_wait_idle(&phdl->q);
+    for (i = 0u; i < SECO_MU_MAX_REG_BUFS; i++) {
+        if ((buf != NULL) && (phdl->reg[i].data == buf)) {
+            pinned = phdl->reg[i].pinned;
+            (void)memset(&phdl->reg[i], 0, sizeof(phdl->reg[i]));
+            err = 0;
+            break;
+        }
+    }
+    (void)pthread_mutex_unlock(&phdl->q.lock);
 
-    if ((path != NULL) && (phdl->type == MU_CHANNEL_HSM_NVM)) {
-        (void)mkdir(SECO_NVM_HSM_STORAGE_CHUNK_PATH, S_IRUSR|S_IWUSR);
-        n = snprintf(path, sizeof(SECO_NVM_HSM_STORAGE_CHUNK_PATH)+16u,
-                        "%s%016lx", SECO_NVM_HSM_STORAGE_CHUNK_PATH, blob_id);
+    if ((err == 0) && (pinned != 0u)) {
+        reg.user_buf = buf;
+        reg.length = 0u;
+        reg.flags = 0u;
+        reg.seco_addr = 0u;
+        err = mu_ioctl(phdl->fd, SECO_MU_IOCTL_UNREGISTER_BUF, &reg);
     }
-    if (n > 0) {
-        /* Open or create the file with access reserved to the current user. */
-        fd = open(path, O_CREAT|O_WRONLY|O_SYNC, S_IRUSR|S_IWUSR);
-        if (fd >= 0) {
-            /* Write the data. */
-            l = (int32_t)write(fd, src, size);
 
-            (void)close(fd);
+    return err;
+}
+
+/* Storage files are relocated under the emulator root when running on the SECO emulator. */
+const char *seco_os_abs_storage_path(const char *path, char *buf, uint32_t size)
+{
+#ifdef SECO_OS_ABS_EMU
+    return seco_emu_storage_path(path, buf, size);
+#else
+    (void)buf;
+    (void)size;
+    return path;
+#endif
+}
+
+int32_t seco_os_abs_storage_open(struct seco_os_abs_hdl *phdl, const struct seco_nvm_storage_cfg *cfg)
+{
+    struct seco_storage *st = NULL;
+    uint8_t type = (cfg != NULL) ? (uint8_t)(cfg->type & ~NVM_STORAGE_FORMAT) : NVM_STORAGE_FILE;
+    bool format = (cfg != NULL) && ((cfg->type & NVM_STORAGE_FORMAT) != 0u);
+    const char *path = (cfg != NULL) ? cfg->path : NULL;
+
+    if (((phdl->type == MU_CHANNEL_SHE_NVM) || (phdl->type == MU_CHANNEL_HSM_NVM)) && (phdl->storage == NULL)) {
+        switch (type) {
+        case NVM_STORAGE_FILE:
+            st = seco_storage_file_open(phdl->type, path);
+            break;
+        case NVM_STORAGE_RAW:
+            st = seco_storage_raw_open(phdl->type, path, format);
+            break;
+        case NVM_STORAGE_RAM:
+            st = seco_storage_ram_open(phdl->type, path, cfg->flush_delay_ms);
+            break;
+        default:
+            st = NULL;
+            break;
         }
+        phdl->storage = st;
     }
 
-    free(path);
-    return l;
+    return (st != NULL) ? 0 : -1;
 }
 
-int32_t seco_os_abs_storage_read_chunk(struct seco_os_abs_hdl *phdl, uint8_t *dst, uint32_t size, uint64_t blob_id)
+/* Backend of a storage channel, the files in /etc if none was selected. */
+static struct seco_storage *seco_os_abs_storage(struct seco_os_abs_hdl *phdl)
+{
+    if (phdl->storage == NULL) {
+        (void)seco_os_abs_storage_open(phdl, NULL);
+    }
+
+    return phdl->storage;
+}
+
+int32_t seco_os_abs_storage_write(struct seco_os_abs_hdl *phdl, uint8_t *src, uint32_t size)
+{
+    struct seco_storage *st = seco_os_abs_storage(phdl);
+
+    return (st != NULL) ? st->ops->write_master(st, src, size) : 0;
+}
+
+int32_t seco_os_abs_storage_read(struct seco_os_abs_hdl *phdl, uint8_t *dst, uint32_t size)
 {
-    int32_t fd = -1;
+    uint8_t *data = NULL;
+    int32_t len;
     int32_t l = 0;
-    int n = -1;
-    char *path = malloc(sizeof(SECO_NVM_HSM_STORAGE_CHUNK_PATH)+16u);
 
-    if ((path != NULL) && (phdl->type == MU_CHANNEL_HSM_NVM)) {
-        n = snprintf(path, sizeof(SECO_NVM_HSM_STORAGE_CHUNK_PATH)+16u,
-                        "%s%016lx",SECO_NVM_HSM_STORAGE_CHUNK_PATH, blob_id);
+    len = seco_os_abs_storage_map(phdl, &data);
+    if (len > 0) {
+        l = ((uint32_t)len < size) ? len : (int32_t)size;
+        (void)memcpy(dst, data, (uint32_t)l);
+        seco_os_abs_storage_unmap(phdl, data, (uint32_t)len);
+    }
+
+    return l;
+}
+
+int32_t seco_os_abs_storage_map(struct seco_os_abs_hdl *phdl, uint8_t **data)
+{
+    struct seco_storage *st = seco_os_abs_storage(phdl);
+
+    return (st != NULL) ? st->ops->map_master(st, data) : 0;
+}
+
+void seco_os_abs_storage_unmap(struct seco_os_abs_hdl *phdl, uint8_t *data, uint32_t size)
+{
+    if ((phdl->storage != NULL) && (data != NULL)) {
+        phdl->storage->ops->unmap_master(phdl->storage, data, size);
     }
+}
 
+int32_t seco_os_abs_storage_write_chunk(struct seco_os_abs_hdl *phdl, uint8_t *src, uint32_t size, uint64_t blob_id)
+{
+    struct seco_storage *st = seco_os_abs_storage(phdl);
 
-    if (n > 0) {
-        /* Open the file as read only. */
-        fd = open(path, O_RDONLY);
-        if (fd >= 0) {
-            /* Read the data. */
-            l = (int32_t)read(fd, dst, size);
+    return (st != NULL) ? st->ops->write_chunk(st, src, size, blob_id) : 0;
+}
+
+int32_t seco_os_abs_storage_read_chunk(struct seco_os_abs_hdl *phdl, uint8_t *dst, uint32_t size, uint64_t blob_id)
+{
+    uint8_t *buf;
+    int32_t len;
+    int32_t l;
 
-            (void)close(fd);
+    /* Backends only read whole chunks: read the beginning of a chunk through a buffer. */
+    l = seco_os_abs_storage_load_chunk(phdl, blob_id, dst, size);
+    len = (l == 0) ? seco_os_abs_storage_chunk_size(phdl, blob_id) : 0;
+    if (len > 0) {
+        buf = malloc((uint32_t)len);
+        if (buf != NULL) {
+            l = seco_os_abs_storage_load_chunk(phdl, blob_id, buf, (uint32_t)len);
+            if (l > (int32_t)size) {
+                l = (int32_t)size;
+            }
+            if (l > 0) {
+                (void)memcpy(dst, buf, (uint32_t)l);
+            }
+            free(buf);
         }
     }
-    free(path);
+
     return l;
 }
 
+int32_t seco_os_abs_storage_load_chunk(struct seco_os_abs_hdl *phdl, uint64_t blob_id, uint8_t *dst, uint32_t size)
+{
+    struct seco_storage *st = seco_os_abs_storage(phdl);
+
+    return (st != NULL) ? st->ops->read_chunk(st, blob_id, dst, size) : 0;
+}
+
+int32_t seco_os_abs_storage_chunk_size(struct seco_os_abs_hdl *phdl, uint64_t blob_id)
+{
+    struct seco_storage *st = seco_os_abs_storage(phdl);
+
+    return (st != NULL) ? st->ops->chunk_size(st, blob_id) : 0;
+}
+
+int32_t seco_os_abs_storage_sync(struct seco_os_abs_hdl *phdl)
+{
+    struct seco_storage *st = seco_os_abs_storage(phdl);
+
+    return (st != NULL) ? st->ops->sync(st) : -1;
+}
+
+int32_t seco_os_abs_storage_enumerate(struct seco_os_abs_hdl *phdl, seco_os_abs_chunk_cb cb, void *arg)
+{
+    struct seco_storage *st = seco_os_abs_storage(phdl);
+
+    return (st != NULL) ? st->ops->enumerate(st, cb, arg) : 0;
+}
+
+static int32_t write_all(int32_t fd, const char *text, uint32_t size)
+{
+    ssize_t n;
+    uint32_t done = 0u;
+
+    while (done < size) {
+        n = write(fd, text + done, size - done);
+        if ((n < 0) && (errno == EINTR)) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        done += (uint32_t)n;
+    }
+
+    return (done == size) ? 0 : -1;
+}
+
+int32_t seco_os_abs_write_report(const char *path, const char *text, uint32_t size)
+{
+    char tmp[256];
+    int32_t fd;
+    int32_t err = -1;
+
+    do {
+        if (path == NULL) {
+            err = write_all(STDERR_FILENO, text, size);
+            break;
+        }
+        /* Written aside then renamed over the previous report. */
+        if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)) {
+            break;
+        }
+        fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            break;
+        }
+        err = write_all(fd, text, size);
+        if ((close(fd) != 0) || (err != 0) || (rename(tmp, path) != 0)) {
+            (void)unlink(tmp);
+            err = -1;
+        }
+    } while (false);
+
+    return err;
+}
+
 void seco_os_abs_memset(uint8_t *dst, uint8_t val, uint32_t len)
 {
     (void)memset(dst, (int32_t)val, len);
@@ -318,6 +1557,32 @@ void seco_os_abs_free(void *ptr)
     free(ptr);
 }
 
+/* Page aligned buffer, locked in memory when the process is allowed to. */
+uint8_t *seco_os_abs_malloc_locked(uint32_t size)
+{
+    void *ptr = NULL;
+    long page = sysconf(_SC_PAGESIZE);
+
+    if (posix_memalign(&ptr, (page > 0) ? (size_t)page : 4096u, size) != 0) {
+        ptr = NULL;
+    }
+    if (ptr != NULL) {
+        /* Fault the pages in now rather than on first use. */
+        (void)memset(ptr, 0, size);
+        (void)mlock(ptr, size);
+    }
+
+    return (uint8_t *)ptr;
+}
+
+void seco_os_abs_free_locked(uint8_t *ptr, uint32_t size)
+{
+    if (ptr != NULL) {
+        (void)munlock(ptr, size);
+        free(ptr);
+    }
+}
+
 void seco_os_abs_start_system_rng(struct seco_os_abs_hdl *phdl)
 {
     /*
@@ -334,7 +1599,7 @@ int32_t seco_os_abs_send_signed_message(struct seco_os_abs_hdl *phdl, uint8_t *s
 
     msg.message = signed_message;
     msg.msg_size = msg_len;
-    err = ioctl(phdl->fd, SECO_MU_IOCTL_SIGNED_MESSAGE, &msg);
+    err = mu_ioctl(phdl->fd, SECO_MU_IOCTL_SIGNED_MESSAGE, &msg);
 
     if (err == 0) {
         err = (int32_t)msg.error_code;
@@ -0,0 +1,1917 @@
+/*
+ * Copyright 2019 NXP
+ *
+ * NXP Confidential.
+ * This software is owned or controlled by NXP and may only be used strictly
+ * in accordance with the applicable license terms.  By expressly accepting
+ * such terms or by downloading, installing, activating and/or otherwise using
+ * the software, you are agreeing that you have read, and that you agree to
+ * comply with and are bound by, such license terms.  If you do not agree to be
+ * bound by the applicable license terms, then you may not retain, install,
+ * activate or otherwise use the software.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <linux/fs.h>
+#include <mtd/mtd-user.h>
+#include "seco_os_abs.h"
+#include "seco_os_abs_storage.h"
+
+#define SECO_NVM_PATH_MAX           256u
+#define SECO_NVM_DEFAULT_DIR        "/etc"
+
+#define SECO_CHUNK_LOG_MAGIC        0x4B4E4843u     /* "CHNK" */
+#define SECO_CHUNK_LOG_MIN_INDEX    64u
+#define SECO_CHUNK_LOG_COMPACT_MIN  (64u * 1024u)   /* Container size under which it is not compacted. */
+
+#define SECO_RAW_SB_MAGIC           0x52564E53u     /* "SNVR" */
+#define SECO_RAW_SLOT_MAGIC         0x4D564E53u     /* "SNVM" */
+#define SECO_RAW_AREA_MAGIC         0x43564E53u     /* "SNVC" */
+#define SECO_RAW_VERSION            1u
+#define SECO_RAW_BLOCK_MIN          4096u
+#define SECO_RAW_SLOT_MIN           (32u * 1024u)   /* Largest master blob, fixed at format. */
+#define SECO_RAW_AREA_MIN_BLOCKS    4u
+
+#define SECO_RAM_BUCKETS            64u
+#define SECO_RAM_RETRY_MS           100u            /* Delay before retrying a failed flush. */
+
+/* Storage files, relative to the storage directory. */
+static char SECO_NVM_SHE_STORAGE_FILE[] = "seco_she_nvm";
+static char SECO_NVM_HSM_STORAGE_FILE[] = "seco_hsm/seco_nvm_master";
+static char SECO_NVM_HSM_STORAGE_CHUNK_PATH[] = "seco_hsm/";
+static char SECO_NVM_HSM_STORAGE_CHUNK_LOG[] = "seco_hsm/seco_nvm_chunks";
+
+/* Record of the chunk container, followed by the chunk data. */
+struct seco_chunk_rec_hdr {
+    uint32_t magic;
+    uint32_t len;
+    uint64_t blob_id;
+    uint32_t crc;                       /* CRC of the data. */
+    uint32_t hdr_crc;                   /* CRC of the fields above. */
+};
+
+/* Location of the latest record of a chunk in the container. */
+struct seco_chunk_entry {
+    uint64_t blob_id;
+    uint64_t off;
+    uint32_t len;
+    uint32_t crc;
+    uint8_t used;
+};
+
+/* Chunk container: records appended to a region of a file or of a device, each one a
+ * header followed by the chunk data. The latest record of a blob_id supersedes the
+ * previous ones. The region is scanned when the storage is opened to build an index
+ * giving the location of the latest record of each blob_id. A record with a valid header
+ * but corrupted data is skipped. The scan stops at the first invalid header: what follows
+ * is left to the backend when it can only be a record torn by a power loss, otherwise
+ * the region is not indexed and left untouched.
+ * Only accessed by the NVM manager thread of the channel.
+ */
+struct seco_chunk_log {
+    int32_t fd;
+    uint64_t base;                      /* Offset of the first record. */
+    uint64_t cap;                       /* Size of the region holding the records. */
+    uint32_t align;                     /* Records are padded to a multiple of align bytes. */
+    uint8_t blank;                      /* Value of the bytes never written in the region. */
+    uint8_t torn;                       /* Data which is not blank follows the last record. */
+    uint8_t *pad;
+    uint64_t end;                       /* Size of the valid records. */
+    uint64_t live;                      /* Size of the records in the index. */
+    struct seco_chunk_entry *index;     /* Open addressing, linear probing. */
+    uint32_t index_size;                /* Power of 2, at least twice count. */
+    uint32_t count;
+};
+
+/* Write a whole buffer at a given offset, retrying on short writes. Return 0 on success. */
+static int32_t storage_pwrite_all(int32_t fd, uint8_t *src, uint32_t size, uint64_t off)
+{
+    uint32_t done = 0u;
+    ssize_t n;
+
+    while (done < size) {
+        n = pwrite(fd, src + done, size - done, (off_t)(off + done));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        done += (uint32_t)n;
+    }
+
+    return (done == size) ? 0 : -1;
+}
+
+/* Read a region by segments through buf, of SECO_STORAGE_SEGMENT bytes, and compute its
+ * CRC on the way. Return 0 on success.
+ */
+static int32_t storage_pread_crc(int32_t fd, uint64_t off, uint32_t len, uint8_t *buf, uint32_t *crc)
+{
+    uint32_t done = 0u;
+    uint32_t n;
+
+    *crc = 0u;
+    while (done < len) {
+        n = ((len - done) < SECO_STORAGE_SEGMENT) ? (len - done) : SECO_STORAGE_SEGMENT;
+        if (pread(fd, buf, n, (off_t)(off + done)) != (ssize_t)n) {
+            break;
+        }
+        *crc = seco_os_abs_crc_update(*crc, buf, n);
+        done += n;
+    }
+
+    return (done == len) ? 0 : -1;
+}
+
+/* Release a master blob read in a buffer. */
+static void storage_free_master(struct seco_storage *st, uint8_t *data, uint32_t size)
+{
+    (void)st;
+    (void)size;
+    free(data);
+}
+
+/* Make the content of a temporary file durable and rename it over path, then sync
+ * the directory so that the rename itself is durable. The temporary file is removed
+ * on failure. Return 0 on success.
+ */
+static int32_t storage_commit(int32_t fd, const char *tmp, const char *path)
+{
+    char dir[SECO_NVM_PATH_MAX];
+    char *sep;
+    int32_t dfd;
+    int32_t err = -1;
+
+    do {
+        if ((fdatasync(fd) != 0) || (rename(tmp, path) != 0)) {
+            (void)unlink(tmp);
+            break;
+        }
+        err = 0;
+
+        (void)snprintf(dir, sizeof(dir), "%s", path);
+        sep = strrchr(dir, '/');
+        if (sep == NULL) {
+            break;
+        }
+        *((sep == dir) ? (sep + 1) : sep) = '\0';
+        dfd = open(dir, O_RDONLY|O_DIRECTORY);
+        if ((dfd < 0) || (fsync(dfd) != 0)) {
+            err = -1;
+        }
+        if (dfd >= 0) {
+            (void)close(dfd);
+        }
+    } while (false);
+
+    return err;
+}
+
+/* Replace the content of a file so that a crash leaves either the previous or the
+ * new content: data are written to a temporary file in the same directory, flushed
+ * with a single fdatasync, then renamed over the file. Return the size written once
+ * it is durable.
+ */
+static int32_t storage_replace(const char *path, uint8_t *src, uint32_t size)
+{
+    char tmp[SECO_NVM_PATH_MAX];
+    int32_t fd;
+    int32_t l = 0;
+    int n;
+
+    do {
+        n = snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+        if ((n <= 0) || ((uint32_t)n >= sizeof(tmp))) {
+            break;
+        }
+        /* Open or create the file with access reserved to the current user. */
+        fd = open(tmp, O_CREAT|O_WRONLY|O_TRUNC, S_IRUSR|S_IWUSR);
+        if (fd < 0) {
+            break;
+        }
+        if (storage_pwrite_all(fd, src, size, 0u) != 0) {
+            (void)unlink(tmp);
+        } else if (storage_commit(fd, tmp, path) == 0) {
+            l = (int32_t)size;
+        }
+        (void)close(fd);
+    } while (false);
+
+    return l;
+}
+
+static void chunk_log_init(struct seco_chunk_log *log, int32_t fd, uint64_t base, uint64_t cap, uint32_t align, uint8_t blank)
+{
+    log->fd = fd;
+    log->base = base;
+    log->cap = cap;
+    log->align = (align == 0u) ? 1u : align;
+    log->blank = blank;
+    log->torn = 0u;
+    log->end = 0u;
+    log->live = 0u;
+    log->count = 0u;
+    if (log->align > 1u) {
+        log->pad = malloc(log->align);
+        if (log->pad != NULL) {
+            (void)memset(log->pad, blank, log->align);
+        }
+    }
+}
+
+static void chunk_log_release(struct seco_chunk_log *log)
+{
+    free(log->index);
+    free(log->pad);
+    log->index = NULL;
+    log->index_size = 0u;
+    log->count = 0u;
+    log->pad = NULL;
+}
+
+/* Space taken by the record of a chunk of len bytes. */
+static uint64_t chunk_log_rec_size(struct seco_chunk_log *log, uint32_t len)
+{
+    uint64_t size = (uint64_t)sizeof(struct seco_chunk_rec_hdr) + len;
+
+    return ((size + log->align - 1u) / log->align) * log->align;
+}
+
+static int32_t chunk_log_find_slot(struct seco_chunk_log *log, uint64_t blob_id)
+{
+    uint32_t mask = log->index_size - 1u;
+    uint32_t i = (uint32_t)((blob_id * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+
+    while ((log->index[i].used != 0u) && (log->index[i].blob_id != blob_id)) {
+        i = (i + 1u) & mask;
+    }
+
+    return (int32_t)i;
+}
+
+static int32_t chunk_log_grow(struct seco_chunk_log *log)
+{
+    struct seco_chunk_entry *old = log->index;
+    uint32_t old_size = log->index_size;
+    uint32_t size = (old_size == 0u) ? SECO_CHUNK_LOG_MIN_INDEX : (old_size * 2u);
+    int32_t err = -1;
+    uint32_t i;
+
+    log->index = calloc(size, sizeof(struct seco_chunk_entry));
+    if (log->index == NULL) {
+        log->index = old;
+    } else {
+        log->index_size = size;
+        for (i = 0u; i < old_size; i++) {
+            if (old[i].used != 0u) {
+                log->index[chunk_log_find_slot(log, old[i].blob_id)] = old[i];
+            }
+        }
+        free(old);
+        err = 0;
+    }
+
+    return err;
+}
+
+/* Point the index to a new record of blob_id. */
+static int32_t chunk_log_set(struct seco_chunk_log *log, uint64_t blob_id, uint64_t off, uint32_t len, uint32_t crc)
+{
+    struct seco_chunk_entry *e;
+    int32_t err = 0;
+
+    if ((log->count + 1u) * 2u > log->index_size) {
+        err = chunk_log_grow(log);
+    }
+    if (err == 0) {
+        e = &log->index[chunk_log_find_slot(log, blob_id)];
+        if (e->used != 0u) {
+            log->live -= chunk_log_rec_size(log, e->len);
+        } else {
+            log->count++;
+        }
+        e->blob_id = blob_id;
+        e->off = off;
+        e->len = len;
+        e->crc = crc;
+        e->used = 1u;
+        log->live += chunk_log_rec_size(log, len);
+    }
+
+    return err;
+}
+
+static uint32_t chunk_log_hdr_crc(struct seco_chunk_rec_hdr *hdr)
+{
+    return seco_os_abs_crc((uint8_t *)hdr, (uint32_t)offsetof(struct seco_chunk_rec_hdr, hdr_crc));
+}
+
+static bool storage_is_blank(uint8_t *data, uint32_t len, uint8_t blank)
+{
+    uint32_t i;
+
+    for (i = 0u; (i < len) && (data[i] == blank); i++) {
+    }
+
+    return (i == len);
+}
+
+/* Whether a valid record header starts in [from, to) of the region. Also true when the
+ * region cannot be read: a record may be there.
+ */
+static bool chunk_log_hdr_follows(struct seco_chunk_log *log, uint64_t from, uint64_t to, uint8_t *seg)
+{
+    struct seco_chunk_rec_hdr hdr;
+    uint64_t off = from;
+    uint32_t i;
+    uint32_t n;
+    ssize_t r;
+    bool found = false;
+
+    while (!found && (off + sizeof(hdr) <= to)) {
+        n = ((to - off) < SECO_STORAGE_SEGMENT) ? (uint32_t)(to - off) : SECO_STORAGE_SEGMENT;
+        r = pread(log->fd, seg, n, (off_t)(log->base + off));
+        if (r < (ssize_t)sizeof(hdr)) {
+            found = true;
+            break;
+        }
+        for (i = 0u; !found && (i + sizeof(hdr) <= (uint32_t)r); i++) {
+            (void)memcpy(&hdr, seg + i, sizeof(hdr));
+            found = (hdr.magic == SECO_CHUNK_LOG_MAGIC) && (hdr.hdr_crc == chunk_log_hdr_crc(&hdr));
+        }
+        /* Next segment overlaps the headers not fully read in this one. */
+        off += (uint64_t)r - sizeof(hdr) + 1u;
+    }
+
+    return found;
+}
+
+/* Index the valid records from the start of the region, size being the amount of data
+ * written in it: the size of the file, or cap when it is not known (device).
+ * Only a record reaching the end of the data can be torn: log->torn is then set and the
+ * record left after log->end. Return 0 on success, -1 if the region could not be indexed
+ * (allocation or read failure, corrupted record followed by valid ones): it must then be
+ * left untouched.
+ */
+static int32_t chunk_log_scan(struct seco_chunk_log *log, uint64_t size)
+{
+    struct seco_chunk_rec_hdr hdr;
+    uint8_t *seg = malloc(SECO_STORAGE_SEGMENT);
+    uint64_t off = 0u;
+    uint64_t rec;
+    uint32_t crc;
+    /* Nothing can be checked without the segment buffer. */
+    int32_t err = (seg != NULL) ? 0 : -1;
+    ssize_t n;
+    bool valid;
+
+    if (size > log->cap) {
+        size = log->cap;
+    }
+    while (err == 0) {
+        if (off + sizeof(hdr) > size) {
+            /* Part of a header at the end of the file. */
+            log->torn = (off < size) ? 1u : 0u;
+            break;
+        }
+        n = pread(log->fd, &hdr, sizeof(hdr), (off_t)(log->base + off));
+        if (n != (ssize_t)sizeof(hdr)) {
+            err = -1;
+            break;
+        }
+        if ((hdr.magic != SECO_CHUNK_LOG_MAGIC) || (hdr.hdr_crc != chunk_log_hdr_crc(&hdr))
+            || (hdr.len > SECO_STORAGE_CHUNK_MAX) || (off + chunk_log_rec_size(log, hdr.len) > log->cap)) {
+            if (size == log->cap) {
+                /* Device: the records end at the first blank header. */
+                log->torn = storage_is_blank((uint8_t *)&hdr, (uint32_t)sizeof(hdr), log->blank) ? 0u : 1u;
+            } else if ((off + chunk_log_rec_size(log, SECO_STORAGE_CHUNK_MAX) >= size)
+                       && !chunk_log_hdr_follows(log, off + 1u, size, seg)) {
+                /* Header of the last record not or partly written. */
+                log->torn = 1u;
+            } else {
+                err = -1;
+            }
+            break;
+        }
+        rec = chunk_log_rec_size(log, hdr.len);
+        valid = (storage_pread_crc(log->fd, log->base + off + sizeof(hdr), hdr.len, seg, &crc) == 0)
+            && (crc == hdr.crc);
+        if (!valid && (off + rec >= size)) {
+            /* Data of the last record not fully written. */
+            log->torn = 1u;
+            break;
+        }
+        if (valid && (chunk_log_set(log, hdr.blob_id, off, hdr.len, hdr.crc) != 0)) {
+            err = -1;
+            break;
+        }
+        /* A record with corrupted data is skipped: the following ones are still valid. */
+        off += rec;
+    }
+    free(seg);
+
+    log->end = off;
+
+    return err;
+}
+
+/* Location of the latest record of blob_id, NULL if none. */
+static struct seco_chunk_entry *chunk_log_lookup(struct seco_chunk_log *log, uint64_t blob_id)
+{
+    struct seco_chunk_entry *e = NULL;
+
+    if ((log != NULL) && (log->index_size != 0u)) {
+        e = &log->index[chunk_log_find_slot(log, blob_id)];
+        if (e->used == 0u) {
+            e = NULL;
+        }
+    }
+
+    return e;
+}
+
+/* Read a whole chunk. Return its size, 0 if it is corrupted or larger than size. */
+static int32_t chunk_log_read(struct seco_chunk_log *log, struct seco_chunk_entry *e, uint8_t *dst, uint32_t size)
+{
+    int32_t l = 0;
+
+    if ((e->len <= size)
+        && (pread(log->fd, dst, e->len, (off_t)(log->base + e->off + sizeof(struct seco_chunk_rec_hdr))) == (ssize_t)e->len)
+        && (seco_os_abs_crc(dst, e->len) == e->crc)) {
+        l = (int32_t)e->len;
+    }
+
+    return l;
+}
+
+/* Write the data of a large record by segments, each one added to the CRC just before
+ * being written, then its header. Only for unpadded records. Return 0 on success.
+ */
+static int32_t chunk_log_write_segments(struct seco_chunk_log *log, struct seco_chunk_rec_hdr *hdr, uint8_t *src)
+{
+    uint64_t off = log->base + log->end;
+    uint32_t done = 0u;
+    uint32_t n;
+
+    hdr->crc = 0u;
+    while (done < hdr->len) {
+        n = ((hdr->len - done) < SECO_STORAGE_SEGMENT) ? (hdr->len - done) : SECO_STORAGE_SEGMENT;
+        hdr->crc = seco_os_abs_crc_update(hdr->crc, src + done, n);
+        if (storage_pwrite_all(log->fd, src + done, n, off + sizeof(*hdr) + done) != 0) {
+            break;
+        }
+        done += n;
+    }
+    hdr->hdr_crc = chunk_log_hdr_crc(hdr);
+
+    return ((done == hdr->len) && (storage_pwrite_all(log->fd, (uint8_t *)hdr, (uint32_t)sizeof(*hdr), off) == 0)) ? 0 : -1;
+}
+
+/* Append a record and make it durable before indexing it. Return 0 on success. */
+static int32_t chunk_log_append(struct seco_chunk_log *log, uint8_t *src, uint32_t size, uint64_t blob_id)
+{
+    struct seco_chunk_rec_hdr hdr;
+    struct iovec iov[3];
+    uint64_t rec = chunk_log_rec_size(log, size);
+    int32_t nb_iov = 2;
+    int32_t err = -1;
+    bool written;
+
+    do {
+        if ((log->end + rec > log->cap) || ((rec > (sizeof(hdr) + size)) && (log->pad == NULL))) {
+            break;
+        }
+        /* Room in the index first: nothing durable is left unindexed. */
+        if (((log->count + 1u) * 2u > log->index_size) && (chunk_log_grow(log) != 0)) {
+            break;
+        }
+        hdr.magic = SECO_CHUNK_LOG_MAGIC;
+        hdr.len = size;
+        hdr.blob_id = blob_id;
+        if ((size > SECO_STORAGE_SEGMENT) && (log->align == 1u)) {
+            /* Nothing is written before fdatasync: the order of the writes does not matter. */
+            written = (chunk_log_write_segments(log, &hdr, src) == 0);
+        } else {
+            /* A single write, padded to the minimum write size of the device. */
+            hdr.crc = seco_os_abs_crc(src, size);
+            hdr.hdr_crc = chunk_log_hdr_crc(&hdr);
+            iov[0].iov_base = &hdr;
+            iov[0].iov_len = sizeof(hdr);
+            iov[1].iov_base = src;
+            iov[1].iov_len = size;
+            if (rec > (sizeof(hdr) + size)) {
+                iov[2].iov_base = log->pad;
+                iov[2].iov_len = (size_t)(rec - (sizeof(hdr) + size));
+                nb_iov = 3;
+            }
+            written = (pwritev(log->fd, iov, nb_iov, (off_t)(log->base + log->end)) == (ssize_t)rec);
+        }
+
+        if (!written || (fdatasync(log->fd) != 0)) {
+            /* What may have been written must be dropped or skipped by the backend. */
+            log->torn = 1u;
+            break;
+        }
+        if (chunk_log_set(log, blob_id, log->end, size, hdr.crc) != 0) {
+            log->torn = 1u;
+            break;
+        }
+        log->end += rec;
+        err = 0;
+    } while (false);
+
+    return err;
+}
+
+/* Copy the latest record of each chunk to fd from offset base, the new offset of the
+ * record of index slot i being written in offs[i]. Return the size copied, -1 on error.
+ */
+static int64_t chunk_log_copy_live(struct seco_chunk_log *log, int32_t fd, uint64_t base, uint64_t *offs)
+{
+    uint8_t *seg = malloc(SECO_STORAGE_SEGMENT);
+    uint64_t off = 0u;
+    uint32_t rec_len;
+    uint32_t done;
+    uint32_t n;
+    uint32_t i;
+    bool ok = (seg != NULL);
+
+    for (i = 0u; ok && (i < log->index_size); i++) {
+        if (log->index[i].used == 0u) {
+            continue;
+        }
+        /* Records are copied by segments, which are multiples of the minimum write size. */
+        rec_len = (uint32_t)chunk_log_rec_size(log, log->index[i].len);
+        for (done = 0u; ok && (done < rec_len); done += n) {
+            n = ((rec_len - done) < SECO_STORAGE_SEGMENT) ? (rec_len - done) : SECO_STORAGE_SEGMENT;
+            ok = (pread(log->fd, seg, n, (off_t)(log->base + log->index[i].off + done)) == (ssize_t)n)
+                && (storage_pwrite_all(fd, seg, n, base + off + done) == 0);
+        }
+        offs[i] = off;
+        off += rec_len;
+    }
+    free(seg);
+
+    return ok ? (int64_t)off : -1;
+}
+
+/* Switch to a copy made by chunk_log_copy_live. */
+static void chunk_log_switch(struct seco_chunk_log *log, int32_t fd, uint64_t base, uint64_t *offs, uint64_t size)
+{
+    uint32_t i;
+
+    log->fd = fd;
+    log->base = base;
+    for (i = 0u; i < log->index_size; i++) {
+        if (log->index[i].used != 0u) {
+            log->index[i].off = offs[i];
+        }
+    }
+    log->end = size;
+    log->live = size;
+    log->torn = 0u;
+}
+
+static int32_t chunk_log_enumerate(struct seco_chunk_log *log, seco_os_abs_chunk_cb cb, void *arg)
+{
+    uint32_t i;
+
+    for (i = 0u; i < log->index_size; i++) {
+        if ((log->index[i].used != 0u) && (cb != NULL)) {
+            cb(arg, log->index[i].blob_id, log->index[i].len);
+        }
+    }
+
+    return (int32_t)log->count;
+}
+
+/*
+ * File backend: the storage of each channel is kept in files of a directory, /etc by
+ * default. The master is replaced atomically, the chunks are appended to a container
+ * file, compacted once most of it holds superseded records. Chunks stored in their own
+ * file by the previous versions are still read.
+ */
+struct seco_storage_file {
+    struct seco_storage st;
+    char master[SECO_NVM_PATH_MAX];
+    char chunk_dir[SECO_NVM_PATH_MAX];
+    char chunk_log[SECO_NVM_PATH_MAX];
+    struct seco_chunk_log log;          /* HSM: opened on first use, fd -1 until then. */
+};
+
+/* Build the location of a storage file. Return 0 on success. */
+static int32_t storage_file_path(char *path, const char *dir, const char *name)
+{
+    char tmp[SECO_NVM_PATH_MAX];
+    char buf[SECO_NVM_PATH_MAX];
+    int32_t err = -1;
+    int n;
+
+    n = snprintf(tmp, sizeof(tmp), "%s/%s", dir, name);
+    if ((n > 0) && ((uint32_t)n < sizeof(tmp))) {
+        n = snprintf(path, SECO_NVM_PATH_MAX, "%s", seco_os_abs_storage_path(tmp, buf, (uint32_t)sizeof(buf)));
+        if ((n > 0) && ((uint32_t)n < SECO_NVM_PATH_MAX)) {
+            err = 0;
+        }
+    }
+
+    return err;
+}
+
+static struct seco_chunk_log *file_chunk_log(struct seco_storage_file *f)
+{
+    struct stat st;
+    int32_t fd;
+
+    if ((f->log.fd < 0) && (f->st.type == MU_CHANNEL_HSM_NVM)) {
+        fd = open(f->chunk_log, O_CREAT|O_RDWR, S_IRUSR|S_IWUSR);
+        if (fd >= 0) {
+            chunk_log_init(&f->log, fd, 0u, UINT64_MAX, 1u, 0u);
+            if ((fstat(fd, &st) != 0) || (chunk_log_scan(&f->log, (uint64_t)st.st_size) != 0)) {
+                /* Keep the file as it is for a later attempt or a recovery. */
+                chunk_log_release(&f->log);
+                (void)close(fd);
+                f->log.fd = -1;
+            } else if (f->log.torn != 0u) {
+                /* Drop the torn record at the end of the file. */
+                (void)ftruncate(fd, (off_t)f->log.end);
+                f->log.torn = 0u;
+            }
+        }
+    }
+
+    return (f->log.fd >= 0) ? &f->log : NULL;
+}
+
+/* Rewrite the container with only the latest record of each blob_id. */
+static void file_compact(struct seco_storage_file *f)
+{
+    struct seco_chunk_log *log = &f->log;
+    char tmp[SECO_NVM_PATH_MAX];
+    uint64_t *offs = NULL;
+    int64_t size;
+    int32_t fd = -1;
+    int n;
+
+    do {
+        if ((log->end < SECO_CHUNK_LOG_COMPACT_MIN) || ((log->live * 2u) > log->end)) {
+            break;
+        }
+        n = snprintf(tmp, sizeof(tmp), "%s.tmp", f->chunk_log);
+        if ((n <= 0) || ((uint32_t)n >= sizeof(tmp))) {
+            break;
+        }
+        offs = malloc(log->index_size * sizeof(uint64_t));
+        fd = open(tmp, O_CREAT|O_RDWR|O_TRUNC, S_IRUSR|S_IWUSR);
+        if ((offs == NULL) || (fd < 0)) {
+            break;
+        }
+        size = chunk_log_copy_live(log, fd, 0u, offs);
+        if (size < 0) {
+            (void)unlink(tmp);
+            break;
+        }
+        if (storage_commit(fd, tmp, f->chunk_log) != 0) {
+            break;
+        }
+        /* The new file is in place: switch to it. */
+        (void)close(log->fd);
+        chunk_log_switch(log, fd, 0u, offs, (uint64_t)size);
+        fd = -1;
+    } while (false);
+
+    if (fd >= 0) {
+        (void)close(fd);
+    }
+    free(offs);
+}
+
+static int32_t file_write_master(struct seco_storage *st, uint8_t *src, uint32_t size)
+{
+    return storage_replace(((struct seco_storage_file *)st)->master, src, size);
+}
+
+/* Map the whole master file read-only with a single open. */
+static int32_t file_map_master(struct seco_storage *st, uint8_t **data)
+{
+    struct seco_storage_file *f = (struct seco_storage_file *)st;
+    struct stat s;
+    int32_t fd;
+    int32_t l = 0;
+    void *map;
+
+    fd = open(f->master, O_RDONLY);
+    if (fd >= 0) {
+        if ((fstat(fd, &s) == 0) && (s.st_size > 0) && (s.st_size <= INT32_MAX)) {
+            map = mmap(NULL, (size_t)s.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map != MAP_FAILED) {
+                *data = (uint8_t *)map;
+                l = (int32_t)s.st_size;
+            }
+        }
+        /* The mapping stays valid once the file is closed. */
+        (void)close(fd);
+    }
+
+    return l;
+}
+
+static void file_unmap_master(struct seco_storage *st, uint8_t *data, uint32_t size)
+{
+    (void)st;
+    (void)munmap(data, size);
+}
+
+static int32_t file_write_chunk(struct seco_storage *st, uint8_t *src, uint32_t size, uint64_t blob_id)
+{
+    struct seco_storage_file *f = (struct seco_storage_file *)st;
+    struct seco_chunk_log *log = file_chunk_log(f);
+    int32_t l = 0;
+
+    if ((log != NULL) && (size <= SECO_STORAGE_CHUNK_MAX)) {
+        if (chunk_log_append(log, src, size, blob_id) == 0) {
+            l = (int32_t)size;
+            file_compact(f);
+        } else if (log->torn != 0u) {
+            /* Drop what may have been written. */
+            (void)ftruncate(log->fd, (off_t)log->end);
+            log->torn = 0u;
+        }
+    }
+
+    return l;
+}
+
+/* Location of a chunk stored in its own file by the previous versions. Return 0 on success. */
+static int32_t file_legacy_chunk_path(struct seco_storage_file *f, uint64_t blob_id, char *path)
+{
+    int n = snprintf(path, SECO_NVM_PATH_MAX, "%s%016" PRIx64, f->chunk_dir, blob_id);
+
+    return ((n > 0) && ((uint32_t)n < SECO_NVM_PATH_MAX)) ? 0 : -1;
+}
+
+static int32_t file_read_chunk(struct seco_storage *st, uint64_t blob_id, uint8_t *dst, uint32_t size)
+{
+    struct seco_storage_file *f = (struct seco_storage_file *)st;
+    struct seco_chunk_log *log = file_chunk_log(f);
+    struct seco_chunk_entry *e = chunk_log_lookup(log, blob_id);
+    char path[SECO_NVM_PATH_MAX];
+    struct stat s;
+    uint32_t len;
+    int32_t fd;
+    int32_t l = 0;
+
+    if (e != NULL) {
+        l = chunk_log_read(log, e, dst, size);
+    } else if ((st->type == MU_CHANNEL_HSM_NVM) && (file_legacy_chunk_path(f, blob_id, path) == 0)) {
+        /* Chunk stored in its own file by the previous versions. */
+        fd = open(path, O_RDONLY);
+        if (fd >= 0) {
+            if ((fstat(fd, &s) == 0) && (s.st_size > 0) && (s.st_size <= (off_t)size)) {
+                len = (uint32_t)s.st_size;
+                if (read(fd, dst, len) == (ssize_t)len) {
+                    l = (int32_t)len;
+                }
+            }
+            (void)close(fd);
+        }
+    }
+
+    return l;
+}
+
+static int32_t file_chunk_size(struct seco_storage *st, uint64_t blob_id)
+{
+    struct seco_storage_file *f = (struct seco_storage_file *)st;
+    struct seco_chunk_entry *e = chunk_log_lookup(file_chunk_log(f), blob_id);
+    char path[SECO_NVM_PATH_MAX];
+    struct stat s;
+    int32_t l = 0;
+
+    if (e != NULL) {
+        l = (int32_t)e->len;
+    } else if ((st->type == MU_CHANNEL_HSM_NVM) && (file_legacy_chunk_path(f, blob_id, path) == 0)) {
+        if ((stat(path, &s) == 0) && (s.st_size > 0) && (s.st_size <= (off_t)SECO_STORAGE_CHUNK_MAX)) {
+            l = (int32_t)s.st_size;
+        }
+    }
+
+    return l;
+}
+
+static int32_t file_sync(struct seco_storage *st)
+{
+    /* Every write is durable when it returns. */
+    (void)st;
+    return 0;
+}
+
+static int32_t file_enumerate(struct seco_storage *st, seco_os_abs_chunk_cb cb, void *arg)
+{
+    struct seco_storage_file *f = (struct seco_storage_file *)st;
+    struct seco_chunk_log *log = file_chunk_log(f);
+    char path[SECO_NVM_PATH_MAX];
+    struct dirent *ent;
+    struct stat s;
+    uint64_t blob_id;
+    char *end;
+    DIR *dir;
+    int32_t nb = 0;
+    int n;
+
+    if (log != NULL) {
+        nb = chunk_log_enumerate(log, cb, arg);
+        /* Chunks of the previous versions, named after their blob_id. */
+        dir = opendir(f->chunk_dir);
+        if (dir != NULL) {
+            for (ent = readdir(dir); ent != NULL; ent = readdir(dir)) {
+                if (strlen(ent->d_name) != 16u) {
+                    continue;
+                }
+                blob_id = strtoull(ent->d_name, &end, 16);
+                if ((*end != '\0') || (chunk_log_lookup(log, blob_id) != NULL)) {
+                    continue;
+                }
+                n = snprintf(path, sizeof(path), "%s%s", f->chunk_dir, ent->d_name);
+                if ((n <= 0) || ((uint32_t)n >= sizeof(path))) {
+                    continue;
+                }
+                if ((stat(path, &s) == 0) && S_ISREG(s.st_mode) && (s.st_size > 0) && (s.st_size <= INT32_MAX)) {
+                    if (cb != NULL) {
+                        cb(arg, blob_id, (uint32_t)s.st_size);
+                    }
+                    nb++;
+                }
+            }
+            (void)closedir(dir);
+        }
+    }
+
+    return nb;
+}
+
+static void file_close(struct seco_storage *st)
+{
+    struct seco_storage_file *f = (struct seco_storage_file *)st;
+
+    if (f->log.fd >= 0) {
+        (void)close(f->log.fd);
+    }
+    chunk_log_release(&f->log);
+    free(f);
+}
+
+static const struct seco_storage_ops seco_storage_file_ops = {
+    .write_master = file_write_master,
+    .map_master = file_map_master,
+    .unmap_master = file_unmap_master,
+    .write_chunk = file_write_chunk,
+    .read_chunk = file_read_chunk,
+    .chunk_size = file_chunk_size,
+    .sync = file_sync,
+    .enumerate = file_enumerate,
+    .close = file_close,
+};
+
+struct seco_storage *seco_storage_file_open(uint32_t type, const char *dir)
+{
+    struct seco_storage_file *f = calloc(1u, sizeof(struct seco_storage_file));
+    int32_t err = -1;
+
+    if (dir == NULL) {
+        dir = SECO_NVM_DEFAULT_DIR;
+    }
+
+    if (f != NULL) {
+        f->st.ops = &seco_storage_file_ops;
+        f->st.type = type;
+        f->log.fd = -1;
+        if (type == MU_CHANNEL_SHE_NVM) {
+            err = storage_file_path(f->master, dir, SECO_NVM_SHE_STORAGE_FILE);
+        } else if (type == MU_CHANNEL_HSM_NVM) {
+            err = storage_file_path(f->master, dir, SECO_NVM_HSM_STORAGE_FILE);
+            err |= storage_file_path(f->chunk_dir, dir, SECO_NVM_HSM_STORAGE_CHUNK_PATH);
+            err |= storage_file_path(f->chunk_log, dir, SECO_NVM_HSM_STORAGE_CHUNK_LOG);
+            if (err == 0) {
+                /* The master is kept in the chunk directory too. */
+                (void)mkdir(f->chunk_dir, S_IRUSR|S_IWUSR);
+            }
+        }
+        if (err != 0) {
+            free(f);
+            f = NULL;
+        }
+    }
+
+    return (f != NULL) ? &f->st : NULL;
+}
+
+/*
+ * Raw backend: block device (e.g. eMMC partition) or MTD partition, holding the SHE
+ * and HSM storages. Layout, in blocks of the erase size (4KB at least):
+ *
+ *     superblock | SHE master slot 0, 1 | HSM master slot 0, 1 | chunk area 0 | chunk area 1
+ *
+ * Each master is written alternatively to its 2 slots, with a generation number:
+ * the valid slot with the latest generation is the current one, so a power loss during
+ * a write leaves the previous master. Chunks are appended to the current chunk area as in
+ * the container file of the file backend. When it is full, or after a torn record, the
+ * latest records are copied to the other area which then becomes current.
+ * On MTD devices areas are erased before being written, and records are padded to the
+ * minimum write size of the device.
+ */
+struct seco_raw_sb {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t block;                     /* Unit of the layout. */
+    uint32_t slot_size;
+    uint64_t she_off;                   /* First SHE master slot. */
+    uint64_t hsm_off;                   /* First HSM master slot. */
+    uint64_t chunk_off;                 /* First chunk area. */
+    uint64_t chunk_size;                /* Size of each chunk area. */
+    uint32_t reserved;
+    uint32_t hdr_crc;
+};
+
+/* Header of a master slot or of a chunk area. */
+struct seco_raw_hdr {
+    uint32_t magic;
+    uint32_t gen;
+    uint32_t size;                      /* Slot: size of the master. */
+    uint32_t crc;                       /* Slot: CRC of the master. */
+    uint32_t reserved;
+    uint32_t hdr_crc;
+};
+
+struct seco_storage_raw {
+    struct seco_storage st;
+    int32_t fd;
+    uint8_t mtd;                        /* MTD device: erase before writing. */
+    uint8_t blank;
+    uint32_t erase_size;
+    uint32_t align;                     /* Minimum write size. */
+    uint64_t dev_size;
+    struct seco_raw_sb sb;
+    uint64_t slot_off;                  /* First master slot of the channel. */
+    int32_t slot;                       /* Slot of the current master, -1 if none. */
+    uint32_t master_gen;
+    uint32_t master_size;
+    uint32_t area;                      /* Current chunk area. */
+    uint32_t area_gen;
+    struct seco_chunk_log log;
+};
+
+static uint32_t raw_crc(void *hdr, uint32_t len)
+{
+    return seco_os_abs_crc((uint8_t *)hdr, len);
+}
+
+static uint64_t raw_round_up(uint64_t size, uint64_t unit)
+{
+    return ((size + unit - 1u) / unit) * unit;
+}
+
+/* Set a range of the device to the blank value. */
+static int32_t raw_blank(struct seco_storage_raw *raw, uint64_t off, uint64_t len)
+{
+    struct erase_info_user64 erase;
+    uint8_t *zero;
+    uint64_t done;
+    uint32_t n;
+    int32_t err = 0;
+
+    if (raw->mtd != 0u) {
+        erase.start = off;
+        erase.length = len;
+        err = ioctl(raw->fd, MEMERASE64, &erase);
+    } else {
+        zero = calloc(1u, SECO_RAW_BLOCK_MIN);
+        if (zero == NULL) {
+            err = -1;
+        }
+        for (done = 0u; (err == 0) && (done < len); done += n) {
+            n = ((len - done) < SECO_RAW_BLOCK_MIN) ? (uint32_t)(len - done) : SECO_RAW_BLOCK_MIN;
+            err = storage_pwrite_all(raw->fd, zero, n, off + done);
+        }
+        free(zero);
+    }
+
+    return err;
+}
+
+/* Write a header, padded to the minimum write size, and make it durable. */
+static int32_t raw_write_hdr(struct seco_storage_raw *raw, uint64_t off, void *hdr, uint32_t len)
+{
+    uint32_t size = (uint32_t)raw_round_up(len, raw->align);
+    uint8_t *buf = malloc(size);
+    int32_t err = -1;
+
+    if (buf != NULL) {
+        (void)memset(buf, raw->blank, size);
+        (void)memcpy(buf, hdr, len);
+        if ((storage_pwrite_all(raw->fd, buf, size, off) == 0) && (fdatasync(raw->fd) == 0)) {
+            err = 0;
+        }
+        free(buf);
+    }
+
+    return err;
+}
+
+static uint64_t raw_area_off(struct seco_storage_raw *raw, uint32_t area)
+{
+    return raw->sb.chunk_off + ((uint64_t)area * raw->sb.chunk_size);
+}
+
+/* Offset of the first record in a chunk area. */
+static uint64_t raw_area_data(struct seco_storage_raw *raw)
+{
+    return raw_round_up(sizeof(struct seco_raw_hdr), raw->align);
+}
+
+static int32_t raw_write_area_hdr(struct seco_storage_raw *raw, uint32_t area, uint32_t gen)
+{
+    struct seco_raw_hdr hdr;
+
+    (void)memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = SECO_RAW_AREA_MAGIC;
+    hdr.gen = gen;
+    hdr.hdr_crc = raw_crc(&hdr, (uint32_t)offsetof(struct seco_raw_hdr, hdr_crc));
+
+    return raw_write_hdr(raw, raw_area_off(raw, area), &hdr, (uint32_t)sizeof(hdr));
+}
+
+/* Lay out an empty storage on the device. The superblock is written last. */
+static int32_t raw_format(struct seco_storage_raw *raw)
+{
+    struct seco_raw_sb *sb = &raw->sb;
+    uint64_t block = (raw->erase_size > SECO_RAW_BLOCK_MIN) ? raw->erase_size : SECO_RAW_BLOCK_MIN;
+    int32_t err = -1;
+
+    do {
+        (void)memset(sb, 0, sizeof(*sb));
+        sb->magic = SECO_RAW_SB_MAGIC;
+        sb->version = SECO_RAW_VERSION;
+        sb->block = (uint32_t)block;
+        sb->slot_size = (uint32_t)raw_round_up(SECO_RAW_SLOT_MIN, block);
+        sb->she_off = block;
+        sb->hsm_off = sb->she_off + (2u * (uint64_t)sb->slot_size);
+        sb->chunk_off = sb->hsm_off + (2u * (uint64_t)sb->slot_size);
+        if (raw->dev_size < sb->chunk_off + (2u * SECO_RAW_AREA_MIN_BLOCKS * block)) {
+            break;
+        }
+        sb->chunk_size = ((raw->dev_size - sb->chunk_off) / 2u / block) * block;
+        sb->hdr_crc = raw_crc(sb, (uint32_t)offsetof(struct seco_raw_sb, hdr_crc));
+
+        /* Blank the master slots and the first chunk area, and the header of the second one. */
+        if ((raw_blank(raw, 0u, sb->chunk_off + sb->chunk_size) != 0)
+            || (raw_blank(raw, raw_area_off(raw, 1u), block) != 0)
+            || (raw_write_area_hdr(raw, 0u, 1u) != 0)) {
+            break;
+        }
+        err = raw_write_hdr(raw, 0u, sb, (uint32_t)sizeof(*sb));
+    } while (false);
+
+    return err;
+}
+
+/* Load the superblock. A device is formatted only when its first block is blank, or when
+ * requested: anything else (other data, damaged superblock) is left untouched.
+ */
+static int32_t raw_load_sb(struct seco_storage_raw *raw, bool format)
+{
+    struct seco_raw_sb *sb = &raw->sb;
+    uint8_t *block = malloc(SECO_RAW_BLOCK_MIN);
+    int32_t err = -1;
+
+    do {
+        if ((block == NULL) || (raw->dev_size < SECO_RAW_BLOCK_MIN)
+            || (pread(raw->fd, block, SECO_RAW_BLOCK_MIN, 0) != (ssize_t)SECO_RAW_BLOCK_MIN)) {
+            break;
+        }
+        (void)memcpy(sb, block, sizeof(*sb));
+        if ((sb->magic == SECO_RAW_SB_MAGIC) && (sb->version == SECO_RAW_VERSION)
+            && (sb->hdr_crc == raw_crc(sb, (uint32_t)offsetof(struct seco_raw_sb, hdr_crc)))
+            && (sb->chunk_off + (2u * sb->chunk_size) <= raw->dev_size)) {
+            err = 0;
+        } else if (format || storage_is_blank(block, SECO_RAW_BLOCK_MIN, raw->blank)) {
+            err = raw_format(raw);
+        } else {
+            /* Not a storage: refuse to open it. */
+        }
+    } while (false);
+    free(block);
+
+    return err;
+}
+
+/* Read a valid header of a slot or area. Return 0 on success. */
+static int32_t raw_read_hdr(struct seco_storage_raw *raw, uint64_t off, uint32_t magic, struct seco_raw_hdr *hdr)
+{
+    int32_t err = -1;
+
+    if ((pread(raw->fd, hdr, sizeof(*hdr), (off_t)off) == (ssize_t)sizeof(*hdr))
+        && (hdr->magic == magic)
+        && (hdr->hdr_crc == raw_crc(hdr, (uint32_t)offsetof(struct seco_raw_hdr, hdr_crc)))) {
+        err = 0;
+    }
+
+    return err;
+}
+
+/* Generation a is more recent than b. */
+static bool raw_gen_after(uint32_t a, uint32_t b)
+{
+    return ((int32_t)(a - b) > 0);
+}
+
+/* Read the master of a slot. Return its size, 0 if the slot does not hold a valid master. */
+static int32_t raw_read_slot(struct seco_storage_raw *raw, int32_t slot, uint8_t *dst, uint32_t size, struct seco_raw_hdr *hdr)
+{
+    uint64_t off = raw->slot_off + ((uint64_t)slot * raw->sb.slot_size);
+    int32_t l = 0;
+
+    if ((raw_read_hdr(raw, off, SECO_RAW_SLOT_MAGIC, hdr) == 0)
+        && (hdr->size <= size) && (hdr->size <= raw->sb.slot_size - (uint32_t)sizeof(*hdr))
+        && (pread(raw->fd, dst, hdr->size, (off_t)(off + sizeof(*hdr))) == (ssize_t)hdr->size)
+        && (raw_crc(dst, hdr->size) == hdr->crc)) {
+        l = (int32_t)hdr->size;
+    }
+
+    return l;
+}
+
+static void raw_find_master(struct seco_storage_raw *raw)
+{
+    struct seco_raw_hdr hdr;
+    uint32_t size = raw->sb.slot_size;
+    uint8_t *buf = malloc(size);
+    int32_t slot;
+
+    raw->slot = -1;
+    for (slot = 0; (buf != NULL) && (slot < 2); slot++) {
+        if ((raw_read_slot(raw, slot, buf, size, &hdr) > 0)
+            && ((raw->slot < 0) || raw_gen_after(hdr.gen, raw->master_gen))) {
+            raw->slot = slot;
+            raw->master_gen = hdr.gen;
+            raw->master_size = hdr.size;
+        }
+    }
+    free(buf);
+}
+
+/* Copy the latest chunk records to the other area and make it the current one. */
+static int32_t raw_compact(struct seco_storage_raw *raw)
+{
+    uint32_t other = 1u - raw->area;
+    uint64_t base = raw_area_off(raw, other) + raw_area_data(raw);
+    uint64_t *offs = malloc((raw->log.index_size + 1u) * sizeof(uint64_t));
+    int64_t size = -1;
+    int32_t err = -1;
+
+    do {
+        if ((offs == NULL) || (raw_blank(raw, raw_area_off(raw, other), raw->sb.chunk_size) != 0)) {
+            break;
+        }
+        size = chunk_log_copy_live(&raw->log, raw->fd, base, offs);
+        if ((size < 0) || (fdatasync(raw->fd) != 0)) {
+            break;
+        }
+        /* The copy is complete: the header makes it current. */
+        if (raw_write_area_hdr(raw, other, raw->area_gen + 1u) != 0) {
+            break;
+        }
+        chunk_log_switch(&raw->log, raw->fd, base, offs, (uint64_t)size);
+        raw->area = other;
+        raw->area_gen++;
+        err = 0;
+    } while (false);
+    free(offs);
+
+    return err;
+}
+
+static int32_t raw_open_chunks(struct seco_storage_raw *raw)
+{
+    struct seco_raw_hdr hdr;
+    uint32_t area;
+    bool found = false;
+    int32_t err = 0;
+
+    for (area = 0u; area < 2u; area++) {
+        if ((raw_read_hdr(raw, raw_area_off(raw, area), SECO_RAW_AREA_MAGIC, &hdr) == 0)
+            && (!found || raw_gen_after(hdr.gen, raw->area_gen))) {
+            raw->area = area;
+            raw->area_gen = hdr.gen;
+            found = true;
+        }
+    }
+    if (!found) {
+        /* Chunk areas lost: start again with an empty one. */
+        raw->area = 0u;
+        raw->area_gen = 1u;
+        err = raw_blank(raw, raw_area_off(raw, 0u), raw->sb.chunk_size);
+        if (err == 0) {
+            err = raw_write_area_hdr(raw, 0u, 1u);
+        }
+    }
+
+    if (err == 0) {
+        chunk_log_init(&raw->log, raw->fd, raw_area_off(raw, raw->area) + raw_area_data(raw),
+                       raw->sb.chunk_size - raw_area_data(raw), raw->align, raw->blank);
+        if ((raw->align > 1u) && (raw->log.pad == NULL)) {
+            err = -1;
+        } else if (chunk_log_scan(&raw->log, raw->log.cap) != 0) {
+            err = -1;
+        } else if (raw->log.torn != 0u) {
+            /* Never write over a torn record: it may not be blank. */
+            (void)raw_compact(raw);
+        }
+    }
+
+    return err;
+}
+
+static int32_t raw_write_master(struct seco_storage *st, uint8_t *src, uint32_t size)
+{
+    struct seco_storage_raw *raw = (struct seco_storage_raw *)st;
+    struct seco_raw_hdr *hdr;
+    int32_t slot = (raw->slot == 0) ? 1 : 0;
+    uint64_t off = raw->slot_off + ((uint64_t)slot * raw->sb.slot_size);
+    uint32_t len = (uint32_t)raw_round_up(sizeof(*hdr) + size, raw->align);
+    uint8_t *buf = NULL;
+    int32_t l = 0;
+
+    do {
+        if (size > raw->sb.slot_size - (uint32_t)sizeof(*hdr)) {
+            break;
+        }
+        buf = malloc(len);
+        if (buf == NULL) {
+            break;
+        }
+        (void)memset(buf, raw->blank, len);
+        hdr = (struct seco_raw_hdr *)buf;
+        (void)memset(hdr, 0, sizeof(*hdr));
+        hdr->magic = SECO_RAW_SLOT_MAGIC;
+        hdr->gen = raw->master_gen + 1u;
+        hdr->size = size;
+        hdr->crc = seco_os_abs_crc_copy(buf + sizeof(*hdr), src, size);
+        hdr->hdr_crc = raw_crc(hdr, (uint32_t)offsetof(struct seco_raw_hdr, hdr_crc));
+
+        /* The current slot is left untouched until the new one is durable. */
+        if ((raw->mtd != 0u) && (raw_blank(raw, off, raw->sb.slot_size) != 0)) {
+            break;
+        }
+        if ((storage_pwrite_all(raw->fd, buf, len, off) != 0) || (fdatasync(raw->fd) != 0)) {
+            break;
+        }
+        raw->slot = slot;
+        raw->master_gen++;
+        raw->master_size = size;
+        l = (int32_t)size;
+    } while (false);
+    free(buf);
+
+    return l;
+}
+
+static int32_t raw_map_master(struct seco_storage *st, uint8_t **data)
+{
+    struct seco_storage_raw *raw = (struct seco_storage_raw *)st;
+    struct seco_raw_hdr hdr;
+    uint8_t *buf;
+    int32_t l = 0;
+
+    if ((raw->slot >= 0) && (raw->master_size > 0u)) {
+        buf = malloc(raw->master_size);
+        if (buf != NULL) {
+            l = raw_read_slot(raw, raw->slot, buf, raw->master_size, &hdr);
+            if (l > 0) {
+                *data = buf;
+            } else {
+                free(buf);
+            }
+        }
+    }
+
+    return l;
+}
+
+static int32_t raw_write_chunk(struct seco_storage *st, uint8_t *src, uint32_t size, uint64_t blob_id)
+{
+    struct seco_storage_raw *raw = (struct seco_storage_raw *)st;
+    int32_t l = 0;
+
+    if ((st->type == MU_CHANNEL_HSM_NVM) && (size <= SECO_STORAGE_CHUNK_MAX)) {
+        if ((raw->log.torn != 0u) || (raw->log.end + chunk_log_rec_size(&raw->log, size) > raw->log.cap)) {
+            (void)raw_compact(raw);
+        }
+        if ((raw->log.torn == 0u) && (chunk_log_append(&raw->log, src, size, blob_id) == 0)) {
+            l = (int32_t)size;
+        }
+    }
+
+    return l;
+}
+
+static int32_t raw_read_chunk(struct seco_storage *st, uint64_t blob_id, uint8_t *dst, uint32_t size)
+{
+    struct seco_storage_raw *raw = (struct seco_storage_raw *)st;
+    struct seco_chunk_entry *e = chunk_log_lookup(&raw->log, blob_id);
+
+    return (e != NULL) ? chunk_log_read(&raw->log, e, dst, size) : 0;
+}
+
+static int32_t raw_chunk_size(struct seco_storage *st, uint64_t blob_id)
+{
+    struct seco_storage_raw *raw = (struct seco_storage_raw *)st;
+    struct seco_chunk_entry *e = chunk_log_lookup(&raw->log, blob_id);
+
+    return (e != NULL) ? (int32_t)e->len : 0;
+}
+
+static int32_t raw_sync(struct seco_storage *st)
+{
+    /* Every write is durable when it returns. */
+    (void)st;
+    return 0;
+}
+
+static int32_t raw_enumerate(struct seco_storage *st, seco_os_abs_chunk_cb cb, void *arg)
+{
+    return chunk_log_enumerate(&((struct seco_storage_raw *)st)->log, cb, arg);
+}
+
+static void raw_close(struct seco_storage *st)
+{
+    struct seco_storage_raw *raw = (struct seco_storage_raw *)st;
+
+    if (raw->fd >= 0) {
+        (void)close(raw->fd);
+    }
+    chunk_log_release(&raw->log);
+    free(raw);
+}
+
+static const struct seco_storage_ops seco_storage_raw_ops = {
+    .write_master = raw_write_master,
+    .map_master = raw_map_master,
+    .unmap_master = storage_free_master,
+    .write_chunk = raw_write_chunk,
+    .read_chunk = raw_read_chunk,
+    .chunk_size = raw_chunk_size,
+    .sync = raw_sync,
+    .enumerate = raw_enumerate,
+    .close = raw_close,
+};
+
+struct seco_storage *seco_storage_raw_open(uint32_t type, const char *dev, bool format)
+{
+    struct seco_storage_raw *raw = calloc(1u, sizeof(struct seco_storage_raw));
+    char buf[SECO_NVM_PATH_MAX];
+    struct mtd_info_user info;
+    struct stat s;
+    uint64_t size;
+    int32_t err = -1;
+
+    do {
+        if ((raw == NULL) || (dev == NULL)) {
+            break;
+        }
+        raw->st.ops = &seco_storage_raw_ops;
+        raw->st.type = type;
+        raw->log.fd = -1;
+        raw->fd = open(seco_os_abs_storage_path(dev, buf, (uint32_t)sizeof(buf)), O_RDWR);
+        if (raw->fd < 0) {
+            break;
+        }
+
+        if (ioctl(raw->fd, MEMGETINFO, &info) == 0) {
+            raw->mtd = 1u;
+            raw->blank = 0xFFu;
+            raw->erase_size = info.erasesize;
+            raw->align = (info.writesize > 0u) ? info.writesize : 1u;
+            raw->dev_size = info.size;
+        } else if (fstat(raw->fd, &s) == 0) {
+            raw->blank = 0u;
+            raw->erase_size = SECO_RAW_BLOCK_MIN;
+            raw->align = 1u;
+            if (S_ISBLK(s.st_mode)) {
+                raw->dev_size = (ioctl(raw->fd, BLKGETSIZE64, &size) == 0) ? size : 0u;
+            } else {
+                raw->dev_size = (uint64_t)s.st_size;
+            }
+        } else {
+            break;
+        }
+
+        /* SHE and HSM storages may be opened at the same time: the first one formats the device. */
+        if (flock(raw->fd, LOCK_EX) != 0) {
+            break;
+        }
+        err = raw_load_sb(raw, format);
+        (void)flock(raw->fd, LOCK_UN);
+        if (err != 0) {
+            break;
+        }
+
+        raw->slot_off = (type == MU_CHANNEL_SHE_NVM) ? raw->sb.she_off : raw->sb.hsm_off;
+        raw_find_master(raw);
+        if (type == MU_CHANNEL_HSM_NVM) {
+            err = raw_open_chunks(raw);
+        }
+    } while (false);
+
+    if ((err != 0) && (raw != NULL)) {
+        if (raw->st.ops != NULL) {
+            raw_close(&raw->st);
+        } else {
+            free(raw);
+        }
+        raw = NULL;
+    }
+
+    return (raw != NULL) ? &raw->st : NULL;
+}
+
+/*
+ * RAM backend: the whole storage is loaded in RAM from a directory laid out as for the file
+ * backend. Writes update the RAM copy and return at once; a background thread writes them
+ * to the files once no write happened for flush_delay_ms, so that successive writes of a
+ * blob cost a single file write. Writes acknowledged during the last flush_delay_ms are lost
+ * on a power failure: sync() or closing the storage writes them immediately.
+ */
+struct seco_ram_chunk {
+    uint64_t blob_id;
+    uint32_t len;
+    uint8_t *data;
+    uint8_t dirty;                      /* Not written to the files yet. */
+    struct seco_ram_chunk *next;
+};
+
+/* Copy of a dirty blob being written by the flusher. */
+struct seco_ram_item {
+    uint64_t blob_id;
+    uint32_t len;
+    struct seco_ram_item *next;
+    uint8_t data[];
+};
+
+struct seco_storage_ram {
+    struct seco_storage st;
+    struct seco_storage *lower;         /* Files where the storage is flushed. */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    uint32_t flush_delay_ms;
+    uint8_t stop;
+    uint8_t flush_now;
+    uint8_t flushing;
+    int32_t error;                      /* Result of the last flush. */
+    uint32_t passes;                    /* Flushes completed. */
+    uint32_t dirty;                     /* Blobs not written to the files yet. */
+    uint8_t *master;
+    uint32_t master_len;
+    uint8_t master_dirty;
+    struct seco_ram_chunk *buckets[SECO_RAM_BUCKETS];
+};
+
+static struct seco_ram_chunk **ram_bucket(struct seco_storage_ram *ram, uint64_t blob_id)
+{
+    return &ram->buckets[(uint32_t)((blob_id * 0x9E3779B97F4A7C15ull) >> 58) % SECO_RAM_BUCKETS];
+}
+
+static struct seco_ram_chunk *ram_find(struct seco_storage_ram *ram, uint64_t blob_id)
+{
+    struct seco_ram_chunk *e = *ram_bucket(ram, blob_id);
+
+    while ((e != NULL) && (e->blob_id != blob_id)) {
+        e = e->next;
+    }
+
+    return e;
+}
+
+/* Store a chunk, taking ownership of data. Called with the lock held. */
+static int32_t ram_put(struct seco_storage_ram *ram, uint64_t blob_id, uint8_t *data, uint32_t len, bool dirty)
+{
+    struct seco_ram_chunk **bucket;
+    struct seco_ram_chunk *e = ram_find(ram, blob_id);
+    int32_t err = 0;
+
+    if (e == NULL) {
+        e = calloc(1u, sizeof(struct seco_ram_chunk));
+        if (e == NULL) {
+            err = -1;
+        } else {
+            bucket = ram_bucket(ram, blob_id);
+            e->blob_id = blob_id;
+            e->next = *bucket;
+            *bucket = e;
+        }
+    }
+    if (e != NULL) {
+        free(e->data);
+        e->data = data;
+        e->len = len;
+        if (dirty && (e->dirty == 0u)) {
+            e->dirty = 1u;
+            ram->dirty++;
+        }
+    }
+
+    return err;
+}
+
+/* Write the dirty blobs to the files. Called and returns with the lock held. */
+static void ram_flush(struct seco_storage_ram *ram)
+{
+    struct seco_ram_item *items = NULL;
+    struct seco_ram_item *it;
+    struct seco_ram_chunk *e;
+    uint8_t *master = NULL;
+    uint32_t master_len = 0u;
+    bool master_failed = false;
+    bool failed = false;
+    uint32_t i;
+
+    /* Take a copy of the dirty blobs: they can be written again meanwhile. */
+    if (ram->master_dirty != 0u) {
+        master = malloc(ram->master_len);
+        if (master != NULL) {
+            (void)memcpy(master, ram->master, ram->master_len);
+            master_len = ram->master_len;
+            ram->master_dirty = 0u;
+            ram->dirty--;
+        }
+    }
+    for (i = 0u; i < SECO_RAM_BUCKETS; i++) {
+        for (e = ram->buckets[i]; e != NULL; e = e->next) {
+            if (e->dirty == 0u) {
+                continue;
+            }
+            it = malloc(sizeof(struct seco_ram_item) + e->len);
+            if (it != NULL) {
+                it->blob_id = e->blob_id;
+                it->len = e->len;
+                (void)memcpy(it->data, e->data, e->len);
+                it->next = items;
+                items = it;
+                e->dirty = 0u;
+                ram->dirty--;
+            } else {
+                /* Left dirty: the master cannot be written without it. */
+                failed = true;
+            }
+        }
+    }
+    ram->flushing = 1u;
+    (void)pthread_mutex_unlock(&ram->lock);
+
+    for (it = items; it != NULL; it = it->next) {
+        if (ram->lower->ops->write_chunk(ram->lower, it->data, it->len, it->blob_id) != (int32_t)it->len) {
+            /* Keep it for the next flush. */
+            it->len = 0u;
+            failed = true;
+        }
+    }
+    /* The master refers to the chunks: it is written once they all are. */
+    if ((master != NULL)
+        && (failed || (ram->lower->ops->write_master(ram->lower, master, master_len) != (int32_t)master_len))) {
+        master_failed = true;
+    }
+
+    (void)pthread_mutex_lock(&ram->lock);
+    /* Blobs which failed are written again by the next flush, unless already updated. */
+    if (master_failed && (ram->master_dirty == 0u)) {
+        ram->master_dirty = 1u;
+        ram->dirty++;
+    }
+    while (items != NULL) {
+        it = items;
+        items = it->next;
+        if (it->len == 0u) {
+            e = ram_find(ram, it->blob_id);
+            if ((e != NULL) && (e->dirty == 0u)) {
+                e->dirty = 1u;
+                ram->dirty++;
+            }
+        }
+        free(it);
+    }
+    free(master);
+    ram->error = (master_failed || failed) ? -1 : 0;
+    ram->flushing = 0u;
+    ram->passes++;
+    (void)pthread_cond_broadcast(&ram->cond);
+}
+
+static void *ram_flusher(void *arg)
+{
+    struct seco_storage_ram *ram = (struct seco_storage_ram *)arg;
+    struct timespec deadline;
+    uint32_t delay;
+
+    (void)pthread_mutex_lock(&ram->lock);
+    while (ram->stop == 0u) {
+        if ((ram->dirty == 0u) && (ram->flush_now == 0u)) {
+            (void)pthread_cond_wait(&ram->cond, &ram->lock);
+            continue;
+        }
+        delay = ram->flush_delay_ms;
+        if ((ram->error != 0) && (delay < SECO_RAM_RETRY_MS)) {
+            delay = SECO_RAM_RETRY_MS;
+        }
+        if ((ram->flush_now == 0u) && (delay > 0u)) {
+            /* Let the writes of a burst gather. */
+            (void)clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += (time_t)(delay / 1000u);
+            deadline.tv_nsec += (long)(delay % 1000u) * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            while ((ram->stop == 0u) && (ram->flush_now == 0u)
+                   && (pthread_cond_timedwait(&ram->cond, &ram->lock, &deadline) != ETIMEDOUT)) {
+            }
+        }
+        ram->flush_now = 0u;
+        ram_flush(ram);
+    }
+    /* Write what is left before the storage is closed. */
+    if (ram->dirty != 0u) {
+        ram_flush(ram);
+    }
+    (void)pthread_mutex_unlock(&ram->lock);
+
+    return NULL;
+}
+
+static int32_t ram_write_master(struct seco_storage *st, uint8_t *src, uint32_t size)
+{
+    struct seco_storage_ram *ram = (struct seco_storage_ram *)st;
+    uint8_t *copy = malloc(size);
+    int32_t l = 0;
+
+    if (copy != NULL) {
+        (void)memcpy(copy, src, size);
+        (void)pthread_mutex_lock(&ram->lock);
+        free(ram->master);
+        ram->master = copy;
+        ram->master_len = size;
+        if (ram->master_dirty == 0u) {
+            ram->master_dirty = 1u;
+            ram->dirty++;
+        }
+        (void)pthread_cond_broadcast(&ram->cond);
+        (void)pthread_mutex_unlock(&ram->lock);
+        l = (int32_t)size;
+    }
+
+    return l;
+}
+
+static int32_t ram_map_master(struct seco_storage *st, uint8_t **data)
+{
+    struct seco_storage_ram *ram = (struct seco_storage_ram *)st;
+    int32_t l = 0;
+
+    (void)pthread_mutex_lock(&ram->lock);
+    if (ram->master_len > 0u) {
+        *data = malloc(ram->master_len);
+        if (*data != NULL) {
+            (void)memcpy(*data, ram->master, ram->master_len);
+            l = (int32_t)ram->master_len;
+        }
+    }
+    (void)pthread_mutex_unlock(&ram->lock);
+
+    return l;
+}
+
+static int32_t ram_write_chunk(struct seco_storage *st, uint8_t *src, uint32_t size, uint64_t blob_id)
+{
+    struct seco_storage_ram *ram = (struct seco_storage_ram *)st;
+    uint8_t *copy;
+    int32_t l = 0;
+
+    if (size <= SECO_STORAGE_CHUNK_MAX) {
+        copy = malloc(size);
+        if (copy != NULL) {
+            (void)memcpy(copy, src, size);
+            (void)pthread_mutex_lock(&ram->lock);
+            if (ram_put(ram, blob_id, copy, size, true) == 0) {
+                l = (int32_t)size;
+                (void)pthread_cond_broadcast(&ram->cond);
+            } else {
+                free(copy);
+            }
+            (void)pthread_mutex_unlock(&ram->lock);
+        }
+    }
+
+    return l;
+}
+
+static int32_t ram_read_chunk(struct seco_storage *st, uint64_t blob_id, uint8_t *dst, uint32_t size)
+{
+    struct seco_storage_ram *ram = (struct seco_storage_ram *)st;
+    struct seco_ram_chunk *e;
+    int32_t l = 0;
+
+    (void)pthread_mutex_lock(&ram->lock);
+    e = ram_find(ram, blob_id);
+    if ((e != NULL) && (e->len <= size)) {
+        (void)memcpy(dst, e->data, e->len);
+        l = (int32_t)e->len;
+    }
+    (void)pthread_mutex_unlock(&ram->lock);
+
+    return l;
+}
+
+static int32_t ram_chunk_size(struct seco_storage *st, uint64_t blob_id)
+{
+    struct seco_storage_ram *ram = (struct seco_storage_ram *)st;
+    struct seco_ram_chunk *e;
+    int32_t l = 0;
+
+    (void)pthread_mutex_lock(&ram->lock);
+    e = ram_find(ram, blob_id);
+    if (e != NULL) {
+        l = (int32_t)e->len;
+    }
+    (void)pthread_mutex_unlock(&ram->lock);
+
+    return l;
+}
+
+/* Write the pending blobs now and wait until they are in the files. */
+static int32_t ram_sync(struct seco_storage *st)
+{
+    struct seco_storage_ram *ram = (struct seco_storage_ram *)st;
+    uint32_t target;
+    int32_t err = 0;
+
+    (void)pthread_mutex_lock(&ram->lock);
+    if (ram->dirty != 0u) {
+        /* A flush in progress does not cover the blobs written since it started. */
+        target = ram->passes + ((ram->flushing != 0u) ? 2u : 1u);
+        ram->flush_now = 1u;
+        (void)pthread_cond_broadcast(&ram->cond);
+        while ((int32_t)(ram->passes - target) < 0) {
+            (void)pthread_cond_wait(&ram->cond, &ram->lock);
+        }
+        err = ram->error;
+    } else if (ram->flushing != 0u) {
+        target = ram->passes + 1u;
+        while ((int32_t)(ram->passes - target) < 0) {
+            (void)pthread_cond_wait(&ram->cond, &ram->lock);
+        }
+        err = ram->error;
+    }
+    (void)pthread_mutex_unlock(&ram->lock);
+
+    return err;
+}
+
+static int32_t ram_enumerate(struct seco_storage *st, seco_os_abs_chunk_cb cb, void *arg)
+{
+    struct seco_storage_ram *ram = (struct seco_storage_ram *)st;
+    struct seco_ram_chunk *e;
+    int32_t nb = 0;
+    uint32_t i;
+
+    (void)pthread_mutex_lock(&ram->lock);
+    for (i = 0u; i < SECO_RAM_BUCKETS; i++) {
+        for (e = ram->buckets[i]; e != NULL; e = e->next) {
+            if (cb != NULL) {
+                cb(arg, e->blob_id, e->len);
+            }
+            nb++;
+        }
+    }
+    (void)pthread_mutex_unlock(&ram->lock);
+
+    return nb;
+}
+
+/* Release the RAM copy and the files. */
+static void ram_release(struct seco_storage_ram *ram)
+{
+    struct seco_ram_chunk *e;
+    uint32_t i;
+
+    for (i = 0u; i < SECO_RAM_BUCKETS; i++) {
+        while (ram->buckets[i] != NULL) {
+            e = ram->buckets[i];
+            ram->buckets[i] = e->next;
+            free(e->data);
+            free(e);
+        }
+    }
+    free(ram->master);
+    ram->lower->ops->close(ram->lower);
+    (void)pthread_cond_destroy(&ram->cond);
+    (void)pthread_mutex_destroy(&ram->lock);
+    free(ram);
+}
+
+static void ram_close(struct seco_storage *st)
+{
+    struct seco_storage_ram *ram = (struct seco_storage_ram *)st;
+
+    (void)pthread_mutex_lock(&ram->lock);
+    ram->stop = 1u;
+    (void)pthread_cond_broadcast(&ram->cond);
+    (void)pthread_mutex_unlock(&ram->lock);
+    (void)pthread_join(ram->thread, NULL);
+    ram_release(ram);
+}
+
+static const struct seco_storage_ops seco_storage_ram_ops = {
+    .write_master = ram_write_master,
+    .map_master = ram_map_master,
+    .unmap_master = storage_free_master,
+    .write_chunk = ram_write_chunk,
+    .read_chunk = ram_read_chunk,
+    .chunk_size = ram_chunk_size,
+    .sync = ram_sync,
+    .enumerate = ram_enumerate,
+    .close = ram_close,
+};
+
+/* Load a chunk of the files in RAM. */
+static void ram_load_chunk(void *arg, uint64_t blob_id, uint32_t size)
+{
+    struct seco_storage_ram *ram = (struct seco_storage_ram *)arg;
+    uint8_t *data = malloc(size);
+
+    if ((data != NULL)
+        && (ram->lower->ops->read_chunk(ram->lower, blob_id, data, size) == (int32_t)size)
+        && (ram_put(ram, blob_id, data, size, false) == 0)) {
+        data = NULL;
+    }
+    free(data);
+}
+
+struct seco_storage *seco_storage_ram_open(uint32_t type, const char *dir, uint32_t flush_delay_ms)
+{
+    struct seco_storage_ram *ram = calloc(1u, sizeof(struct seco_storage_ram));
+    uint8_t *data = NULL;
+    int32_t len;
+
+    do {
+        if (ram == NULL) {
+            break;
+        }
+        ram->lower = seco_storage_file_open(type, dir);
+        if (ram->lower == NULL) {
+            free(ram);
+            ram = NULL;
+            break;
+        }
+        ram->st.ops = &seco_storage_ram_ops;
+        ram->st.type = type;
+        ram->flush_delay_ms = flush_delay_ms;
+        (void)pthread_mutex_init(&ram->lock, NULL);
+        (void)pthread_cond_init(&ram->cond, NULL);
+
+        len = ram->lower->ops->map_master(ram->lower, &data);
+        if (len > 0) {
+            ram->master = malloc((uint32_t)len);
+            if (ram->master != NULL) {
+                (void)memcpy(ram->master, data, (uint32_t)len);
+                ram->master_len = (uint32_t)len;
+            }
+            ram->lower->ops->unmap_master(ram->lower, data, (uint32_t)len);
+        }
+        (void)ram->lower->ops->enumerate(ram->lower, ram_load_chunk, ram);
+
+        if (pthread_create(&ram->thread, NULL, ram_flusher, ram) != 0) {
+            ram_release(ram);
+            ram = NULL;
+        }
+    } while (false);
+
+    return (ram != NULL) ? &ram->st : NULL;
+}
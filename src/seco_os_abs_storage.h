@@ -0,0 +1,80 @@
+/*
+ * Copyright 2019 NXP
+ *
+ * NXP Confidential.
+ * This software is owned or controlled by NXP and may only be used strictly
+ * in accordance with the applicable license terms.  By expressly accepting
+ * such terms or by downloading, installing, activating and/or otherwise using
+ * the software, you are agreeing that you have read, and that you agree to
+ * comply with and are bound by, such license terms.  If you do not agree to be
+ * bound by the applicable license terms, then you may not retain, install,
+ * activate or otherwise use the software.
+ */
+
+#ifndef SECO_OS_ABS_STORAGE_H
+#define SECO_OS_ABS_STORAGE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "seco_os_abs.h"
+
+/*
+ * Storage backends of the Linux OS abstraction.
+ *
+ * A backend instance holds the storage of one NVM channel (SHE or HSM): its master blob
+ * and, for HSM, the chunks. It is opened with the storage channel and only used by the
+ * NVM manager thread serving this channel.
+ */
+struct seco_storage;
+
+/* Largest chunk kept by the backends. */
+#define SECO_STORAGE_CHUNK_MAX      (1024u * 1024u)
+
+/* Chunks larger than this are read and written by segments of this size, the memory
+ * used by the backends does not depend on the size of the chunks.
+ */
+#define SECO_STORAGE_SEGMENT        (16u * 1024u)
+
+struct seco_storage_ops {
+    /* Replace the master blob: a power loss leaves either the previous or the new one.
+     * Return the size written, once durable for the durable backends.
+     */
+    int32_t (*write_master)(struct seco_storage *st, uint8_t *src, uint32_t size);
+    /* Give read access to the whole master blob until unmap_master. Return its size, 0 if none. */
+    int32_t (*map_master)(struct seco_storage *st, uint8_t **data);
+    void (*unmap_master)(struct seco_storage *st, uint8_t *data, uint32_t size);
+    /* Store a chunk, superseding the previous one of blob_id. Return the size written. */
+    int32_t (*write_chunk)(struct seco_storage *st, uint8_t *src, uint32_t size, uint64_t blob_id);
+    /* Read a whole chunk. Return its size, 0 if not available or larger than size.
+     * Can be called from several threads while no chunk is written.
+     */
+    int32_t (*read_chunk)(struct seco_storage *st, uint64_t blob_id, uint8_t *dst, uint32_t size);
+    /* Return the size of a chunk, 0 if not available. */
+    int32_t (*chunk_size)(struct seco_storage *st, uint64_t blob_id);
+    /* Make all the writes done so far durable. Return 0 on success. */
+    int32_t (*sync)(struct seco_storage *st);
+    /* Call cb for each chunk stored. Return the number of chunks. */
+    int32_t (*enumerate)(struct seco_storage *st, seco_os_abs_chunk_cb cb, void *arg);
+    void (*close)(struct seco_storage *st);
+};
+
+struct seco_storage {
+    const struct seco_storage_ops *ops;
+    uint32_t type;                      /* MU_CHANNEL_SHE_NVM or MU_CHANNEL_HSM_NVM. */
+};
+
+/* Files in a directory: one file per master, chunks appended to a container file. */
+struct seco_storage *seco_storage_file_open(uint32_t type, const char *dir);
+
+/* Raw block device or MTD partition, shared by the SHE and HSM storages. Formatted when its
+ * first block is blank, or when format is set and it does not hold a valid storage.
+ */
+struct seco_storage *seco_storage_raw_open(uint32_t type, const char *dev, bool format);
+
+/* Storage held in RAM, written to files in dir by a background thread. */
+struct seco_storage *seco_storage_ram_open(uint32_t type, const char *dir, uint32_t flush_delay_ms);
+
+/* Location of a storage file or device, relocated when built for the SECO emulator. */
+const char *seco_os_abs_storage_path(const char *path, char *buf, uint32_t size);
+
+#endif
@@ -11,6 +11,7 @@
  * activate or otherwise use the software.
  */
 
+#include <stddef.h>
 #include "seco_os_abs.h"
 #include "seco_sab_messaging.h"
 #include "seco_sab_msg_def.h"
@@ -374,6 +375,8 @@ uint32_t sab_cmd_cipher_one_go(struct seco_os_abs_hdl *phdl,
 {
     struct sab_cmd_cipher_one_go_msg cmd;
     struct sab_cmd_cipher_one_go_rsp rsp;
+    struct seco_os_abs_buf bufs[3];
+    uint32_t nb_bufs = 0u;
     int32_t error;
     uint32_t ret = SAB_FAILURE_STATUS;
 
@@ -385,24 +388,31 @@ uint32_t sab_cmd_cipher_one_go(struct seco_os_abs_hdl *phdl,
         seco_fill_cmd_msg_hdr(&cmd.hdr, SAB_CIPHER_ONE_GO_REQ, (uint32_t)sizeof(struct sab_cmd_cipher_one_go_msg));
         cmd.cipher_handle = cipher_handle;
         cmd.key_id = key_id;
-        if (iv == NULL) {
-            cmd.iv_address = 0;
-        } else {
-            cmd.iv_address = seco_os_abs_data_buf(phdl, iv, iv_size, DATA_BUF_IS_INPUT);
+        cmd.iv_address = 0;
+        if (iv != NULL) {
+            seco_fill_data_buf(&bufs[nb_bufs], iv, iv_size, DATA_BUF_IS_INPUT,
+                               (uint32_t)offsetof(struct sab_cmd_cipher_one_go_msg, iv_address));
+            nb_bufs++;
         }
         cmd.iv_size = iv_size;
         cmd.algo = algo;
         cmd.flags = flags;
-        cmd.input_address = seco_os_abs_data_buf(phdl, input, input_size, DATA_BUF_IS_INPUT);
-        cmd.output_address = seco_os_abs_data_buf(phdl, output, output_size, 0u);
+        cmd.input_address = 0;
+        seco_fill_data_buf(&bufs[nb_bufs], input, input_size, DATA_BUF_IS_INPUT,
+                           (uint32_t)offsetof(struct sab_cmd_cipher_one_go_msg, input_address));
+        nb_bufs++;
+        cmd.output_address = 0;
+        seco_fill_data_buf(&bufs[nb_bufs], output, output_size, 0u,
+                           (uint32_t)offsetof(struct sab_cmd_cipher_one_go_msg, output_address));
+        nb_bufs++;
         cmd.input_size = input_size;
         cmd.output_size = output_size;
-        cmd.crc = seco_compute_msg_crc((uint32_t*)&cmd, (uint32_t)(sizeof(cmd) - sizeof(uint32_t)));
 
-        /* Send the message to Seco. */
-        error = seco_send_msg_and_get_resp(phdl,
+        /* Send the message to Seco. The CRC is computed once the buffer addresses are set. */
+        error = seco_send_msg_with_bufs_and_get_resp(phdl,
                     (uint32_t *)&cmd, (uint32_t)sizeof(struct sab_cmd_cipher_one_go_msg),
-                    (uint32_t *)&rsp, (uint32_t)sizeof(struct sab_cmd_cipher_one_go_rsp));
+                    (uint32_t *)&rsp, (uint32_t)sizeof(struct sab_cmd_cipher_one_go_rsp),
+                    bufs, nb_bufs, MU_TRANSACTION_CMD_CRC);
         if (error != 0) {
             break;
         }
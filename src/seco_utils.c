@@ -32,8 +32,24 @@ void seco_fill_rsp_msg_hdr(struct sab_mu_hdr *hdr, uint8_t cmd, uint32_t len)
     hdr->ver = MESSAGING_VERSION_6;
 };
 
+/* Fill the description of a data buffer referenced by a command at a given offset. */
+void seco_fill_data_buf(struct seco_os_abs_buf *buf, uint8_t *data, uint32_t size, uint32_t flags, uint32_t cmd_offset)
+{
+    buf->data = data;
+    buf->size = size;
+    buf->flags = flags;
+    buf->cmd_offset = cmd_offset;
+}
+
 /* Helper function to send a message and wait for the response. Return 0 on success.*/
 int32_t seco_send_msg_and_get_resp(struct seco_os_abs_hdl *phdl, uint32_t *cmd, uint32_t cmd_len, uint32_t *rsp, uint32_t rsp_len)
+{
+    return seco_send_msg_with_bufs_and_get_resp(phdl, cmd, cmd_len, rsp, rsp_len, NULL, 0u, 0u);
+}
+
+/* Same as seco_send_msg_and_get_resp() for a command referencing data buffers. */
+int32_t seco_send_msg_with_bufs_and_get_resp(struct seco_os_abs_hdl *phdl, uint32_t *cmd, uint32_t cmd_len, uint32_t *rsp, uint32_t rsp_len,
+                                             struct seco_os_abs_buf *bufs, uint32_t nb_bufs, uint32_t flags)
 {
     int32_t err = -1;
     int32_t len;
@@ -46,15 +62,8 @@ int32_t seco_send_msg_and_get_resp(struct seco_os_abs_hdl *phdl, uint32_t *cmd,
             break;
         }
 
-        /* Send the command. */
-        len = seco_os_abs_send_mu_message(phdl, cmd, cmd_len);
-        if (len != (int32_t)cmd_len) {
-            printf("error cmd_len 0x%x \n", cmd_len);
-            printf("error len 0x%x \n", len);
-            break;
-        }
-        /* Read the response. */
-        len = seco_os_abs_read_mu_message(phdl, rsp, rsp_len);
+        /* Send the command and read the response. */
+        len = seco_os_abs_mu_transaction(phdl, cmd, cmd_len, rsp, rsp_len, bufs, nb_bufs, flags);
         if (len != (int32_t)rsp_len) {
             printf("error rsp_len 0x%x \n", rsp_len);
             printf("error len 0x%x \n", len);
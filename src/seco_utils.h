@@ -22,8 +22,13 @@ void seco_fill_cmd_msg_hdr(struct sab_mu_hdr *hdr, uint8_t cmd, uint32_t len);
 
 void seco_fill_rsp_msg_hdr(struct sab_mu_hdr *hdr, uint8_t cmd, uint32_t len);
 
+void seco_fill_data_buf(struct seco_os_abs_buf *buf, uint8_t *data, uint32_t size, uint32_t flags, uint32_t cmd_offset);
+
 int32_t seco_send_msg_and_get_resp(struct seco_os_abs_hdl *phdl, uint32_t *cmd, uint32_t cmd_len, uint32_t *rsp, uint32_t rsp_len);
 
+int32_t seco_send_msg_with_bufs_and_get_resp(struct seco_os_abs_hdl *phdl, uint32_t *cmd, uint32_t cmd_len, uint32_t *rsp, uint32_t rsp_len,
+                                             struct seco_os_abs_buf *bufs, uint32_t nb_bufs, uint32_t flags);
+
 uint32_t seco_compute_msg_crc(uint32_t *msg, uint32_t msg_len);
 
 #endif
@@ -11,6 +11,7 @@
  * activate or otherwise use the software.
  */
 
+#include <stddef.h>
 #include "seco_os_abs.h"
 #include "seco_sab_msg_def.h"
 #include "seco_sab_messaging.h"
@@ -337,11 +338,58 @@ struct she_hdl_s *she_open_session(uint32_t key_storage_identifier, uint32_t aut
     return hdl;
 };
 
+/* Allocate memory in the secure RAM shared buffer of the session. */
+uint8_t *she_shared_buf_alloc(struct she_hdl_s *hdl, uint32_t size, uint16_t *offset)
+{
+    uint8_t *ptr = NULL;
+    uint32_t off;
+
+    if (hdl != NULL) {
+        ptr = seco_os_abs_shared_buf_alloc(hdl->phdl, size, &off);
+        if ((ptr != NULL) && (offset != NULL)) {
+            *offset = (uint16_t)(off & SEC_MEM_SHORT_ADDR_MASK);
+        }
+    }
+    return ptr;
+}
+
+/* Release the memory allocated in the shared buffer. */
+void she_shared_buf_reset(struct she_hdl_s *hdl)
+{
+    if (hdl != NULL) {
+        seco_os_abs_shared_buf_reset(hdl->phdl);
+    }
+}
+
+/* Locate the message and the MAC of a fast MAC command in secure memory.
+ * Return the number of buffers to be copied there for the command.
+ */
+static uint32_t she_fast_mac_bufs(struct she_hdl_s *hdl, struct sab_she_fast_mac_msg *cmd, uint8_t *message, uint8_t *mac,
+                                  uint32_t mac_flags, struct seco_os_abs_buf *bufs)
+{
+    uint32_t nb_bufs = 2u;
+    uint32_t off;
+
+    /* Already allocated in the shared buffer with the layout expected by Seco: used in place. */
+    if ((message != NULL) && (mac == message + SHE_SHARED_BUF_MAC_POS(cmd->data_length))
+        && (seco_os_abs_shared_buf_offset(hdl->phdl, message, SHE_SHARED_BUF_MAC_POS(cmd->data_length) + SHE_MAC_SIZE, &off) == 0)) {
+        cmd->data_offset = (uint16_t)(off & SEC_MEM_SHORT_ADDR_MASK);
+        nb_bufs = 0u;
+    } else {
+        seco_fill_data_buf(&bufs[0], message, cmd->data_length, DATA_BUF_IS_INPUT | DATA_BUF_USE_SEC_MEM | DATA_BUF_SHORT_ADDR,
+                           (uint32_t)offsetof(struct sab_she_fast_mac_msg, data_offset));
+        seco_fill_data_buf(&bufs[1], mac, SHE_MAC_SIZE, mac_flags | DATA_BUF_USE_SEC_MEM | DATA_BUF_SHORT_ADDR, DATA_BUF_NO_ADDR);
+    }
+    return nb_bufs;
+}
+
 /* MAC generation command processing. */
 she_err_t she_cmd_generate_mac(struct she_hdl_s *hdl, uint8_t key_ext, uint8_t key_id, uint16_t message_length, uint8_t *message, uint8_t *mac)
 {
     struct sab_she_fast_mac_msg cmd;
     struct sab_she_fast_mac_rsp rsp;
+    struct seco_os_abs_buf bufs[2];
+    uint32_t nb_bufs;
     int32_t error;
     she_err_t ret = ERC_GENERAL_ERROR;
 
@@ -354,15 +402,18 @@ she_err_t she_cmd_generate_mac(struct she_hdl_s *hdl, uint8_t key_ext, uint8_t k
         cmd.she_utils_handle = hdl->utils_handle;
         cmd.key_id = (uint16_t)key_ext | (uint16_t)key_id;
         cmd.data_length = message_length;
-        cmd.data_offset = (uint16_t)(seco_os_abs_data_buf(hdl->phdl, message, message_length, DATA_BUF_IS_INPUT | DATA_BUF_USE_SEC_MEM | DATA_BUF_SHORT_ADDR) & SEC_MEM_SHORT_ADDR_MASK);
-        (void)(seco_os_abs_data_buf(hdl->phdl, mac, SHE_MAC_SIZE, DATA_BUF_USE_SEC_MEM | DATA_BUF_SHORT_ADDR) & SEC_MEM_SHORT_ADDR_MASK);
+        cmd.data_offset = 0u;
         cmd.mac_length = 0u;
         cmd.flags = 0u;
 
+        /* Message in secure memory, followed by the MAC written by Seco. */
+        nb_bufs = she_fast_mac_bufs(hdl, &cmd, message, mac, 0u, bufs);
+
         /* Send the message to Seco. */
-        error = seco_send_msg_and_get_resp(hdl->phdl,
+        error = seco_send_msg_with_bufs_and_get_resp(hdl->phdl,
                     (uint32_t *)&cmd, (uint32_t)sizeof(struct sab_she_fast_mac_msg),
-                    (uint32_t *)&rsp, (uint32_t)sizeof(struct sab_she_fast_mac_rsp));
+                    (uint32_t *)&rsp, (uint32_t)sizeof(struct sab_she_fast_mac_rsp),
+                    bufs, nb_bufs, 0u);
         if (error != 0) {
             break;
         }
@@ -387,6 +438,8 @@ she_err_t she_cmd_verify_mac(struct she_hdl_s *hdl, uint8_t key_ext, uint8_t key
 {
     struct sab_she_fast_mac_msg cmd;
     struct sab_she_fast_mac_rsp rsp;
+    struct seco_os_abs_buf bufs[2];
+    uint32_t nb_bufs;
     int32_t error;
     she_err_t ret = ERC_GENERAL_ERROR;
 
@@ -405,15 +458,18 @@ she_err_t she_cmd_verify_mac(struct she_hdl_s *hdl, uint8_t key_ext, uint8_t key
         cmd.she_utils_handle = hdl->utils_handle;
         cmd.key_id = (uint16_t)key_ext | (uint16_t)key_id;
         cmd.data_length = message_length;
-        cmd.data_offset = (uint16_t)(seco_os_abs_data_buf(hdl->phdl, message, message_length, DATA_BUF_IS_INPUT | DATA_BUF_USE_SEC_MEM | DATA_BUF_SHORT_ADDR) & SEC_MEM_SHORT_ADDR_MASK);
-        (void)(seco_os_abs_data_buf(hdl->phdl, mac, SHE_MAC_SIZE, DATA_BUF_IS_INPUT | DATA_BUF_USE_SEC_MEM | DATA_BUF_SHORT_ADDR) & SEC_MEM_SHORT_ADDR_MASK);
+        cmd.data_offset = 0u;
         cmd.mac_length = mac_length;
         cmd.flags = SAB_SHE_FAST_MAC_FLAGS_VERIFICATION;
 
+        /* Message in secure memory, followed by the MAC to be verified. */
+        nb_bufs = she_fast_mac_bufs(hdl, &cmd, message, mac, DATA_BUF_IS_INPUT, bufs);
+
         /* Send the message to Seco. */
-        error = seco_send_msg_and_get_resp(hdl->phdl,
+        error = seco_send_msg_with_bufs_and_get_resp(hdl->phdl,
                     (uint32_t *)&cmd, (uint32_t)sizeof(struct sab_she_fast_mac_msg),
-                    (uint32_t *)&rsp, (uint32_t)sizeof(struct sab_she_fast_mac_rsp));
+                    (uint32_t *)&rsp, (uint32_t)sizeof(struct sab_she_fast_mac_rsp),
+                    bufs, nb_bufs, 0u);
         if (error != 0) {
             break;
         }
@@ -828,7 +884,7 @@ she_err_t she_cmd_rnd(struct she_hdl_s *hdl, uint8_t *rnd)
     she_err_t ret = ERC_GENERAL_ERROR;
     struct sab_cmd_get_rnd_msg cmd;
     struct sab_cmd_get_rnd_rsp rsp;
-    uint64_t seco_rnd_addr;
+    struct seco_os_abs_buf bufs[1];
     int32_t error;
 
     do {
@@ -842,15 +898,16 @@ she_err_t she_cmd_rnd(struct she_hdl_s *hdl, uint8_t *rnd)
 
         /* Build command message. */
         seco_fill_cmd_msg_hdr(&cmd.hdr, SAB_RNG_GET_RANDOM, (uint32_t)sizeof(struct sab_cmd_get_rnd_msg));
-        seco_rnd_addr = seco_os_abs_data_buf(hdl->phdl, rnd, SHE_RND_SIZE, 0u);
         cmd.rng_handle = hdl->rng_handle;
-        cmd.rnd_addr = (uint32_t)(seco_rnd_addr & 0xFFFFFFFFu);
+        cmd.rnd_addr = 0u;
+        seco_fill_data_buf(&bufs[0], rnd, SHE_RND_SIZE, 0u, (uint32_t)offsetof(struct sab_cmd_get_rnd_msg, rnd_addr));
         cmd.rnd_size = SHE_RND_SIZE;
 
         /* Send the message to Seco. */
-        error = seco_send_msg_and_get_resp(hdl->phdl,
+        error = seco_send_msg_with_bufs_and_get_resp(hdl->phdl,
                     (uint32_t *)&cmd, (uint32_t)sizeof(struct sab_cmd_get_rnd_msg),
-                    (uint32_t *)&rsp, (uint32_t)sizeof(struct sab_cmd_get_rnd_rsp));
+                    (uint32_t *)&rsp, (uint32_t)sizeof(struct sab_cmd_get_rnd_rsp),
+                    bufs, 1u, 0u);
         if (error != 0) {
             break;
         }
@@ -0,0 +1,140 @@
+/*
+ * Copyright 2019 NXP
+ *
+ * NXP Confidential.
+ * This software is owned or controlled by NXP and may only be used strictly
+ * in accordance with the applicable license terms.  By expressly accepting
+ * such terms or by downloading, installing, activating and/or otherwise using
+ * the software, you are agreeing that you have read, and that you agree to
+ * comply with and are bound by, such license terms.  If you do not agree to be
+ * bound by the applicable license terms, then you may not retain, install,
+ * activate or otherwise use the software.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <zlib.h>
+#include "seco_os_abs.h"
+
+/*
+ * Compare the CRC of the NVM storage against zlib crc32(), for the sizes of the blobs
+ * handled by the NVM manager. Results of both are checked to be identical, including for
+ * unaligned buffers and odd sizes.
+ *
+ * usage: crc_bench [total MB processed per size, default 64]
+ */
+
+#define BENCH_MAX_SIZE  (16u * 1024u)
+
+static const uint32_t bench_sizes[] = {64u, 256u, 1024u, 4096u, 16384u};
+
+/* Reference: zlib with the same initial value and final inversion as seco_os_abs_crc(). */
+static uint32_t ref_crc(uint8_t *data, uint32_t size)
+{
+    return ((uint32_t)crc32(0xFFFFFFFFu, data, size) ^ 0xFFFFFFFFu);
+}
+
+static double elapsed_ms(struct timespec *ts1, struct timespec *ts2)
+{
+    return ((double)(ts2->tv_sec - ts1->tv_sec) * 1000.0) + ((double)(ts2->tv_nsec - ts1->tv_nsec) / 1000000.0);
+}
+
+static uint32_t check(uint8_t *src, uint8_t *dst)
+{
+    uint32_t fails = 0u;
+    uint32_t off;
+    uint32_t size;
+
+    for (off = 0u; off < 16u; off++) {
+        for (size = 0u; size < 1100u; size++) {
+            (void)memset(dst, 0, size + 1u);
+            if (seco_os_abs_crc(src + off, size) != ref_crc(src + off, size)) {
+                fails++;
+            }
+            if ((seco_os_abs_crc_copy(dst, src + off, size) != ref_crc(src + off, size))
+                || (memcmp(dst, src + off, size) != 0) || (dst[size] != 0u)) {
+                fails++;
+            }
+        }
+    }
+
+    return fails;
+}
+
+int main(int argc, char *argv[])
+{
+    struct timespec ts1, ts2;
+    uint64_t total = 64u * 1024u * 1024u;
+    uint32_t acc = 0u;
+    uint32_t fails;
+    uint32_t iter;
+    uint32_t size;
+    uint32_t i, j;
+    uint8_t *src;
+    uint8_t *dst;
+    double t_zlib, t_crc, t_copy_zlib, t_copy_crc;
+
+    if (argc > 1) {
+        total = (uint64_t)strtoul(argv[1], NULL, 0) * 1024u * 1024u;
+    }
+
+    src = malloc(BENCH_MAX_SIZE + 16u);
+    dst = malloc(BENCH_MAX_SIZE + 16u);
+    if ((src == NULL) || (dst == NULL)) {
+        return 1;
+    }
+    for (i = 0u; i < BENCH_MAX_SIZE + 16u; i++) {
+        src[i] = (uint8_t)(rand() & 0xFF);
+    }
+
+    fails = check(src, dst);
+    printf("crc check %s (%d fails)\n", (fails == 0u) ? "PASS" : "FAIL", fails);
+
+    printf("%8s %14s %14s %14s %14s  (MB/s)\n", "size", "zlib", "seco", "memcpy+zlib", "seco copy");
+    for (j = 0u; j < sizeof(bench_sizes) / sizeof(bench_sizes[0]); j++) {
+        size = bench_sizes[j];
+        iter = (uint32_t)(total / size);
+
+        clock_gettime(CLOCK_MONOTONIC_RAW, &ts1);
+        for (i = 0u; i < iter; i++) {
+            acc += ref_crc(src, size);
+        }
+        clock_gettime(CLOCK_MONOTONIC_RAW, &ts2);
+        t_zlib = elapsed_ms(&ts1, &ts2);
+
+        clock_gettime(CLOCK_MONOTONIC_RAW, &ts1);
+        for (i = 0u; i < iter; i++) {
+            acc += seco_os_abs_crc(src, size);
+        }
+        clock_gettime(CLOCK_MONOTONIC_RAW, &ts2);
+        t_crc = elapsed_ms(&ts1, &ts2);
+
+        clock_gettime(CLOCK_MONOTONIC_RAW, &ts1);
+        for (i = 0u; i < iter; i++) {
+            (void)memcpy(dst, src, size);
+            acc += ref_crc(dst, size);
+        }
+        clock_gettime(CLOCK_MONOTONIC_RAW, &ts2);
+        t_copy_zlib = elapsed_ms(&ts1, &ts2);
+
+        clock_gettime(CLOCK_MONOTONIC_RAW, &ts1);
+        for (i = 0u; i < iter; i++) {
+            acc += seco_os_abs_crc_copy(dst, src, size);
+        }
+        clock_gettime(CLOCK_MONOTONIC_RAW, &ts2);
+        t_copy_crc = elapsed_ms(&ts1, &ts2);
+
+        printf("%8d %14.0f %14.0f %14.0f %14.0f\n", size,
+                (double)total / 1000.0 / t_zlib, (double)total / 1000.0 / t_crc,
+                (double)total / 1000.0 / t_copy_zlib, (double)total / 1000.0 / t_copy_crc);
+    }
+    /* Keep the results alive. */
+    printf("(%08x)\n", acc);
+
+    free(src);
+    free(dst);
+
+    return (fails == 0u) ? 0 : 1;
+}
@@ -0,0 +1,278 @@
+/*
+ * Copyright 2019 NXP
+ *
+ * NXP Confidential.
+ * This software is owned or controlled by NXP and may only be used strictly
+ * in accordance with the applicable license terms.  By expressly accepting
+ * such terms or by downloading, installing, activating and/or otherwise using
+ * the software, you are agreeing that you have read, and that you agree to
+ * comply with and are bound by, such license terms.  If you do not agree to be
+ * bound by the applicable license terms, then you may not retain, install,
+ * activate or otherwise use the software.
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "hsm_api.h"
+#include "hsm_dispatch.h"
+#include "seco_nvm.h"
+
+#define NB_OPS          64u
+#define INPUT_SIZE      48u
+#define DIGEST_SIZE     32u
+
+struct test_op {
+    hsm_dispatch_op_t op;
+    op_hash_one_go_args_t hash;
+    uint8_t input[INPUT_SIZE];
+    uint8_t output[DIGEST_SIZE];
+    uint32_t nb_callbacks;
+};
+
+static struct test_op ops[NB_OPS];
+static uint8_t ref_digest[NB_OPS][DIGEST_SIZE];
+
+/* Completion order of the operations, filled by the callback. */
+static pthread_mutex_t done_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static uint32_t done_order[NB_OPS];
+static uint32_t nb_done;
+
+static void test_op_done(hsm_dispatch_op_t *op)
+{
+    struct test_op *t = (struct test_op *)op->user_data;
+
+    (void)pthread_mutex_lock(&done_lock);
+    t->nb_callbacks++;
+    if (nb_done < NB_OPS) {
+        done_order[nb_done] = (uint32_t)(t - ops);
+    }
+    nb_done++;
+    (void)pthread_cond_signal(&done_cond);
+    (void)pthread_mutex_unlock(&done_lock);
+}
+
+static void test_op_init(struct test_op *t, uint32_t idx)
+{
+    memset(t, 0, sizeof(*t));
+    memset(t->input, (int)idx, sizeof(t->input));
+    t->hash.input = t->input;
+    t->hash.output = t->output;
+    t->hash.input_size = INPUT_SIZE - (idx % 16u);
+    t->hash.output_size = DIGEST_SIZE;
+    t->hash.algo = HSM_HASH_ALGO_SHA_256;
+    t->op.type = HSM_DISPATCH_OP_HASH;
+    t->op.args.hash = &t->hash;
+    t->op.callback = test_op_done;
+    t->op.user_data = t;
+}
+
+static hsm_err_t test_open(uint32_t nb_sessions, hsm_dispatcher_t **d)
+{
+    hsm_dispatcher_args_t args;
+
+    memset(&args, 0, sizeof(args));
+    args.nb_sessions = nb_sessions;
+    args.session.session_priority = 0;
+    args.session.operating_mode = 0;
+    args.key_store = NULL;
+
+    return hsm_open_dispatcher(&args, d);
+}
+
+static uint32_t test_submit_all(hsm_dispatcher_t *d)
+{
+    uint32_t i;
+
+    (void)pthread_mutex_lock(&done_lock);
+    nb_done = 0u;
+    (void)pthread_mutex_unlock(&done_lock);
+
+    for (i = 0u; i < NB_OPS; i++) {
+        test_op_init(&ops[i], i);
+        if (hsm_dispatch_submit(d, &ops[i].op) != HSM_NO_ERROR) {
+            break;
+        }
+    }
+
+    return i;
+}
+
+/* Each operation completed once, without error and with the expected digest. */
+static bool test_check_ops(void)
+{
+    uint32_t i;
+    bool ok = true;
+
+    for (i = 0u; i < NB_OPS; i++) {
+        if ((ops[i].nb_callbacks != 1u) || (ops[i].op.err != HSM_NO_ERROR)
+            || (memcmp(ops[i].output, ref_digest[i], DIGEST_SIZE) != 0)) {
+            printf("op %d: callbacks %d err 0x%x\n", i, ops[i].nb_callbacks, ops[i].op.err);
+            ok = false;
+        }
+    }
+
+    return ok;
+}
+
+/* With a single session the operations complete in submission order. */
+static bool test_ordering(void)
+{
+    hsm_dispatcher_t *d;
+    struct test_op t;
+    uint32_t i;
+    bool ok = false;
+
+    do {
+        if (test_open(1u, &d) != HSM_NO_ERROR) {
+            break;
+        }
+        /* Reference digests, one synchronous operation at a time. */
+        for (i = 0u; i < NB_OPS; i++) {
+            test_op_init(&t, i);
+            if (hsm_dispatch_run(d, &t.op) != HSM_NO_ERROR) {
+                break;
+            }
+            memcpy(ref_digest[i], t.output, DIGEST_SIZE);
+        }
+        if (i == NB_OPS) {
+            ok = (test_submit_all(d) == NB_OPS);
+        }
+        (void)hsm_close_dispatcher(d);
+        if (!ok) {
+            break;
+        }
+        ok = test_check_ops();
+        for (i = 0u; i < NB_OPS; i++) {
+            if (done_order[i] != i) {
+                printf("op %d completed at position %d\n", done_order[i], i);
+                ok = false;
+            }
+        }
+    } while (false);
+
+    return ok;
+}
+
+/* Operations spread over several sessions all complete, without closing the dispatcher. */
+static bool test_completion(void)
+{
+    hsm_dispatcher_t *d;
+    struct timespec deadline;
+    bool ok = false;
+
+    do {
+        if (test_open(4u, &d) != HSM_NO_ERROR) {
+            break;
+        }
+        if (test_submit_all(d) == NB_OPS) {
+            (void)clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += 10;
+            (void)pthread_mutex_lock(&done_lock);
+            while ((nb_done < NB_OPS)
+                   && (pthread_cond_timedwait(&done_cond, &done_lock, &deadline) == 0)) {
+            }
+            (void)pthread_mutex_unlock(&done_lock);
+            ok = test_check_ops();
+        }
+        (void)hsm_close_dispatcher(d);
+    } while (false);
+
+    return ok;
+}
+
+/* Closing completes the operations still queued before stopping the workers. */
+static bool test_shutdown(void)
+{
+    hsm_dispatcher_t *d;
+    bool ok = false;
+
+    do {
+        if (test_open(4u, &d) != HSM_NO_ERROR) {
+            break;
+        }
+        ok = (test_submit_all(d) == NB_OPS);
+        if (hsm_close_dispatcher(d) != HSM_NO_ERROR) {
+            ok = false;
+        }
+        ok = ok && test_check_ops();
+    } while (false);
+
+    return ok;
+}
+
+/* Workers without operation to perform sleep. */
+static bool test_idle(void)
+{
+    hsm_dispatcher_t *d;
+    struct timespec start, end;
+    int64_t cpu_us;
+    bool ok = false;
+
+    do {
+        if (test_open(4u, &d) != HSM_NO_ERROR) {
+            break;
+        }
+        (void)clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
+        (void)usleep(200000);
+        (void)clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &end);
+        (void)hsm_close_dispatcher(d);
+
+        cpu_us = ((int64_t)end.tv_sec - (int64_t)start.tv_sec) * 1000000
+                 + ((int64_t)end.tv_nsec - (int64_t)start.tv_nsec) / 1000;
+        if (cpu_us > 20000) {
+            printf("%d us of CPU used in 200 ms while idle\n", (int)cpu_us);
+            break;
+        }
+        ok = true;
+    } while (false);
+
+    return ok;
+}
+
+/* Test entry function. */
+int main(int argc, char *argv[])
+{
+    struct seco_nvm_manager_s *nvm_mgr;
+    uint32_t pass = 0u;
+    uint32_t fail = 0u;
+    uint32_t i;
+    struct {
+        const char *name;
+        bool (*test)(void);
+    } tests[] = {
+        {"ordering", test_ordering},
+        {"completion", test_completion},
+        {"shutdown", test_shutdown},
+        {"idle", test_idle},
+    };
+
+    (void)argc;
+    (void)argv;
+
+    /* Returns once the storage manager is ready to receive commands from SECO. */
+    if (seco_nvm_manager_start(NVM_FLAGS_HSM, NULL, &nvm_mgr) != NVM_STATUS_RUNNING) {
+        printf("nvm manager failed to start\n");
+        return 1;
+    }
+
+    for (i = 0u; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        if (tests[i].test()) {
+            printf("dispatch %s PASS\n", tests[i].name);
+            pass++;
+        } else {
+            printf("dispatch %s FAIL\n", tests[i].name);
+            fail++;
+        }
+    }
+    printf("dispatch_test PASS=%d FAIL=%d\n", pass, fail);
+
+    seco_nvm_manager_stop(nvm_mgr);
+
+    return (fail == 0u) ? 0 : 1;
+}
@@ -162,14 +162,6 @@ static void ecies_tests(hsm_hdl_t hsm_session_hdl)
 
 }
 
-static uint32_t nvm_status;
-
-static void *hsm_storage_thread(void *arg)
-{
-    seco_nvm_manager(NVM_FLAGS_HSM, &nvm_status);
-}
-
-
 /* Test entry function. */
 int main(int argc, char *argv[])
 {
@@ -179,21 +171,13 @@ int main(int argc, char *argv[])
     open_session_args_t open_session_args;
     open_svc_key_store_args_t open_svc_key_store_args;
 
-    pthread_t tid;
+    struct seco_nvm_manager_s *nvm_mgr;
 
     hsm_err_t err;
 
     do {
-        nvm_status = NVM_STATUS_UNDEF;
-
-        (void)pthread_create(&tid, NULL, hsm_storage_thread, NULL);
-
-        /* Wait for the storage manager to be ready to receive commands from SECO. */
-        while (nvm_status <= NVM_STATUS_STARTING) {
-            usleep(1000);
-        }
-        /* Check if it ended because of an error. */
-        if (nvm_status == NVM_STATUS_STOPPED) {
+        /* Returns once the storage manager is ready to receive commands from SECO. */
+        if (seco_nvm_manager_start(NVM_FLAGS_HSM, NULL, &nvm_mgr) != NVM_STATUS_RUNNING) {
             printf("nvm manager failed to start\n");
             break;
         }
@@ -226,7 +210,7 @@ int main(int argc, char *argv[])
 
         printf("hsm_close_session ret:0x%x\n", err);
 
-        (void)pthread_cancel(tid);
+        seco_nvm_manager_stop(nvm_mgr);
 
     } while (0);
     return 0;
@@ -0,0 +1,684 @@
+/*
+ * Copyright 2019 NXP
+ *
+ * NXP Confidential.
+ * This software is owned or controlled by NXP and may only be used strictly
+ * in accordance with the applicable license terms.  By expressly accepting
+ * such terms or by downloading, installing, activating and/or otherwise using
+ * the software, you are agreeing that you have read, and that you agree to
+ * comply with and are bound by, such license terms.  If you do not agree to be
+ * bound by the applicable license terms, then you may not retain, install,
+ * activate or otherwise use the software.
+ */
+
+/*
+ * Storage manager serving the exports of key groups and key stores made by SECO, on a
+ * storage of its own in a temporary directory: stop during an export, write coalescing
+ * and skipped writes of unchanged chunks.
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "hsm_api.h"
+#include "seco_nvm.h"
+#include "seco_os_abs_storage.h"
+
+/* SECO waits this long before sending the finish message of an export (emulator only). */
+#define EXPORT_FINISH_DELAY_US  20000u
+
+/* Key groups SECO keeps in memory: loading one more exports the least recently used one. */
+#define RESIDENT_GROUPS         16u
+
+/* Chunks the manager keeps pending at most: one more writes them first. */
+#define PENDING_CHUNKS          32u
+
+/* Long enough for nothing to be flushed in the background during a test. */
+#define NEVER_MS                600000u
+
+#define MAX_KEYS                128u
+#define MAX_WRITES              1024u
+
+/* Storage write made by the manager. */
+struct test_write {
+    bool master;
+    uint64_t blob_id;
+    uint32_t len;
+    uint32_t crc;
+};
+
+struct test_ks {
+    uint32_t id;
+    hsm_hdl_t session;
+    hsm_hdl_t key_store;
+    hsm_hdl_t key_mgmt;
+    uint16_t group;
+    uint32_t key_id;                    /* Last key generated. */
+    hsm_err_t err;
+};
+
+static char test_dir[64];
+static uint32_t test_ks_id = 0x4E56u;
+
+/* Successful writes, in order, recorded by wrapping the storage functions at link time. */
+static struct test_write writes[MAX_WRITES];
+static uint32_t nb_writes;
+static pthread_mutex_t writes_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int32_t __real_seco_os_abs_storage_write(struct seco_os_abs_hdl *phdl, uint8_t *src, uint32_t size);
+int32_t __real_seco_os_abs_storage_write_chunk(struct seco_os_abs_hdl *phdl, uint8_t *src, uint32_t size, uint64_t blob_id);
+
+static void test_write_add(bool master, uint64_t blob_id, uint8_t *src, uint32_t size)
+{
+    (void)pthread_mutex_lock(&writes_lock);
+    if (nb_writes < MAX_WRITES) {
+        writes[nb_writes].master = master;
+        writes[nb_writes].blob_id = blob_id;
+        writes[nb_writes].len = size;
+        writes[nb_writes].crc = seco_os_abs_crc(src, size);
+    }
+    nb_writes++;
+    (void)pthread_mutex_unlock(&writes_lock);
+}
+
+int32_t __wrap_seco_os_abs_storage_write(struct seco_os_abs_hdl *phdl, uint8_t *src, uint32_t size)
+{
+    int32_t len = __real_seco_os_abs_storage_write(phdl, src, size);
+
+    if (len == (int32_t)size) {
+        test_write_add(true, 0u, src, size);
+    }
+    return len;
+}
+
+int32_t __wrap_seco_os_abs_storage_write_chunk(struct seco_os_abs_hdl *phdl, uint8_t *src, uint32_t size, uint64_t blob_id)
+{
+    int32_t len = __real_seco_os_abs_storage_write_chunk(phdl, src, size, blob_id);
+
+    if (len == (int32_t)size) {
+        test_write_add(false, blob_id, src, size);
+    }
+    return len;
+}
+
+static uint32_t test_nb_writes(void)
+{
+    uint32_t nb;
+
+    (void)pthread_mutex_lock(&writes_lock);
+    nb = nb_writes;
+    (void)pthread_mutex_unlock(&writes_lock);
+
+    return nb;
+}
+
+/* Number of chunk writes of a key store since first, the master written last if any, each chunk at most
+ * once. SECO exports the chunks of all its key stores with the next master, only those of one are counted.
+ */
+static uint32_t test_chunks_written_once(uint32_t first, uint32_t ks_id, bool *master_last)
+{
+    uint32_t nb = test_nb_writes();
+    uint32_t chunks = 0u;
+    uint32_t i, j;
+
+    *master_last = (nb > first) && (nb <= MAX_WRITES) && writes[nb - 1u].master;
+    for (i = first; (i < nb) && (i < MAX_WRITES); i++) {
+        if (writes[i].master) {
+            *master_last = *master_last && (i == (nb - 1u));
+            continue;
+        }
+        if ((uint32_t)(writes[i].blob_id >> 32) != ks_id) {
+            continue;
+        }
+        for (j = first; j < i; j++) {
+            if (!writes[j].master && (writes[j].blob_id == writes[i].blob_id)) {
+                chunks = MAX_WRITES;
+            }
+        }
+        chunks++;
+    }
+
+    return chunks;
+}
+
+/* Once the manager is stopped: the storage holds the last write of each blob written since first. */
+static bool test_stored(const char *dir, uint32_t first)
+{
+    struct seco_storage *st = seco_storage_file_open(MU_CHANNEL_HSM_NVM, dir);
+    uint8_t *buf = malloc(SECO_STORAGE_CHUNK_MAX);
+    uint8_t *master;
+    uint32_t nb = test_nb_writes();
+    uint32_t i, j;
+    int32_t len;
+    bool ok = (st != NULL) && (buf != NULL) && (nb <= MAX_WRITES);
+
+    for (i = first; ok && (i < nb); i++) {
+        for (j = i + 1u; j < nb; j++) {
+            if ((writes[j].master == writes[i].master) && (writes[j].blob_id == writes[i].blob_id)) {
+                break;
+            }
+        }
+        if (j < nb) {
+            /* Superseded. */
+            continue;
+        }
+        if (writes[i].master) {
+            len = st->ops->map_master(st, &master);
+            ok = (len == (int32_t)writes[i].len) && (seco_os_abs_crc(master, (uint32_t)len) == writes[i].crc);
+            if (len > 0) {
+                st->ops->unmap_master(st, master, (uint32_t)len);
+            }
+        } else {
+            len = st->ops->read_chunk(st, writes[i].blob_id, buf, SECO_STORAGE_CHUNK_MAX);
+            ok = (len == (int32_t)writes[i].len) && (seco_os_abs_crc(buf, (uint32_t)len) == writes[i].crc);
+        }
+    }
+    if (st != NULL) {
+        st->ops->close(st);
+    }
+    free(buf);
+
+    return ok;
+}
+
+/* Storage directory of its own for a test: its files are relocated when built for the emulator. */
+static void test_storage(struct seco_nvm_storage_cfg *cfg, char *dir, const char *name)
+{
+    char tmp[256];
+    char reloc[256];
+    char cmd[600];
+
+    (void)snprintf(dir, 128, "%s/%s", test_dir, name);
+    (void)snprintf(tmp, sizeof(tmp), "%s/seco_hsm/", dir);
+    (void)snprintf(cmd, sizeof(cmd), "mkdir -p %s", seco_os_abs_storage_path(tmp, reloc, (uint32_t)sizeof(reloc)));
+    (void)system(cmd);
+
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->type = NVM_STORAGE_FILE;
+    cfg->path = dir;
+}
+
+/* New key store, for the key management. */
+static hsm_err_t test_ks_open(struct test_ks *t)
+{
+    open_session_args_t session_args;
+    open_svc_key_store_args_t ks_args;
+    open_svc_key_management_args_t km_args;
+    hsm_err_t err;
+
+    memset(t, 0, sizeof(*t));
+    memset(&session_args, 0, sizeof(session_args));
+    memset(&ks_args, 0, sizeof(ks_args));
+    memset(&km_args, 0, sizeof(km_args));
+    t->id = test_ks_id++;
+    ks_args.key_store_identifier = t->id;
+    ks_args.authentication_nonce = 0x1234u;
+    ks_args.max_updates_number = 1000u;
+    ks_args.flags = HSM_SVC_KEY_STORE_FLAGS_CREATE;
+
+    do {
+        err = hsm_open_session(&session_args, &t->session);
+        if (err != HSM_NO_ERROR) {
+            break;
+        }
+        err = hsm_open_key_store_service(t->session, &ks_args, &t->key_store);
+        if (err != HSM_NO_ERROR) {
+            (void)hsm_close_session(t->session);
+            break;
+        }
+        err = hsm_open_key_management_service(t->key_store, &km_args, &t->key_mgmt);
+        if (err != HSM_NO_ERROR) {
+            (void)hsm_close_key_store_service(t->key_store);
+            (void)hsm_close_session(t->session);
+        }
+    } while (false);
+
+    return err;
+}
+
+static void test_ks_close(struct test_ks *t)
+{
+    (void)hsm_close_key_management_service(t->key_mgmt);
+    (void)hsm_close_key_store_service(t->key_store);
+    (void)hsm_close_session(t->session);
+}
+
+/* New persistent key in a group. A strict operation exports the updated groups then the key store. */
+static hsm_err_t test_gen_key(struct test_ks *t, uint16_t group, bool strict)
+{
+    op_generate_key_args_t args;
+    uint8_t pub[64];
+
+    memset(&args, 0, sizeof(args));
+    args.key_identifier = &t->key_id;
+    args.out_size = (uint16_t)sizeof(pub);
+    args.flags = HSM_OP_KEY_GENERATION_FLAGS_CREATE;
+    if (strict) {
+        args.flags |= HSM_OP_KEY_GENERATION_FLAGS_STRICT_OPERATION;
+    }
+    args.key_type = HSM_KEY_TYPE_ECDSA_NIST_P256;
+    args.key_info = HSM_KEY_INFO_PERSISTENT;
+    args.key_group = group;
+    args.out_key = pub;
+
+    return hsm_generate_key(t->key_mgmt, &args);
+}
+
+/* Delete a key. A strict operation exports the updated groups then the key store. */
+static hsm_err_t test_delete_key(struct test_ks *t, uint32_t key_id, bool strict)
+{
+    op_manage_key_args_t args;
+
+    memset(&args, 0, sizeof(args));
+    args.key_identifier = &key_id;
+    args.flags = HSM_OP_MANAGE_KEY_FLAGS_DELETE;
+    if (strict) {
+        args.flags |= HSM_OP_MANAGE_KEY_FLAGS_STRICT_OPERATION;
+    }
+
+    return hsm_manage_key(t->key_mgmt, &args);
+}
+
+/* Sign with each key: their groups are loaded again if not in SECO memory. */
+static bool test_sign_all(struct test_ks *t, uint32_t *key_ids, uint32_t nb)
+{
+    open_svc_sign_gen_args_t sg_args;
+    op_generate_sign_args_t args;
+    hsm_hdl_t sig_gen;
+    uint8_t msg[32] = {0};
+    uint8_t sig[65];
+    uint32_t i;
+    bool ok = false;
+
+    memset(&sg_args, 0, sizeof(sg_args));
+    if (hsm_open_signature_generation_service(t->key_store, &sg_args, &sig_gen) == HSM_NO_ERROR) {
+        ok = true;
+        for (i = 0u; ok && (i < nb); i++) {
+            memset(&args, 0, sizeof(args));
+            args.key_identifier = key_ids[i];
+            args.message = msg;
+            args.signature = sig;
+            args.message_size = (uint32_t)sizeof(msg);
+            args.signature_size = (uint16_t)sizeof(sig);
+            args.scheme_id = HSM_SIGNATURE_SCHEME_ECDSA_NIST_P256_SHA_256;
+            args.flags = HSM_OP_GENERATE_SIGN_FLAGS_INPUT_MESSAGE;
+            ok = (hsm_generate_signature(sig_gen, &args) == HSM_NO_ERROR);
+        }
+        (void)hsm_close_signature_generation_service(sig_gen);
+    }
+
+    return ok;
+}
+
+static void *test_gen_thread(void *arg)
+{
+    struct test_ks *t = (struct test_ks *)arg;
+
+    t->err = test_gen_key(t, t->group, false);
+
+    return NULL;
+}
+
+/* A stop while SECO exports a chunk completes the export, then stops at once. */
+static bool test_stop_export(const char *name, uint32_t coalesce_ms)
+{
+    struct seco_nvm_storage_cfg cfg;
+    struct seco_nvm_manager_s *mgr;
+    struct seco_nvm_metrics before, after;
+    struct test_ks t;
+    struct timespec ts1, ts2;
+    pthread_t thread;
+    char dir[128];
+    int64_t stop_us;
+    uint16_t group;
+    bool ok = false;
+
+    test_storage(&cfg, dir, name);
+    cfg.coalesce_ms = coalesce_ms;
+
+    do {
+        if (seco_nvm_manager_start(NVM_FLAGS_HSM, &cfg, &mgr) != NVM_STATUS_RUNNING) {
+            break;
+        }
+        if (test_ks_open(&t) != HSM_NO_ERROR) {
+            seco_nvm_manager_stop(mgr);
+            break;
+        }
+        /* Resident groups, all stored by a strict operation then updated again, the first one least recently. */
+        for (group = 0u; group < (2u * RESIDENT_GROUPS); group++) {
+            (void)test_gen_key(&t, group % RESIDENT_GROUPS, (group == (RESIDENT_GROUPS - 1u)));
+        }
+        seco_nvm_get_metrics(NVM_FLAGS_HSM, &before);
+
+        /* Evicts the first group: exported alone, without any key store export. */
+        t.group = RESIDENT_GROUPS;
+        if (pthread_create(&thread, NULL, test_gen_thread, &t) != 0) {
+            test_ks_close(&t);
+            seco_nvm_manager_stop(mgr);
+            break;
+        }
+        /* Stop while the manager waits for the finish message of the chunk export. */
+        (void)usleep(EXPORT_FINISH_DELAY_US / 3u);
+        (void)clock_gettime(CLOCK_MONOTONIC, &ts1);
+        seco_nvm_manager_stop(mgr);
+        (void)clock_gettime(CLOCK_MONOTONIC, &ts2);
+        (void)pthread_join(thread, NULL);
+        test_ks_close(&t);
+        stop_us = ((int64_t)ts2.tv_sec - (int64_t)ts1.tv_sec) * 1000000
+                  + ((int64_t)ts2.tv_nsec - (int64_t)ts1.tv_nsec) / 1000;
+
+        /* The export was completed and its chunk written, even if coalesced. */
+        seco_nvm_get_metrics(NVM_FLAGS_HSM, &after);
+        ok = (t.err == HSM_NO_ERROR) && (stop_us < 1000000)
+             && (after.req[NVM_REQ_CHUNK_EXPORT].count == (before.req[NVM_REQ_CHUNK_EXPORT].count + 1u))
+             && (after.req[NVM_REQ_CHUNK_EXPORT].errors == before.req[NVM_REQ_CHUNK_EXPORT].errors)
+             && (after.write.count == (before.write.count + 1u));
+        if (!ok) {
+            printf("err 0x%x, stop %d us, chunk exports %d errors %d, writes %d\n", t.err, (int)stop_us,
+                   (int)(after.req[NVM_REQ_CHUNK_EXPORT].count - before.req[NVM_REQ_CHUNK_EXPORT].count),
+                   (int)(after.req[NVM_REQ_CHUNK_EXPORT].errors - before.req[NVM_REQ_CHUNK_EXPORT].errors),
+                   (int)(after.write.count - before.write.count));
+        }
+    } while (false);
+
+    return ok;
+}
+
+static bool test_stop_export_sync(void)
+{
+    return test_stop_export("stop_sync", 0u);
+}
+
+static bool test_stop_export_coalesce(void)
+{
+    return test_stop_export("stop_coalesce", 10000u);
+}
+
+/*
+ * One blob exported again and again with the writes coalesced: acknowledged without being written, served
+ * back to SECO from memory, then written once, before the master exported to commit the key store.
+ */
+static bool test_coalesce(void)
+{
+    struct seco_nvm_storage_cfg cfg;
+    struct seco_nvm_manager_s *mgr;
+    struct seco_nvm_metrics before, after;
+    struct test_ks t;
+    uint32_t key_ids[MAX_KEYS];
+    uint32_t nb_keys = 0u;
+    uint32_t first = 0u;
+    uint32_t chunks = 0u;
+    uint32_t i;
+    char dir[128];
+    bool master_last = false;
+    bool ok = false;
+
+    test_storage(&cfg, dir, "coalesce");
+    cfg.coalesce_ms = NEVER_MS;
+
+    do {
+        if (seco_nvm_manager_start(NVM_FLAGS_HSM, &cfg, &mgr) != NVM_STATUS_RUNNING) {
+            break;
+        }
+        if (test_ks_open(&t) != HSM_NO_ERROR) {
+            seco_nvm_manager_stop(mgr);
+            break;
+        }
+        ok = (test_gen_key(&t, 0u, true) == HSM_NO_ERROR);
+        seco_nvm_get_metrics(NVM_FLAGS_HSM, &before);
+        first = test_nb_writes();
+
+        /* One group more than SECO keeps: each key generation loads a group and exports another one. */
+        for (i = 0u; ok && (i < (3u * (RESIDENT_GROUPS + 1u))); i++) {
+            ok = (test_gen_key(&t, (uint16_t)(i % (RESIDENT_GROUPS + 1u)), false) == HSM_NO_ERROR);
+            key_ids[nb_keys++] = t.key_id;
+        }
+        ok = ok && test_sign_all(&t, key_ids, nb_keys);
+
+        /* Acknowledged without being written, the chunks loaded again served from memory. */
+        seco_nvm_get_metrics(NVM_FLAGS_HSM, &after);
+        ok = ok && (test_nb_writes() == first)
+             && ((after.req[NVM_REQ_CHUNK_EXPORT].count - before.req[NVM_REQ_CHUNK_EXPORT].count) > (2u * (RESIDENT_GROUPS + 1u)))
+             && (after.req[NVM_REQ_CHUNK_EXPORT].errors == before.req[NVM_REQ_CHUNK_EXPORT].errors)
+             && (after.req[NVM_REQ_CHUNK_GET].count > before.req[NVM_REQ_CHUNK_GET].count)
+             && (after.req[NVM_REQ_CHUNK_GET].errors == before.req[NVM_REQ_CHUNK_GET].errors)
+             && (after.read.count == before.read.count);
+
+        /* Commit: every group written once, then the master. */
+        ok = ok && (test_gen_key(&t, 0u, true) == HSM_NO_ERROR);
+        chunks = test_chunks_written_once(first, t.id, &master_last);
+        ok = ok && (chunks == (RESIDENT_GROUPS + 1u)) && master_last;
+
+        test_ks_close(&t);
+        seco_nvm_manager_stop(mgr);
+        ok = ok && test_stored(dir, first);
+        if (!ok) {
+            printf("chunk exports %d gets %d reads %d, chunks written %d, master last %d\n",
+                   (int)(after.req[NVM_REQ_CHUNK_EXPORT].count - before.req[NVM_REQ_CHUNK_EXPORT].count),
+                   (int)(after.req[NVM_REQ_CHUNK_GET].count - before.req[NVM_REQ_CHUNK_GET].count),
+                   (int)(after.read.count - before.read.count), (int)chunks, (int)master_last);
+        }
+    } while (false);
+
+    return ok;
+}
+
+/* More chunks exported than can be kept pending: the pending ones are written before the next one is. */
+static bool test_coalesce_full(void)
+{
+    struct seco_nvm_storage_cfg cfg;
+    struct seco_nvm_manager_s *mgr;
+    struct seco_nvm_metrics before, after;
+    struct test_ks t;
+    uint32_t first = 0u;
+    uint32_t written = 0u;
+    uint32_t chunks = 0u;
+    uint32_t key_id = 0u;
+    uint16_t group;
+    char dir[128];
+    bool master_last = false;
+    bool ok = false;
+
+    test_storage(&cfg, dir, "coalesce_full");
+    cfg.coalesce_ms = NEVER_MS;
+
+    do {
+        if (seco_nvm_manager_start(NVM_FLAGS_HSM, &cfg, &mgr) != NVM_STATUS_RUNNING) {
+            break;
+        }
+        if (test_ks_open(&t) != HSM_NO_ERROR) {
+            seco_nvm_manager_stop(mgr);
+            break;
+        }
+        seco_nvm_get_metrics(NVM_FLAGS_HSM, &before);
+        first = test_nb_writes();
+
+        /* Each new group exports another one, never written before. */
+        ok = true;
+        for (group = 0u; ok && (group < (RESIDENT_GROUPS + PENDING_CHUNKS + 2u)); group++) {
+            ok = (test_gen_key(&t, group, false) == HSM_NO_ERROR);
+            if (group == 0u) {
+                key_id = t.key_id;
+            }
+        }
+        written = test_nb_writes() - first;
+        /* The first group, written since, is loaded again: one more group exported. */
+        ok = ok && test_sign_all(&t, &key_id, 1u);
+
+        seco_nvm_get_metrics(NVM_FLAGS_HSM, &after);
+        ok = ok && (written == PENDING_CHUNKS)
+             && ((after.req[NVM_REQ_CHUNK_EXPORT].count - before.req[NVM_REQ_CHUNK_EXPORT].count) == (PENDING_CHUNKS + 3u))
+             && (after.req[NVM_REQ_CHUNK_EXPORT].errors == before.req[NVM_REQ_CHUNK_EXPORT].errors)
+             && (after.req[NVM_REQ_CHUNK_GET].count == (before.req[NVM_REQ_CHUNK_GET].count + 1u))
+             && (after.req[NVM_REQ_CHUNK_GET].errors == before.req[NVM_REQ_CHUNK_GET].errors);
+
+        test_ks_close(&t);
+        seco_nvm_manager_stop(mgr);
+        /* The chunks still pending are written on stop. */
+        chunks = test_chunks_written_once(first, t.id, &master_last);
+        ok = ok && (chunks == (after.req[NVM_REQ_CHUNK_EXPORT].count - before.req[NVM_REQ_CHUNK_EXPORT].count))
+             && test_stored(dir, first);
+        if (!ok) {
+            printf("chunk exports %d, written before stop %d, after %d\n",
+                   (int)(after.req[NVM_REQ_CHUNK_EXPORT].count - before.req[NVM_REQ_CHUNK_EXPORT].count),
+                   (int)written, (int)chunks);
+        }
+    } while (false);
+
+    return ok;
+}
+
+/* A chunk exported unchanged is not written again, the key store exported with it is. */
+static bool test_unchanged(void)
+{
+    struct seco_nvm_storage_cfg cfg;
+    struct seco_nvm_manager_s *mgr;
+    struct seco_nvm_metrics before, after;
+    struct test_ks t;
+    uint32_t start = test_nb_writes();
+    uint32_t first = 0u;
+    uint32_t chunks = 0u;
+    char dir[128];
+    bool master_last = false;
+    bool ok = false;
+
+    test_storage(&cfg, dir, "unchanged");
+
+    do {
+        if (seco_nvm_manager_start(NVM_FLAGS_HSM, &cfg, &mgr) != NVM_STATUS_RUNNING) {
+            break;
+        }
+        if (test_ks_open(&t) != HSM_NO_ERROR) {
+            seco_nvm_manager_stop(mgr);
+            break;
+        }
+        ok = (test_gen_key(&t, 2u, true) == HSM_NO_ERROR);
+        seco_nvm_get_metrics(NVM_FLAGS_HSM, &before);
+        first = test_nb_writes();
+
+        /* The group goes back to what is stored. */
+        ok = ok && (test_gen_key(&t, 2u, false) == HSM_NO_ERROR) && (test_delete_key(&t, t.key_id, true) == HSM_NO_ERROR);
+
+        seco_nvm_get_metrics(NVM_FLAGS_HSM, &after);
+        chunks = test_chunks_written_once(first, t.id, &master_last);
+        ok = ok && (chunks == 0u) && master_last
+             && (after.req[NVM_REQ_CHUNK_EXPORT].count == (before.req[NVM_REQ_CHUNK_EXPORT].count + 1u))
+             && (after.req[NVM_REQ_CHUNK_EXPORT].errors == before.req[NVM_REQ_CHUNK_EXPORT].errors)
+             && (after.write_skipped == (before.write_skipped + 1u));
+
+        test_ks_close(&t);
+        seco_nvm_manager_stop(mgr);
+        ok = ok && test_stored(dir, start);
+        if (!ok) {
+            printf("chunk exports %d, skipped %d, chunks written %d, master last %d\n",
+                   (int)(after.req[NVM_REQ_CHUNK_EXPORT].count - before.req[NVM_REQ_CHUNK_EXPORT].count),
+                   (int)(after.write_skipped - before.write_skipped), (int)chunks, (int)master_last);
+        }
+    } while (false);
+
+    return ok;
+}
+
+/* Size of a file of a storage directory, as found on the disk. */
+static off_t test_file_size(const char *dir, const char *name)
+{
+    struct stat sb;
+    char path[256];
+    char reloc[256];
+    off_t size = -1;
+
+    (void)snprintf(path, sizeof(path), "%s/%s", dir, name);
+    if (stat(seco_os_abs_storage_path(path, reloc, (uint32_t)sizeof(reloc)), &sb) == 0) {
+        size = sb.st_size;
+    }
+
+    return size;
+}
+
+/* A strict operation on a storage flushed in the background returns once its chunks and master are on the disk. */
+static bool test_ram_commit(void)
+{
+    struct seco_nvm_storage_cfg cfg;
+    struct seco_nvm_manager_s *mgr;
+    struct test_ks t;
+    char dir[128];
+    bool ok = false;
+
+    test_storage(&cfg, dir, "ram_commit");
+    cfg.type = NVM_STORAGE_RAM;
+    cfg.flush_delay_ms = NEVER_MS;
+
+    do {
+        if (seco_nvm_manager_start(NVM_FLAGS_HSM, &cfg, &mgr) != NVM_STATUS_RUNNING) {
+            break;
+        }
+        if (test_ks_open(&t) == HSM_NO_ERROR) {
+            ok = (test_gen_key(&t, 1u, true) == HSM_NO_ERROR)
+                 && (test_file_size(dir, "seco_hsm/seco_nvm_master") > 0)
+                 && (test_file_size(dir, "seco_hsm/seco_nvm_chunks") > 0);
+            test_ks_close(&t);
+        }
+        seco_nvm_manager_stop(mgr);
+    } while (false);
+
+    return ok;
+}
+
+/* Test entry function. */
+int main(int argc, char *argv[])
+{
+    char reloc[256];
+    char cmd[400];
+    uint32_t pass = 0u;
+    uint32_t fail = 0u;
+    uint32_t i;
+    struct {
+        const char *name;
+        bool (*test)(void);
+    } tests[] = {
+        {"stop during export", test_stop_export_sync},
+        {"stop during coalesced export", test_stop_export_coalesce},
+        {"commit on ram storage", test_ram_commit},
+        {"coalesced exports", test_coalesce},
+        {"coalesced exports beyond the pending chunks", test_coalesce_full},
+        {"unchanged chunk", test_unchanged},
+    };
+
+    (void)argc;
+    (void)argv;
+
+    /* Read by the emulator when the first device is opened, ignored otherwise. */
+    (void)snprintf(cmd, sizeof(cmd), "0xE4=%u", EXPORT_FINISH_DELAY_US);
+    (void)setenv("SECO_EMU_LATENCY", cmd, 0);
+
+    (void)snprintf(test_dir, sizeof(test_dir), "/tmp/seco_nvm_test.XXXXXX");
+    if (mkdtemp(test_dir) == NULL) {
+        printf("cannot create the test directory\n");
+        return 1;
+    }
+    /* A test blocked on a stop never completes. */
+    (void)alarm(60u);
+
+    for (i = 0u; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        if (tests[i].test()) {
+            printf("nvm %s PASS\n", tests[i].name);
+            pass++;
+        } else {
+            printf("nvm %s FAIL\n", tests[i].name);
+            fail++;
+        }
+    }
+    printf("nvm_test PASS=%d FAIL=%d\n", pass, fail);
+
+    (void)snprintf(cmd, sizeof(cmd), "rm -rf %s %s", test_dir,
+                   seco_os_abs_storage_path(test_dir, reloc, (uint32_t)sizeof(reloc)));
+    (void)system(cmd);
+
+    return (fail == 0u) ? 0 : 1;
+}
@@ -20,7 +20,7 @@ typedef struct
 {
 	struct she_storage_context *storage_ctx;
     struct she_hdl_s *hdl[16];
-    pthread_t tid;
+    struct seco_nvm_manager_s *nvm_mgr;
 } test_struct_t;
 
 uint32_t read_single_data(FILE *fp);
@@ -23,36 +23,16 @@
 #include "she_test_storage_manager.h"
 #include "she_test_macros.h"
 
-static uint32_t nvm_status;
-
-static void *she_storage_thread(void *arg)
-{
-    seco_nvm_manager(NVM_FLAGS_SHE, &nvm_status);
-}
-
-
 /* Start the storage manager.*/
 uint32_t she_test_start_storage_manager(test_struct_t *testCtx, FILE *fp)
 {
     uint32_t fails = 0;
-    
-    nvm_status = NVM_STATUS_UNDEF;
 
-    if (pthread_create(&(testCtx->tid), NULL, she_storage_thread, NULL) != 0) {
+    /* Returns once the storage manager is ready to receive commands from SECO. */
+    if (seco_nvm_manager_start(NVM_FLAGS_SHE, NULL, &testCtx->nvm_mgr) != NVM_STATUS_RUNNING) {
         fails = 1;
     }
 
-    if (fails == 0) {
-        /* Wait for the storage manager to be ready to receive commands from SECO. */
-        while (nvm_status <= NVM_STATUS_STARTING) {
-            usleep(1000);
-        }
-        /* Check if it ended because of an error. */
-        if (nvm_status == NVM_STATUS_STOPPED) {
-            fails = 1;
-        }
-    }
-
     return fails;
 }
 
@@ -62,10 +42,9 @@ uint32_t she_test_stop_storage_manager(test_struct_t *testCtx, FILE *fp)
 {
     uint32_t fails = 0;
 
-    if (nvm_status != NVM_STATUS_STOPPED) {
-        if (pthread_cancel(testCtx->tid) != 0) {
-            fails = 1;
-        }
+    if (testCtx->nvm_mgr != NULL) {
+        seco_nvm_manager_stop(testCtx->nvm_mgr);
+        testCtx->nvm_mgr = NULL;
     }
 
     return fails;
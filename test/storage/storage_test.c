@@ -0,0 +1,518 @@
+/*
+ * Copyright 2019 NXP
+ *
+ * NXP Confidential.
+ * This software is owned or controlled by NXP and may only be used strictly
+ * in accordance with the applicable license terms.  By expressly accepting
+ * such terms or by downloading, installing, activating and/or otherwise using
+ * the software, you are agreeing that you have read, and that you agree to
+ * comply with and are bound by, such license terms.  If you do not agree to be
+ * bound by the applicable license terms, then you may not retain, install,
+ * activate or otherwise use the software.
+ */
+
+/*
+ * Storage backends on a temporary directory and on an image file used as a raw device:
+ * recovery from torn writes and corruption, compaction and master slot fallback.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "seco_os_abs_storage.h"
+
+#define CHUNK_SIZE      300u
+#define NB_CHUNKS       5u
+#define RAW_IMAGE_SIZE  (1024u * 1024u)
+
+static char test_dir[64];
+static char raw_dev[128];
+static char hsm_dir[256];
+static char chunk_file[256];
+static char master_file[256];
+static char raw_image[256];
+
+static uint8_t buf[CHUNK_SIZE];
+static uint8_t out[CHUNK_SIZE];
+
+/* Actual location of a test file, relocated when built for the SECO emulator. */
+static void test_path(char *path, const char *name)
+{
+    char tmp[256];
+    char reloc[256];
+
+    (void)snprintf(tmp, sizeof(tmp), "%s/%s", test_dir, name);
+    (void)snprintf(path, 256, "%s", seco_os_abs_storage_path(tmp, reloc, (uint32_t)sizeof(reloc)));
+}
+
+static int64_t file_size(const char *path)
+{
+    struct stat s;
+
+    return (stat(path, &s) == 0) ? (int64_t)s.st_size : -1;
+}
+
+static void file_poke(const char *path, int64_t off, const char *data, uint32_t len)
+{
+    int fd = open(path, O_WRONLY);
+
+    if (fd >= 0) {
+        (void)pwrite(fd, data, len, (off_t)off);
+        (void)close(fd);
+    }
+}
+
+/* Offset in a file of the first occurrence of len bytes of value, -1 if none. */
+static int64_t file_find(const char *path, uint8_t value, uint32_t len)
+{
+    uint8_t *data = malloc(RAW_IMAGE_SIZE);
+    int64_t size = file_size(path);
+    int64_t off = -1;
+    int64_t i;
+    uint32_t run = 0u;
+    int fd = open(path, O_RDONLY);
+
+    if ((data != NULL) && (fd >= 0) && (size > 0) && (size <= RAW_IMAGE_SIZE)
+        && (read(fd, data, (size_t)size) == size)) {
+        for (i = 0; (i < size) && (off < 0); i++) {
+            run = (data[i] == value) ? (run + 1u) : 0u;
+            if (run == len) {
+                off = i + 1 - (int64_t)len;
+            }
+        }
+    }
+    if (fd >= 0) {
+        (void)close(fd);
+    }
+    free(data);
+
+    return off;
+}
+
+static struct seco_storage *file_open(void)
+{
+    return seco_storage_file_open(MU_CHANNEL_HSM_NVM, test_dir);
+}
+
+/* Chunk i (1 to NB_CHUNKS) is CHUNK_SIZE bytes of value i + version * 16. */
+static int32_t write_chunk(struct seco_storage *st, uint32_t i, uint32_t version)
+{
+    memset(buf, (int)(i + (version * 16u)), CHUNK_SIZE);
+    return st->ops->write_chunk(st, buf, CHUNK_SIZE, i);
+}
+
+/* Bit i set for each chunk i read back with the given version. */
+static uint32_t read_chunks(struct seco_storage *st, uint32_t version)
+{
+    uint32_t mask = 0u;
+    uint32_t i;
+
+    for (i = 1u; i <= NB_CHUNKS; i++) {
+        memset(out, 0, CHUNK_SIZE);
+        if ((st->ops->read_chunk(st, i, out, CHUNK_SIZE) == (int32_t)CHUNK_SIZE)
+            && (out[0] == (uint8_t)(i + (version * 16u))) && (out[CHUNK_SIZE - 1u] == out[0])) {
+            mask |= 1u << i;
+        }
+    }
+
+    return mask;
+}
+
+#define ALL_CHUNKS  (((1u << (NB_CHUNKS + 1u)) - 1u) & ~1u)
+
+/* New container holding NB_CHUNKS chunks. Return its size. */
+static int64_t file_setup(void)
+{
+    struct seco_storage *st;
+    char cmd[600];
+    uint32_t i;
+
+    /* The file backend does not create its directories. */
+    (void)snprintf(cmd, sizeof(cmd), "rm -rf %s && mkdir -p %s", hsm_dir, hsm_dir);
+    (void)system(cmd);
+    st = file_open();
+    for (i = 1u; (st != NULL) && (i <= NB_CHUNKS); i++) {
+        (void)write_chunk(st, i, 0u);
+    }
+    if (st != NULL) {
+        st->ops->close(st);
+    }
+
+    return file_size(chunk_file);
+}
+
+/* Garbage appended after the last record is dropped, the chunks are kept. */
+static bool test_file_torn_tail(void)
+{
+    struct seco_storage *st;
+    int64_t size = file_setup();
+    int fd = open(chunk_file, O_WRONLY | O_APPEND);
+    bool ok = false;
+
+    if (fd >= 0) {
+        (void)write(fd, "garbage after the last record", 29);
+        (void)close(fd);
+    }
+    st = file_open();
+    if (st != NULL) {
+        ok = (read_chunks(st, 0u) == ALL_CHUNKS) && (file_size(chunk_file) == size);
+        st->ops->close(st);
+    }
+
+    return ok;
+}
+
+/* Power cut at any point of the write of a chunk superseding a previous one: the previous
+ * version is read back, the other chunks are kept and the container accepts new records.
+ */
+static bool test_file_power_cut(void)
+{
+    struct seco_storage *st;
+    int64_t size;
+    int64_t rec_size;
+    int64_t cut;
+    bool ok = true;
+
+    size = file_setup();
+    rec_size = size / NB_CHUNKS;
+    for (cut = 1; ok && (cut < rec_size); cut += 7) {
+        (void)file_setup();
+        st = file_open();
+        ok = (st != NULL) && (write_chunk(st, 3u, 1u) == (int32_t)CHUNK_SIZE);
+        if (st != NULL) {
+            st->ops->close(st);
+        }
+        /* Keep only the first cut bytes of the new record. */
+        ok = ok && (truncate(chunk_file, (off_t)(size + cut)) == 0);
+        st = file_open();
+        ok = ok && (st != NULL) && (read_chunks(st, 0u) == ALL_CHUNKS) && (file_size(chunk_file) == size);
+        ok = ok && (write_chunk(st, 4u, 1u) == (int32_t)CHUNK_SIZE) && (read_chunks(st, 1u) == (1u << 4));
+        if (st != NULL) {
+            st->ops->close(st);
+        }
+        if (!ok) {
+            printf("power cut after %d bytes of the record\n", (int)cut);
+        }
+    }
+
+    return ok;
+}
+
+/* A corrupted record followed by valid ones is never dropped. */
+static bool test_file_corruption(void)
+{
+    struct seco_storage *st;
+    int64_t size = file_setup();
+    int64_t rec_size = size / NB_CHUNKS;
+    bool ok = false;
+
+    do {
+        /* Data of chunk 2: only this chunk is lost. */
+        file_poke(chunk_file, rec_size + (rec_size / 2), "XX", 2u);
+        st = file_open();
+        if ((st == NULL) || (read_chunks(st, 0u) != (ALL_CHUNKS & ~(1u << 2)))) {
+            break;
+        }
+        st->ops->close(st);
+
+        /* Header of chunk 2: the following records cannot be located, nothing is indexed
+         * and the file is kept as it is.
+         */
+        (void)file_setup();
+        file_poke(chunk_file, rec_size, "XXXX", 4u);
+        st = file_open();
+        if ((st == NULL) || (read_chunks(st, 0u) != 0u) || (file_size(chunk_file) != size)
+            || (write_chunk(st, 1u, 1u) != 0)) {
+            break;
+        }
+        st->ops->close(st);
+        ok = (file_size(chunk_file) == size);
+    } while (false);
+
+    return ok;
+}
+
+/* Superseded records are dropped once most of the container holds them. */
+static bool test_file_compaction(void)
+{
+    struct seco_storage *st;
+    int64_t size = file_setup();
+    uint32_t version;
+    uint32_t i;
+    bool ok = false;
+
+    st = file_open();
+    if (st != NULL) {
+        for (version = 1u; version < 100u; version++) {
+            for (i = 1u; i <= NB_CHUNKS; i++) {
+                (void)write_chunk(st, i, version % 8u);
+            }
+        }
+        st->ops->close(st);
+        st = file_open();
+    }
+    if (st != NULL) {
+        /* Never more than the compaction threshold plus a round of records. */
+        ok = (read_chunks(st, 99u % 8u) == ALL_CHUNKS) && (file_size(chunk_file) < (64 * 1024) + size)
+             && (st->ops->enumerate(st, NULL, NULL) == (int32_t)NB_CHUNKS);
+        st->ops->close(st);
+    }
+
+    return ok;
+}
+
+/* The master is written after the chunks it refers to, and not at all if one of them failed. */
+static bool test_ram_flush_order(void)
+{
+    struct seco_storage *st;
+    uint8_t master[64];
+    char cmd[600];
+    bool ok = false;
+
+    (void)snprintf(cmd, sizeof(cmd), "rm -rf %s && mkdir -p %s", hsm_dir, chunk_file);
+    (void)system(cmd);
+    memset(master, 0x5A, sizeof(master));
+
+    do {
+        /* The container cannot be opened: it is a directory. */
+        st = seco_storage_ram_open(MU_CHANNEL_HSM_NVM, test_dir, 0u);
+        if (st == NULL) {
+            break;
+        }
+        (void)write_chunk(st, 1u, 0u);
+        (void)st->ops->write_master(st, master, (uint32_t)sizeof(master));
+        if ((st->ops->sync(st) == 0) || (file_size(master_file) >= 0)) {
+            break;
+        }
+        st->ops->close(st);
+
+        /* Once the chunk can be written the master follows. */
+        (void)rmdir(chunk_file);
+        st = seco_storage_ram_open(MU_CHANNEL_HSM_NVM, test_dir, 0u);
+        if (st == NULL) {
+            break;
+        }
+        (void)write_chunk(st, 1u, 0u);
+        (void)st->ops->write_master(st, master, (uint32_t)sizeof(master));
+        ok = (st->ops->sync(st) == 0) && (file_size(master_file) == (int64_t)sizeof(master))
+             && (file_size(chunk_file) > 0);
+        st->ops->close(st);
+    } while (false);
+
+    return ok;
+}
+
+static struct seco_storage *raw_open(bool format)
+{
+    return seco_storage_raw_open(MU_CHANNEL_HSM_NVM, raw_dev, format);
+}
+
+static void raw_setup(uint8_t fill)
+{
+    uint8_t *data = malloc(RAW_IMAGE_SIZE);
+    int fd = open(raw_image, O_CREAT | O_TRUNC | O_WRONLY, S_IRUSR | S_IWUSR);
+
+    if ((data != NULL) && (fd >= 0)) {
+        memset(data, fill, RAW_IMAGE_SIZE);
+        (void)write(fd, data, RAW_IMAGE_SIZE);
+    }
+    if (fd >= 0) {
+        (void)close(fd);
+    }
+    free(data);
+}
+
+/* Only a blank device is formatted without being asked to. */
+static bool test_raw_format(void)
+{
+    struct seco_storage *st;
+    bool ok = false;
+
+    do {
+        raw_setup(0xA5u);
+        st = raw_open(false);
+        if ((st != NULL) || (file_find(raw_image, 0xA5u, RAW_IMAGE_SIZE) != 0)) {
+            break;
+        }
+        st = raw_open(true);
+        if (st == NULL) {
+            break;
+        }
+        st->ops->close(st);
+
+        raw_setup(0u);
+        st = raw_open(false);
+        if ((st == NULL) || (write_chunk(st, 1u, 0u) != (int32_t)CHUNK_SIZE)) {
+            break;
+        }
+        st->ops->close(st);
+
+        /* Damaged superblock: left to a recovery, the chunks are not lost. */
+        file_poke(raw_image, 0, "XXXX", 4u);
+        st = raw_open(false);
+        if (st != NULL) {
+            break;
+        }
+        file_poke(raw_image, 0, "SNVR", 4u);
+        st = raw_open(false);
+        ok = (st != NULL) && (read_chunks(st, 0u) == (1u << 1));
+        if (st != NULL) {
+            st->ops->close(st);
+        }
+    } while (false);
+
+    return ok;
+}
+
+/* A corrupted master slot falls back to the previous master. */
+static bool test_raw_master_fallback(void)
+{
+    struct seco_storage *st;
+    uint8_t master[1000];
+    uint8_t *data;
+    int32_t len;
+    int64_t off;
+    bool ok = false;
+
+    raw_setup(0u);
+    do {
+        st = raw_open(false);
+        if (st == NULL) {
+            break;
+        }
+        memset(master, 0x11, sizeof(master));
+        (void)st->ops->write_master(st, master, (uint32_t)sizeof(master));
+        memset(master, 0x22, sizeof(master));
+        (void)st->ops->write_master(st, master, (uint32_t)sizeof(master));
+        st->ops->close(st);
+
+        /* Power cut during the write of the second master: its slot is damaged. */
+        off = file_find(raw_image, 0x22u, (uint32_t)sizeof(master));
+        if (off < 0) {
+            break;
+        }
+        file_poke(raw_image, off + 500, "XX", 2u);
+        st = raw_open(false);
+        if (st == NULL) {
+            break;
+        }
+        len = st->ops->map_master(st, &data);
+        ok = (len == (int32_t)sizeof(master)) && (data[0] == 0x11u) && (data[sizeof(master) - 1u] == 0x11u);
+        if (len > 0) {
+            st->ops->unmap_master(st, data, (uint32_t)len);
+        }
+        st->ops->close(st);
+    } while (false);
+
+    return ok;
+}
+
+/* Chunks of a raw device survive a torn record and the switch to the other chunk area. */
+static bool test_raw_chunks(void)
+{
+    struct seco_storage *st;
+    uint32_t version;
+    uint32_t i;
+    int64_t off;
+    bool ok = false;
+
+    raw_setup(0u);
+    do {
+        st = raw_open(false);
+        for (i = 1u; (st != NULL) && (i <= NB_CHUNKS); i++) {
+            (void)write_chunk(st, i, 0u);
+        }
+        if (st == NULL) {
+            break;
+        }
+        (void)write_chunk(st, 2u, 1u);
+        st->ops->close(st);
+
+        /* Torn last record: the previous version of chunk 2 is read back. */
+        off = file_find(raw_image, 2u + 16u, CHUNK_SIZE);
+        if (off < 0) {
+            break;
+        }
+        file_poke(raw_image, off + 100, "XX", 2u);
+        st = raw_open(false);
+        if ((st == NULL) || (read_chunks(st, 0u) != ALL_CHUNKS)) {
+            break;
+        }
+
+        /* Enough records to fill the chunk area several times. */
+        for (version = 1u; version < 400u; version++) {
+            for (i = 1u; i <= NB_CHUNKS; i++) {
+                if (write_chunk(st, i, version % 8u) != (int32_t)CHUNK_SIZE) {
+                    break;
+                }
+            }
+        }
+        st->ops->close(st);
+        st = raw_open(false);
+        ok = (st != NULL) && (read_chunks(st, 399u % 8u) == ALL_CHUNKS);
+        if (st != NULL) {
+            st->ops->close(st);
+        }
+    } while (false);
+
+    return ok;
+}
+
+/* Test entry function. */
+int main(int argc, char *argv[])
+{
+    char cmd[300];
+    uint32_t pass = 0u;
+    uint32_t fail = 0u;
+    uint32_t i;
+    struct {
+        const char *name;
+        bool (*test)(void);
+    } tests[] = {
+        {"file torn tail", test_file_torn_tail},
+        {"file power cut", test_file_power_cut},
+        {"file corruption", test_file_corruption},
+        {"file compaction", test_file_compaction},
+        {"ram flush order", test_ram_flush_order},
+        {"raw format", test_raw_format},
+        {"raw master fallback", test_raw_master_fallback},
+        {"raw chunks", test_raw_chunks},
+    };
+
+    (void)argc;
+    (void)argv;
+
+    (void)snprintf(test_dir, sizeof(test_dir), "/tmp/seco_storage_test.XXXXXX");
+    if (mkdtemp(test_dir) == NULL) {
+        printf("cannot create the test directory\n");
+        return 1;
+    }
+    (void)snprintf(raw_dev, sizeof(raw_dev), "%s/raw.img", test_dir);
+    test_path(hsm_dir, "seco_hsm");
+    test_path(chunk_file, "seco_hsm/seco_nvm_chunks");
+    test_path(master_file, "seco_hsm/seco_nvm_master");
+    test_path(raw_image, "raw.img");
+    (void)snprintf(cmd, sizeof(cmd), "mkdir -p %s", hsm_dir);
+    (void)system(cmd);
+
+    for (i = 0u; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        if (tests[i].test()) {
+            printf("storage %s PASS\n", tests[i].name);
+            pass++;
+        } else {
+            printf("storage %s FAIL\n", tests[i].name);
+            fail++;
+        }
+    }
+    printf("storage_test PASS=%d FAIL=%d\n", pass, fail);
+
+    (void)snprintf(cmd, sizeof(cmd), "rm -rf %s", test_dir);
+    (void)system(cmd);
+
+    return (fail == 0u) ? 0 : 1;
+}